@@ -0,0 +1,24 @@
+// include/admission.h
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "client.h"
+
+extern int admission_queue_size;  // Connections held while the server is full (0 = reject at once)
+extern int admission_wait;        // Seconds a queued connection waits before 421
+extern int max_per_ip;            // Concurrent sessions per address (0 = unlimited)
+extern int shed_idle_time;        // Idle seconds after which a session may be shed when nearly full (0 = never)
+
+// Start, queue or reject a newly accepted client; takes ownership of it
+void admission_submit(client_t *client);
+
+// A session has ended; admit queued connections into the free slots
+void admission_release(client_t *client);
+
+// Periodic work from the accept loop: expire queued connections and shed idle sessions
+void admission_tick(void);
+
+// Turn away everything still queued
+void admission_cleanup(void);
+
+#endif // ADMISSION_H
@@ -0,0 +1,29 @@
+// include/ascii.h
+#ifndef ASCII_H
+#define ASCII_H
+
+#include "config.h"
+
+// Line-ending state carried from one buffer of a transfer to the next
+typedef struct {
+    int last_cr;   // Sending: the previous buffer ended in CR
+    int cr_held;   // Receiving: a CR ended the previous buffer and is not written yet
+} ascii_state_t;
+
+// Start a TYPE A transfer
+void ascii_begin(ascii_state_t *state);
+
+// Sending: turn each LF not already preceded by CR into CRLF. out must have
+// room for 2 * len bytes; returns the bytes written.
+size_t ascii_encode(ascii_state_t *state, const char *in, size_t len, char *out);
+
+// Receiving: turn CRLF into LF. A CR ending in is held back until the next
+// buffer shows whether LF follows; at the end of the transfer the caller
+// writes it if cr_held is still set. out must have room for len + 1 bytes;
+// returns the bytes written.
+size_t ascii_decode(ascii_state_t *state, const char *in, size_t len, char *out);
+
+// Name of the kernels in use, e.g. "avx2"
+const char *ascii_implementation(void);
+
+#endif // ASCII_H
@@ -0,0 +1,20 @@
+// include/bufpool.h
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include "config.h"
+
+#define BUFPOOL_BUFFER_SIZE (256 * 1024)  // Size of each pooled buffer
+#define BUFPOOL_ALIGNMENT 4096            // Alignment suitable for O_DIRECT
+#define BUFPOOL_MAX_FREE 64               // Free buffers kept for reuse
+
+// Get an aligned buffer of BUFPOOL_BUFFER_SIZE bytes, NULL on failure
+void *bufpool_get(void);
+
+// Return a buffer to the pool
+void bufpool_put(void *buffer);
+
+// Free all pooled buffers
+void bufpool_cleanup(void);
+
+#endif // BUFPOOL_H
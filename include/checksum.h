@@ -0,0 +1,65 @@
+// include/checksum.h
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "config.h"
+#include <stdint.h>
+
+// Supported checksum algorithms
+typedef enum {
+    HASH_CRC32,     // CRC-32 (IEEE 802.3), as used by XCRC
+    HASH_CRC32C,    // CRC-32C (Castagnoli)
+    HASH_MD5,
+    HASH_SHA256,
+    HASH_ALGO_COUNT
+} hash_algo_t;
+
+#define HASH_MAX_HEX 65  // Longest hex digest plus terminator
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+    unsigned char block[64];
+} md5_ctx_t;
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+} sha256_ctx_t;
+
+// Running checksum of any algorithm
+typedef struct {
+    hash_algo_t algo;
+    union {
+        uint32_t crc;
+        md5_ctx_t md5;
+        sha256_ctx_t sha256;
+    } u;
+} hash_ctx_t;
+
+// Name used by HASH/FEAT, e.g. "SHA-256"
+const char *hash_name(hash_algo_t algo);
+
+// Short lowercase key, e.g. "sha256"
+const char *hash_key(hash_algo_t algo);
+
+// Look up an algorithm by name (case-insensitive, with or without dash); returns 1 if found
+int hash_lookup(const char *name, hash_algo_t *algo);
+
+// Streaming interface
+void hash_init(hash_ctx_t *ctx, hash_algo_t algo);
+void hash_update(hash_ctx_t *ctx, const void *data, size_t len);
+void hash_final(hash_ctx_t *ctx, char hex[HASH_MAX_HEX]);
+
+// Raw CRC primitives; crc starts at 0 and the result is final
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+
+// CRC of A||B from CRC(A), CRC(B) and len(B), for hashing chunks in parallel
+uint32_t crc_combine(hash_algo_t algo, uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+// Name of the implementation chosen at runtime, for logging
+const char *hash_implementation(hash_algo_t algo);
+
+#endif // CHECKSUM_H
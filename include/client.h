@@ -3,24 +3,56 @@
 #define CLIENT_H
 
 #include "config.h"
+#include "ratelimit.h"
+#include "scheduler.h"
 
 // Client structure for multi-client support
 typedef struct {
     int control_socket;
     int data_socket;
     char ip_address[INET6_ADDRSTRLEN];
+    char username[64];     // Name given with USER
     char current_dir[PATH_MAX];
     pthread_t thread_id;
     int thread_running;    // Flag to indicate if thread is running
+    const char *close_reason;  // 421 text the session sends when stopped by another thread
     
     // Data transfer mode
     int transfer_mode;     // 0=not set, 1=PORT (active), 2=PASV (passive)
+    int transfer_type;     // TYPE I or TYPE A
     
     // For PORT mode
     char data_ip[INET6_ADDRSTRLEN];
     int data_port;
     
+    // Data connections encrypted (PROT P after AUTH TLS)
+    int prot_private;
+    
+    // Checksum algorithm selected with OPTS HASH (hash_algo_t)
+    int hash_algo;
+    
+    // Size announced with ALLO for the next STOR (0 = none)
+    off_t alloc_size;
+    
+    // Source named by RNFR or SITE CPFR, for the command that must follow
+    int pending_op;
+    char pending_path[PATH_MAX];
+    
+    // Bytes moved by the last data transfer command
+    off_t transfer_bytes;
+    
+    // Bandwidth shaping buckets (see ratelimit.h)
+    rate_session_t rate;
+    
+    // Fair share of the outbound link (see scheduler.h)
+    sched_flow_t sched;
+    
+    // Session tracing (see trace.h)
+    unsigned int trace_session;
+    struct timespec trace_start;
+    
     // Activity tracking
+    time_t connected_at;   // When the session was admitted
     time_t last_activity;  // Timestamp of last activity
 } client_t;
 
@@ -29,6 +61,15 @@ typedef struct {
 #define TRANSFER_MODE_PORT 1
 #define TRANSFER_MODE_PASV 2
 
+// Representation types
+#define TRANSFER_TYPE_BINARY 0  // TYPE I, bytes as stored
+#define TRANSFER_TYPE_ASCII 1   // TYPE A, CRLF line endings on the wire
+
+// Two-step commands awaiting their second half
+#define PENDING_NONE 0
+#define PENDING_RENAME 1   // RNFR seen, RNTO next
+#define PENDING_COPY 2     // SITE CPFR seen, SITE CPTO next
+
 extern client_t **clients;
 extern int active_clients;
 
@@ -8,6 +8,12 @@
 // Process an FTP command
 void process_command(client_t *client, const char *command, const char *arg);
 
+// Format one LIST (long_format) or NLST line for a directory entry; returns its length
+int format_list_line(char *line, size_t size, const char *name, const struct stat *st, int long_format);
+
+// Format one MLST/MLSD fact line (type, size, modify, perm) for a path; returns its length
+int format_mlst_line(char *line, size_t size, const char *name, const struct stat *st);
+
 // Send response to client
 void send_response(int socket, int code, const char *message);
 
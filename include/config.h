@@ -2,6 +2,11 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// Expose Linux extensions (readahead, posix_fadvise, struct timeval, ...)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,16 +37,29 @@
 #define DEFAULT_MAX_CLIENTS 512  // Default maximum concurrent clients
 #define DEFAULT_CLIENT_TIMEOUT 300  // Default inactivity timeout in seconds (5 minutes)
 #define DEFAULT_LOG_DIR "/var/log/ftpserver"  // Default log directory
+#define DEFAULT_GROUP_COMMIT_MS 10  // Default group commit window for upload durability
+#define DEFAULT_HOT_CACHE_SIZE (32LL * 1024 * 1024)  // Default hot-file cache size
+#define DEFAULT_HOT_CACHE_MAX_FILE (256 * 1024)      // Default largest file kept in the hot-file cache
+#define DEFAULT_ADMISSION_QUEUE 64   // Connections held waiting for a slot when the server is full
+#define DEFAULT_ADMISSION_WAIT 60    // Seconds a queued connection waits before it is turned away
+#define DEFAULT_SHED_IDLE_TIME 60    // Idle seconds before a session may be shed near capacity
+#define DEFAULT_DROP_CACHE_SIZE (256LL * 1024 * 1024)  // Drop page cache behind RETR of files this large
+#define DEFAULT_EXTRACT_THREADS 4    // Threads writing small files out of uploaded tar archives
+#define DEFAULT_QUOTA_RECONCILE 3600 // Seconds between background rescans of quota usage
+#define DEFAULT_STAT_CACHE_SIZE (16LL * 1024 * 1024)  // File metadata kept for SIZE/MDTM/MLST
 
 // Global variables
 extern int server_running;
 extern int server_socket;
 extern char root_directory[PATH_MAX];
 extern char upload_directory[PATH_MAX];  // Custom upload directory
+extern int server_port;     // Control connection port
 extern int client_timeout;  // Configurable timeout
 extern int max_clients;     // Maximum number of concurrent clients
 extern int daemon_mode;     // Flag for daemon mode
 extern FILE *log_file;      // Log file handle
+extern off_t drop_cache_size;  // RETR size above which sent pages are dropped (0 = never)
+extern off_t direct_io_size;   // ALLO size at or above which STOR uses O_DIRECT (0 = never)
 
 // Thread management
 extern pthread_mutex_t clients_mutex;  // Mutex for client array access
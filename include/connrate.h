@@ -0,0 +1,33 @@
+// include/connrate.h
+#ifndef CONNRATE_H
+#define CONNRATE_H
+
+#include "config.h"
+
+// What happens to connections over the per-address rate
+typedef enum {
+    CONNRATE_REJECT,     // 421 and close at once
+    CONNRATE_TARPIT      // Hold the socket silently, then close it
+} connrate_action_t;
+
+extern int conn_rate_limit;              // Connections per window and address (0 disables)
+extern int conn_rate_window;             // Window length in seconds
+extern connrate_action_t conn_rate_action;
+
+// Parse "N[/SECS]"; returns 1 on success
+int connrate_parse(const char *spec);
+
+// Parse an action name (reject, tarpit); returns 1 on success
+int connrate_parse_action(const char *name);
+
+// Count a connection just accepted from addr. Returns 1 to go ahead, or 0
+// if the address is over its rate, in which case the socket has been dealt with.
+int connrate_admit(int fd, const struct in_addr *addr);
+
+// Periodic work: release tarpitted sockets and age out idle addresses
+void connrate_tick(void);
+
+// Free the table and close tarpitted sockets
+void connrate_cleanup(void);
+
+#endif // CONNRATE_H
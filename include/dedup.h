@@ -0,0 +1,41 @@
+// include/dedup.h
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "config.h"
+#include "checksum.h"
+
+#define DEDUP_OBJECTS "objects"       // <store>/objects/ab/abcdef... holds one copy of each content
+#define DEDUP_INDEX "index"           // <store>/index lists the stored digests, one per line
+#define DEDUP_INDEX_BUCKETS 4096      // Hash chains of the in-memory inode index, power of two
+#define DEDUP_ALGO HASH_SHA256        // Content addresses are SHA-256 digests
+
+extern char dedup_store[PATH_MAX];  // Store directory, relative to the root unless absolute ("" = off)
+
+// What dedup_commit() did with an upload
+typedef enum {
+    DEDUP_NONE,        // Left as it was
+    DEDUP_NEW,         // First copy of this content, now also the stored object
+    DEDUP_LINKED,      // Replaced by a hard link to the stored object
+    DEDUP_CLONED       // Blocks shared with the stored object (reflink)
+} dedup_result_t;
+
+// Create the store and load its index; returns 1 on success (or if dedup is off)
+int dedup_init(void);
+
+// Close the index
+void dedup_cleanup(void);
+
+// 1 if uploads are being deduplicated
+int dedup_enabled(void);
+
+// Deduplicate a finished upload whose SHA-256 is hex
+dedup_result_t dedup_commit(const char *path, const char *hex);
+
+// SHA-256 of a file from the index, if it is a stored object unchanged since; returns 1 if found
+int dedup_lookup(const struct stat *st, char hex[HASH_MAX_HEX]);
+
+// Short name of a result for replies and logs
+const char *dedup_result_name(dedup_result_t result);
+
+#endif // DEDUP_H
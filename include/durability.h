@@ -0,0 +1,36 @@
+// include/durability.h
+#ifndef DURABILITY_H
+#define DURABILITY_H
+
+#include "config.h"
+
+// Upload durability modes
+typedef enum {
+    DURABILITY_NONE,       // Rely on normal kernel writeback
+    DURABILITY_FDATASYNC,  // fdatasync() each file before replying 226
+    DURABILITY_GROUP       // Batch syncs across sessions on a background thread
+} durability_mode_t;
+
+extern durability_mode_t durability_mode;
+extern int group_commit_ms;  // How long a group commit waits for more files
+
+// Parse a mode name (none, fdatasync, group); returns 1 on success
+int durability_parse(const char *name);
+
+// Start the group commit thread if needed
+int durability_init(void);
+
+// Stop the group commit thread, flushing anything still queued
+void durability_cleanup(void);
+
+// Make a written file durable according to the mode; returns 1 on success
+int durability_commit(int fd);
+
+// Make the name of a newly created file durable: in fdatasync mode its
+// directory is synced too (a group commit's syncfs() already covers it)
+int durability_commit_name(const char *path);
+
+// Make everything created below dir durable, e.g. after extracting an archive
+int durability_commit_tree(const char *dir);
+
+#endif // DURABILITY_H
@@ -0,0 +1,44 @@
+// include/filecache.h
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include "config.h"
+
+// Cached contents of a small file, keyed by (dev, inode, mtime, size)
+typedef struct filecache_entry {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    char *data;
+    int refcount;                   // One for the table plus one per transfer
+    int referenced;                 // Clock bit, set on every hit
+    int in_table;
+    struct filecache_entry *next;   // Hash chain
+} filecache_entry_t;
+
+extern off_t hot_cache_size;      // Total bytes of file data cached (0 disables)
+extern off_t hot_cache_max_file;  // Largest file that is cached
+
+// Initialize the cache
+int filecache_init(void);
+
+// Drop all cached files
+void filecache_cleanup(void);
+
+// Check whether a file of this size is eligible for caching
+int filecache_eligible(off_t size);
+
+// Look up a file by its stat; returns a referenced entry or NULL
+filecache_entry_t *filecache_lookup(const struct stat *st);
+
+// Read an open file into the cache; returns a referenced entry or NULL
+filecache_entry_t *filecache_insert(int fd, const struct stat *st);
+
+// Release a reference returned by lookup/insert (NULL is ignored)
+void filecache_release(filecache_entry_t *entry);
+
+// Log cache size and hit ratio
+void filecache_log_stats(void);
+
+#endif // FILECACHE_H
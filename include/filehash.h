@@ -0,0 +1,35 @@
+// include/filehash.h
+#ifndef FILEHASH_H
+#define FILEHASH_H
+
+#include "config.h"
+#include "checksum.h"
+
+#define HASH_XATTR_PREFIX "user.ftpserver."  // Cached digests live in user.ftpserver.<algo>
+#define PARALLEL_HASH_MIN (32LL * 1024 * 1024)  // Files this large are CRC'd in parallel chunks
+#define PARALLEL_HASH_MAX_THREADS 8
+
+// Where digests computed during STOR are stored (bitmask)
+#define CHECKSUM_STORE_XATTR   1
+#define CHECKSUM_STORE_SIDECAR 2  // <file>.<algo> in sha256sum format
+
+extern int stor_checksum_algo;  // Algorithm computed inline during STOR (-1 = none)
+extern int checksum_store;      // CHECKSUM_STORE_* flags
+
+// Checksum a whole file, answering from the xattr cache when it is still valid.
+// Returns 1 on success (size receives the file size), 0 on failure with errno set.
+int hash_file(const char *path, hash_algo_t algo, char hex[HASH_MAX_HEX], off_t *size);
+
+// Look up a cached digest for an open file; returns 1 if valid for its mtime/size
+int hash_cache_load(int fd, const struct stat *st, hash_algo_t algo, char hex[HASH_MAX_HEX]);
+
+// Cache a digest for an open file, keyed on its mtime/size; returns 1 on success
+int hash_cache_store(int fd, const struct stat *st, hash_algo_t algo, const char *hex);
+
+// Parse "xattr", "sidecar" or "both" into checksum_store; returns 1 on success
+int checksum_store_parse(const char *name);
+
+// Record a digest computed while the file was written, per checksum_store
+int hash_store_digest(int fd, const char *path, hash_algo_t algo, const char *hex);
+
+#endif // FILEHASH_H
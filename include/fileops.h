@@ -0,0 +1,35 @@
+// include/fileops.h
+#ifndef FILEOPS_H
+#define FILEOPS_H
+
+#include "config.h"
+
+// How fileops_copy() moved the data
+typedef enum {
+    COPY_REFLINK,        // FICLONE: blocks shared, nothing copied
+    COPY_FILE_RANGE,     // copy_file_range(): in-kernel, possibly offloaded
+    COPY_READ_WRITE      // Plain read/write fallback
+} copy_method_t;
+
+// Check that a resolved (realpath) path lies inside the FTP root; returns 1 if so
+int fileops_inside_root(const char *resolved);
+
+// Open the directory holding path (which must lie inside the FTP root) and
+// return its final component in name. Returns the directory fd, or -1 with errno set.
+int fileops_open_parent(const char *path, char *name, size_t name_size);
+
+// Check that path names something that exists; returns 1 if so, 0 with errno set
+int fileops_exists(const char *path);
+
+// Rename a file or directory; returns 1 on success, 0 with errno set
+int fileops_rename(const char *from, const char *to);
+
+// Copy a regular file, sharing blocks when the filesystem can; progress is
+// called between chunks of a long copy. Returns 1 on success, 0 with errno set.
+int fileops_copy(const char *from, const char *to, copy_method_t *method,
+                 void (*progress)(void *arg), void *arg);
+
+// Short name of a copy method for replies and logs
+const char *copy_method_name(copy_method_t method);
+
+#endif // FILEOPS_H
@@ -0,0 +1,47 @@
+// include/filewriter.h
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include "config.h"
+#include "hashstream.h"
+#include "storage.h"
+
+// Buffered writer used for uploads
+typedef struct {
+    int fd;                // -1 when the file is not on the real filesystem
+    storage_file_t file;   // The file in its storage backend
+    int direct;            // File is open with O_DIRECT
+    char *buffer;          // Pooled, aligned staging buffer
+    size_t used;           // Bytes staged in buffer
+    off_t written;         // Bytes written to the file
+    off_t preallocated;    // Bytes reserved with fallocate()
+    int created;           // The name is new, so its directory must be synced too
+    int hashing;           // Checksum the data as it is written
+    int hash_algo;
+    hash_stream_t hash;
+    char digest[HASH_MAX_HEX];  // Hex digest, set by close when hashing
+    char path[PATH_MAX];
+} file_writer_t;
+
+// Create/truncate a file for writing; size_hint > 0 preallocates that many bytes.
+// Returns 1 on success, 0 on failure with errno set.
+int file_writer_open(file_writer_t *writer, const char *path, off_t size_hint);
+
+// Checksum everything written from now on on a worker thread; the digest
+// is stored with the file and left in writer->digest by file_writer_close()
+void file_writer_enable_hash(file_writer_t *writer, hash_algo_t algo);
+
+// Get free space in the staging buffer to receive directly into
+char *file_writer_reserve(file_writer_t *writer, size_t *available);
+
+// Account for bytes placed in the reserved space; returns 1 on success
+int file_writer_commit(file_writer_t *writer, size_t len);
+
+// Copy data into the writer; returns 1 on success
+int file_writer_write(file_writer_t *writer, const void *data, size_t len);
+
+// Flush staged data, release unused preallocation, make the file durable
+// according to the durability mode and close; returns 1 on success
+int file_writer_close(file_writer_t *writer);
+
+#endif // FILEWRITER_H
@@ -0,0 +1,35 @@
+// include/hashstream.h
+#ifndef HASHSTREAM_H
+#define HASHSTREAM_H
+
+#include "config.h"
+#include "checksum.h"
+
+#define HASH_STREAM_QUEUE 8  // Blocks queued for the worker before the receiver waits
+
+// Checksum computed on a worker thread while data streams through
+typedef struct {
+    hash_ctx_t ctx;                       // Owned by the worker while it runs
+    char *current;                        // Block being filled by the receiver
+    size_t current_len;
+    char *queue[HASH_STREAM_QUEUE];       // Full blocks waiting to be hashed
+    int head;
+    int count;
+    int closing;
+    int thread_started;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} hash_stream_t;
+
+// Start a stream; the worker thread is only created once a full block is queued
+void hash_stream_init(hash_stream_t *stream, hash_algo_t algo);
+
+// Feed data (copied); returns 1 on success
+int hash_stream_update(hash_stream_t *stream, const void *data, size_t len);
+
+// Wait for the worker, hash what remains and release everything
+void hash_stream_final(hash_stream_t *stream, char hex[HASH_MAX_HEX]);
+
+#endif // HASHSTREAM_H
@@ -11,6 +11,9 @@ int init_server_socket(int port);
 // Open data connection for passive mode
 int open_data_connection(client_t *client);
 
+// Accept the client's connection on the passive mode data socket
+int accept_data_connection(client_t *client);
+
 // Create data connection for active mode
 int create_data_connection(client_t *client);
 
@@ -0,0 +1,40 @@
+// include/pagecache.h
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include "config.h"
+
+// Page cache policy applied to files sent with RETR
+typedef enum {
+    CACHE_POLICY_AUTO,    // Drop sent pages if the file is above the size threshold
+    CACHE_POLICY_KEEP,    // Never drop, leave pages in the cache
+    CACHE_POLICY_DROP     // Always drop pages once they have been sent
+} cache_policy_t;
+
+// Per-transfer readahead and cache-drop state
+typedef struct {
+    int fd;
+    int drop;                  // Drop pages behind the read position
+    off_t file_size;
+    off_t ra_end;              // End of the readahead window issued so far
+    off_t drop_start;          // Start of the range not yet dropped
+    size_t ra_window;          // Current readahead window size
+    struct timespec start;     // Transfer start (monotonic)
+} read_hint_t;
+
+// Add a policy rule of the form "DIR=keep|drop|auto[:SIZE]" (DIR relative to FTP root)
+int pagecache_add_rule(const char *spec);
+
+// Release all policy rules
+void pagecache_cleanup(void);
+
+// Begin a sequential read of an open file, issuing the initial hints
+void read_hint_begin(read_hint_t *hint, int fd, const char *path, off_t file_size);
+
+// Report progress; extends readahead and drops already-sent ranges as needed
+void read_hint_advance(read_hint_t *hint, off_t offset);
+
+// Finish the read, dropping whatever remains if the policy requires it
+void read_hint_end(read_hint_t *hint);
+
+#endif // PAGECACHE_H
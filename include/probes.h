@@ -0,0 +1,36 @@
+// include/probes.h
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes for bpftrace/perf, provider "ftpserver". With <sys/sdt.h>
+// available each probe is a single nop plus an ELF note, so they cost
+// nothing until attached; without it (or with -DNO_USDT) they vanish.
+//
+//   accept(fd, ip)                          new control connection in main()
+//   session__start(client, ip)              handle_client_thread() begins
+//   session__end(client, ip)                handle_client_thread() ends
+//   command__start(client, verb, arg)       process_command() entry
+//   command__done(client, verb)             process_command() exit
+//   data__listen(client, port)              PASV socket ready
+//   data__connect(client, fd, ip, port)     PORT connection established
+//   data__accept(client, fd)                PASV connection accepted
+//   transfer__chunk(client, bytes, total)   RETR/STOR moved a chunk
+//   transfer__done(client, verb, total, ok) RETR/STOR/LIST finished
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#define PROBE2(name, a, b) DTRACE_PROBE2(ftpserver, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(ftpserver, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(ftpserver, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif // PROBES_H
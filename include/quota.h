@@ -0,0 +1,81 @@
+// include/quota.h
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include "config.h"
+#include "filehash.h"
+
+#define QUOTA_MAX 64                            // Configured quotas
+#define QUOTA_RESERVE_STEP (4LL * 1024 * 1024)  // Bytes an upload without a size hint reserves at a time
+#define QUOTA_JOURNAL_COMPACT 4096              // Journal lines before it is rewritten as a snapshot
+#define QUOTA_MAX_DEPTH 64                      // Directory depth the reconciler descends to
+#define QUOTA_OWNER_XATTR HASH_XATTR_PREFIX "owner"  // User a file was uploaded by
+#define QUOTA_OWNER_MAX 64
+
+extern char quota_journal[PATH_MAX];  // Usage journal, relative to the root unless absolute ("" = none)
+extern int quota_reconcile_interval;  // Seconds between background rescans (0 = only when needed)
+
+// What a path held before an operation changes it
+typedef struct {
+    int exists;
+    int is_dir;
+    off_t size;
+    char owner[QUOTA_OWNER_MAX];  // Uploading user, "" if unknown
+} quota_file_t;
+
+// Space held for an upload or copy while it runs
+typedef struct {
+    int active;
+    char user[QUOTA_OWNER_MAX];
+    char path[PATH_MAX];
+    quota_file_t old;              // The file being replaced
+    off_t reserved;                // Bytes held against every matching quota
+} quota_reservation_t;
+
+// Add a quota of the form "user:NAME=BYTES[/FILES]" or "dir:PATH=BYTES[/FILES]"
+// (PATH relative to the root, 0 bytes = no byte limit); returns 1 on success
+int quota_add(const char *spec);
+
+// Load the journal and start the reconciler; returns 1 on success (or if no quotas)
+int quota_init(void);
+
+// Stop the reconciler and write a final snapshot
+void quota_cleanup(void);
+
+// 1 if any quota is configured
+int quota_enabled(void);
+
+// Record what path holds now, for quota_removed() and quota_renamed()
+void quota_stat(const char *path, quota_file_t *file);
+
+// Hold bytes (the ALLO size, or 0) for user writing path. Returns 1 if every
+// matching quota has room, 0 with errno EDQUOT if not.
+int quota_begin(quota_reservation_t *r, const char *user, const char *path, off_t bytes);
+
+// Grow a reservation to cover total bytes received; 0 with errno EDQUOT once over
+int quota_extend(quota_reservation_t *r, off_t total);
+
+// Release a reservation when nothing was written
+void quota_cancel(quota_reservation_t *r);
+
+// Charge whatever path holds now against the reservation's quotas and release it
+void quota_end(quota_reservation_t *r);
+
+// Release a reservation taken on a directory that received many files (an
+// extracted archive), charging the bytes and files written below it. A
+// background rescan settles the exact figures.
+void quota_end_tree(quota_reservation_t *r, off_t bytes, off_t files);
+
+// User to record as the owner of files written under a reservation, or NULL
+const char *quota_owner(const quota_reservation_t *r);
+
+// Account for a removed file
+void quota_removed(const char *path, const quota_file_t *file);
+
+// Account for a rename; target is what the destination held before
+void quota_renamed(const char *from, const char *to, const quota_file_t *source, const quota_file_t *target);
+
+// Ask for a background rescan, after changes that are not tracked one file at a time
+void quota_dirty(void);
+
+#endif // QUOTA_H
@@ -0,0 +1,57 @@
+// include/ratelimit.h
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include "config.h"
+
+// Transfer directions
+#define RATE_DOWN 0    // Server to client: RETR, LIST, NLST
+#define RATE_UP 1      // Client to server: STOR
+
+// Token bucket state. Rate and burst live in the shared limit table, so a
+// reload changes them under buckets that are in use by running transfers.
+typedef struct {
+    double tokens;     // Bytes that may go out now, negative while in debt
+    double last;       // Time of the last refill (monotonic seconds)
+} rate_bucket_t;
+
+typedef struct rate_shared rate_shared_t;
+
+// A session's buckets; every transfer is charged to global, IP, user and session
+typedef struct {
+    rate_shared_t *ip;
+    rate_shared_t *user;
+    rate_bucket_t session[2];
+} rate_session_t;
+
+extern volatile sig_atomic_t ratelimit_reload_pending;  // Set by SIGHUP
+
+// Add a limit of the form "SCOPE[:DIR]=RATE[/BURST]" where SCOPE is
+// global|ip|user|session and DIR is down|up (both if omitted); returns 1 on success
+int ratelimit_add(const char *spec);
+
+// Read further limits from a file, one spec per line, on startup and SIGHUP
+void ratelimit_set_file(const char *path);
+
+// Rebuild the limit table from the command line and the file; returns 1 on success
+int ratelimit_reload(void);
+
+// Release all buckets
+void ratelimit_cleanup(void);
+
+// Attach a new session to the buckets of its IP address
+void ratelimit_session_begin(rate_session_t *rs, const char *ip);
+
+// Move a session to the buckets of the user it logged in as
+void ratelimit_session_user(rate_session_t *rs, const char *user);
+
+// Detach a session from its shared buckets
+void ratelimit_session_end(rate_session_t *rs);
+
+// Largest piece of len to move in one send/recv so shaping stays smooth
+size_t ratelimit_chunk(int dir, size_t len);
+
+// Charge bytes already moved to every bucket, sleeping off any debt
+void ratelimit_consume(rate_session_t *rs, int dir, size_t bytes);
+
+#endif // RATELIMIT_H
@@ -0,0 +1,50 @@
+// include/scheduler.h
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "config.h"
+
+// A session's place in the outbound transfer scheduler
+typedef struct sched_flow {
+    int weight;                  // Quanta per round, from the user's class
+    long deficit;                // Bytes the flow may still send this round
+    size_t request;              // Chunk waiting for a grant (0 = none)
+    int granted;
+    int active;                  // Between sched_begin() and sched_end()
+    pthread_cond_t cond;
+    struct sched_flow *next;     // Round-robin ring of active flows
+    struct sched_flow *prev;
+} sched_flow_t;
+
+extern off_t sched_link_rate;    // Outbound bytes/s shared fairly (0 disables)
+
+// Add a user class "NAME=WEIGHT[:user,user...]"; the class named default
+// covers everyone not listed. Returns 1 on success.
+int sched_add_class(const char *spec);
+
+// Start the scheduler thread if a link rate is set
+int sched_init(void);
+
+// Stop the scheduler thread, releasing every waiting transfer
+void sched_cleanup(void);
+
+// Prepare a session's flow; weight comes from the default class
+void sched_flow_init(sched_flow_t *flow);
+
+// Move a session's flow to the class of the user it logged in as
+void sched_flow_user(sched_flow_t *flow, const char *user);
+
+// Release a session's flow
+void sched_flow_destroy(sched_flow_t *flow);
+
+// Join and leave the round robin around one transfer
+void sched_begin(sched_flow_t *flow);
+void sched_end(sched_flow_t *flow);
+
+// Largest piece of len to request at once
+size_t sched_chunk(size_t len);
+
+// Block until the scheduler lets the flow send bytes
+void sched_wait(sched_flow_t *flow, size_t bytes);
+
+#endif // SCHEDULER_H
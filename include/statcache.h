@@ -0,0 +1,24 @@
+// include/statcache.h
+#ifndef STATCACHE_H
+#define STATCACHE_H
+
+#include "config.h"
+
+#define STATCACHE_BUCKETS 65536      // File entry hash chains, power of two
+#define STATCACHE_DIR_BUCKETS 4096   // Directory hash chains (by path and by watch), power of two
+#define STATCACHE_MAX_DIRS 4096      // Directories watched at once; the least recently used go first
+
+extern off_t stat_cache_size;  // Bytes of file metadata cached (0 disables)
+
+// Start watching for changes; returns 1 on success. Without inotify the
+// cache stays off and lookups fall through to stat().
+int statcache_init(void);
+
+// Stop the watcher and drop everything
+void statcache_cleanup(void);
+
+// stat() a file, answered from memory while its directory shows no change.
+// Returns 1 on success, 0 with errno set.
+int statcache_stat(const char *path, struct stat *st);
+
+#endif // STATCACHE_H
@@ -0,0 +1,118 @@
+// include/storage.h
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "config.h"
+
+#define STORAGE_MAX_MOUNTS 16
+#define MEMSTORE_BUCKETS 4096    // Name hash chains per in-memory store, power of two
+
+typedef struct storage storage_t;
+
+// An open file
+typedef struct {
+    storage_t *storage;
+    int fd;            // Descriptor for POSIX files (for sendfile, caches, hints), -1 otherwise
+    void *node;        // Backend-specific
+    off_t offset;
+} storage_file_t;
+
+// An open directory listing
+typedef struct {
+    storage_t *storage;
+    DIR *dir;          // POSIX
+    char path[PATH_MAX];
+    void *entries;     // Backend-specific snapshot
+    size_t count;
+    size_t next;
+} storage_dir_t;
+
+// Backend operations. Paths are absolute filesystem-style paths under the
+// backend's mount point. Functions returning int give 1 on success and 0
+// with errno set; read and write behave like read(2) and write(2).
+typedef struct {
+    const char *name;
+    int (*stat)(storage_t *storage, const char *path, struct stat *st);
+    int (*open)(storage_t *storage, const char *path, int flags, mode_t mode, storage_file_t *file);
+    ssize_t (*read)(storage_file_t *file, void *buf, size_t len);
+    ssize_t (*write)(storage_file_t *file, const void *buf, size_t len);
+    int (*fstat)(storage_file_t *file, struct stat *st);
+    int (*close)(storage_file_t *file);
+    int (*opendir)(storage_t *storage, const char *path, storage_dir_t *dir);
+    int (*readdir)(storage_dir_t *dir, char *name, size_t size, struct stat *st);  // 0 at the end; st may be NULL
+    int (*entry_stat)(storage_dir_t *dir, const char *name, struct stat *st);     // Entry readdir just returned
+    void (*closedir)(storage_dir_t *dir);
+    int (*rename)(storage_t *storage, const char *from, const char *to);
+    int (*remove)(storage_t *storage, const char *path);  // File or empty directory
+    int (*mkdir)(storage_t *storage, const char *path, mode_t mode);
+    void (*destroy)(storage_t *storage);
+} storage_ops_t;
+
+// A backend serving everything under prefix
+struct storage {
+    const storage_ops_t *ops;
+    char prefix[PATH_MAX];
+    size_t prefix_len;
+    void *data;
+};
+
+extern const storage_ops_t posix_storage_ops;
+extern const storage_ops_t memory_storage_ops;
+
+// Queue an in-memory mount, "PATH[:SIZE]" with PATH relative to the FTP
+// root; returns 1 if the spec is valid
+int storage_add_memory(const char *spec);
+
+// Set up queued mounts once the root is known; returns 1 on success
+int storage_init(void);
+
+// Refuse every client operation under path (absolute and canonical), e.g.
+// for the dedup store; called after storage_init(). Returns 1 on success.
+int storage_add_private(const char *path);
+
+// Release all mounts and their contents
+void storage_cleanup(void);
+
+// Create in-memory store state with a byte limit (0 = unlimited); returns 1 on success
+int memory_storage_create(storage_t *storage, off_t capacity);
+
+// Backend serving a path
+storage_t *storage_for(const char *path);
+
+// 1 if path is on the real filesystem
+int storage_is_posix(const char *path);
+
+// Collapse "//", "." and ".." in an absolute path without touching the filesystem
+void storage_normalize(const char *path, char *out, size_t size);
+
+// Canonical form of a path: realpath() on disk, lexical elsewhere; returns 1 on success
+int storage_realpath(const char *path, char resolved[PATH_MAX]);
+
+// 1 if path names something (for RNFR and CPFR); 0 with errno set
+int storage_exists(const char *path);
+
+int storage_stat(const char *path, struct stat *st);
+int storage_open(const char *path, int flags, mode_t mode, storage_file_t *file);
+ssize_t storage_read(storage_file_t *file, void *buf, size_t len);
+ssize_t storage_write(storage_file_t *file, const void *buf, size_t len);
+int storage_fstat(storage_file_t *file, struct stat *st);
+int storage_close(storage_file_t *file);
+int storage_opendir(const char *path, storage_dir_t *dir);
+int storage_readdir(storage_dir_t *dir, char *name, size_t size, struct stat *st);
+
+// Metadata of the entry storage_readdir() just returned as name, for listings
+// that read names only (st NULL) and examine the ones they keep
+int storage_entry_stat(storage_dir_t *dir, const char *name, struct stat *st);
+
+void storage_closedir(storage_dir_t *dir);
+int storage_remove(const char *path);
+int storage_mkdir(const char *path, mode_t mode);
+
+// Rename within one backend; EXDEV across backends
+int storage_rename(const char *from, const char *to);
+
+// Copy a file through the backends, for copies that leave the real filesystem;
+// progress is called between chunks. Returns 1 on success, 0 with errno set.
+int storage_copy(const char *from, const char *to, void (*progress)(void *arg), void *arg);
+
+#endif // STORAGE_H
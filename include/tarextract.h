@@ -0,0 +1,45 @@
+// include/tarextract.h
+#ifndef TAREXTRACT_H
+#define TAREXTRACT_H
+
+#include "config.h"
+#include "quota.h"
+#include "tarstream.h"
+
+#define EXTRACT_INLINE_MAX (256 * 1024)         // Larger files are written by the receiving session
+#define EXTRACT_QUEUE_BYTES (8 * 1024 * 1024)   // Small-file data buffered per upload
+#define EXTRACT_META_MAX (64 * 1024)            // Largest pax header accepted
+
+extern int extract_threads;  // Workers writing small files (0 = the session writes them)
+
+// Counters for the transfer log and the reply
+typedef struct {
+    long files;
+    long directories;
+    long skipped;      // Links, special files, unsafe names
+    long errors;       // Entries that could not be written
+    off_t bytes;       // Bytes received on the data connection
+    off_t written;     // File contents of the members extracted
+    int complete;      // The archive ended properly
+    int over_quota;    // Stopped because a quota had no room for the next file
+} tar_extract_stats_t;
+
+// If path ends in .tar and, without the suffix, names an existing directory
+// inside the root, store that directory; returns 1 if so
+int tar_extract_target(const char *path, char *dir, size_t size);
+
+// Start the worker threads; returns 1 on success
+int tar_extract_init(void);
+
+// Stop the worker threads once queued files are written
+void tar_extract_cleanup(void);
+
+// Read a tar archive from data_fd and unpack it under dir. Names are kept
+// inside dir and out of memory and private mounts; links and special files
+// are skipped. progress is called with the bytes of each read. Each file is
+// reserved against quota (if not NULL) before it is created. Returns 1 if the
+// archive was complete and every entry was written.
+int tar_extract(int data_fd, const char *dir, quota_reservation_t *quota, tar_extract_stats_t *stats,
+                tar_progress_t progress, void *arg);
+
+#endif // TAREXTRACT_H
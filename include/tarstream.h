@@ -0,0 +1,61 @@
+// include/tarstream.h
+#ifndef TARSTREAM_H
+#define TARSTREAM_H
+
+#include "config.h"
+
+#define TAR_PREFETCH 16                  // Files opened and read ahead of the one being sent
+#define TAR_MAX_DEPTH 64                 // Deeper directories are left out
+#define TAR_SENDFILE_MIN (64 * 1024)     // Smaller bodies are copied into the send buffer
+#define TAR_BLOCK 512
+
+// POSIX ustar header block
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tar_header_t;
+
+// Archive formats a virtual download can ask for
+typedef enum {
+    TAR_PLAIN,     // name.tar
+    TAR_GZIP       // name.tar.gz or name.tgz (needs zlib)
+} tar_format_t;
+
+// Counters for the transfer log
+typedef struct {
+    long files;
+    long directories;
+    long skipped;      // Unreadable entries, special files, too deep
+    off_t bytes;       // Bytes sent on the data connection
+} tar_stats_t;
+
+// Called after each write with the number of bytes sent
+typedef void (*tar_progress_t)(void *arg, size_t bytes);
+
+// If path names no real file but, without a .tar/.tar.gz/.tgz suffix, an
+// existing directory, store that directory and the format; returns 1 if so
+int tar_virtual_path(const char *path, char *dir, size_t size, tar_format_t *format);
+
+// Stream the tree under dir as a tar archive to data_fd. Entries are named
+// after the directory's own name, as "tar cf name.tar name" would. Memory
+// and private mounts below dir are left out. Returns 1 on success, 0 if the
+// connection failed.
+int tar_stream(int data_fd, const char *dir, tar_format_t format, tar_stats_t *stats,
+               tar_progress_t progress, void *arg);
+
+#endif // TARSTREAM_H
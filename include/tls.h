@@ -0,0 +1,51 @@
+// include/tls.h
+#ifndef TLS_H
+#define TLS_H
+
+#include "config.h"
+
+#define TLS_HANDSHAKE_TIMEOUT 10        // Seconds a client gets to finish a handshake
+#define TLS_SESSION_CACHE 20480         // Sessions kept for resumption by data connections
+#define TLS_SESSION_TIMEOUT 3600        // Seconds a session can be resumed for
+
+extern char tls_cert_file[PATH_MAX];  // PEM certificate chain ("" = no FTPS)
+extern char tls_key_file[PATH_MAX];   // PEM private key ("" = in the certificate file)
+extern int tls_required;              // Refuse logins and data transfers in the clear
+extern int tls_require_reuse;         // Data connections must resume their own control session
+
+// Load the certificate; returns 1 on success (or if FTPS is not configured)
+int tls_init(void);
+
+// Free the server context
+void tls_cleanup(void);
+
+// 1 if AUTH TLS can be offered
+int tls_available(void);
+
+// Run the server side of a handshake on fd. Afterwards tls_send() and
+// tls_recv() on fd are encrypted, by the kernel when it takes the keys.
+// Returns 1 on success, 0 with errno set.
+int tls_accept(int fd);
+
+// 1 if fd carries TLS
+int tls_active(int fd);
+
+// 1 if the handshake on fd resumed a session that came from control_fd's
+// connection, rather than any session in the server's cache
+int tls_resumed_from(int fd, int control_fd);
+
+// 1 if sendfile() works on fd: plain sockets and kernel TLS
+int tls_can_sendfile(int fd);
+
+// send()/recv() through the TLS layer when fd has one
+ssize_t tls_send(int fd, const void *buf, size_t len, int flags);
+ssize_t tls_recv(int fd, void *buf, size_t len, int flags);
+
+// sendfile() through kernel TLS when fd has it; fails with EOPNOTSUPP for
+// userspace TLS (check tls_can_sendfile() first)
+ssize_t tls_sendfile(int fd, int in_fd, off_t *offset, size_t count);
+
+// Send close_notify if fd carries TLS, then close fd
+void tls_close(int fd);
+
+#endif // TLS_H
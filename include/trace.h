@@ -0,0 +1,31 @@
+// include/trace.h
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "config.h"
+#include "client.h"
+
+// Control-session trace, one tab-separated record per line:
+//   S <session> <unix time ms>                               session start
+//   C <session> <offset ms> <duration us> <bytes> <COMMAND> [arg]
+//   E <session> <offset ms>                                  session end
+// Path arguments are replaced component by component with keyed hashes
+// (extensions kept), credentials and addresses are dropped.
+#define TRACE_VERSION "# ftpserver trace v1"
+
+extern int trace_enabled;
+
+// Start writing the trace to path (appending); returns 1 on success
+int trace_open(const char *path);
+
+// Flush and close the trace
+void trace_close(void);
+
+// Record the start and end of a client session
+void trace_session_begin(client_t *client);
+void trace_session_end(client_t *client);
+
+// Record a command that started at start and moved client->transfer_bytes of data
+void trace_command(client_t *client, const char *command, const char *arg, const struct timespec *start);
+
+#endif // TRACE_H
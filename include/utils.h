@@ -7,4 +7,7 @@
 // Utility function to get the absolute path
 char* get_absolute_path(const char *path);
 
+// Parse a byte count with an optional K/M/G/T suffix; returns 1 on success
+int parse_size(const char *str, off_t *size);
+
 #endif // UTILS_H
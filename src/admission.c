@@ -0,0 +1,238 @@
+// src/admission.c
+#include "admission.h"
+#include "commands.h"
+#include "logging.h"
+
+#define SHED_THRESHOLD_PERCENT 90    // Start shedding idle sessions at this share of max_clients
+#define SHED_MAX_PER_TICK 8
+#define SESSION_TIME_SMOOTHING 0.1   // Weight of each finished session in the average
+
+int admission_queue_size = DEFAULT_ADMISSION_QUEUE;
+int admission_wait = DEFAULT_ADMISSION_WAIT;
+int max_per_ip = 0;
+int shed_idle_time = DEFAULT_SHED_IDLE_TIME;
+
+// A connection waiting for a free slot
+typedef struct waiter {
+    client_t *client;
+    time_t queued_at;
+    struct waiter *next;
+} waiter_t;
+
+static pthread_mutex_t admission_mutex = PTHREAD_MUTEX_INITIALIZER;
+static waiter_t *queue_head = NULL;
+static waiter_t *queue_tail = NULL;
+static int queue_length = 0;
+static double average_session = 60;  // Seconds, for the 120 reply's estimate
+
+static void reject(client_t *client, const char *message) {
+    send_response(client->control_socket, 421, message);
+    close(client->control_socket);
+    free(client);
+}
+
+// Sessions from this address, running and queued; caller holds admission_mutex
+static int sessions_from(const char *ip) {
+    int count = 0;
+
+    pthread_mutex_lock(&clients_mutex);
+    for (int i = 0; i < max_clients; i++) {
+        if (clients[i] && strcmp(clients[i]->ip_address, ip) == 0) {
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (waiter_t *w = queue_head; w != NULL; w = w->next) {
+        if (strcmp(w->client->ip_address, ip) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Register the client and give it a thread; returns 1 on success, 0 if the server is full
+static int start_session(client_t *client) {
+    if (!add_client(client)) {
+        return 0;
+    }
+
+    client->connected_at = time(NULL);
+    log_message(FTPLOG_INFO, "New client connected: %s (%d/%d active)",
+                client->ip_address, active_clients, max_clients);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    if (pthread_create(&client->thread_id, &attr, handle_client_thread, client) != 0) {
+        log_message(FTPLOG_ERROR, "Failed to create thread for client: %s", strerror(errno));
+        remove_client(client);
+        close(client->control_socket);
+        free(client);
+    }
+
+    pthread_attr_destroy(&attr);
+    return 1;
+}
+
+// Admit queued connections while there is room; caller holds admission_mutex
+static void drain_queue(void) {
+    while (queue_head != NULL && server_running) {
+        waiter_t *w = queue_head;
+        long waited = (long)(time(NULL) - w->queued_at);
+        if (!start_session(w->client)) {
+            break;
+        }
+        log_message(FTPLOG_INFO, "Admitted queued client after %ld seconds (%d still waiting)",
+                    waited, queue_length - 1);
+        queue_head = w->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        queue_length--;
+        free(w);
+    }
+}
+
+void admission_submit(client_t *client) {
+    pthread_mutex_lock(&admission_mutex);
+
+    if (max_per_ip > 0 && sessions_from(client->ip_address) >= max_per_ip) {
+        pthread_mutex_unlock(&admission_mutex);
+        log_message(FTPLOG_ERROR, "Too many connections from %s (limit %d)", client->ip_address, max_per_ip);
+        reject(client, "Too many connections from your address");
+        return;
+    }
+
+    // Earlier arrivals go first, even if a slot has just come free
+    drain_queue();
+    if (queue_head == NULL && start_session(client)) {
+        pthread_mutex_unlock(&admission_mutex);
+        return;
+    }
+
+    if (queue_length >= admission_queue_size) {
+        pthread_mutex_unlock(&admission_mutex);
+        log_message(FTPLOG_ERROR, "Maximum number of clients reached (%d), queue full. Rejecting connection from %s",
+                    max_clients, client->ip_address);
+        reject(client, "Service not available, too many users connected");
+        return;
+    }
+
+    waiter_t *w = malloc(sizeof(waiter_t));
+    if (w == NULL) {
+        pthread_mutex_unlock(&admission_mutex);
+        reject(client, "Service not available, too many users connected");
+        return;
+    }
+    w->client = client;
+    w->queued_at = time(NULL);
+    w->next = NULL;
+    if (queue_tail) queue_tail->next = w; else queue_head = w;
+    queue_tail = w;
+    queue_length++;
+
+    // Sessions ahead of us leave at roughly max_clients per average session length
+    double wait = queue_length * average_session / max_clients;
+    int minutes = (int)(wait / 60) + 1;
+    char message[MAX_BUFFER];
+    snprintf(message, sizeof(message), "Service ready in %d minute%s, %d waiting",
+             minutes, minutes == 1 ? "" : "s", queue_length);
+    send_response(client->control_socket, 120, message);
+    log_message(FTPLOG_INFO, "Server full, queued %s (%d waiting)", client->ip_address, queue_length);
+
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void admission_release(client_t *client) {
+    pthread_mutex_lock(&admission_mutex);
+    if (client->connected_at != 0) {
+        double length = difftime(time(NULL), client->connected_at);
+        average_session += (length - average_session) * SESSION_TIME_SMOOTHING;
+    }
+    drain_queue();
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+// Drop queued connections that timed out or hung up; caller holds admission_mutex
+static void expire_queue(time_t now) {
+    waiter_t **link = &queue_head;
+    queue_tail = NULL;
+
+    while (*link != NULL) {
+        waiter_t *w = *link;
+        char byte;
+        int gone = recv(w->client->control_socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+
+        if (gone || difftime(now, w->queued_at) >= admission_wait) {
+            if (gone) {
+                log_message(FTPLOG_INFO, "Queued client %s hung up", w->client->ip_address);
+                close(w->client->control_socket);
+                free(w->client);
+            } else {
+                log_message(FTPLOG_INFO, "Queued client %s timed out", w->client->ip_address);
+                reject(w->client, "Timed out waiting for a free slot");
+            }
+            *link = w->next;
+            queue_length--;
+            free(w);
+            continue;
+        }
+        queue_tail = w;
+        link = &w->next;
+    }
+}
+
+// Close the longest-idle sessions to make room; caller holds admission_mutex
+static void shed_idle(time_t now) {
+    int wanted = queue_length > 0 ? queue_length : 1;
+    if (wanted > SHED_MAX_PER_TICK) {
+        wanted = SHED_MAX_PER_TICK;
+    }
+
+    pthread_mutex_lock(&clients_mutex);
+    while (wanted-- > 0) {
+        client_t *idlest = NULL;
+        for (int i = 0; i < max_clients; i++) {
+            client_t *c = clients[i];
+            if (c && c->thread_running && difftime(now, c->last_activity) >= shed_idle_time &&
+                (idlest == NULL || c->last_activity < idlest->last_activity)) {
+                idlest = c;
+            }
+        }
+        if (idlest == NULL) {
+            break;
+        }
+
+        log_message(FTPLOG_INFO, "Shedding %s, idle for %.0f seconds with %d/%d active",
+                    idlest->ip_address, difftime(now, idlest->last_activity), active_clients, max_clients);
+        idlest->close_reason = "Server busy, closing idle connection";
+        idlest->thread_running = 0;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+void admission_tick(void) {
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&admission_mutex);
+    expire_queue(now);
+    if (shed_idle_time > 0 && active_clients * 100 >= max_clients * SHED_THRESHOLD_PERCENT) {
+        shed_idle(now);
+    }
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void admission_cleanup(void) {
+    pthread_mutex_lock(&admission_mutex);
+    while (queue_head != NULL) {
+        waiter_t *w = queue_head;
+        queue_head = w->next;
+        reject(w->client, "Service shutting down");
+        free(w);
+    }
+    queue_tail = NULL;
+    queue_length = 0;
+    pthread_mutex_unlock(&admission_mutex);
+}
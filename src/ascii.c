@@ -0,0 +1,243 @@
+// src/ascii.c
+#include "ascii.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Runtime-selected implementations
+static size_t (*encode_impl)(ascii_state_t *state, const char *in, size_t len, char *out);
+static size_t (*decode_impl)(ascii_state_t *state, const char *in, size_t len, char *out);
+static const char *impl_name = "generic";
+static pthread_once_t ascii_once = PTHREAD_ONCE_INIT;
+
+void ascii_begin(ascii_state_t *state) {
+    state->last_cr = 0;
+    state->cr_held = 0;
+}
+
+/* ---- Shared pieces: the kernels only find the interesting bytes ---- */
+
+// Copy in[i, end) and expand the LF at end, unless CR already precedes it
+static size_t encode_lf(const char *in, size_t i, size_t end, int last_cr, char *out, size_t o) {
+    memcpy(out + o, in + i, end - i);
+    o += end - i;
+    if (!(end > 0 ? in[end - 1] == '\r' : last_cr)) {
+        out[o++] = '\r';
+    }
+    out[o++] = '\n';
+    return o;
+}
+
+// Copy in[i, end) and keep the CR at end unless LF follows it; a CR ending
+// the buffer is held. Returns the new output length.
+static size_t decode_cr(ascii_state_t *state, const char *in, size_t len, size_t i, size_t end,
+                        char *out, size_t o) {
+    memcpy(out + o, in + i, end - i);
+    o += end - i;
+    if (end + 1 == len) {
+        state->cr_held = 1;
+    } else if (in[end + 1] != '\n') {
+        out[o++] = '\r';
+    }
+    return o;
+}
+
+// A CR held from the previous buffer goes out unless this one starts with LF
+static size_t decode_held(ascii_state_t *state, const char *in, size_t len, char *out) {
+    if (!state->cr_held || len == 0) {
+        return 0;
+    }
+    state->cr_held = 0;
+    if (in[0] == '\n') {
+        return 0;
+    }
+    out[0] = '\r';
+    return 1;
+}
+
+// Expand every LF set in mask, a bitmap of the width bytes at in + i
+static size_t encode_mask(const char *in, size_t i, size_t width, uint32_t mask, int last_cr,
+                          char *out, size_t o) {
+    size_t start = i;
+    while (mask != 0) {
+        size_t pos = i + (size_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+        o = encode_lf(in, start, pos, last_cr, out, o);
+        start = pos + 1;
+    }
+    memcpy(out + o, in + start, i + width - start);
+    return o + (i + width - start);
+}
+
+static size_t decode_mask(ascii_state_t *state, const char *in, size_t len, size_t i, size_t width,
+                          uint32_t mask, char *out, size_t o) {
+    size_t start = i;
+    while (mask != 0) {
+        size_t pos = i + (size_t)__builtin_ctz(mask);
+        mask &= mask - 1;
+        o = decode_cr(state, in, len, start, pos, out, o);
+        start = pos + 1;
+    }
+    memcpy(out + o, in + start, i + width - start);
+    return o + (i + width - start);
+}
+
+/* ---- Generic: memchr between line endings ---- */
+
+static size_t encode_tail(const char *in, size_t i, size_t len, int last_cr, char *out, size_t o) {
+    while (i < len) {
+        const char *lf = memchr(in + i, '\n', len - i);
+        if (lf == NULL) {
+            memcpy(out + o, in + i, len - i);
+            return o + (len - i);
+        }
+        size_t end = (size_t)(lf - in);
+        o = encode_lf(in, i, end, last_cr, out, o);
+        i = end + 1;
+    }
+    return o;
+}
+
+static size_t decode_tail(ascii_state_t *state, const char *in, size_t len, size_t i, char *out, size_t o) {
+    while (i < len) {
+        const char *cr = memchr(in + i, '\r', len - i);
+        if (cr == NULL) {
+            memcpy(out + o, in + i, len - i);
+            return o + (len - i);
+        }
+        size_t end = (size_t)(cr - in);
+        o = decode_cr(state, in, len, i, end, out, o);
+        i = end + 1;
+    }
+    return o;
+}
+
+static size_t encode_generic(ascii_state_t *state, const char *in, size_t len, char *out) {
+    return encode_tail(in, 0, len, state->last_cr, out, 0);
+}
+
+static size_t decode_generic(ascii_state_t *state, const char *in, size_t len, char *out) {
+    size_t o = decode_held(state, in, len, out);
+    return decode_tail(state, in, len, 0, out, o);
+}
+
+/* ---- SSE2 and AVX2: whole blocks without line endings are copied as they are ---- */
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static size_t encode_sse2(ascii_state_t *state, const char *in, size_t len, char *out) {
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0, o = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)(out + o), v);
+            o += 16;
+        } else {
+            o = encode_mask(in, i, 16, mask, state->last_cr, out, o);
+        }
+    }
+    return encode_tail(in, i, len, state->last_cr, out, o);
+}
+
+__attribute__((target("sse2")))
+static size_t decode_sse2(ascii_state_t *state, const char *in, size_t len, char *out) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i = 0;
+    size_t o = decode_held(state, in, len, out);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)(out + o), v);
+            o += 16;
+        } else {
+            o = decode_mask(state, in, len, i, 16, mask, out, o);
+        }
+    }
+    return decode_tail(state, in, len, i, out, o);
+}
+
+__attribute__((target("avx2")))
+static size_t encode_avx2(ascii_state_t *state, const char *in, size_t len, char *out) {
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0, o = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)(out + o), v);
+            o += 32;
+        } else {
+            o = encode_mask(in, i, 32, mask, state->last_cr, out, o);
+        }
+    }
+    return encode_tail(in, i, len, state->last_cr, out, o);
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(ascii_state_t *state, const char *in, size_t len, char *out) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    size_t o = decode_held(state, in, len, out);
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr));
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)(out + o), v);
+            o += 32;
+        } else {
+            o = decode_mask(state, in, len, i, 32, mask, out, o);
+        }
+    }
+    return decode_tail(state, in, len, i, out, o);
+}
+#endif
+
+/* ---- Runtime dispatch ---- */
+
+static void ascii_setup(void) {
+    encode_impl = encode_generic;
+    decode_impl = decode_generic;
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        encode_impl = encode_avx2;
+        decode_impl = decode_avx2;
+        impl_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        encode_impl = encode_sse2;
+        decode_impl = decode_sse2;
+        impl_name = "sse2";
+    }
+#endif
+}
+
+size_t ascii_encode(ascii_state_t *state, const char *in, size_t len, char *out) {
+    pthread_once(&ascii_once, ascii_setup);
+    if (len == 0) {
+        return 0;
+    }
+    size_t o = encode_impl(state, in, len, out);
+    state->last_cr = in[len - 1] == '\r';
+    return o;
+}
+
+size_t ascii_decode(ascii_state_t *state, const char *in, size_t len, char *out) {
+    pthread_once(&ascii_once, ascii_setup);
+    return decode_impl(state, in, len, out);
+}
+
+const char *ascii_implementation(void) {
+    pthread_once(&ascii_once, ascii_setup);
+    return impl_name;
+}
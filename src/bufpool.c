@@ -0,0 +1,48 @@
+// src/bufpool.c
+#include "bufpool.h"
+#include "logging.h"
+
+static void *free_buffers[BUFPOOL_MAX_FREE];
+static int free_count = 0;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void *bufpool_get(void) {
+    void *buffer = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (free_count > 0) {
+        buffer = free_buffers[--free_count];
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (buffer == NULL) {
+        int err = posix_memalign(&buffer, BUFPOOL_ALIGNMENT, BUFPOOL_BUFFER_SIZE);
+        if (err != 0) {
+            log_message(FTPLOG_ERROR, "Failed to allocate transfer buffer: %s", strerror(err));
+            return NULL;
+        }
+    }
+    return buffer;
+}
+
+void bufpool_put(void *buffer) {
+    if (buffer == NULL) return;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (free_count < BUFPOOL_MAX_FREE) {
+        free_buffers[free_count++] = buffer;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    // Pool is full
+    free(buffer);
+}
+
+void bufpool_cleanup(void) {
+    pthread_mutex_lock(&pool_mutex);
+    while (free_count > 0) {
+        free(free_buffers[--free_count]);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
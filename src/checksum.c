@@ -0,0 +1,556 @@
+// src/checksum.c
+#include "checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define HAVE_ARM_CRC32 1
+#include <arm_acle.h>
+#endif
+
+#define CRC32_POLY  0xEDB88320u  // Reflected IEEE 802.3 polynomial
+#define CRC32C_POLY 0x82F63B78u  // Reflected Castagnoli polynomial
+
+static const char *hash_names[HASH_ALGO_COUNT] = { "CRC32", "CRC32C", "MD5", "SHA-256" };
+static const char *hash_keys[HASH_ALGO_COUNT] = { "crc32", "crc32c", "md5", "sha256" };
+
+// Slicing-by-8 tables for both CRC polynomials
+static uint32_t crc32_table[8][256];
+static uint32_t crc32c_table[8][256];
+
+// Runtime-selected implementations
+static uint32_t (*crc32c_impl)(uint32_t crc, const unsigned char *p, size_t len);
+static void (*sha256_blocks)(uint32_t state[8], const unsigned char *data, size_t blocks);
+static const char *crc32c_impl_name = "table";
+static const char *sha256_impl_name = "generic";
+
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+static void checksum_init_once(void);
+
+/* ---- CRC-32 / CRC-32C ---- */
+
+static void build_crc_table(uint32_t poly, uint32_t table[8][256]) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ poly : c >> 1;
+        }
+        table[0][i] = c;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+        }
+    }
+}
+
+static uint32_t crc_table_update(uint32_t table[8][256], uint32_t crc, const unsigned char *p, size_t len) {
+    crc = ~crc;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+              table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+              table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len-- > 0) {
+        crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t crc32c_table_update(uint32_t crc, const unsigned char *p, size_t len) {
+    return crc_table_update(crc32c_table, crc, p, len);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint32_t c = ~crc;
+
+    while (len > 0 && ((uintptr_t)p & 7) != 0) {
+        c = _mm_crc32_u8(c, *p++);
+        len--;
+    }
+#if defined(__x86_64__)
+    uint64_t c64 = c;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+        p += 8;
+        len -= 8;
+    }
+    c = (uint32_t)c64;
+#endif
+    while (len-- > 0) {
+        c = _mm_crc32_u8(c, *p++);
+    }
+    return ~c;
+}
+#endif
+
+#ifdef HAVE_ARM_CRC32
+static uint32_t crc32c_arm(uint32_t crc, const unsigned char *p, size_t len) {
+    uint32_t c = ~crc;
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __crc32cd(c, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c = __crc32cb(c, *p++);
+    }
+    return ~c;
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    checksum_init_once();
+    return crc_table_update(crc32_table, crc, (const unsigned char *)data, len);
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    checksum_init_once();
+    return crc32c_impl(crc, (const unsigned char *)data, len);
+}
+
+// GF(2) matrix helpers for combining CRCs (as in zlib's crc32_combine)
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+uint32_t crc_combine(hash_algo_t algo, uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (len2 == 0) {
+        return crc1;
+    }
+
+    // Operator for one zero bit
+    odd[0] = (algo == HASH_CRC32C) ? CRC32C_POLY : CRC32_POLY;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);  // Two zero bits
+    gf2_matrix_square(odd, even);  // Four zero bits
+
+    // Apply len2 zero bytes to crc1
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1) crc1 = gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0) break;
+
+        gf2_matrix_square(odd, even);
+        if (len2 & 1) crc1 = gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+/* ---- MD5 ---- */
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned char md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void md5_blocks(uint32_t state[4], const unsigned char *data, size_t blocks) {
+    while (blocks-- > 0) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)data[i * 4] | ((uint32_t)data[i * 4 + 1] << 8) |
+                   ((uint32_t)data[i * 4 + 2] << 16) | ((uint32_t)data[i * 4 + 3] << 24);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        for (int i = 0; i < 64; i++) {
+            uint32_t f;
+            int g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5 * i + 1) & 15;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3 * i + 5) & 15;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7 * i) & 15;
+            }
+            uint32_t tmp = d;
+            d = c;
+            c = b;
+            uint32_t x = a + f + md5_k[i] + w[g];
+            b = b + ROTL32(x, md5_r[i]);
+            a = tmp;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        data += 64;
+    }
+}
+
+/* ---- SHA-256 ---- */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_blocks_generic(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    while (blocks-- > 0) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[i * 4 + 1] << 16) |
+                   ((uint32_t)data[i * 4 + 2] << 8) | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+            uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+        data += 64;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// SHA-256 with the x86 SHA extensions; four rounds per pair of sha256rnds2
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Rearrange state into the ABEF/CDGH layout the instructions expect
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks-- > 0) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i msgs[4];
+
+        for (int i = 0; i < 4; i++) {
+            msgs[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), byteswap);
+        }
+
+        for (int g = 0; g < 16; g++) {
+            __m128i cur = msgs[g & 3];
+            __m128i msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i *)&sha256_k[g * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+
+            // Finish the schedule for the next group of four words
+            if (g >= 3 && g <= 14) {
+                __m128i next = msgs[(g + 1) & 3];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(cur, msgs[(g + 3) & 3], 4));
+                msgs[(g + 1) & 3] = _mm_sha256msg2_epu32(next, cur);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+            // Start the schedule for the group three ahead
+            if (g >= 1 && g <= 12) {
+                msgs[(g + 3) & 3] = _mm_sha256msg1_epu32(msgs[(g + 3) & 3], cur);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static int cpu_has_sha(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & (1u << 29)) != 0 &&
+           __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+}
+#endif
+
+/* ---- Runtime dispatch ---- */
+
+static void checksum_setup(void) {
+    build_crc_table(CRC32_POLY, crc32_table);
+    build_crc_table(CRC32C_POLY, crc32c_table);
+
+    crc32c_impl = crc32c_table_update;
+    sha256_blocks = sha256_blocks_generic;
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_impl = crc32c_sse42;
+        crc32c_impl_name = "sse4.2";
+    }
+    if (cpu_has_sha()) {
+        sha256_blocks = sha256_blocks_shani;
+        sha256_impl_name = "sha-ni";
+    }
+#endif
+#ifdef HAVE_ARM_CRC32
+    crc32c_impl = crc32c_arm;
+    crc32c_impl_name = "armv8-crc";
+#endif
+}
+
+static void checksum_init_once(void) {
+    pthread_once(&checksum_once, checksum_setup);
+}
+
+const char *hash_implementation(hash_algo_t algo) {
+    checksum_init_once();
+    switch (algo) {
+        case HASH_CRC32C: return crc32c_impl_name;
+        case HASH_SHA256: return sha256_impl_name;
+        case HASH_CRC32:  return "table";
+        default:          return "generic";
+    }
+}
+
+const char *hash_name(hash_algo_t algo) {
+    return ((unsigned)algo < HASH_ALGO_COUNT) ? hash_names[algo] : "UNKNOWN";
+}
+
+const char *hash_key(hash_algo_t algo) {
+    return ((unsigned)algo < HASH_ALGO_COUNT) ? hash_keys[algo] : "unknown";
+}
+
+int hash_lookup(const char *name, hash_algo_t *algo) {
+    for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+        if (strcasecmp(name, hash_names[i]) == 0 || strcasecmp(name, hash_keys[i]) == 0) {
+            *algo = (hash_algo_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Shared buffering for the 64-byte block hashes
+static void block_update(uint32_t *state, uint64_t *length, unsigned char block[64],
+                         void (*blocks_fn)(uint32_t *, const unsigned char *, size_t),
+                         const unsigned char *p, size_t len) {
+    size_t used = (size_t)(*length & 63);
+    *length += len;
+
+    if (used > 0) {
+        size_t take = 64 - used;
+        if (take > len) take = len;
+        memcpy(block + used, p, take);
+        p += take;
+        len -= take;
+        if (used + take < 64) {
+            return;
+        }
+        blocks_fn(state, block, 1);
+    }
+
+    if (len >= 64) {
+        blocks_fn(state, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    memcpy(block, p, len);
+}
+
+static void md5_blocks_fn(uint32_t *state, const unsigned char *data, size_t blocks) {
+    md5_blocks(state, data, blocks);
+}
+
+static void sha256_blocks_fn(uint32_t *state, const unsigned char *data, size_t blocks) {
+    sha256_blocks(state, data, blocks);
+}
+
+void hash_init(hash_ctx_t *ctx, hash_algo_t algo) {
+    static const uint32_t sha256_init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    checksum_init_once();
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->algo = algo;
+
+    if (algo == HASH_MD5) {
+        ctx->u.md5.state[0] = 0x67452301;
+        ctx->u.md5.state[1] = 0xefcdab89;
+        ctx->u.md5.state[2] = 0x98badcfe;
+        ctx->u.md5.state[3] = 0x10325476;
+    } else if (algo == HASH_SHA256) {
+        memcpy(ctx->u.sha256.state, sha256_init, sizeof(sha256_init));
+    }
+}
+
+void hash_update(hash_ctx_t *ctx, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+
+    switch (ctx->algo) {
+        case HASH_CRC32:
+            ctx->u.crc = crc_table_update(crc32_table, ctx->u.crc, p, len);
+            break;
+        case HASH_CRC32C:
+            ctx->u.crc = crc32c_impl(ctx->u.crc, p, len);
+            break;
+        case HASH_MD5:
+            block_update(ctx->u.md5.state, &ctx->u.md5.length, ctx->u.md5.block, md5_blocks_fn, p, len);
+            break;
+        case HASH_SHA256:
+            block_update(ctx->u.sha256.state, &ctx->u.sha256.length, ctx->u.sha256.block,
+                         sha256_blocks_fn, p, len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void to_hex(const unsigned char *bytes, size_t len, char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        hex[i * 2] = digits[bytes[i] >> 4];
+        hex[i * 2 + 1] = digits[bytes[i] & 15];
+    }
+    hex[len * 2] = '\0';
+}
+
+void hash_final(hash_ctx_t *ctx, char hex[HASH_MAX_HEX]) {
+    unsigned char pad[64] = { 0x80 };
+    unsigned char digest[32];
+
+    if (ctx->algo == HASH_CRC32 || ctx->algo == HASH_CRC32C) {
+        snprintf(hex, HASH_MAX_HEX, "%08x", ctx->u.crc);
+        return;
+    }
+
+    if (ctx->algo == HASH_MD5) {
+        md5_ctx_t *md5 = &ctx->u.md5;
+        uint64_t bits = md5->length * 8;
+        size_t used = (size_t)(md5->length & 63);
+        hash_update(ctx, pad, used < 56 ? 56 - used : 120 - used);
+        unsigned char len_le[8];
+        for (int i = 0; i < 8; i++) len_le[i] = (unsigned char)(bits >> (8 * i));
+        hash_update(ctx, len_le, 8);
+        for (int i = 0; i < 16; i++) digest[i] = (unsigned char)(md5->state[i / 4] >> (8 * (i % 4)));
+        to_hex(digest, 16, hex);
+        return;
+    }
+
+    if (ctx->algo == HASH_SHA256) {
+        sha256_ctx_t *sha = &ctx->u.sha256;
+        uint64_t bits = sha->length * 8;
+        size_t used = (size_t)(sha->length & 63);
+        hash_update(ctx, pad, used < 56 ? 56 - used : 120 - used);
+        unsigned char len_be[8];
+        for (int i = 0; i < 8; i++) len_be[i] = (unsigned char)(bits >> (56 - 8 * i));
+        hash_update(ctx, len_be, 8);
+        for (int i = 0; i < 32; i++) digest[i] = (unsigned char)(sha->state[i / 4] >> (24 - 8 * (i % 4)));
+        to_hex(digest, 32, hex);
+        return;
+    }
+
+    hex[0] = '\0';
+}
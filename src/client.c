@@ -3,6 +3,11 @@
 #include "logging.h"
 #include "commands.h"
 #include "network.h"
+#include "checksum.h"
+#include "trace.h"
+#include "probes.h"
+#include "admission.h"
+#include "tls.h"
 
 // Global variables
 client_t **clients = NULL;
@@ -58,12 +63,8 @@ void check_inactive_clients(void) {
                 log_message(FTPLOG_INFO, "Client %s timed out after %d seconds of inactivity", 
                            clients[i]->ip_address, client_timeout);
                 
-                // Send timeout message if socket is still valid
-                if (clients[i]->control_socket >= 0) {
-                    send_response(clients[i]->control_socket, 421, "Timeout: closing control connection");
-                }
-                
-                // Indicate thread should stop
+                // Indicate thread should stop; it sends the timeout message itself
+                clients[i]->close_reason = "Timeout: closing control connection";
                 clients[i]->thread_running = 0;
                 
                 // Disconnect will happen in the thread
@@ -124,7 +125,7 @@ void disconnect_client(client_t *client) {
     
     // Close control socket
     if (client->control_socket >= 0) {
-        close(client->control_socket);
+        tls_close(client->control_socket);
         client->control_socket = -1;
     }
 }
@@ -140,8 +141,15 @@ void *handle_client_thread(void *arg) {
     
     // Initialize transfer mode and activity timestamp
     client->transfer_mode = TRANSFER_MODE_NONE;
+    client->transfer_type = TRANSFER_TYPE_BINARY;
     client->data_socket = -1;
+    client->prot_private = 0;
+    client->hash_algo = HASH_SHA256;
     client_update_activity(client);  // Set initial activity timestamp
+    ratelimit_session_begin(&client->rate, client->ip_address);
+    sched_flow_init(&client->sched);
+    trace_session_begin(client);
+    PROBE2(session__start, client, client->ip_address);
     
     // Send welcome message
     send_response(client->control_socket, 220, "Welcome to Simple FTP Server");
@@ -154,7 +162,7 @@ void *handle_client_thread(void *arg) {
     
     while (server_running && client->thread_running) {
         // Use recv with timeout to periodically check server_running and thread_running
-        bytes_read = recv(client->control_socket, buffer, sizeof(buffer) - 1, 0);
+        bytes_read = tls_recv(client->control_socket, buffer, sizeof(buffer) - 1, 0);
         
         if (bytes_read > 0) {
             // Update activity timestamp on any received data
@@ -185,7 +193,15 @@ void *handle_client_thread(void *arg) {
             }
             
             // Process the command
+            struct timespec command_start = {0, 0};
+            if (trace_enabled) {
+                clock_gettime(CLOCK_MONOTONIC, &command_start);
+            }
+            client->transfer_bytes = 0;
             process_command(client, command, arg);
+            if (trace_enabled) {
+                trace_command(client, command, arg, &command_start);
+            }
             
             // Update activity timestamp after processing command
             client_update_activity(client);
@@ -211,10 +227,20 @@ void *handle_client_thread(void *arg) {
         }
     }
     
+    // Sent from here rather than by the reaper, which would wait behind a TLS read
+    if (client->close_reason != NULL) {
+        send_response(client->control_socket, 421, client->close_reason);
+    }
+    
     // Clean up client
+    trace_session_end(client);
+    ratelimit_session_end(&client->rate);
+    sched_flow_destroy(&client->sched);
+    PROBE2(session__end, client, client->ip_address);
     log_message(FTPLOG_INFO, "Client disconnected: %s", client->ip_address);
     disconnect_client(client);
     remove_client(client);
+    admission_release(client);
     free(client);
     
     return NULL;
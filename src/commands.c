@@ -2,19 +2,623 @@
 #include "commands.h"
 #include "logging.h"
 #include "network.h"
+#include "pagecache.h"
+#include "filewriter.h"
+#include "utils.h"
+#include "filecache.h"
+#include "filehash.h"
+#include "probes.h"
+#include "scheduler.h"
+#include "fileops.h"
+#include "tarstream.h"
+#include "tarextract.h"
+#include "dedup.h"
+#include "storage.h"
+#include "quota.h"
+#include "statcache.h"
+#include "tls.h"
+#include "ascii.h"
+#include <fnmatch.h>
+
+#define RETR_SENDFILE_CHUNK (1024 * 1024)  // Bytes per sendfile() between progress reports
+#define LIST_BATCH (16 * 1024)             // Listing bytes gathered per send()
 
 void send_response(int socket, int code, const char *message) {
     char response[MAX_BUFFER];
     snprintf(response, sizeof(response), "%d %s\r\n", code, message);
-    send(socket, response, strlen(response), 0);
+    tls_send(socket, response, strlen(response), 0);
     log_message(FTPLOG_DEBUG, "Sent: %d %s", code, message);
 }
 
-void process_command(client_t *client, const char *command, const char *arg) {
+int format_list_line(char *line, size_t size, const char *name, const struct stat *st, int long_format) {
+    int len;
+    
+    if (long_format) {
+        // Format like ls -l
+        char perms[11];
+        perms[0] = S_ISDIR(st->st_mode) ? 'd' : '-';
+        perms[1] = (st->st_mode & S_IRUSR) ? 'r' : '-';
+        perms[2] = (st->st_mode & S_IWUSR) ? 'w' : '-';
+        perms[3] = (st->st_mode & S_IXUSR) ? 'x' : '-';
+        perms[4] = (st->st_mode & S_IRGRP) ? 'r' : '-';
+        perms[5] = (st->st_mode & S_IWGRP) ? 'w' : '-';
+        perms[6] = (st->st_mode & S_IXGRP) ? 'x' : '-';
+        perms[7] = (st->st_mode & S_IROTH) ? 'r' : '-';
+        perms[8] = (st->st_mode & S_IWOTH) ? 'w' : '-';
+        perms[9] = (st->st_mode & S_IXOTH) ? 'x' : '-';
+        perms[10] = '\0';
+        
+        struct tm tm_info;
+        char time_str[20];
+        strftime(time_str, sizeof(time_str), "%b %d %H:%M", localtime_r(&st->st_mtime, &tm_info));
+        
+        len = snprintf(line, size, "%s %3d %-8d %-8d %8lld %s %s\r\n",
+                       perms, (int)st->st_nlink, (int)st->st_uid, (int)st->st_gid,
+                       (long long)st->st_size, time_str, name);
+    } else {
+        // Just filename for NLST
+        len = snprintf(line, size, "%s\r\n", name);
+    }
+    
+    return len < (int)size ? len : (int)size - 1;
+}
+
+int format_mlst_line(char *line, size_t size, const char *name, const struct stat *st) {
+    // RFC 3659 facts: type, size, modify (UTC) and perm
+    struct tm tm_info;
+    char modify[16];
+    strftime(modify, sizeof(modify), "%Y%m%d%H%M%S", gmtime_r(&st->st_mtime, &tm_info));
+
+    int writable = (st->st_mode & S_IWUSR) != 0;
+    const char *perm;
+    if (S_ISDIR(st->st_mode)) {
+        perm = writable ? "elcdmf" : "el";
+    } else {
+        perm = writable ? "rawdf" : "r";
+    }
+
+    int len = snprintf(line, size, "type=%s;size=%lld;modify=%s;perm=%s; %s\r\n",
+                       S_ISDIR(st->st_mode) ? "dir" : S_ISREG(st->st_mode) ? "file" : "OS.unix=other",
+                       (long long)st->st_size, modify, perm, name);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+// Release the source of a RETR: an open file or a hot-cache entry
+static void release_retr_source(storage_file_t *file, filecache_entry_t *cached) {
+    if (file->storage != NULL) {
+        storage_close(file);
+        file->storage = NULL;
+    }
+    filecache_release(cached);
+}
+
+// Build the full path of a file argument (absolute paths are relative to the FTP root)
+static void build_file_path(client_t *client, const char *arg, char *path, size_t len) {
+    if (arg[0] == '/') {
+        snprintf(path, len, "%s%s", root_directory, arg);
+    } else {
+        snprintf(path, len, "%s/%s", client->current_dir, arg);
+    }
+}
+
+// Checksum a file for HASH/XCRC/XMD5/XSHA256, replying with an error on failure
+static int checksum_command(client_t *client, const char *arg, hash_algo_t algo,
+                            char hex[HASH_MAX_HEX], off_t *size) {
+    char file_path[PATH_MAX];
+    
+    if (strlen(arg) == 0) {
+        send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+        return 0;
+    }
+    
+    build_file_path(client, arg, file_path, sizeof(file_path));
+    if (!hash_file(file_path, algo, hex, size)) {
+        log_message(FTPLOG_ERROR, "%s: Failed to hash %s - %s", hash_name(algo), file_path, strerror(errno));
+        if (errno == ENOENT) {
+            send_response(client->control_socket, 550, "File not found");
+        } else if (errno == EISDIR) {
+            send_response(client->control_socket, 550, "Not a regular file");
+        } else {
+            send_response(client->control_socket, 550, "Failed to compute checksum");
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// Keep a long server-side copy from looking like an idle session
+static void copy_progress(void *arg) {
+    client_update_activity((client_t *)arg);
+}
+
+// First half of RNFR/RNTO and SITE CPFR/CPTO: remember the source if it exists
+static void remember_source(client_t *client, int op, const char *arg) {
+    if (strlen(arg) == 0) {
+        send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+        return;
+    }
+    
+    build_file_path(client, arg, client->pending_path, sizeof(client->pending_path));
+    if (!storage_exists(client->pending_path)) {
+        log_message(FTPLOG_ERROR, "%s: Cannot use %s - %s", op == PENDING_RENAME ? "RNFR" : "CPFR",
+                    client->pending_path, strerror(errno));
+        send_response(client->control_socket, 550, errno == EACCES ? "Access denied" : "File not found");
+        return;
+    }
+    
+    client->pending_op = op;
+    send_response(client->control_socket, 350, "File exists, ready for destination name");
+}
+
+static void close_data_channel(client_t *client, int data_conn) {
+    tls_close(data_conn);
+    if (client->transfer_mode == TRANSFER_MODE_PASV) {
+        close(client->data_socket);
+        client->data_socket = -1;
+    }
+}
+
+// Open the data connection for a transfer, replying 150 with message; on
+// failure replies 425 (522 if TLS could not be set up) and returns -1
+static int open_data_channel(client_t *client, const char *message) {
+    int data_conn;
+    
+    if (client->transfer_mode == TRANSFER_MODE_PORT) {
+        data_conn = create_data_connection(client);
+        if (data_conn < 0) {
+            send_response(client->control_socket, 425, "Cannot open data connection");
+            return -1;
+        }
+        send_response(client->control_socket, 150, message);
+    } else {
+        if (client->data_socket < 0) {
+            send_response(client->control_socket, 425, "Cannot open data connection");
+            return -1;
+        }
+        send_response(client->control_socket, 150, message);
+        data_conn = accept_data_connection(client);
+        if (data_conn < 0) {
+            send_response(client->control_socket, 425, "Cannot open data connection");
+            close(client->data_socket);
+            client->data_socket = -1;
+            return -1;
+        }
+    }
+    
+    // After PROT P the client starts a handshake once it has seen the 150
+    if (client->prot_private) {
+        if (!tls_accept(data_conn)) {
+            log_message(FTPLOG_ERROR, "TLS: Data connection handshake with %s failed: %s",
+                        client->ip_address, strerror(errno));
+            close_data_channel(client, data_conn);
+            send_response(client->control_socket, 522, "TLS negotiation failed on data connection");
+            return -1;
+        }
+        if (tls_require_reuse && !tls_resumed_from(data_conn, client->control_socket)) {
+            log_message(FTPLOG_ERROR, "TLS: Data connection from %s did not resume the control session",
+                        client->ip_address);
+            close_data_channel(client, data_conn);
+            send_response(client->control_socket, 522, "Data connection must resume the TLS session");
+            return -1;
+        }
+    }
+    return data_conn;
+}
+
+// Count archive bytes as they move, for rate limits and the idle timer
+static void tar_send_progress(void *arg, size_t bytes) {
+    client_t *client = arg;
+    client->transfer_bytes += (off_t)bytes;
+    client_update_activity(client);
+    ratelimit_consume(&client->rate, RATE_DOWN, bytes);
+}
+
+static void tar_receive_progress(void *arg, size_t bytes) {
+    client_t *client = arg;
+    client->transfer_bytes += (off_t)bytes;
+    client_update_activity(client);
+    ratelimit_consume(&client->rate, RATE_UP, bytes);
+}
+
+// RETR of name.tar for a directory: the archive is built while it is sent
+static void send_tar(client_t *client, const char *arg, const char *dir, tar_format_t format) {
+    int data_conn = open_data_channel(client, "Opening BINARY mode data connection for archive");
+    if (data_conn < 0) {
+        return;
+    }
+    
+    tar_stats_t stats;
+    time_t start_time = time(NULL);
+    int ok = tar_stream(data_conn, dir, format, &stats, tar_send_progress, client);
+    close_data_channel(client, data_conn);
+    
+    double elapsed = difftime(time(NULL), start_time);
+    char rate_str[64];
+    format_transfer_rate(elapsed > 0 ? stats.bytes / elapsed : 0, rate_str, sizeof(rate_str));
+    log_message(ok ? FTPLOG_TRANSFER : FTPLOG_ERROR,
+                "%s archive of %s: %ld files, %ld directories, %ld skipped, %lld bytes in %.1f seconds, %s",
+                ok ? "Completed" : "Aborted", arg, stats.files, stats.directories, stats.skipped,
+                (long long)stats.bytes, elapsed, rate_str);
+    PROBE4(transfer__done, client, "RETR", (long long)stats.bytes, ok);
+    
+    if (ok) {
+        send_response(client->control_socket, 226, "Transfer complete");
+    } else {
+        send_response(client->control_socket, 426, "Connection closed; transfer aborted");
+    }
+}
+
+// STOR of name.tar onto a directory: members are unpacked as they arrive
+static void receive_tar(client_t *client, const char *arg, const char *dir) {
+    // Members are reserved against the directory's quotas as they arrive
+    quota_reservation_t quota;
+    if (!quota_begin(&quota, client->username, dir, 0)) {
+        send_response(client->control_socket, 552, "Requested file action aborted: exceeded storage allocation");
+        return;
+    }
+    
+    int data_conn = open_data_channel(client, "Opening BINARY mode data connection for archive");
+    if (data_conn < 0) {
+        quota_cancel(&quota);
+        return;
+    }
+    
+    tar_extract_stats_t stats;
+    time_t start_time = time(NULL);
+    int ok = tar_extract(data_conn, dir, &quota, &stats, tar_receive_progress, client);
+    close_data_channel(client, data_conn);
+    quota_end_tree(&quota, stats.written, stats.files);
+    
+    double elapsed = difftime(time(NULL), start_time);
+    char rate_str[64];
+    format_transfer_rate(elapsed > 0 ? stats.bytes / elapsed : 0, rate_str, sizeof(rate_str));
+    log_message(ok ? FTPLOG_TRANSFER : FTPLOG_ERROR,
+                "%s extracting %s: %ld files, %ld directories, %ld skipped, %ld failed, %lld bytes in %.1f seconds, %s",
+                ok ? "Completed" : "Failed", arg, stats.files, stats.directories, stats.skipped, stats.errors,
+                (long long)stats.bytes, elapsed, rate_str);
+    PROBE4(transfer__done, client, "STOR", (long long)stats.bytes, ok);
+    
+    char message[MAX_BUFFER];
+    if (stats.over_quota) {
+        send_response(client->control_socket, 552, "Requested file action aborted: exceeded storage allocation");
+    } else if (!stats.complete) {
+        send_response(client->control_socket, 451, "Requested action aborted: archive incomplete or malformed");
+    } else if (stats.errors > 0) {
+        snprintf(message, sizeof(message), "Requested action aborted: %ld entries could not be written", stats.errors);
+        send_response(client->control_socket, 451, message);
+    } else {
+        snprintf(message, sizeof(message), "Transfer complete, %ld files extracted", stats.files);
+        send_response(client->control_socket, 226, message);
+    }
+}
+
+// What LIST, NLST and MLSD enumerate
+typedef struct {
+    char dir[PATH_MAX];            // Directory to read
+    char prefix[PATH_MAX];         // Put before NLST names: the directory as the client wrote it
+    char pattern[NAME_MAX + 1];    // Names to keep (fnmatch), "" = all
+    time_t newer;                  // Only entries modified after this (0 = no limit)
+} list_request_t;
+
+// Resolve the directory to list, which must lie inside the root as for CWD;
+// replies 550 and returns 0 if it does not
+static int list_dir_inside_root(client_t *client, list_request_t *req) {
+    char resolved[PATH_MAX];
+    if (!storage_realpath(req->dir, resolved) || !fileops_inside_root(resolved)) {
+        log_message(FTPLOG_ERROR, "LIST: Directory outside root or invalid: %s", req->dir);
+        send_response(client->control_socket, 550, "No such file or directory");
+        return 0;
+    }
+    memcpy(req->dir, resolved, sizeof(req->dir));
+    return 1;
+}
+
+// Parse "[-options] [--newer=YYYYMMDDHHMMSS] [path]", where the last part of
+// path may be a glob. Replies with an error and returns 0 if it is unusable.
+static int parse_list_request(client_t *client, const char *command, const char *arg, list_request_t *req) {
+    memset(req, 0, sizeof(*req));
+    
+    // ls-style options such as -l and -a are accepted and ignored
+    while (*arg == '-') {
+        size_t len = strcspn(arg, " ");
+        if (strncmp(arg, "--newer=", 8) == 0) {
+            struct tm tm;
+            int consumed = 0;
+            memset(&tm, 0, sizeof(tm));
+            if (len != 8 + 14 ||
+                sscanf(arg + 8, "%4d%2d%2d%2d%2d%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                       &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &consumed) != 6 || consumed != 14) {
+                send_response(client->control_socket, 501, "Use --newer=YYYYMMDDHHMMSS (UTC)");
+                return 0;
+            }
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+            req->newer = timegm(&tm);
+        }
+        arg += len;
+        while (*arg == ' ') arg++;
+    }
+    
+    if (*arg == '\0') {
+        snprintf(req->dir, sizeof(req->dir), "%s", client->current_dir);
+        return 1;
+    }
+    
+    char path[PATH_MAX];
+    struct stat st;
+    build_file_path(client, arg, path, sizeof(path));
+    const char *slash = strrchr(arg, '/');
+    const char *base = slash != NULL ? slash + 1 : arg;
+    int glob = strpbrk(base, "*?[") != NULL;
+    
+    // A directory: list what is in it
+    if (!glob && storage_stat(path, &st) && S_ISDIR(st.st_mode)) {
+        snprintf(req->dir, sizeof(req->dir), "%s", path);
+        snprintf(req->prefix, sizeof(req->prefix), "%s%s", arg, *base != '\0' ? "/" : "");
+        return list_dir_inside_root(client, req);
+    }
+    
+    // A file name or a pattern: the matching entries of its directory
+    if (*base == '\0' || strlen(base) > NAME_MAX || (!glob && !storage_exists(path))) {
+        send_response(client->control_socket, 550, "No such file or directory");
+        return 0;
+    }
+    if (!glob && strcmp(command, "MLSD") == 0) {
+        send_response(client->control_socket, 501, "Not a directory");
+        return 0;
+    }
+    strcpy(req->pattern, base);
+    if (slash != NULL) {
+        snprintf(req->prefix, sizeof(req->prefix), "%.*s", (int)(base - arg), arg);
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%.*s", slash == arg ? 1 : (int)(slash - arg), arg);
+        build_file_path(client, parent, req->dir, sizeof(req->dir));
+    } else {
+        snprintf(req->dir, sizeof(req->dir), "%s", client->current_dir);
+    }
+    return list_dir_inside_root(client, req);
+}
+
+// Send a batch of listing lines; returns 0 if the client went away
+static int send_listing_batch(client_t *client, int data_conn, const char *data, size_t len) {
+    if (len == 0) {
+        return 1;
+    }
+    if (tls_send(data_conn, data, len, 0) < 0) {
+        log_message(FTPLOG_ERROR, "Failed to send directory entries: %s", strerror(errno));
+        return 0;
+    }
+    client->transfer_bytes += len;
+    ratelimit_consume(&client->rate, RATE_DOWN, len);
+    client_update_activity(client);
+    return 1;
+}
+
+// LIST, NLST and MLSD. Names are matched as the directory is read, so only
+// the entries that will be sent are stat'd, and NLST needs no stat at all
+// unless --newer is given.
+static void send_listing(client_t *client, const char *command, const char *arg) {
+    list_request_t req;
+    if (!parse_list_request(client, command, arg, &req)) {
+        return;
+    }
+    
+    int mlsd = strcmp(command, "MLSD") == 0;
+    int nlst = strcmp(command, "NLST") == 0;
+    int need_stat = !nlst || req.newer != 0;
+    
+    storage_dir_t dir;
+    if (!storage_opendir(req.dir, &dir)) {
+        log_message(FTPLOG_ERROR, "Failed to open directory: %s - %s", req.dir, strerror(errno));
+        send_response(client->control_socket, 550, "Failed to open directory");
+        return;
+    }
+    
+    int data_conn = open_data_channel(client, "Here comes the directory listing");
+    if (data_conn < 0) {
+        storage_closedir(&dir);
+        return;
+    }
+    
+    char name[NAME_MAX + 1];
+    char display[PATH_MAX + NAME_MAX + 1];
+    char batch[LIST_BATCH];
+    size_t used = 0;
+    long read = 0, matched = 0;
+    int ok = 1;
+    struct stat st;
+    
+    while (ok && storage_readdir(&dir, name, sizeof(name), NULL)) {
+        read++;
+        if (req.pattern[0] != '\0') {
+            if (fnmatch(req.pattern, name, FNM_PERIOD) != 0) {
+                continue;
+            }
+        } else if (mlsd && (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+            continue;
+        }
+        if (need_stat && !storage_entry_stat(&dir, name, &st)) {
+            continue;  // Vanished meanwhile
+        }
+        if (req.newer != 0 && st.st_mtime <= req.newer) {
+            continue;
+        }
+        matched++;
+        
+        if (used + MAX_BUFFER > sizeof(batch)) {
+            ok = send_listing_batch(client, data_conn, batch, used);
+            used = 0;
+        }
+        if (mlsd) {
+            used += format_mlst_line(batch + used, MAX_BUFFER, name, &st);
+        } else if (nlst) {
+            snprintf(display, sizeof(display), "%s%s", req.prefix, name);
+            used += format_list_line(batch + used, MAX_BUFFER, display, &st, 0);
+        } else {
+            used += format_list_line(batch + used, MAX_BUFFER, name, &st, 1);
+        }
+    }
+    if (ok) {
+        ok = send_listing_batch(client, data_conn, batch, used);
+    }
+    
+    storage_closedir(&dir);
+    close_data_channel(client, data_conn);
+    log_message(FTPLOG_DEBUG, "%s: %ld of %ld entries in %s sent", command, matched, read, req.dir);
+    
+    PROBE4(transfer__done, client, command, (long long)client->transfer_bytes, ok);
+    if (ok) {
+        send_response(client->control_socket, 226, "Directory send OK");
+    } else {
+        send_response(client->control_socket, 426, "Connection closed; transfer aborted");
+    }
+}
+
+static void site_command(client_t *client, const char *arg, int pending) {
+    char subcommand[16] = {0};
+    const char *param = arg;
+    
+    // Split "CPFR path" into subcommand and parameter
+    size_t len = strcspn(arg, " ");
+    if (len >= sizeof(subcommand)) {
+        send_response(client->control_socket, 501, "Unknown SITE command");
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        subcommand[i] = toupper((unsigned char)arg[i]);
+    }
+    param = arg + len;
+    while (*param == ' ') param++;
+    
+    if (strcmp(subcommand, "CPFR") == 0) {
+        remember_source(client, PENDING_COPY, param);
+    }
+    else if (strcmp(subcommand, "CPTO") == 0) {
+        if (pending != PENDING_COPY) {
+            send_response(client->control_socket, 503, "Bad sequence of commands, use SITE CPFR first");
+            return;
+        }
+        if (strlen(param) == 0) {
+            send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+            return;
+        }
+        
+        char target[PATH_MAX];
+        build_file_path(client, param, target, sizeof(target));
+        
+        // The copy counts against quotas like an upload of the same size
+        quota_reservation_t quota;
+        struct stat st;
+        if (!quota_begin(&quota, client->username, target,
+                         storage_stat(client->pending_path, &st) ? st.st_size : 0)) {
+            send_response(client->control_socket, 552, "Requested file action aborted: exceeded storage allocation");
+            return;
+        }
+        
+        struct timespec start, end;
+        copy_method_t method;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        
+        // Copies that involve another backend go through a buffer
+        int ok;
+        if (storage_is_posix(client->pending_path) && storage_is_posix(target)) {
+            ok = fileops_copy(client->pending_path, target, &method, copy_progress, client);
+        } else {
+            method = COPY_READ_WRITE;
+            ok = storage_copy(client->pending_path, target, copy_progress, client);
+        }
+        int err = errno;
+        quota_end(&quota);
+        errno = err;
+        if (!ok) {
+            log_message(FTPLOG_ERROR, "CPTO: Failed to copy %s to %s - %s",
+                        client->pending_path, target, strerror(errno));
+            send_response(client->control_socket, 550,
+                          errno == EISDIR ? "Not a regular file" :
+                          errno == ELOOP ? "Symbolic links are not copied" : "Copy failed");
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        log_message(FTPLOG_TRANSFER, "Copied %s to %s with %s in %.3f seconds",
+                    client->pending_path, target, copy_method_name(method), elapsed);
+        
+        char message[64];
+        snprintf(message, sizeof(message), "Copy successful (%s)", copy_method_name(method));
+        send_response(client->control_socket, 250, message);
+    }
+    else {
+        send_response(client->control_socket, 501, "Unknown SITE command");
+    }
+}
+
+static void dispatch_command(client_t *client, const char *command, const char *arg) {
     // Update activity timestamp for each command
     client_update_activity(client);
     
-    if (strcmp(command, "USER") == 0) {
+    // RNTO and SITE CPTO are only valid straight after their first half
+    int pending = client->pending_op;
+    client->pending_op = PENDING_NONE;
+    
+    // With --tls-required neither passwords nor files cross the network in the clear
+    if (tls_required) {
+        if ((strcmp(command, "USER") == 0 || strcmp(command, "PASS") == 0) &&
+            !tls_active(client->control_socket)) {
+            send_response(client->control_socket, 530, "Use AUTH TLS first");
+            return;
+        }
+        if ((strcmp(command, "LIST") == 0 || strcmp(command, "NLST") == 0 || strcmp(command, "MLSD") == 0 ||
+             strcmp(command, "RETR") == 0 || strcmp(command, "STOR") == 0) && !client->prot_private) {
+            send_response(client->control_socket, 521, "Data connections must be protected, use PROT P");
+            return;
+        }
+    }
+    
+    if (strcmp(command, "AUTH") == 0) {
+        // RFC 4217: the handshake starts as soon as the client reads the 234
+        if (!tls_available()) {
+            send_response(client->control_socket, 502, "TLS not configured");
+        } else if (strcasecmp(arg, "TLS") != 0 && strcasecmp(arg, "TLS-C") != 0 && strcasecmp(arg, "SSL") != 0) {
+            send_response(client->control_socket, 504, "Security mechanism not understood");
+        } else if (tls_active(client->control_socket)) {
+            send_response(client->control_socket, 503, "TLS already active");
+        } else {
+            send_response(client->control_socket, 234, "Proceed with negotiation");
+            if (!tls_accept(client->control_socket)) {
+                // Nothing sensible can follow a failed handshake on the control connection
+                log_message(FTPLOG_ERROR, "TLS: Control connection handshake with %s failed: %s",
+                            client->ip_address, strerror(errno));
+                client->thread_running = 0;
+            }
+        }
+    }
+    else if (strcmp(command, "PBSZ") == 0) {
+        if (!tls_active(client->control_socket)) {
+            send_response(client->control_socket, 503, "Use AUTH TLS first");
+        } else {
+            send_response(client->control_socket, 200, "PBSZ=0");
+        }
+    }
+    else if (strcmp(command, "PROT") == 0) {
+        if (!tls_active(client->control_socket)) {
+            send_response(client->control_socket, 503, "Use AUTH TLS first");
+        } else if (strcasecmp(arg, "P") == 0) {
+            client->prot_private = 1;
+            send_response(client->control_socket, 200, "Protection level set to Private");
+        } else if (strcasecmp(arg, "C") == 0) {
+            client->prot_private = 0;
+            send_response(client->control_socket, 200, "Protection level set to Clear");
+        } else if (strcasecmp(arg, "S") == 0 || strcasecmp(arg, "E") == 0) {
+            send_response(client->control_socket, 536, "Protection level not supported");
+        } else {
+            send_response(client->control_socket, 504, "Unknown protection level");
+        }
+    }
+    else if (strcmp(command, "USER") == 0) {
+        snprintf(client->username, sizeof(client->username), "%s", arg);
+        ratelimit_session_user(&client->rate, client->username);
+        sched_flow_user(&client->sched, client->username);
         send_response(client->control_socket, 331, "User name okay, need password");
     }
     else if (strcmp(command, "PASS") == 0) {
@@ -29,13 +633,44 @@ void process_command(client_t *client, const char *command, const char *arg) {
         strcpy(response, "211-Features:\r\n");
         strcat(response, " UTF8\r\n");
         strcat(response, " PASV\r\n");
+        if (tls_available()) {
+            strcat(response, " AUTH TLS\r\n");
+            strcat(response, " PBSZ\r\n");
+            strcat(response, " PROT\r\n");
+        }
+        strcat(response, " SIZE\r\n");
+        strcat(response, " MDTM\r\n");
+        strcat(response, " MLST type*;size*;modify*;perm*;\r\n");
+        
+        // HASH algorithms, the selected one marked with an asterisk
+        strcat(response, " HASH ");
+        for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+            strcat(response, hash_name((hash_algo_t)i));
+            if (i == client->hash_algo) {
+                strcat(response, "*");
+            }
+            strcat(response, i + 1 < HASH_ALGO_COUNT ? ";" : "\r\n");
+        }
         strcat(response, "211 End\r\n");
-        send(client->control_socket, response, strlen(response), 0);
+        tls_send(client->control_socket, response, strlen(response), 0);
     }
     else if (strcmp(command, "OPTS") == 0) {
         // Handle options command
         if (strncmp(arg, "UTF8", 4) == 0) {
             send_response(client->control_socket, 200, "UTF8 option accepted");
+        } else if (strncasecmp(arg, "HASH", 4) == 0 && (arg[4] == '\0' || arg[4] == ' ')) {
+            // OPTS HASH reports the selected algorithm, OPTS HASH <algo> changes it
+            const char *name = arg + 4;
+            while (*name == ' ') name++;
+            hash_algo_t algo;
+            if (*name == '\0') {
+                send_response(client->control_socket, 200, hash_name((hash_algo_t)client->hash_algo));
+            } else if (hash_lookup(name, &algo)) {
+                client->hash_algo = algo;
+                send_response(client->control_socket, 200, hash_name(algo));
+            } else {
+                send_response(client->control_socket, 501, "Unknown algorithm");
+            }
         } else {
             send_response(client->control_socket, 501, "Option not supported");
         }
@@ -66,9 +701,9 @@ void process_command(client_t *client, const char *command, const char *arg) {
         log_message(FTPLOG_DEBUG, "PWD: reporting=%s", rel_path);
         
         // Send the response - note that FTP requires double quotes around the path
-        char response[MAX_BUFFER];
+        char response[PATH_MAX + 32];
         snprintf(response, sizeof(response), "257 \"%s\" is current directory\r\n", rel_path);
-        send(client->control_socket, response, strlen(response), 0);
+        tls_send(client->control_socket, response, strlen(response), 0);
         log_message(FTPLOG_DEBUG, "Sent: 257 \"%s\" is current directory", rel_path);
     }
     else if (strcmp(command, "CWD") == 0) {
@@ -113,7 +748,11 @@ void process_command(client_t *client, const char *command, const char *arg) {
         }
         else {
             // Relative path
-            snprintf(new_path, sizeof(new_path), "%s/%s", client->current_dir, arg);
+            int n = snprintf(new_path, sizeof(new_path), "%s/%s", client->current_dir, arg);
+            if (n < 0 || (size_t)n >= sizeof(new_path)) {
+                send_response(client->control_socket, 550, "Failed to change directory");
+                return;
+            }
         }
         
         // Log for debugging
@@ -121,7 +760,7 @@ void process_command(client_t *client, const char *command, const char *arg) {
         log_message(FTPLOG_DEBUG, "CWD: Constructed path: %s", new_path);
         
         // Normalize the path (resolve .., ., and symlinks)
-        if (realpath(new_path, normalized_path) == NULL) {
+        if (!storage_realpath(new_path, normalized_path)) {
             log_message(FTPLOG_ERROR, "CWD: Invalid path: %s (%s)", new_path, strerror(errno));
             send_response(client->control_socket, 550, "Failed to change directory");
             return;
@@ -136,7 +775,7 @@ void process_command(client_t *client, const char *command, const char *arg) {
         
         // Check if directory exists and is accessible
         struct stat st;
-        if (stat(normalized_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        if (storage_stat(normalized_path, &st) && S_ISDIR(st.st_mode)) {
             strcpy(client->current_dir, normalized_path);
             log_message(FTPLOG_DEBUG, "CWD: Changed to: %s", normalized_path);
             send_response(client->control_socket, 250, "Directory successfully changed");
@@ -146,10 +785,12 @@ void process_command(client_t *client, const char *command, const char *arg) {
         }
     }
     else if (strcmp(command, "TYPE") == 0) {
-        // We support both ASCII and Binary mode
-        if (arg[0] == 'A') {
+        // A [N] translates line endings for RETR and STOR; I and L 8 send bytes as stored
+        if (strcasecmp(arg, "A") == 0 || strcasecmp(arg, "A N") == 0) {
+            client->transfer_type = TRANSFER_TYPE_ASCII;
             send_response(client->control_socket, 200, "Type set to A");
-        } else if (arg[0] == 'I') {
+        } else if (strcasecmp(arg, "I") == 0 || strcasecmp(arg, "L 8") == 0) {
+            client->transfer_type = TRANSFER_TYPE_BINARY;
             send_response(client->control_socket, 200, "Type set to I");
         } else {
             send_response(client->control_socket, 504, "Type not supported");
@@ -214,120 +855,13 @@ void process_command(client_t *client, const char *command, const char *arg) {
             send_response(client->control_socket, 425, "Cannot open data connection");
         }
     }
-    else if (strcmp(command, "LIST") == 0 || strcmp(command, "NLST") == 0) {
-        int data_conn = -1;
-        
+    else if (strcmp(command, "LIST") == 0 || strcmp(command, "NLST") == 0 || strcmp(command, "MLSD") == 0) {
         // Check if transfer mode is set
         if (client->transfer_mode == TRANSFER_MODE_NONE) {
             send_response(client->control_socket, 425, "Use PORT or PASV first");
             return;
         }
-        
-        // Set up data connection based on transfer mode
-        if (client->transfer_mode == TRANSFER_MODE_PORT) {
-            // Active mode - we connect to the client
-            data_conn = create_data_connection(client);
-            if (data_conn < 0) {
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                return;
-            }
-        } else {
-            // Passive mode - accept connection from client
-            if (client->data_socket < 0) {
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                return;
-            }
-            
-            // Tell client we're ready to send directory listing
-            send_response(client->control_socket, 150, "Here comes the directory listing");
-            
-            // Accept the connection from client
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            data_conn = accept(client->data_socket, (struct sockaddr*)&client_addr, &client_len);
-            
-            if (data_conn < 0) {
-                log_message(FTPLOG_ERROR, "Failed to accept data connection: %s", strerror(errno));
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                close(client->data_socket);
-                client->data_socket = -1;
-                return;
-            }
-        }
-        
-        // In active mode, send the 150 message after the connection is established
-        if (client->transfer_mode == TRANSFER_MODE_PORT) {
-            send_response(client->control_socket, 150, "Here comes the directory listing");
-        }
-        
-        // Open directory
-        DIR *dir = opendir(client->current_dir);
-        if (dir == NULL) {
-            log_message(FTPLOG_ERROR, "Failed to open directory: %s", strerror(errno));
-            send_response(client->control_socket, 550, "Failed to open directory");
-            close(data_conn);
-            if (client->transfer_mode == TRANSFER_MODE_PASV) {
-                close(client->data_socket);
-                client->data_socket = -1;
-            }
-            return;
-        }
-        
-        struct dirent *entry;
-        char line[MAX_BUFFER];
-        
-        // Read directory entries
-        while ((entry = readdir(dir)) != NULL) {
-            char full_path[PATH_MAX];
-            snprintf(full_path, sizeof(full_path), "%s/%s", client->current_dir, entry->d_name);
-            
-            struct stat st;
-            if (stat(full_path, &st) == 0) {
-                if (strcmp(command, "LIST") == 0) {
-                    // Format like ls -l
-                    char perms[11];
-                    perms[0] = S_ISDIR(st.st_mode) ? 'd' : '-';
-                    perms[1] = (st.st_mode & S_IRUSR) ? 'r' : '-';
-                    perms[2] = (st.st_mode & S_IWUSR) ? 'w' : '-';
-                    perms[3] = (st.st_mode & S_IXUSR) ? 'x' : '-';
-                    perms[4] = (st.st_mode & S_IRGRP) ? 'r' : '-';
-                    perms[5] = (st.st_mode & S_IWGRP) ? 'w' : '-';
-                    perms[6] = (st.st_mode & S_IXGRP) ? 'x' : '-';
-                    perms[7] = (st.st_mode & S_IROTH) ? 'r' : '-';
-                    perms[8] = (st.st_mode & S_IWOTH) ? 'w' : '-';
-                    perms[9] = (st.st_mode & S_IXOTH) ? 'x' : '-';
-                    perms[10] = '\0';
-                    
-                    char time_str[20];
-                    strftime(time_str, sizeof(time_str), "%b %d %H:%M", localtime(&st.st_mtime));
-                    
-                    snprintf(line, sizeof(line), "%s %3d %-8d %-8d %8lld %s %s\r\n",
-                            perms, (int)st.st_nlink, (int)st.st_uid, (int)st.st_gid,
-                            (long long)st.st_size, time_str, entry->d_name);
-                } else {
-                    // Just filename for NLST
-                    snprintf(line, sizeof(line), "%s\r\n", entry->d_name);
-                }
-                
-                if (send(data_conn, line, strlen(line), 0) < 0) {
-                    log_message(FTPLOG_ERROR, "Failed to send directory entry: %s", strerror(errno));
-                    break;
-                }
-                
-                // Update activity timestamp during transfer to prevent timeout
-                client_update_activity(client);
-            }
-        }
-        
-        closedir(dir);
-        close(data_conn);
-        
-        if (client->transfer_mode == TRANSFER_MODE_PASV) {
-            close(client->data_socket);
-            client->data_socket = -1;
-        }
-        
-        send_response(client->control_socket, 226, "Directory send OK");
+        send_listing(client, command, arg);
     }
     else if (strcmp(command, "RETR") == 0) {
         int data_conn = -1;
@@ -343,74 +877,140 @@ void process_command(client_t *client, const char *command, const char *arg) {
         if (arg[0] == '/') {
             snprintf(file_path, sizeof(file_path), "%s%s", root_directory, arg);
         } else {
-            snprintf(file_path, sizeof(file_path), "%s/%s", client->current_dir, arg);
+            int n = snprintf(file_path, sizeof(file_path), "%s/%s", client->current_dir, arg);
+            if (n < 0 || (size_t)n >= sizeof(file_path)) {
+                send_response(client->control_socket, 550, "File name too long");
+                return;
+            }
         }
         
-        // Open file
-        int file_fd = open(file_path, O_RDONLY);
-        if (file_fd < 0) {
-            log_message(FTPLOG_ERROR, "Failed to open file: %s - %s", file_path, strerror(errno));
-            send_response(client->control_socket, 550, "Failed to open file");
+        // name.tar (or .tar.gz) of a directory downloads the whole tree
+        char tar_dir[PATH_MAX];
+        tar_format_t tar_format;
+        if (tar_virtual_path(file_path, tar_dir, sizeof(tar_dir), &tar_format)) {
+            send_tar(client, arg, tar_dir, tar_format);
             return;
         }
         
-        // Get file size
+        // Small popular files are served from the shared hot-file cache; ASCII
+        // transfers are translated on the way out and always read the file
+        int ascii = client->transfer_type == TRANSFER_TYPE_ASCII;
         struct stat st;
-        fstat(file_fd, &st);
+        storage_file_t file = {NULL, -1, NULL, 0};
+        int file_fd = -1;
+        filecache_entry_t *cached = NULL;
+        if (hot_cache_size > 0 && !ascii && storage_is_posix(file_path) && stat(file_path, &st) == 0) {
+            cached = filecache_lookup(&st);
+        }
         
-        // Set up data connection based on transfer mode
-        if (client->transfer_mode == TRANSFER_MODE_PORT) {
-            // Active mode - we connect to the client
-            data_conn = create_data_connection(client);
-            if (data_conn < 0) {
-                close(file_fd);
-                send_response(client->control_socket, 425, "Cannot open data connection");
+        if (cached == NULL) {
+            // Open file
+            if (!storage_open(file_path, O_RDONLY, 0, &file)) {
+                log_message(FTPLOG_ERROR, "Failed to open file: %s - %s", file_path, strerror(errno));
+                send_response(client->control_socket, 550, "Failed to open file");
                 return;
             }
+            file_fd = file.fd;
             
-            // Send 150 response after connection is established
-            send_response(client->control_socket, 150, "Opening BINARY mode data connection for file transfer");
-        } else {
-            // Passive mode - accept connection from client
-            if (client->data_socket < 0) {
-                close(file_fd);
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                return;
+            // Get file size
+            if (!storage_fstat(&file, &st)) {
+                st.st_size = 0;
             }
             
-            // Tell client we're ready to send file
-            send_response(client->control_socket, 150, "Opening BINARY mode data connection for file transfer");
-            
-            // Accept the connection from client
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            data_conn = accept(client->data_socket, (struct sockaddr*)&client_addr, &client_len);
-            
-            if (data_conn < 0) {
-                log_message(FTPLOG_ERROR, "Failed to accept data connection: %s", strerror(errno));
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                close(file_fd);
-                close(client->data_socket);
-                client->data_socket = -1;
-                return;
+            // Keep small files in memory for the next request
+            if (file_fd >= 0 && !ascii) {
+                cached = filecache_insert(file_fd, &st);
+            }
+            if (cached != NULL) {
+                release_retr_source(&file, NULL);
+                file_fd = -1;
             }
         }
         
-        // Transfer file
+        // Set up data connection based on transfer mode
+        data_conn = open_data_channel(client, ascii ? "Opening ASCII mode data connection for file transfer" :
+                                                      "Opening BINARY mode data connection for file transfer");
+        if (data_conn < 0) {
+            release_retr_source(&file, cached);
+            return;
+        }
+        
+        // Transfer file, taking turns with other sessions when the link is shared
         char buffer[8192];
+        char encoded[2 * sizeof(buffer)];
+        ascii_state_t ascii_state;
+        ascii_begin(&ascii_state);
         ssize_t bytes;
         size_t total_bytes = 0;
+        sched_begin(&client->sched);
         time_t start_time = time(NULL);
         time_t last_log = start_time;
         
-        while ((bytes = read(file_fd, buffer, sizeof(buffer))) > 0) {
-            ssize_t sent = send(data_conn, buffer, bytes, 0);
+        // Cache hit: the whole file goes out from memory
+        while (cached != NULL && total_bytes < (size_t)cached->size) {
+            size_t chunk = sched_chunk(ratelimit_chunk(RATE_DOWN, cached->size - total_bytes));
+            sched_wait(&client->sched, chunk);
+            ssize_t sent = tls_send(data_conn, cached->data + total_bytes, chunk, 0);
+            if (sent <= 0) {
+                log_message(FTPLOG_ERROR, "Failed to send file data: %s", strerror(errno));
+                break;
+            }
+            total_bytes += sent;
+            PROBE3(transfer__chunk, client, sent, total_bytes);
+            ratelimit_consume(&client->rate, RATE_DOWN, (size_t)sent);
+        }
+        
+        // Sequential access hints and page cache policy for this file
+        read_hint_t hint;
+        if (file_fd >= 0) {
+            read_hint_begin(&hint, file_fd, file_path, st.st_size);
+        }
+        
+        // Plain and kernel TLS connections take the file straight from the page cache;
+        // userspace TLS and other backends go through a buffer
+        int use_sendfile = file_fd >= 0 && !ascii && tls_can_sendfile(data_conn);
+        off_t offset = 0;
+        
+        while (file.storage != NULL) {
+            ssize_t sent;
+            if (use_sendfile) {
+                if (offset >= st.st_size) {
+                    break;
+                }
+                size_t chunk = sched_chunk(ratelimit_chunk(RATE_DOWN, (size_t)(st.st_size - offset) > RETR_SENDFILE_CHUNK ?
+                                                                       RETR_SENDFILE_CHUNK : (size_t)(st.st_size - offset)));
+                sched_wait(&client->sched, chunk);
+                sent = tls_sendfile(data_conn, file_fd, &offset, chunk);
+                if (sent < 0 && (errno == EINTR || errno == EAGAIN)) {
+                    continue;
+                }
+                if (sent == 0) {
+                    break;  // The file shrank
+                }
+            } else {
+                bytes = storage_read(&file, buffer, ratelimit_chunk(RATE_DOWN, sizeof(buffer)));
+                if (bytes <= 0) {
+                    break;
+                }
+                offset += bytes;
+                const char *data = buffer;
+                size_t len = (size_t)bytes;
+                if (ascii) {
+                    len = ascii_encode(&ascii_state, buffer, len, encoded);
+                    data = encoded;
+                }
+                sched_wait(&client->sched, len);
+                sent = tls_send(data_conn, data, len, 0);
+            }
             if (sent <= 0) {
                 log_message(FTPLOG_ERROR, "Failed to send file data: %s", strerror(errno));
                 break;
             }
             
             total_bytes += sent;
+            PROBE3(transfer__chunk, client, sent, total_bytes);
+            ratelimit_consume(&client->rate, RATE_DOWN, (size_t)sent);
+            read_hint_advance(&hint, offset);
             time_t current_time = time(NULL);
             
             // Update activity timestamp during transfer to prevent timeout
@@ -430,13 +1030,12 @@ void process_command(client_t *client, const char *command, const char *arg) {
             }
         }
         
-        close(file_fd);
-        close(data_conn);
-        
-        if (client->transfer_mode == TRANSFER_MODE_PASV) {
-            close(client->data_socket);
-            client->data_socket = -1;
+        if (file_fd >= 0) {
+            read_hint_end(&hint);
         }
+        sched_end(&client->sched);
+        release_retr_source(&file, cached);
+        close_data_channel(client, data_conn);
         
         time_t end_time = time(NULL);
         double elapsed = difftime(end_time, start_time);
@@ -446,6 +1045,8 @@ void process_command(client_t *client, const char *command, const char *arg) {
         
         log_message(FTPLOG_TRANSFER, "Completed transfer of %s: %zu bytes in %.1f seconds, %s", 
                     arg, total_bytes, elapsed, rate_str);
+        client->transfer_bytes = (off_t)total_bytes;
+        PROBE4(transfer__done, client, command, total_bytes, 1);
         
         send_response(client->control_socket, 226, "Transfer complete");
     }
@@ -466,7 +1067,19 @@ void process_command(client_t *client, const char *command, const char *arg) {
             snprintf(file_path, sizeof(file_path), "%s%s", root_directory, arg);
         } else {
             // Relative path
-            snprintf(file_path, sizeof(file_path), "%s/%s", client->current_dir, arg);
+            int n = snprintf(file_path, sizeof(file_path), "%s/%s", client->current_dir, arg);
+            if (n < 0 || (size_t)n >= sizeof(file_path)) {
+                send_response(client->control_socket, 553, "File name too long");
+                return;
+            }
+        }
+        
+        // name.tar onto an existing directory unpacks the archive into it
+        char tar_dir[PATH_MAX];
+        if (tar_extract_target(file_path, tar_dir, sizeof(tar_dir))) {
+            client->alloc_size = 0;
+            receive_tar(client, arg, tar_dir);
+            return;
         }
         
         // Get the directory part of the path
@@ -479,82 +1092,102 @@ void process_command(client_t *client, const char *command, const char *arg) {
         
         // Check if the directory exists and is writable
         struct stat st;
-        if (stat(dir_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        int found = storage_stat(dir_path, &st);
+        if (!found || !S_ISDIR(st.st_mode)) {
+            int denied = !found && errno == EACCES;
             log_message(FTPLOG_ERROR, "STOR: Directory does not exist: %s", dir_path);
-            send_response(client->control_socket, 550, "Directory does not exist");
+            send_response(client->control_socket, 550, denied ? "Access denied" : "Directory does not exist");
             return;
         }
         
         // Check if the directory is writable
-        if (access(dir_path, W_OK) != 0) {
+        if (storage_is_posix(dir_path) && access(dir_path, W_OK) != 0) {
             log_message(FTPLOG_ERROR, "STOR: Directory not writable: %s", dir_path);
             send_response(client->control_socket, 550, "Permission denied");
             return;
         }
         
-        // Open the file for writing
-        int file_fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (file_fd < 0) {
+        // The size announced with ALLO must fit the quotas before anything is opened
+        quota_reservation_t quota;
+        off_t size_hint = client->alloc_size;
+        client->alloc_size = 0;
+        if (!quota_begin(&quota, client->username, file_path, size_hint)) {
+            send_response(client->control_socket, 552, "Requested file action aborted: exceeded storage allocation");
+            return;
+        }
+        
+        // Open the file for writing, preallocating any size announced with ALLO
+        file_writer_t writer;
+        if (!file_writer_open(&writer, file_path, size_hint)) {
             log_message(FTPLOG_ERROR, "STOR: Failed to create file: %s - %s", file_path, strerror(errno));
+            quota_cancel(&quota);
             send_response(client->control_socket, 550, "Failed to create file");
             return;
         }
         
+        // Checksum the upload as it streams through, if configured
+        int dedup_on = dedup_enabled() && storage_is_posix(file_path);
+        if (stor_checksum_algo >= 0) {
+            file_writer_enable_hash(&writer, (hash_algo_t)stor_checksum_algo);
+        } else if (dedup_on) {
+            file_writer_enable_hash(&writer, DEDUP_ALGO);
+        }
+        
         log_message(FTPLOG_DEBUG, "STOR: Creating file: %s", file_path);
         
         // Set up data connection based on transfer mode
-        if (client->transfer_mode == TRANSFER_MODE_PORT) {
-            // Active mode - we connect to the client
-            data_conn = create_data_connection(client);
-            if (data_conn < 0) {
-                close(file_fd);
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                return;
-            }
-            
-            // Send 150 response after connection is established
-            send_response(client->control_socket, 150, "Opening BINARY mode data connection for file transfer");
-        } else {
-            // Passive mode - accept connection from client
-            if (client->data_socket < 0) {
-                close(file_fd);
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                return;
-            }
-            
-            // Tell client we're ready to receive file
-            send_response(client->control_socket, 150, "Opening BINARY mode data connection for file transfer");
-            
-            // Accept the connection from client
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            data_conn = accept(client->data_socket, (struct sockaddr*)&client_addr, &client_len);
-            
-            if (data_conn < 0) {
-                log_message(FTPLOG_ERROR, "STOR: Failed to accept data connection: %s", strerror(errno));
-                send_response(client->control_socket, 425, "Cannot open data connection");
-                close(file_fd);
-                close(client->data_socket);
-                client->data_socket = -1;
-                return;
-            }
+        int ascii = client->transfer_type == TRANSFER_TYPE_ASCII;
+        data_conn = open_data_channel(client, ascii ? "Opening ASCII mode data connection for file transfer" :
+                                                      "Opening BINARY mode data connection for file transfer");
+        if (data_conn < 0) {
+            file_writer_close(&writer);
+            quota_end(&quota);
+            return;
         }
         
-        // Receive file data and write to disk
-        char buffer[8192];
-        ssize_t bytes;
+        // Receive file data straight into the writer's buffer; ASCII goes
+        // through a bounce buffer, since CRLF is collapsed on the way in
+        char received[8192];
+        char decoded[sizeof(received) + 1];
+        ascii_state_t ascii_state;
+        ascii_begin(&ascii_state);
+        ssize_t bytes = 0;
         size_t total_bytes = 0;
+        int write_failed = 0;
+        int over_quota = 0;
         time_t start_time = time(NULL);
         time_t last_log = start_time;
         
-        while ((bytes = recv(data_conn, buffer, sizeof(buffer), 0)) > 0) {
-            ssize_t written = write(file_fd, buffer, bytes);
-            if (written < 0) {
-                log_message(FTPLOG_ERROR, "STOR: Failed to write to file: %s", strerror(errno));
+        for (;;) {
+            size_t available = sizeof(received);
+            char *space = ascii ? received : file_writer_reserve(&writer, &available);
+            if (space == NULL) {
+                write_failed = 1;
+                break;
+            }
+            
+            bytes = tls_recv(data_conn, space, ratelimit_chunk(RATE_UP, available), 0);
+            if (bytes <= 0) {
                 break;
             }
             
-            total_bytes += written;
+            // Without a size hint, space is reserved as the data arrives
+            if (!quota_extend(&quota, (off_t)(total_bytes + bytes))) {
+                over_quota = 1;
+                break;
+            }
+            
+            int written = ascii ? file_writer_write(&writer, decoded,
+                                                    ascii_decode(&ascii_state, received, (size_t)bytes, decoded))
+                                : file_writer_commit(&writer, (size_t)bytes);
+            if (!written) {
+                write_failed = 1;
+                break;
+            }
+            
+            total_bytes += bytes;
+            PROBE3(transfer__chunk, client, bytes, total_bytes);
+            ratelimit_consume(&client->rate, RATE_UP, (size_t)bytes);
             time_t current_time = time(NULL);
             
             // Update activity timestamp during transfer to prevent timeout
@@ -579,14 +1212,22 @@ void process_command(client_t *client, const char *command, const char *arg) {
             log_message(FTPLOG_ERROR, "STOR: Error receiving data: %s", strerror(errno));
         }
         
-        // Close file and data connection
-        close(file_fd);
-        close(data_conn);
+        // A CR that ended the upload was not part of a CRLF
+        if (ascii_state.cr_held && !write_failed && !over_quota && !file_writer_write(&writer, "\r", 1)) {
+            write_failed = 1;
+        }
         
-        if (client->transfer_mode == TRANSFER_MODE_PASV) {
-            close(client->data_socket);
-            client->data_socket = -1;
+        if (write_failed) {
+            log_message(FTPLOG_ERROR, "STOR: Failed to write to file: %s", strerror(errno));
+        }
+        
+        // Close file and data connection
+        if (!file_writer_close(&writer) && !write_failed) {
+            log_message(FTPLOG_ERROR, "STOR: Failed to write to file: %s", strerror(errno));
+            write_failed = 1;
         }
+        quota_end(&quota);
+        close_data_channel(client, data_conn);
         
         time_t end_time = time(NULL);
         double elapsed = difftime(end_time, start_time);
@@ -596,9 +1237,216 @@ void process_command(client_t *client, const char *command, const char *arg) {
         
         log_message(FTPLOG_TRANSFER, "Completed receiving %s: %zu bytes in %.1f seconds, %s", 
                     arg, total_bytes, elapsed, rate_str);
+        client->transfer_bytes = (off_t)total_bytes;
+        PROBE4(transfer__done, client, command, total_bytes, !write_failed && !over_quota);
+        
+        if (over_quota) {
+            send_response(client->control_socket, 552, "Requested file action aborted: exceeded storage allocation");
+            return;
+        }
+        if (write_failed) {
+            send_response(client->control_socket, 451, "Requested action aborted: local error in processing");
+            return;
+        }
+        
+        // Content already in the store is kept once
+        dedup_result_t dedup = DEDUP_NONE;
+        if (dedup_on && writer.digest[0] != '\0') {
+            dedup = dedup_commit(file_path, writer.digest);
+            log_message(FTPLOG_DEBUG, "STOR: %s %s", file_path, dedup_result_name(dedup));
+        }
+        
+        // Hand the inline checksum back so the client can verify without a second pass
+        if (writer.digest[0] != '\0') {
+            char message[MAX_BUFFER];
+            snprintf(message, sizeof(message), "Transfer complete, %s %s%s%s",
+                     hash_name((hash_algo_t)writer.hash_algo), writer.digest,
+                     dedup_on ? ", " : "", dedup_on ? dedup_result_name(dedup) : "");
+            send_response(client->control_socket, 226, message);
+            return;
+        }
         
         send_response(client->control_socket, 226, "Transfer complete");
     }
+    else if (strcmp(command, "HASH") == 0) {
+        // draft-bryan-ftp-hash: 213 <algo> <start>-<end> <hash> <path>
+        char hex[HASH_MAX_HEX];
+        off_t size;
+        hash_algo_t algo = (hash_algo_t)client->hash_algo;
+        if (!checksum_command(client, arg, algo, hex, &size)) {
+            return;
+        }
+        
+        char response[MAX_BUFFER];
+        snprintf(response, sizeof(response), "213 %s 0-%lld %s %s\r\n",
+                 hash_name(algo), (long long)size, hex, arg);
+        tls_send(client->control_socket, response, strlen(response), 0);
+        log_message(FTPLOG_DEBUG, "Sent: 213 %s 0-%lld %s %s", hash_name(algo), (long long)size, hex, arg);
+    }
+    else if (strcmp(command, "SIZE") == 0 || strcmp(command, "MDTM") == 0) {
+        // RFC 3659: 213 <bytes> or 213 YYYYMMDDHHMMSS (UTC), from the stat cache
+        if (strlen(arg) == 0) {
+            send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+            return;
+        }
+        char file_path[PATH_MAX];
+        struct stat st;
+        build_file_path(client, arg, file_path, sizeof(file_path));
+        if (!statcache_stat(file_path, &st)) {
+            send_response(client->control_socket, 550, "File not found");
+            return;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            send_response(client->control_socket, 550, "Not a regular file");
+            return;
+        }
+
+        char reply[32];
+        if (command[0] == 'S') {
+            snprintf(reply, sizeof(reply), "%lld", (long long)st.st_size);
+        } else {
+            struct tm tm_info;
+            strftime(reply, sizeof(reply), "%Y%m%d%H%M%S", gmtime_r(&st.st_mtime, &tm_info));
+        }
+        send_response(client->control_socket, 213, reply);
+    }
+    else if (strcmp(command, "MLST") == 0) {
+        // Facts for one path (the current directory by default) over the control connection
+        char file_path[PATH_MAX];
+        struct stat st;
+        const char *name = strlen(arg) > 0 ? arg : ".";
+        build_file_path(client, name, file_path, sizeof(file_path));
+        if (!statcache_stat(file_path, &st)) {
+            send_response(client->control_socket, 550, "File not found");
+            return;
+        }
+
+        char response[MAX_BUFFER];
+        int len = snprintf(response, sizeof(response), "250-Listing %s\r\n ", name);
+        len += format_mlst_line(response + len, sizeof(response) - len, name, &st);
+        snprintf(response + len, sizeof(response) - len, "250 End\r\n");
+        tls_send(client->control_socket, response, strlen(response), 0);
+        log_message(FTPLOG_DEBUG, "Sent: 250 MLST %s", name);
+    }
+    else if (strcmp(command, "XCRC") == 0 || strcmp(command, "XMD5") == 0 ||
+             strcmp(command, "XSHA256") == 0) {
+        // Legacy single-algorithm checksum commands
+        hash_algo_t algo = HASH_CRC32;
+        if (strcmp(command, "XMD5") == 0) {
+            algo = HASH_MD5;
+        } else if (strcmp(command, "XSHA256") == 0) {
+            algo = HASH_SHA256;
+        }
+        
+        // The file name may be quoted and followed by a byte range, which is ignored
+        char name[MAX_BUFFER];
+        if (arg[0] == '"') {
+            const char *end = strchr(arg + 1, '"');
+            size_t len = end ? (size_t)(end - arg - 1) : strlen(arg + 1);
+            snprintf(name, sizeof(name), "%.*s", (int)len, arg + 1);
+        } else {
+            snprintf(name, sizeof(name), "%s", arg);
+        }
+        
+        char hex[HASH_MAX_HEX];
+        off_t size;
+        if (checksum_command(client, name, algo, hex, &size)) {
+            send_response(client->control_socket, 250, hex);
+        }
+    }
+    else if (strcmp(command, "ALLO") == 0) {
+        // ALLO <size> [R <record size>]; the size is used to preallocate the next STOR
+        off_t size;
+        char size_str[32] = {0};
+        sscanf(arg, "%31s", size_str);
+        if (!parse_size(size_str, &size)) {
+            send_response(client->control_socket, 501, "Invalid ALLO size");
+            return;
+        }
+        client->alloc_size = size;
+        send_response(client->control_socket, 200, "ALLO command successful");
+    }
+    else if (strcmp(command, "RNFR") == 0) {
+        remember_source(client, PENDING_RENAME, arg);
+    }
+    else if (strcmp(command, "RNTO") == 0) {
+        if (pending != PENDING_RENAME) {
+            send_response(client->control_socket, 503, "Bad sequence of commands, use RNFR first");
+            return;
+        }
+        if (strlen(arg) == 0) {
+            send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+            return;
+        }
+        
+        char target[PATH_MAX];
+        quota_file_t source, replaced;
+        build_file_path(client, arg, target, sizeof(target));
+        quota_stat(client->pending_path, &source);
+        quota_stat(target, &replaced);
+        if (!storage_rename(client->pending_path, target)) {
+            log_message(FTPLOG_ERROR, "RNTO: Failed to rename %s to %s - %s",
+                        client->pending_path, target, strerror(errno));
+            send_response(client->control_socket, 550, errno == EACCES ? "Access denied" : "Rename failed");
+            return;
+        }
+        quota_renamed(client->pending_path, target, &source, &replaced);
+        log_message(FTPLOG_INFO, "Renamed %s to %s", client->pending_path, target);
+        send_response(client->control_socket, 250, "Rename successful");
+    }
+    else if (strcmp(command, "DELE") == 0 || strcmp(command, "RMD") == 0) {
+        if (strlen(arg) == 0) {
+            send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+            return;
+        }
+        
+        // DELE removes files and RMD empty directories
+        char path[PATH_MAX];
+        struct stat st;
+        int want_dir = strcmp(command, "RMD") == 0;
+        build_file_path(client, arg, path, sizeof(path));
+        if (!storage_stat(path, &st)) {
+            send_response(client->control_socket, 550, "File not found");
+            return;
+        }
+        if (S_ISDIR(st.st_mode) != want_dir) {
+            send_response(client->control_socket, 550, want_dir ? "Not a directory" : "Is a directory");
+            return;
+        }
+        quota_file_t removed;
+        quota_stat(path, &removed);
+        if (!storage_remove(path)) {
+            log_message(FTPLOG_ERROR, "%s: Failed to remove %s - %s", command, path, strerror(errno));
+            send_response(client->control_socket, 550, errno == ENOTEMPTY ? "Directory not empty" :
+                          errno == EACCES ? "Access denied" : "Remove failed");
+            return;
+        }
+        quota_removed(path, &removed);
+        log_message(FTPLOG_INFO, "Removed %s", path);
+        send_response(client->control_socket, 250, want_dir ? "Directory removed" : "File removed");
+    }
+    else if (strcmp(command, "MKD") == 0) {
+        if (strlen(arg) == 0) {
+            send_response(client->control_socket, 501, "Syntax error in parameters or arguments");
+            return;
+        }
+        
+        char path[PATH_MAX];
+        build_file_path(client, arg, path, sizeof(path));
+        if (!storage_mkdir(path, 0755)) {
+            log_message(FTPLOG_ERROR, "MKD: Failed to create %s - %s", path, strerror(errno));
+            send_response(client->control_socket, 550, errno == EEXIST ? "Directory already exists" :
+                          errno == EACCES ? "Access denied" : "Create directory failed");
+            return;
+        }
+        
+        char response[MAX_BUFFER];
+        snprintf(response, sizeof(response), "\"%s\" directory created", arg);
+        send_response(client->control_socket, 257, response);
+    }
+    else if (strcmp(command, "SITE") == 0) {
+        site_command(client, arg, pending);
+    }
     else if (strcmp(command, "QUIT") == 0) {
         send_response(client->control_socket, 221, "Goodbye");
     }
@@ -607,3 +1455,9 @@ void process_command(client_t *client, const char *command, const char *arg) {
         send_response(client->control_socket, 502, "Command not implemented");
     }
 }
+
+void process_command(client_t *client, const char *command, const char *arg) {
+    PROBE3(command__start, client, command, arg);
+    dispatch_command(client, command, arg);
+    PROBE2(command__done, client, command);
+}
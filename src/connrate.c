@@ -0,0 +1,249 @@
+// src/connrate.c
+#include "connrate.h"
+#include "commands.h"
+#include "logging.h"
+#include <stdint.h>
+
+#define CONNRATE_SHARDS 64             // Power of two; each has its own lock
+#define CONNRATE_BUCKETS 256           // Hash chains per shard, power of two
+#define CONNRATE_SHARD_MAX 4096        // Addresses tracked per shard; beyond this, fail open
+#define CONNRATE_AGE_PER_TICK 4        // Shards swept for stale addresses each tick
+#define TARPIT_MAX 256                 // Sockets held at once; more are closed outright
+#define TARPIT_SECONDS 10
+
+int conn_rate_limit = 0;
+int conn_rate_window = 1;
+connrate_action_t conn_rate_action = CONNRATE_REJECT;
+
+// Two fixed windows give an O(1) sliding-window estimate:
+// count = previous * (share of the previous window still in range) + current
+typedef struct rate_entry {
+    uint32_t addr;
+    uint32_t previous;
+    uint32_t current;
+    long long window;                  // Index of the current window
+    struct rate_entry *next;
+} rate_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int count;
+    rate_entry_t *buckets[CONNRATE_BUCKETS];
+} rate_shard_t;
+
+typedef struct {
+    int fd;
+    time_t release_at;
+} tarpit_t;
+
+static rate_shard_t shards[CONNRATE_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+static int age_cursor = 0;
+
+static pthread_mutex_t tarpit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static tarpit_t tarpit[TARPIT_MAX];
+static int tarpit_count = 0;
+
+static void init_shards(void) {
+    for (int i = 0; i < CONNRATE_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+}
+
+int connrate_parse(const char *spec) {
+    char *end;
+    long limit = strtol(spec, &end, 10);
+    long window = 1;
+
+    if (end == spec || limit < 0 || limit > INT_MAX) {
+        return 0;
+    }
+    if (*end == '/') {
+        const char *p = end + 1;
+        window = strtol(p, &end, 10);
+        if (end == p || window < 1 || window > 3600) {
+            return 0;
+        }
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+
+    conn_rate_limit = (int)limit;
+    conn_rate_window = (int)window;
+    return 1;
+}
+
+int connrate_parse_action(const char *name) {
+    if (strcmp(name, "reject") == 0) {
+        conn_rate_action = CONNRATE_REJECT;
+    } else if (strcmp(name, "tarpit") == 0) {
+        conn_rate_action = CONNRATE_TARPIT;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static unsigned int hash_addr(uint32_t addr) {
+    return (addr * 0x9E3779B1u) >> 8;
+}
+
+// Count one connection; returns the sliding-window estimate including it
+static double count_connection(uint32_t addr, long long now) {
+    long long window_ms = (long long)conn_rate_window * 1000;
+    long long index = now / window_ms;
+    unsigned int h = hash_addr(addr);
+    rate_shard_t *shard = &shards[h & (CONNRATE_SHARDS - 1)];
+    rate_entry_t **chain = &shard->buckets[(h / CONNRATE_SHARDS) & (CONNRATE_BUCKETS - 1)];
+    double estimate = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    rate_entry_t *entry = *chain;
+    while (entry != NULL && entry->addr != addr) {
+        entry = entry->next;
+    }
+
+    if (entry == NULL) {
+        if (shard->count < CONNRATE_SHARD_MAX && (entry = calloc(1, sizeof(rate_entry_t))) != NULL) {
+            entry->addr = addr;
+            entry->window = index;
+            entry->next = *chain;
+            *chain = entry;
+            shard->count++;
+        }
+    } else if (entry->window != index) {
+        entry->previous = entry->window == index - 1 ? entry->current : 0;
+        entry->current = 0;
+        entry->window = index;
+    }
+
+    if (entry != NULL) {
+        double elapsed = (double)(now % window_ms) / window_ms;
+        if (entry->current < UINT32_MAX) {
+            entry->current++;
+        }
+        estimate = entry->previous * (1 - elapsed) + entry->current;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return estimate;
+}
+
+static void tarpit_hold(int fd) {
+    pthread_mutex_lock(&tarpit_mutex);
+    if (tarpit_count < TARPIT_MAX) {
+        tarpit[tarpit_count].fd = fd;
+        tarpit[tarpit_count].release_at = time(NULL) + TARPIT_SECONDS;
+        tarpit_count++;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&tarpit_mutex);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int connrate_admit(int fd, const struct in_addr *addr) {
+    if (conn_rate_limit <= 0) {
+        return 1;
+    }
+
+    pthread_once(&shards_once, init_shards);
+    double estimate = count_connection(addr->s_addr, now_ms());
+    if (estimate <= conn_rate_limit) {
+        return 1;
+    }
+
+    // Log once as an address crosses the limit, not for every connection of a flood
+    if (estimate <= conn_rate_limit + 1) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, addr, ip, sizeof(ip));
+        log_message(FTPLOG_ERROR, "Connection rate from %s over %d per %d s, %s",
+                    ip, conn_rate_limit, conn_rate_window,
+                    conn_rate_action == CONNRATE_TARPIT ? "tarpitting" : "rejecting");
+    }
+
+    if (conn_rate_action == CONNRATE_TARPIT) {
+        tarpit_hold(fd);
+    } else {
+        send_response(fd, 421, "Too many connections, slow down");
+        close(fd);
+    }
+    return 0;
+}
+
+void connrate_tick(void) {
+    if (conn_rate_limit <= 0) {
+        return;
+    }
+    pthread_once(&shards_once, init_shards);
+
+    // Release tarpitted sockets whose time is up
+    time_t now = time(NULL);
+    pthread_mutex_lock(&tarpit_mutex);
+    for (int i = 0; i < tarpit_count; ) {
+        if (tarpit[i].release_at <= now) {
+            close(tarpit[i].fd);
+            tarpit[i] = tarpit[--tarpit_count];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&tarpit_mutex);
+
+    // Forget addresses with nothing in either window, a few shards at a time
+    long long index = now_ms() / ((long long)conn_rate_window * 1000);
+    for (int n = 0; n < CONNRATE_AGE_PER_TICK; n++) {
+        rate_shard_t *shard = &shards[age_cursor];
+        age_cursor = (age_cursor + 1) % CONNRATE_SHARDS;
+
+        pthread_mutex_lock(&shard->lock);
+        for (int b = 0; b < CONNRATE_BUCKETS; b++) {
+            rate_entry_t **link = &shard->buckets[b];
+            while (*link != NULL) {
+                rate_entry_t *entry = *link;
+                if (entry->window < index - 1) {
+                    *link = entry->next;
+                    shard->count--;
+                    free(entry);
+                } else {
+                    link = &entry->next;
+                }
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void connrate_cleanup(void) {
+    pthread_mutex_lock(&tarpit_mutex);
+    while (tarpit_count > 0) {
+        close(tarpit[--tarpit_count].fd);
+    }
+    pthread_mutex_unlock(&tarpit_mutex);
+
+    if (conn_rate_limit <= 0) {
+        return;
+    }
+    pthread_once(&shards_once, init_shards);
+    for (int i = 0; i < CONNRATE_SHARDS; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        for (int b = 0; b < CONNRATE_BUCKETS; b++) {
+            while (shards[i].buckets[b] != NULL) {
+                rate_entry_t *entry = shards[i].buckets[b];
+                shards[i].buckets[b] = entry->next;
+                free(entry);
+            }
+        }
+        shards[i].count = 0;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
@@ -0,0 +1,376 @@
+// src/dedup.c
+#include "dedup.h"
+#include "fileops.h"
+#include "filehash.h"
+#include "logging.h"
+#include "storage.h"
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+char dedup_store[PATH_MAX] = "";
+
+// A stored object, found by inode so that every link to it is recognised
+typedef struct dedup_entry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int verified;              // Contents checked against hex (not just named after it)
+    char hex[HASH_MAX_HEX];
+    struct dedup_entry *next;
+} dedup_entry_t;
+
+static pthread_rwlock_t index_lock = PTHREAD_RWLOCK_INITIALIZER;
+static dedup_entry_t *buckets[DEDUP_INDEX_BUCKETS];
+static char store_path[PATH_MAX];
+
+// Longest path below the store: "/objects/ab/" and a digest
+#define OBJECT_SUFFIX_MAX (sizeof("/" DEDUP_OBJECTS "/ab/") + 64)
+static int index_fd = -1;
+static long objects = 0;
+static unsigned int temp_counter = 0;
+
+int dedup_enabled(void) {
+    return index_fd >= 0;
+}
+
+static unsigned int index_bucket(dev_t dev, ino_t ino) {
+    unsigned long long h = (unsigned long long)ino * 0x9E3779B97F4A7C15ULL ^ (unsigned long long)dev;
+    return (unsigned int)(h >> 32) & (DEDUP_INDEX_BUCKETS - 1);
+}
+
+static void object_path(const char *hex, char *path, size_t size) {
+    snprintf(path, size, "%s/" DEDUP_OBJECTS "/%.2s/%s", store_path, hex, hex);
+}
+
+// Only lowercase hex of the right length names an object
+static int valid_digest(const char *hex) {
+    size_t len = strspn(hex, "0123456789abcdef");
+    return len == 64 && hex[len] == '\0';
+}
+
+// Remember the inode of an object; replaces an older entry for the same inode
+static void index_add(const struct stat *st, const char *hex, int verified) {
+    dedup_entry_t *entry = malloc(sizeof(dedup_entry_t));
+    if (entry == NULL) {
+        return;
+    }
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->verified = verified;
+    snprintf(entry->hex, sizeof(entry->hex), "%s", hex);
+
+    unsigned int b = index_bucket(st->st_dev, st->st_ino);
+    pthread_rwlock_wrlock(&index_lock);
+    dedup_entry_t **link = &buckets[b];
+    while (*link != NULL && ((*link)->dev != st->st_dev || (*link)->ino != st->st_ino)) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        dedup_entry_t *old = *link;
+        entry->next = old->next;
+        free(old);
+    } else {
+        entry->next = NULL;
+        objects++;
+    }
+    *link = entry;
+    pthread_rwlock_unlock(&index_lock);
+}
+
+// Digest of an indexed inode unchanged since; only verified entries count
+// unless any is set. Returns 1 if found.
+static int index_find(const struct stat *st, int any, char hex[HASH_MAX_HEX]) {
+    int found = 0;
+
+    if (index_fd < 0) {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&index_lock);
+    for (dedup_entry_t *entry = buckets[index_bucket(st->st_dev, st->st_ino)]; entry != NULL; entry = entry->next) {
+        if (entry->dev == st->st_dev && entry->ino == st->st_ino) {
+            // A changed size or mtime means the inode no longer holds what was indexed
+            if ((entry->verified || any) && entry->size == st->st_size &&
+                entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec) {
+                snprintf(hex, HASH_MAX_HEX, "%s", entry->hex);
+                found = 1;
+            }
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&index_lock);
+
+    return found;
+}
+
+int dedup_lookup(const struct stat *st, char hex[HASH_MAX_HEX]) {
+    return index_find(st, 0, hex);
+}
+
+// Read the index, keeping digests whose object still exists. Objects are
+// only named after their digest until dedup_commit() checks them. Stale
+// lines are dropped by rewriting the file. Returns 1 on success.
+static int load_index(const char *index) {
+    char object[PATH_MAX];
+    char line[128];
+    long stale = 0;
+    struct stat st;
+
+    FILE *fp = fopen(index, "r");
+    if (fp == NULL) {
+        return errno == ENOENT;
+    }
+
+    char temp[PATH_MAX];
+    snprintf(temp, sizeof(temp), "%s.tmp", index);
+    FILE *out = NULL;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        object_path(line, object, sizeof(object));
+        if (valid_digest(line) && lstat(object, &st) == 0 && S_ISREG(st.st_mode)) {
+            index_add(&st, line, 0);
+        } else {
+            stale++;
+        }
+    }
+    fclose(fp);
+
+    if (stale == 0) {
+        return 1;
+    }
+
+    // Compact: write out the live digests and swap the file in
+    out = fopen(temp, "w");
+    if (out == NULL) {
+        return 1;
+    }
+    for (int b = 0; b < DEDUP_INDEX_BUCKETS; b++) {
+        for (dedup_entry_t *entry = buckets[b]; entry != NULL; entry = entry->next) {
+            fprintf(out, "%s\n", entry->hex);
+        }
+    }
+    if (fclose(out) == 0 && rename(temp, index) == 0) {
+        log_message(FTPLOG_INFO, "Dedup: Dropped %ld stale index entries", stale);
+    } else {
+        unlink(temp);
+    }
+    return 1;
+}
+
+int dedup_init(void) {
+    char objects_dir[PATH_MAX + sizeof("/" DEDUP_OBJECTS)];
+    char index[PATH_MAX + sizeof("/" DEDUP_INDEX)];
+    int len;
+
+    if (dedup_store[0] == '\0') {
+        return 1;
+    }
+
+    if (dedup_store[0] == '/') {
+        len = snprintf(store_path, sizeof(store_path), "%s", dedup_store);
+    } else {
+        len = snprintf(store_path, sizeof(store_path), "%s/%s", root_directory, dedup_store);
+    }
+    // Every object path must fit in PATH_MAX
+    if (len < 0 || (size_t)len + OBJECT_SUFFIX_MAX > sizeof(store_path)) {
+        log_message(FTPLOG_ERROR, "Dedup: Store path too long: %s", dedup_store);
+        return 0;
+    }
+    snprintf(objects_dir, sizeof(objects_dir), "%s/" DEDUP_OBJECTS, store_path);
+    if ((mkdir(store_path, 0755) != 0 && errno != EEXIST) ||
+        (mkdir(objects_dir, 0755) != 0 && errno != EEXIST)) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot create store %s: %s", store_path, strerror(errno));
+        return 0;
+    }
+
+    snprintf(index, sizeof(index), "%s/" DEDUP_INDEX, store_path);
+    if (!load_index(index)) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot read index %s: %s", index, strerror(errno));
+        return 0;
+    }
+    index_fd = open(index, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (index_fd < 0) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot open index %s: %s", index, strerror(errno));
+        return 0;
+    }
+
+    // Clients must not write objects of their own into a store inside the root
+    char resolved[PATH_MAX];
+    if (realpath(store_path, resolved) == NULL) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot resolve store %s: %s", store_path, strerror(errno));
+        return 0;
+    }
+    if (fileops_inside_root(resolved) && !storage_add_private(resolved)) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot hide store %s: %s", resolved, strerror(errno));
+        return 0;
+    }
+
+    log_message(FTPLOG_INFO, "Dedup: Store %s with %ld objects", store_path, objects);
+    return 1;
+}
+
+void dedup_cleanup(void) {
+    if (index_fd >= 0) {
+        close(index_fd);
+        index_fd = -1;
+    }
+
+    pthread_rwlock_wrlock(&index_lock);
+    for (int b = 0; b < DEDUP_INDEX_BUCKETS; b++) {
+        while (buckets[b] != NULL) {
+            dedup_entry_t *entry = buckets[b];
+            buckets[b] = entry->next;
+            free(entry);
+        }
+    }
+    objects = 0;
+    pthread_rwlock_unlock(&index_lock);
+}
+
+// Record a new object: in memory, and one appended line on disk
+static void index_record(const struct stat *st, const char *hex) {
+    char line[HASH_MAX_HEX + 1];
+    int len = snprintf(line, sizeof(line), "%s\n", hex);
+
+    index_add(st, hex, 1);
+    if (write(index_fd, line, (size_t)len) != len) {
+        log_message(FTPLOG_ERROR, "Dedup: Cannot append to index: %s", strerror(errno));
+    }
+}
+
+// Point path at the stored object by linking it in beside path and renaming over
+static int link_to_object(const char *object, const char *path) {
+    char temp[PATH_MAX];
+    unsigned int n = __atomic_fetch_add(&temp_counter, 1, __ATOMIC_RELAXED);
+    snprintf(temp, sizeof(temp), "%s.dedup-%d-%u", path, (int)getpid(), n);
+
+    if (link(object, temp) != 0) {
+        return 0;
+    }
+    if (rename(temp, path) != 0) {
+        int saved = errno;
+        unlink(temp);
+        errno = saved;
+        return 0;
+    }
+    return 1;
+}
+
+// Share the object's blocks with path where the filesystem supports reflinks
+static int clone_object(const char *object, const char *path) {
+    int src = open(object, O_RDONLY | O_CLOEXEC);
+    int dst = src >= 0 ? open(path, O_WRONLY | O_CLOEXEC) : -1;
+    int ok = dst >= 0 && ioctl(dst, FICLONE, src) == 0;
+
+    int saved = errno;
+    if (dst >= 0) close(dst);
+    if (src >= 0) close(src);
+    errno = saved;
+    return ok;
+}
+
+// Check that the object at path holds the content named by hex: from the
+// index or the xattr cache when they vouch for it, else by reading it.
+// Returns 1 if it does.
+static int object_matches(const char *path, const struct stat *st, const char *hex) {
+    char actual[HASH_MAX_HEX];
+    char buffer[65536];
+
+    if (index_find(st, 0, actual)) {
+        return strcmp(actual, hex) == 0;
+    }
+
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = hash_cache_load(fd, st, DEDUP_ALGO, actual);
+    if (!ok) {
+        hash_ctx_t ctx;
+        ssize_t n;
+        hash_init(&ctx, DEDUP_ALGO);
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) {
+                hash_update(&ctx, buffer, (size_t)n);
+            }
+        }
+        hash_final(&ctx, actual);
+        ok = n == 0;
+        if (ok) {
+            hash_cache_store(fd, st, DEDUP_ALGO, actual);
+        }
+    }
+    close(fd);
+
+    if (!ok || strcmp(actual, hex) != 0) {
+        return 0;
+    }
+    index_add(st, hex, 1);
+    return 1;
+}
+
+dedup_result_t dedup_commit(const char *path, const char *hex) {
+    char object[PATH_MAX];
+    char fanout[PATH_MAX + sizeof("/" DEDUP_OBJECTS "/ab")];
+    struct stat upload, stored;
+
+    if (index_fd < 0 || !valid_digest(hex) || lstat(path, &upload) != 0 || !S_ISREG(upload.st_mode)) {
+        return DEDUP_NONE;
+    }
+    object_path(hex, object, sizeof(object));
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (lstat(object, &stored) == 0) {
+            if (stored.st_dev == upload.st_dev && stored.st_ino == upload.st_ino) {
+                return DEDUP_LINKED;
+            }
+            if (!S_ISREG(stored.st_mode) || stored.st_size != upload.st_size ||
+                !object_matches(object, &stored, hex)) {
+                log_message(FTPLOG_ERROR, "Dedup: Object %s does not match %s, left alone", object, path);
+                return DEDUP_NONE;
+            }
+
+            // The upload's own blocks are freed once the link replaces it
+            if (link_to_object(object, path)) {
+                return DEDUP_LINKED;
+            }
+
+            // Too many links, or the store is on another filesystem
+            if ((errno == EMLINK || errno == EXDEV) && clone_object(object, path)) {
+                return DEDUP_CLONED;
+            }
+            log_message(FTPLOG_DEBUG, "Dedup: Cannot share %s with %s: %s", path, object, strerror(errno));
+            return DEDUP_NONE;
+        }
+
+        // First copy of this content: the upload becomes the stored object
+        snprintf(fanout, sizeof(fanout), "%s/" DEDUP_OBJECTS "/%.2s", store_path, hex);
+        if (mkdir(fanout, 0755) != 0 && errno != EEXIST) {
+            log_message(FTPLOG_ERROR, "Dedup: Cannot create %s: %s", fanout, strerror(errno));
+            return DEDUP_NONE;
+        }
+        if (link(path, object) == 0) {
+            index_record(&upload, hex);
+            return DEDUP_NEW;
+        }
+        if (errno != EEXIST) {
+            log_message(FTPLOG_ERROR, "Dedup: Cannot store %s: %s", path, strerror(errno));
+            return DEDUP_NONE;
+        }
+        // Another session stored the same content first; link to its copy
+    }
+    return DEDUP_NONE;
+}
+
+const char *dedup_result_name(dedup_result_t result) {
+    switch (result) {
+        case DEDUP_NEW: return "stored";
+        case DEDUP_LINKED: return "deduplicated";
+        case DEDUP_CLONED: return "deduplicated (reflink)";
+        default: return "not deduplicated";
+    }
+}
@@ -0,0 +1,229 @@
+// src/durability.c
+#include "durability.h"
+#include "logging.h"
+
+#define GROUP_COMMIT_MAX_BATCH 256   // Flush early once this many files are waiting
+#define GROUP_COMMIT_MAX_DEVICES 16  // Distinct filesystems synced per batch
+
+durability_mode_t durability_mode = DURABILITY_NONE;
+int group_commit_ms = DEFAULT_GROUP_COMMIT_MS;
+
+// A session waiting for its file to be flushed
+typedef struct sync_request {
+    int fd;
+    dev_t dev;
+    int done;
+    int result;                 // 0 or errno
+    struct sync_request *next;
+} sync_request_t;
+
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sync_pending_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sync_done_cond = PTHREAD_COND_INITIALIZER;
+static sync_request_t *pending = NULL;
+static int pending_count = 0;
+static int sync_thread_running = 0;
+static pthread_t sync_thread;
+
+int durability_parse(const char *name) {
+    if (strcmp(name, "none") == 0) {
+        durability_mode = DURABILITY_NONE;
+    } else if (strcmp(name, "fdatasync") == 0) {
+        durability_mode = DURABILITY_FDATASYNC;
+    } else if (strcmp(name, "group") == 0) {
+        durability_mode = DURABILITY_GROUP;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Flush one batch: a single syncfs() per filesystem covers every file in it
+static void flush_batch(sync_request_t *batch) {
+    dev_t devices[GROUP_COMMIT_MAX_DEVICES];
+    int results[GROUP_COMMIT_MAX_DEVICES];
+    int device_count = 0;
+    int files = 0;
+
+    for (sync_request_t *req = batch; req != NULL; req = req->next) {
+        int i;
+        for (i = 0; i < device_count; i++) {
+            if (devices[i] == req->dev) break;
+        }
+
+        if (i < device_count) {
+            req->result = results[i];
+        } else {
+            req->result = (syncfs(req->fd) == 0) ? 0 : errno;
+            if (device_count < GROUP_COMMIT_MAX_DEVICES) {
+                devices[device_count] = req->dev;
+                results[device_count] = req->result;
+                device_count++;
+            }
+        }
+        files++;
+    }
+
+    log_message(FTPLOG_DEBUG, "Group commit: %d files on %d filesystems", files, device_count);
+}
+
+static void *group_commit_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&sync_mutex);
+    while (sync_thread_running || pending != NULL) {
+        if (pending == NULL) {
+            pthread_cond_wait(&sync_pending_cond, &sync_mutex);
+            continue;
+        }
+
+        // Give other sessions a short window to join this batch
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)group_commit_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (sync_thread_running && pending_count < GROUP_COMMIT_MAX_BATCH) {
+            if (pthread_cond_timedwait(&sync_pending_cond, &sync_mutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+
+        sync_request_t *batch = pending;
+        pending = NULL;
+        pending_count = 0;
+        pthread_mutex_unlock(&sync_mutex);
+
+        flush_batch(batch);
+
+        pthread_mutex_lock(&sync_mutex);
+        for (sync_request_t *req = batch; req != NULL; req = req->next) {
+            req->done = 1;
+        }
+        pthread_cond_broadcast(&sync_done_cond);
+    }
+    pthread_mutex_unlock(&sync_mutex);
+
+    return NULL;
+}
+
+int durability_init(void) {
+    if (durability_mode != DURABILITY_GROUP) {
+        return 1;
+    }
+
+    sync_thread_running = 1;
+    if (pthread_create(&sync_thread, NULL, group_commit_thread, NULL) != 0) {
+        log_message(FTPLOG_ERROR, "Failed to start group commit thread: %s", strerror(errno));
+        sync_thread_running = 0;
+        return 0;
+    }
+
+    log_message(FTPLOG_INFO, "Upload durability: group commit every %d ms", group_commit_ms);
+    return 1;
+}
+
+void durability_cleanup(void) {
+    pthread_mutex_lock(&sync_mutex);
+    if (!sync_thread_running) {
+        pthread_mutex_unlock(&sync_mutex);
+        return;
+    }
+    sync_thread_running = 0;
+    pthread_cond_signal(&sync_pending_cond);
+    pthread_mutex_unlock(&sync_mutex);
+
+    pthread_join(sync_thread, NULL);
+}
+
+// Sync the directory at path (or the one holding it)
+static int sync_directory(const char *path, int parent) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    if (parent) {
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL) {
+            strcpy(dir, ".");
+        } else if (slash == dir) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    int ok = parent ? fsync(fd) == 0 : syncfs(fd) == 0;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ok;
+}
+
+// Whether files are being committed by the group commit thread's syncfs()
+static int group_commit_active(void) {
+    pthread_mutex_lock(&sync_mutex);
+    int running = sync_thread_running;
+    pthread_mutex_unlock(&sync_mutex);
+    return durability_mode == DURABILITY_GROUP && running;
+}
+
+int durability_commit_name(const char *path) {
+    if (durability_mode == DURABILITY_NONE || group_commit_active()) {
+        return 1;
+    }
+    return sync_directory(path, 1);
+}
+
+int durability_commit_tree(const char *dir) {
+    if (durability_mode == DURABILITY_NONE || group_commit_active()) {
+        return 1;
+    }
+    return sync_directory(dir, 0);
+}
+
+int durability_commit(int fd) {
+    if (durability_mode == DURABILITY_NONE) {
+        return 1;
+    }
+    if (durability_mode == DURABILITY_FDATASYNC) {
+        return fdatasync(fd) == 0;
+    }
+
+    // Start writeback now so the batched flush has less left to do
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return 0;
+    }
+
+    sync_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.fd = fd;
+    req.dev = st.st_dev;
+
+    pthread_mutex_lock(&sync_mutex);
+    if (!sync_thread_running) {
+        pthread_mutex_unlock(&sync_mutex);
+        return fdatasync(fd) == 0;
+    }
+
+    req.next = pending;
+    pending = &req;
+    pending_count++;
+    pthread_cond_signal(&sync_pending_cond);
+
+    while (!req.done) {
+        pthread_cond_wait(&sync_done_cond, &sync_mutex);
+    }
+    pthread_mutex_unlock(&sync_mutex);
+
+    if (req.result != 0) {
+        errno = req.result;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,224 @@
+// src/filecache.c
+#include "filecache.h"
+#include "logging.h"
+
+#define FILECACHE_BUCKETS 1024
+
+off_t hot_cache_size = DEFAULT_HOT_CACHE_SIZE;
+off_t hot_cache_max_file = DEFAULT_HOT_CACHE_MAX_FILE;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static filecache_entry_t *buckets[FILECACHE_BUCKETS];
+
+// Clock ring of cached entries for eviction
+static filecache_entry_t **ring = NULL;
+static int ring_count = 0;
+static int ring_capacity = 0;
+static int ring_hand = 0;
+
+static off_t cached_bytes = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+static unsigned int hash_key(dev_t dev, ino_t ino) {
+    unsigned long long h = (unsigned long long)ino * 0x9E3779B97F4A7C15ULL ^ (unsigned long long)dev;
+    return (unsigned int)(h >> 32) % FILECACHE_BUCKETS;
+}
+
+static int same_key(const filecache_entry_t *entry, const struct stat *st) {
+    return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+           entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void free_entry(filecache_entry_t *entry) {
+    free(entry->data);
+    free(entry);
+}
+
+// Unlink an entry from the hash table and ring; caller holds cache_mutex
+static void remove_entry(int ring_index) {
+    filecache_entry_t *entry = ring[ring_index];
+    filecache_entry_t **link = &buckets[hash_key(entry->dev, entry->ino)];
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+
+    ring[ring_index] = ring[--ring_count];
+    if (ring_hand >= ring_count) {
+        ring_hand = 0;
+    }
+
+    cached_bytes -= entry->size;
+    entry->in_table = 0;
+    if (--entry->refcount == 0) {
+        free_entry(entry);
+    }
+}
+
+// Evict with the clock algorithm until size more bytes fit; caller holds cache_mutex
+static int make_room(off_t size) {
+    int budget = ring_count * 2;
+
+    while (cached_bytes + size > hot_cache_size && ring_count > 0 && budget-- > 0) {
+        filecache_entry_t *entry = ring[ring_hand];
+        if (entry->referenced) {
+            entry->referenced = 0;
+            ring_hand = (ring_hand + 1) % ring_count;
+        } else {
+            // In-flight transfers keep their reference, so the data outlives eviction
+            remove_entry(ring_hand);
+        }
+    }
+
+    return cached_bytes + size <= hot_cache_size;
+}
+
+int filecache_init(void) {
+    memset(buckets, 0, sizeof(buckets));
+    return 1;
+}
+
+void filecache_cleanup(void) {
+    pthread_mutex_lock(&cache_mutex);
+    while (ring_count > 0) {
+        remove_entry(ring_count - 1);
+    }
+    free(ring);
+    ring = NULL;
+    ring_capacity = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int filecache_eligible(off_t size) {
+    return hot_cache_size > 0 && size <= hot_cache_max_file && size <= hot_cache_size;
+}
+
+filecache_entry_t *filecache_lookup(const struct stat *st) {
+    if (!filecache_eligible(st->st_size) || !S_ISREG(st->st_mode)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    filecache_entry_t *entry = buckets[hash_key(st->st_dev, st->st_ino)];
+    while (entry != NULL && !same_key(entry, st)) {
+        entry = entry->next;
+    }
+
+    if (entry != NULL) {
+        entry->refcount++;
+        entry->referenced = 1;
+        cache_hits++;
+    } else {
+        cache_misses++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    return entry;
+}
+
+filecache_entry_t *filecache_insert(int fd, const struct stat *st) {
+    if (!filecache_eligible(st->st_size) || !S_ISREG(st->st_mode)) {
+        return NULL;
+    }
+
+    filecache_entry_t *entry = (filecache_entry_t *)calloc(1, sizeof(filecache_entry_t));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->data = (char *)malloc(st->st_size > 0 ? (size_t)st->st_size : 1);
+    if (entry->data == NULL) {
+        free(entry);
+        return NULL;
+    }
+
+    // Read the whole file outside the lock
+    off_t offset = 0;
+    while (offset < st->st_size) {
+        ssize_t n = pread(fd, entry->data + offset, (size_t)(st->st_size - offset), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            free_entry(entry);
+            return NULL;
+        }
+        offset += n;
+    }
+
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim;
+    entry->size = st->st_size;
+    entry->refcount = 2;  // Table and caller
+    entry->referenced = 1;
+
+    pthread_mutex_lock(&cache_mutex);
+
+    // Another session may have inserted the same file meanwhile
+    unsigned int bucket = hash_key(st->st_dev, st->st_ino);
+    filecache_entry_t *existing = buckets[bucket];
+    while (existing != NULL && !same_key(existing, st)) {
+        existing = existing->next;
+    }
+    if (existing != NULL) {
+        existing->refcount++;
+        pthread_mutex_unlock(&cache_mutex);
+        free_entry(entry);
+        return existing;
+    }
+
+    if (ring_count == ring_capacity) {
+        int capacity = ring_capacity ? ring_capacity * 2 : 64;
+        filecache_entry_t **grown = (filecache_entry_t **)realloc(ring, capacity * sizeof(*ring));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&cache_mutex);
+            entry->refcount = 1;
+            return entry;  // Serve from memory, just don't cache it
+        }
+        ring = grown;
+        ring_capacity = capacity;
+    }
+
+    if (!make_room(entry->size)) {
+        pthread_mutex_unlock(&cache_mutex);
+        entry->refcount = 1;
+        return entry;
+    }
+
+    entry->in_table = 1;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+    ring[ring_count++] = entry;
+    cached_bytes += entry->size;
+
+    pthread_mutex_unlock(&cache_mutex);
+    return entry;
+}
+
+void filecache_release(filecache_entry_t *entry) {
+    if (entry == NULL) return;
+
+    pthread_mutex_lock(&cache_mutex);
+    int last = (--entry->refcount == 0);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (last) {
+        free_entry(entry);
+    }
+}
+
+void filecache_log_stats(void) {
+    if (hot_cache_size <= 0) return;
+
+    pthread_mutex_lock(&cache_mutex);
+    unsigned long hits = cache_hits;
+    unsigned long lookups = cache_hits + cache_misses;
+    int files = ring_count;
+    off_t bytes = cached_bytes;
+    pthread_mutex_unlock(&cache_mutex);
+
+    log_message(FTPLOG_INFO, "Hot file cache: %d files, %lld KB, hit ratio %.1f%% (%lu/%lu)",
+                files, (long long)(bytes / 1024),
+                lookups ? 100.0 * hits / lookups : 0.0, hits, lookups);
+}
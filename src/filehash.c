@@ -0,0 +1,335 @@
+// src/filehash.c
+#include "filehash.h"
+#include "bufpool.h"
+#include "dedup.h"
+#include "logging.h"
+#include "pagecache.h"
+#include "storage.h"
+#include <sys/xattr.h>
+
+int stor_checksum_algo = -1;
+int checksum_store = CHECKSUM_STORE_XATTR;
+
+// One chunk of a parallel CRC
+typedef struct {
+    int fd;
+    hash_algo_t algo;
+    off_t start;
+    off_t end;
+    uint32_t crc;
+    int error;       // 0 or errno
+} hash_chunk_t;
+
+static void xattr_name(hash_algo_t algo, char *name, size_t len) {
+    snprintf(name, len, "%s%s", HASH_XATTR_PREFIX, hash_key(algo));
+}
+
+int hash_cache_load(int fd, const struct stat *st, hash_algo_t algo, char hex[HASH_MAX_HEX]) {
+    char name[64];
+    char value[128];
+    xattr_name(algo, name, sizeof(name));
+
+    ssize_t len = fgetxattr(fd, name, value, sizeof(value) - 1);
+    if (len <= 0) {
+        return 0;
+    }
+    value[len] = '\0';
+
+    // Format: <mtime sec>.<mtime nsec>:<size>:<hex digest>
+    long long sec, size;
+    long nsec;
+    char digest[HASH_MAX_HEX];
+    if (sscanf(value, "%lld.%ld:%lld:%64s", &sec, &nsec, &size, digest) != 4) {
+        return 0;
+    }
+    if (sec != (long long)st->st_mtim.tv_sec || nsec != st->st_mtim.tv_nsec || size != (long long)st->st_size) {
+        return 0;
+    }
+
+    snprintf(hex, HASH_MAX_HEX, "%s", digest);
+    return 1;
+}
+
+int hash_cache_store(int fd, const struct stat *st, hash_algo_t algo, const char *hex) {
+    char name[64];
+    char value[128];
+    xattr_name(algo, name, sizeof(name));
+    snprintf(value, sizeof(value), "%lld.%09ld:%lld:%s", (long long)st->st_mtim.tv_sec,
+             st->st_mtim.tv_nsec, (long long)st->st_size, hex);
+
+    if (fsetxattr(fd, name, value, strlen(value), 0) != 0) {
+        log_message(FTPLOG_DEBUG, "Cannot cache %s digest in xattr: %s", hash_name(algo), strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+static void *crc_chunk_thread(void *arg) {
+    hash_chunk_t *chunk = (hash_chunk_t *)arg;
+    char *buffer = (char *)bufpool_get();
+    if (buffer == NULL) {
+        chunk->error = ENOMEM;
+        return NULL;
+    }
+
+    hash_ctx_t ctx;
+    hash_init(&ctx, chunk->algo);
+    off_t offset = chunk->start;
+    while (offset < chunk->end) {
+        size_t want = BUFPOOL_BUFFER_SIZE;
+        if ((off_t)want > chunk->end - offset) {
+            want = (size_t)(chunk->end - offset);
+        }
+        ssize_t n = pread(chunk->fd, buffer, want, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            chunk->error = n < 0 ? errno : EIO;
+            break;
+        }
+        hash_update(&ctx, buffer, (size_t)n);
+        offset += n;
+    }
+    chunk->crc = ctx.u.crc;
+
+    bufpool_put(buffer);
+    return NULL;
+}
+
+// CRCs can be combined, so large files are split across threads
+static int hash_parallel(int fd, hash_algo_t algo, off_t size, int threads, char hex[HASH_MAX_HEX]) {
+    hash_chunk_t chunks[PARALLEL_HASH_MAX_THREADS];
+    pthread_t tids[PARALLEL_HASH_MAX_THREADS];
+    off_t chunk_size = (size / threads + BUFPOOL_BUFFER_SIZE - 1) / BUFPOOL_BUFFER_SIZE * BUFPOOL_BUFFER_SIZE;
+    int started = 0;
+
+    for (int i = 0; i < threads; i++) {
+        chunks[i].fd = fd;
+        chunks[i].algo = algo;
+        chunks[i].start = i * chunk_size < size ? i * chunk_size : size;
+        chunks[i].end = (i + 1) * chunk_size < size ? (i + 1) * chunk_size : size;
+        chunks[i].crc = 0;
+        chunks[i].error = 0;
+    }
+
+    // The calling thread takes the first chunk itself
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, crc_chunk_thread, &chunks[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+    crc_chunk_thread(&chunks[0]);
+    for (int i = started + 1; i < threads; i++) {
+        crc_chunk_thread(&chunks[i]);
+    }
+    for (int i = 1; i <= started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    uint32_t crc = chunks[0].crc;
+    for (int i = 0; i < threads; i++) {
+        if (chunks[i].error != 0) {
+            errno = chunks[i].error;
+            return 0;
+        }
+        if (i > 0) {
+            crc = crc_combine(algo, crc, chunks[i].crc, (uint64_t)(chunks[i].end - chunks[i].start));
+        }
+    }
+
+    snprintf(hex, HASH_MAX_HEX, "%08x", crc);
+    return 1;
+}
+
+static int hash_sequential(int fd, const char *path, hash_algo_t algo, off_t size, char hex[HASH_MAX_HEX]) {
+    char *buffer = (char *)bufpool_get();
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    // Same readahead and cache policy as a RETR of the file
+    read_hint_t hint;
+    read_hint_begin(&hint, fd, path, size);
+
+    hash_ctx_t ctx;
+    hash_init(&ctx, algo);
+    off_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, BUFPOOL_BUFFER_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            read_hint_end(&hint);
+            bufpool_put(buffer);
+            errno = err;
+            return 0;
+        }
+        hash_update(&ctx, buffer, (size_t)n);
+        total += n;
+        read_hint_advance(&hint, total);
+    }
+
+    read_hint_end(&hint);
+    bufpool_put(buffer);
+    hash_final(&ctx, hex);
+    return 1;
+}
+
+// Files in other storage backends have no xattr cache; just read them through
+static int hash_storage(const char *path, hash_algo_t algo, char hex[HASH_MAX_HEX], off_t *size) {
+    storage_file_t file;
+    struct stat st;
+    int ok = 1;
+
+    if (!storage_open(path, O_RDONLY, 0, &file)) {
+        return 0;
+    }
+    if (!storage_fstat(&file, &st) || !S_ISREG(st.st_mode)) {
+        storage_close(&file);
+        errno = EISDIR;
+        return 0;
+    }
+    *size = st.st_size;
+
+    char *buffer = (char *)bufpool_get();
+    if (buffer == NULL) {
+        storage_close(&file);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    hash_ctx_t ctx;
+    hash_init(&ctx, algo);
+    ssize_t n;
+    while ((n = storage_read(&file, buffer, BUFPOOL_BUFFER_SIZE)) != 0) {
+        if (n < 0) {
+            ok = 0;
+            break;
+        }
+        hash_update(&ctx, buffer, (size_t)n);
+    }
+
+    int err = errno;
+    bufpool_put(buffer);
+    storage_close(&file);
+    if (!ok) {
+        errno = err;
+        return 0;
+    }
+    hash_final(&ctx, hex);
+    return 1;
+}
+
+int hash_file(const char *path, hash_algo_t algo, char hex[HASH_MAX_HEX], off_t *size) {
+    if (!storage_is_posix(path)) {
+        return hash_storage(path, algo, hex, size);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        return 0;
+    }
+    *size = st.st_size;
+
+    if (hash_cache_load(fd, &st, algo, hex)) {
+        log_message(FTPLOG_DEBUG, "HASH: %s %s served from xattr cache", hash_name(algo), path);
+        close(fd);
+        return 1;
+    }
+    if (algo == DEDUP_ALGO && dedup_lookup(&st, hex)) {
+        log_message(FTPLOG_DEBUG, "HASH: %s %s served from dedup index", hash_name(algo), path);
+        close(fd);
+        return 1;
+    }
+
+    int threads = 1;
+    if ((algo == HASH_CRC32 || algo == HASH_CRC32C) && st.st_size >= PARALLEL_HASH_MIN) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > PARALLEL_HASH_MAX_THREADS ? PARALLEL_HASH_MAX_THREADS : (cpus > 0 ? (int)cpus : 1);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int ok = threads > 1 ? hash_parallel(fd, algo, st.st_size, threads, hex)
+                         : hash_sequential(fd, path, algo, st.st_size, hex);
+    if (!ok) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    log_message(FTPLOG_DEBUG, "HASH: %s %s (%lld bytes, %s, %d threads) in %.3f seconds",
+                hash_name(algo), path, (long long)st.st_size, hash_implementation(algo), threads, elapsed);
+
+    // Only cache if the file did not change while it was being read
+    struct stat after;
+    if (fstat(fd, &after) == 0 && after.st_size == st.st_size &&
+        after.st_mtim.tv_sec == st.st_mtim.tv_sec && after.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+        hash_cache_store(fd, &st, algo, hex);
+    }
+
+    close(fd);
+    return 1;
+}
+
+int checksum_store_parse(const char *name) {
+    if (strcmp(name, "xattr") == 0) {
+        checksum_store = CHECKSUM_STORE_XATTR;
+    } else if (strcmp(name, "sidecar") == 0) {
+        checksum_store = CHECKSUM_STORE_SIDECAR;
+    } else if (strcmp(name, "both") == 0) {
+        checksum_store = CHECKSUM_STORE_XATTR | CHECKSUM_STORE_SIDECAR;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+int hash_store_digest(int fd, const char *path, hash_algo_t algo, const char *hex) {
+    int ok = 1;
+
+    if (checksum_store & CHECKSUM_STORE_XATTR) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !hash_cache_store(fd, &st, algo, hex)) {
+            ok = 0;
+        }
+    }
+
+    if (checksum_store & CHECKSUM_STORE_SIDECAR) {
+        char sidecar[PATH_MAX];
+        snprintf(sidecar, sizeof(sidecar), "%s.%s", path, hash_key(algo));
+
+        const char *name = strrchr(path, '/');
+        name = name ? name + 1 : path;
+
+        FILE *fp = fopen(sidecar, "w");
+        if (fp == NULL) {
+            log_message(FTPLOG_ERROR, "Failed to write checksum file %s: %s", sidecar, strerror(errno));
+            return 0;
+        }
+        fprintf(fp, "%s  %s\n", hex, name);
+        if (fclose(fp) != 0) {
+            ok = 0;
+        }
+    }
+
+    return ok;
+}
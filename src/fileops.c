@@ -0,0 +1,232 @@
+// src/fileops.c
+#include "fileops.h"
+#include "bufpool.h"
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#define COPY_CHUNK (64LL * 1024 * 1024)  // Bytes per copy_file_range() call between progress reports
+
+int fileops_inside_root(const char *resolved) {
+    size_t root_len = strlen(root_directory);
+    return strncmp(resolved, root_directory, root_len) == 0 &&
+           (resolved[root_len] == '\0' || resolved[root_len] == '/' || root_len == 1);
+}
+
+int fileops_open_parent(const char *path, char *name, size_t name_size) {
+    char dir[PATH_MAX];
+    char resolved[PATH_MAX];
+
+    // Split off the last component, ignoring trailing slashes
+    snprintf(dir, sizeof(dir), "%s", path);
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') {
+        dir[--len] = '\0';
+    }
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *base = slash + 1;
+    if (*base == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0 ||
+        strlen(base) >= name_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(name, name_size, "%s", base);
+    if (slash == dir) {
+        slash[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+
+    // The directory is checked once; the name is then resolved relative to its fd
+    if (realpath(dir, resolved) == NULL) {
+        return -1;
+    }
+    if (!fileops_inside_root(resolved)) {
+        errno = EACCES;
+        return -1;
+    }
+
+    return open(resolved, O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+int fileops_exists(const char *path) {
+    char name[NAME_MAX + 1];
+    int dir = fileops_open_parent(path, name, sizeof(name));
+    if (dir < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    int found = fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    int saved = errno;
+    close(dir);
+    errno = saved;
+    return found;
+}
+
+int fileops_rename(const char *from, const char *to) {
+    char from_name[NAME_MAX + 1], to_name[NAME_MAX + 1];
+    int from_dir = -1, to_dir = -1, ok = 0;
+
+    if ((from_dir = fileops_open_parent(from, from_name, sizeof(from_name))) >= 0 &&
+        (to_dir = fileops_open_parent(to, to_name, sizeof(to_name))) >= 0) {
+        ok = renameat2(from_dir, from_name, to_dir, to_name, 0) == 0;
+    }
+
+    int saved = errno;
+    if (from_dir >= 0) close(from_dir);
+    if (to_dir >= 0) close(to_dir);
+    errno = saved;
+    return ok;
+}
+
+// Copy with read/write when the kernel cannot do it for us
+static int copy_read_write(int src, int dst, off_t offset, off_t size,
+                           void (*progress)(void *arg), void *arg) {
+    char *buffer = bufpool_get();
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    int ok = 1;
+    while (offset < size) {
+        ssize_t n = pread(src, buffer, BUFPOOL_BUFFER_SIZE, offset);
+        if (n <= 0) {
+            ok = n == 0;  // File shrank under us; keep what we have
+            break;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = pwrite(dst, buffer + done, (size_t)(n - done), offset + done);
+            if (w < 0) {
+                ok = 0;
+                break;
+            }
+            done += w;
+        }
+        if (!ok) {
+            break;
+        }
+        offset += n;
+        if (progress && offset % COPY_CHUNK < n) {
+            progress(arg);
+        }
+    }
+
+    int saved = errno;
+    bufpool_put(buffer);
+    errno = saved;
+    return ok;
+}
+
+static int copy_data(int src, int dst, off_t size, copy_method_t *method,
+                     void (*progress)(void *arg), void *arg) {
+    // Reflink: the copy shares extents with the source until either is written
+    if (ioctl(dst, FICLONE, src) == 0) {
+        *method = COPY_REFLINK;
+        return 1;
+    }
+
+    *method = COPY_FILE_RANGE;
+    off_t offset = 0;
+    while (offset < size) {
+        size_t len = size - offset > COPY_CHUNK ? (size_t)COPY_CHUNK : (size_t)(size - offset);
+        loff_t in = offset, out = offset;
+        ssize_t n = copy_file_range(src, &in, dst, &out, len, 0);
+        if (n < 0) {
+            // Cross-filesystem on older kernels, or a filesystem without support
+            if (offset == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                *method = COPY_READ_WRITE;
+                return copy_read_write(src, dst, 0, size, progress, arg);
+            }
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        offset += n;
+        if (progress) {
+            progress(arg);
+        }
+    }
+    return 1;
+}
+
+int fileops_copy(const char *from, const char *to, copy_method_t *method,
+                 void (*progress)(void *arg), void *arg) {
+    char from_name[NAME_MAX + 1], to_name[NAME_MAX + 1];
+    int from_dir = -1, to_dir = -1, src = -1, dst = -1, ok = 0, created = 0;
+    struct stat st, dst_st;
+
+    if ((from_dir = fileops_open_parent(from, from_name, sizeof(from_name))) < 0 ||
+        (to_dir = fileops_open_parent(to, to_name, sizeof(to_name))) < 0) {
+        goto out;
+    }
+    // Neither end may be a symlink, which could point anywhere outside the root
+    if ((src = openat(from_dir, from_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) < 0 || fstat(src, &st) != 0) {
+        goto out;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        goto out;
+    }
+
+    // Truncate only after making sure the target is not the source itself
+    dst = openat(to_dir, to_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+    if (dst >= 0) {
+        created = 1;
+    } else if (errno == EEXIST) {
+        dst = openat(to_dir, to_name, O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (dst < 0 || fstat(dst, &dst_st) != 0) {
+        goto out;
+    }
+    if (dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino) {
+        errno = EINVAL;
+        goto out;
+    }
+    if (!created && dst_st.st_nlink > 1) {
+        // Shared with other names (deduplicated): replace it rather than truncate
+        close(dst);
+        dst = -1;
+        if (unlinkat(to_dir, to_name, 0) != 0 ||
+            (dst = openat(to_dir, to_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777)) < 0) {
+            goto out;
+        }
+        created = 1;
+    }
+    if (!created && ftruncate(dst, 0) != 0) {
+        goto out;
+    }
+
+    ok = copy_data(src, dst, st.st_size, method, progress, arg);
+    if (ok && close(dst) != 0) {
+        ok = 0;
+    }
+    dst = -1;
+    if (!ok) {
+        int saved = errno;
+        unlinkat(to_dir, to_name, 0);
+        errno = saved;
+    }
+
+out:;
+    int saved = errno;
+    if (dst >= 0) close(dst);
+    if (src >= 0) close(src);
+    if (from_dir >= 0) close(from_dir);
+    if (to_dir >= 0) close(to_dir);
+    errno = saved;
+    return ok;
+}
+
+const char *copy_method_name(copy_method_t method) {
+    switch (method) {
+        case COPY_REFLINK: return "reflink";
+        case COPY_FILE_RANGE: return "copy_file_range";
+        default: return "read/write";
+    }
+}
@@ -0,0 +1,249 @@
+// src/filewriter.c
+#include "filewriter.h"
+#include "bufpool.h"
+#include "durability.h"
+#include "filehash.h"
+#include "logging.h"
+
+off_t direct_io_size = 0;
+
+// Write a block, retrying on short writes
+static int write_all(file_writer_t *writer, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = writer->fd >= 0 ? write(writer->fd, data, len) : storage_write(&writer->file, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+        writer->written += n;
+    }
+    return 1;
+}
+
+// Write out staged data; with O_DIRECT only whole blocks are written until the final flush
+static int flush_buffer(file_writer_t *writer, int final) {
+    size_t len = writer->used;
+
+    if (!writer->direct) {
+        if (!write_all(writer, writer->buffer, len)) {
+            return 0;
+        }
+        writer->used = 0;
+        return 1;
+    }
+
+    size_t aligned = len & ~(size_t)(BUFPOOL_ALIGNMENT - 1);
+    if (aligned > 0 && !write_all(writer, writer->buffer, aligned)) {
+        return 0;
+    }
+
+    if (final && aligned != len) {
+        // Unaligned tail goes through the page cache
+        int flags = fcntl(writer->fd, F_GETFL);
+        if (flags < 0 || fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+            return 0;
+        }
+        writer->direct = 0;
+        if (!write_all(writer, writer->buffer + aligned, len - aligned)) {
+            return 0;
+        }
+        aligned = len;
+    }
+
+    // Keep the partial block at the front of the buffer
+    memmove(writer->buffer, writer->buffer + aligned, len - aligned);
+    writer->used = len - aligned;
+    return 1;
+}
+
+int file_writer_open(file_writer_t *writer, const char *path, off_t size_hint) {
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+
+    writer->buffer = (char *)bufpool_get();
+    if (writer->buffer == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    // Other backends take plain buffered writes
+    if (!storage_is_posix(path)) {
+        if (!storage_open(path, flags, 0644, &writer->file)) {
+            int err = errno;
+            bufpool_put(writer->buffer);
+            writer->buffer = NULL;
+            errno = err;
+            return 0;
+        }
+        log_message(FTPLOG_DEBUG, "STOR: Opened %s in %s storage", path, writer->file.storage->ops->name);
+        return 1;
+    }
+
+    // A file with other hard links (a deduplicated upload) is replaced,
+    // not truncated, so the other names keep their contents
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        writer->created = 1;
+    } else if (S_ISREG(st.st_mode) && st.st_nlink > 1 && unlink(path) == 0) {
+        writer->created = 1;
+    }
+
+    // Bulk uploads bypass the page cache when the client announced a large size
+    if (direct_io_size > 0 && size_hint >= direct_io_size) {
+        writer->fd = open(path, flags | O_DIRECT, 0644);
+        if (writer->fd >= 0) {
+            writer->direct = 1;
+        } else {
+            log_message(FTPLOG_DEBUG, "STOR: O_DIRECT not available for %s: %s", path, strerror(errno));
+        }
+    }
+
+    if (writer->fd < 0) {
+        writer->fd = open(path, flags, 0644);
+    }
+
+    if (writer->fd < 0) {
+        int err = errno;
+        bufpool_put(writer->buffer);
+        writer->buffer = NULL;
+        errno = err;
+        return 0;
+    }
+
+    // Reserve contiguous space up front to limit fragmentation
+    if (size_hint > 0) {
+        if (fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, 0, size_hint) == 0) {
+            writer->preallocated = size_hint;
+        } else {
+            log_message(FTPLOG_DEBUG, "STOR: Preallocation of %lld bytes failed for %s: %s",
+                        (long long)size_hint, path, strerror(errno));
+        }
+    }
+
+    log_message(FTPLOG_DEBUG, "STOR: Opened %s (size hint %lld, %s)", path,
+                (long long)size_hint, writer->direct ? "direct" : "buffered");
+    return 1;
+}
+
+void file_writer_enable_hash(file_writer_t *writer, hash_algo_t algo) {
+    hash_stream_init(&writer->hash, algo);
+    writer->hashing = 1;
+    writer->hash_algo = algo;
+}
+
+char *file_writer_reserve(file_writer_t *writer, size_t *available) {
+    if (writer->used == BUFPOOL_BUFFER_SIZE && !flush_buffer(writer, 0)) {
+        return NULL;
+    }
+    *available = BUFPOOL_BUFFER_SIZE - writer->used;
+    return writer->buffer + writer->used;
+}
+
+int file_writer_commit(file_writer_t *writer, size_t len) {
+    if (writer->hashing && !hash_stream_update(&writer->hash, writer->buffer + writer->used, len)) {
+        return 0;
+    }
+
+    writer->used += len;
+    if (writer->used == BUFPOOL_BUFFER_SIZE) {
+        return flush_buffer(writer, 0);
+    }
+    return 1;
+}
+
+int file_writer_write(file_writer_t *writer, const void *data, size_t len) {
+    const char *src = (const char *)data;
+
+    while (len > 0) {
+        size_t available;
+        char *space = file_writer_reserve(writer, &available);
+        if (space == NULL) {
+            return 0;
+        }
+        size_t chunk = len < available ? len : available;
+        memcpy(space, src, chunk);
+        if (!file_writer_commit(writer, chunk)) {
+            return 0;
+        }
+        src += chunk;
+        len -= chunk;
+    }
+    return 1;
+}
+
+int file_writer_close(file_writer_t *writer) {
+    int ok = 1;
+    int err = 0;
+
+    if (writer->fd >= 0) {
+        if (writer->used > 0 && !flush_buffer(writer, 1)) {
+            ok = 0;
+            err = errno;
+        }
+
+        // Give back preallocated blocks beyond what was actually received
+        if (writer->preallocated > writer->written) {
+            if (ftruncate(writer->fd, writer->written) != 0 && ok) {
+                ok = 0;
+                err = errno;
+            }
+        }
+
+        // Store the inline checksum alongside the file before it is made durable
+        if (writer->hashing) {
+            hash_stream_final(&writer->hash, writer->digest);
+            writer->hashing = 0;
+            if (ok) {
+                hash_store_digest(writer->fd, writer->path, (hash_algo_t)writer->hash_algo, writer->digest);
+            } else {
+                writer->digest[0] = '\0';
+            }
+        }
+
+        // Flush to stable storage before the 226 reply, per the durability mode
+        if (ok && !durability_commit(writer->fd)) {
+            ok = 0;
+            err = errno;
+        }
+
+        if (close(writer->fd) != 0 && ok) {
+            ok = 0;
+            err = errno;
+        }
+        writer->fd = -1;
+
+        // A new name is only kept once its directory is on disk as well
+        if (ok && writer->created && !durability_commit_name(writer->path)) {
+            ok = 0;
+            err = errno;
+        }
+    } else if (writer->file.storage != NULL) {
+        if (writer->used > 0 && !flush_buffer(writer, 1)) {
+            ok = 0;
+            err = errno;
+        }
+        if (!storage_close(&writer->file) && ok) {
+            ok = 0;
+            err = errno;
+        }
+        writer->file.storage = NULL;
+    }
+
+    if (writer->hashing) {
+        hash_stream_final(&writer->hash, writer->digest);
+        writer->hashing = 0;
+    }
+
+    bufpool_put(writer->buffer);
+    writer->buffer = NULL;
+
+    if (!ok) {
+        errno = err;
+    }
+    return ok;
+}
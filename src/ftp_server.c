@@ -6,12 +6,30 @@
 #include "utils.h"
 #include "commands.h"
 #include "daemon.h"
+#include "pagecache.h"
+#include "bufpool.h"
+#include "durability.h"
+#include "filecache.h"
+#include "filehash.h"
+#include "trace.h"
+#include "ratelimit.h"
+#include "scheduler.h"
+#include "admission.h"
+#include "connrate.h"
+#include "tarextract.h"
+#include "dedup.h"
+#include "storage.h"
+#include "quota.h"
+#include "statcache.h"
+#include "tls.h"
+#include "probes.h"
 
 // Global variables
 int server_running = 1;
 int server_socket = -1;
 char root_directory[PATH_MAX];
 char upload_directory[PATH_MAX]; // Custom upload directory
+int server_port = FTP_PORT;
 
 // Signal handler for graceful shutdown
 void signal_handler(int sig) {
@@ -24,6 +42,9 @@ void signal_handler(int sig) {
             close(server_socket);
             server_socket = -1;
         }
+    } else if (sig == SIGHUP) {
+        // Picked up by the main loop; transfers keep their buckets
+        ratelimit_reload_pending = 1;
     }
 }
 
@@ -33,7 +54,22 @@ void cleanup(void) {
         close(server_socket);
     }
     
+    admission_cleanup();
+    connrate_cleanup();
     client_cleanup();
+    tls_cleanup();
+    tar_extract_cleanup();
+    quota_cleanup();
+    dedup_cleanup();
+    storage_cleanup();
+    durability_cleanup();
+    statcache_cleanup();
+    filecache_cleanup();
+    pagecache_cleanup();
+    bufpool_cleanup();
+    trace_close();
+    ratelimit_cleanup();
+    sched_cleanup();
     
     // Destroy mutexes
     pthread_mutex_destroy(&clients_mutex);
@@ -45,16 +81,165 @@ void cleanup(void) {
     log_message(FTPLOG_INFO, "Server shutdown complete");
 }
 
+// Building with -DFTPSERVER_NO_MAIN leaves out the entry point so the server
+// objects can be linked into the microbenchmarks
+#ifndef FTPSERVER_NO_MAIN
+
 void print_usage(const char *program_name) {
-    fprintf(stderr, "Usage: %s [-d directory] [-u upload_dir] [-t timeout] [-c max_clients] [-D]\n", program_name);
+    fprintf(stderr, "Usage: %s [-d directory] [-u upload_dir] [-p port] [-t timeout] [-c max_clients] [-D]\n", program_name);
     fprintf(stderr, "  -d directory    Set the root directory for FTP access\n");
     fprintf(stderr, "  -u upload_dir   Set custom upload directory (default: same as root)\n");
+    fprintf(stderr, "  -p port         Listen on this port (default: %d)\n", FTP_PORT);
     fprintf(stderr, "  -t timeout      Set client inactivity timeout in seconds (default: %d)\n", DEFAULT_CLIENT_TIMEOUT);
     fprintf(stderr, "  -c max_clients  Set maximum number of concurrent clients (default: %d)\n", DEFAULT_MAX_CLIENTS);
     fprintf(stderr, "  -D              Run as daemon (detach from terminal and log to file)\n");
     fprintf(stderr, "  -h              Display this help message\n");
+    fprintf(stderr, "  --drop-cache-size SIZE\n");
+    fprintf(stderr, "                  Drop sent pages from the page cache for RETR of files this large\n");
+    fprintf(stderr, "                  (default: %lldM, 0 disables)\n", (long long)(DEFAULT_DROP_CACHE_SIZE >> 20));
+    fprintf(stderr, "  --cache-policy DIR=keep|drop|auto[:SIZE]\n");
+    fprintf(stderr, "                  Page cache policy for RETR below DIR (repeatable)\n");
+    fprintf(stderr, "  --direct-io-size SIZE\n");
+    fprintf(stderr, "                  Use O_DIRECT for STOR when ALLO announced at least SIZE bytes\n");
+    fprintf(stderr, "                  (default: 0, disabled)\n");
+    fprintf(stderr, "  --hot-cache-size SIZE\n");
+    fprintf(stderr, "                  Memory for caching small popular files (default: %lldM, 0 disables)\n",
+            (long long)(DEFAULT_HOT_CACHE_SIZE >> 20));
+    fprintf(stderr, "  --hot-cache-max-file SIZE\n");
+    fprintf(stderr, "                  Largest file kept in the hot-file cache (default: %dK)\n",
+            DEFAULT_HOT_CACHE_MAX_FILE >> 10);
+    fprintf(stderr, "  --stat-cache SIZE\n");
+    fprintf(stderr, "                  Memory for file metadata answering SIZE/MDTM/MLST (default: %lldM, 0 disables)\n",
+            (long long)(DEFAULT_STAT_CACHE_SIZE >> 20));
+    fprintf(stderr, "  --stor-checksum ALGO\n");
+    fprintf(stderr, "                  Checksum uploads while receiving them (crc32, crc32c, md5, sha256)\n");
+    fprintf(stderr, "  --checksum-store xattr|sidecar|both\n");
+    fprintf(stderr, "                  Where upload checksums are kept (default: xattr)\n");
+    fprintf(stderr, "  --dedup DIR\n");
+    fprintf(stderr, "                  Keep one copy of identical uploads in a content-addressed store\n");
+    fprintf(stderr, "                  at DIR (relative to the root unless absolute)\n");
+    fprintf(stderr, "  --quota user:NAME=BYTES[/FILES] | dir:PATH=BYTES[/FILES]\n");
+    fprintf(stderr, "                  Limit what a user owns or a directory holds (repeatable)\n");
+    fprintf(stderr, "  --quota-journal FILE\n");
+    fprintf(stderr, "                  Keep quota usage across restarts in FILE (relative to the root unless absolute)\n");
+    fprintf(stderr, "  --quota-reconcile SECS\n");
+    fprintf(stderr, "                  Recount quota usage in the background this often (default: %d, 0 never)\n",
+            DEFAULT_QUOTA_RECONCILE);
+    fprintf(stderr, "  --mem-mount PATH[:SIZE]\n");
+    fprintf(stderr, "                  Serve PATH (relative to the root) from memory, optionally limited\n");
+    fprintf(stderr, "                  to SIZE bytes; contents are lost on exit (repeatable)\n");
+    fprintf(stderr, "  --durability none|fdatasync|group\n");
+    fprintf(stderr, "                  Flush uploads to disk before replying 226 (default: none)\n");
+    fprintf(stderr, "  --group-commit-ms MS\n");
+    fprintf(stderr, "                  Batching window for --durability group (default: %d)\n", DEFAULT_GROUP_COMMIT_MS);
+    fprintf(stderr, "  --extract-threads N\n");
+    fprintf(stderr, "                  Threads writing files out of uploaded name.tar archives (default: %d)\n",
+            DEFAULT_EXTRACT_THREADS);
+    fprintf(stderr, "  --trace-file FILE\n");
+    fprintf(stderr, "                  Record anonymized control sessions for tools/ftpreplay\n");
+    fprintf(stderr, "  --rate-limit SCOPE[:DIR]=RATE[/BURST]\n");
+    fprintf(stderr, "                  Bytes/s for global, ip, user or session, down or up (repeatable)\n");
+    fprintf(stderr, "  --rate-file FILE\n");
+    fprintf(stderr, "                  More --rate-limit specs, one per line, re-read on SIGHUP\n");
+    fprintf(stderr, "  --queue N\n");
+    fprintf(stderr, "                  Hold up to N connections with a 120 reply when full (default: %d)\n",
+            DEFAULT_ADMISSION_QUEUE);
+    fprintf(stderr, "  --queue-wait SECS\n");
+    fprintf(stderr, "                  Longest a queued connection waits (default: %d)\n", DEFAULT_ADMISSION_WAIT);
+    fprintf(stderr, "  --max-per-ip N\n");
+    fprintf(stderr, "                  Concurrent sessions per client address (default: unlimited)\n");
+    fprintf(stderr, "  --shed-idle SECS\n");
+    fprintf(stderr, "                  Near capacity, close sessions idle this long (default: %d, 0 never)\n",
+            DEFAULT_SHED_IDLE_TIME);
+    fprintf(stderr, "  --conn-rate N[/SECS]\n");
+    fprintf(stderr, "                  New connections allowed per address in a sliding window (default: off)\n");
+    fprintf(stderr, "  --conn-rate-action reject|tarpit\n");
+    fprintf(stderr, "                  Answer excess connections with 421, or hold them silently (default: reject)\n");
+    fprintf(stderr, "  --fair-share RATE\n");
+    fprintf(stderr, "                  Share this many outbound bytes/s between RETR transfers by weight\n");
+    fprintf(stderr, "  --user-class NAME=WEIGHT[:USER,...]\n");
+    fprintf(stderr, "                  Scheduling weight for these users; NAME default sets the rest (repeatable)\n");
+    fprintf(stderr, "  --tls-cert FILE\n");
+    fprintf(stderr, "                  Offer AUTH TLS with this PEM certificate chain\n");
+    fprintf(stderr, "  --tls-key FILE\n");
+    fprintf(stderr, "                  PEM private key (default: in the --tls-cert file)\n");
+    fprintf(stderr, "  --tls-required\n");
+    fprintf(stderr, "                  Refuse logins and data transfers that are not encrypted\n");
+    fprintf(stderr, "  --tls-require-reuse\n");
+    fprintf(stderr, "                  Refuse data connections that do not resume the control connection's session\n");
 }
 
+// Long-only options
+enum {
+    OPT_DROP_CACHE_SIZE = 256,
+    OPT_CACHE_POLICY,
+    OPT_DIRECT_IO_SIZE,
+    OPT_DURABILITY,
+    OPT_GROUP_COMMIT_MS,
+    OPT_HOT_CACHE_SIZE,
+    OPT_HOT_CACHE_MAX_FILE,
+    OPT_STOR_CHECKSUM,
+    OPT_CHECKSUM_STORE,
+    OPT_TRACE_FILE,
+    OPT_RATE_LIMIT,
+    OPT_RATE_FILE,
+    OPT_FAIR_SHARE,
+    OPT_USER_CLASS,
+    OPT_QUEUE,
+    OPT_QUEUE_WAIT,
+    OPT_MAX_PER_IP,
+    OPT_SHED_IDLE,
+    OPT_CONN_RATE,
+    OPT_CONN_RATE_ACTION,
+    OPT_EXTRACT_THREADS,
+    OPT_DEDUP,
+    OPT_MEM_MOUNT,
+    OPT_QUOTA,
+    OPT_QUOTA_JOURNAL,
+    OPT_QUOTA_RECONCILE,
+    OPT_STAT_CACHE,
+    OPT_TLS_CERT,
+    OPT_TLS_KEY,
+    OPT_TLS_REQUIRED,
+    OPT_TLS_REQUIRE_REUSE
+};
+
+static const struct option long_options[] = {
+    {"drop-cache-size", required_argument, NULL, OPT_DROP_CACHE_SIZE},
+    {"cache-policy",    required_argument, NULL, OPT_CACHE_POLICY},
+    {"direct-io-size",  required_argument, NULL, OPT_DIRECT_IO_SIZE},
+    {"durability",      required_argument, NULL, OPT_DURABILITY},
+    {"group-commit-ms", required_argument, NULL, OPT_GROUP_COMMIT_MS},
+    {"hot-cache-size",  required_argument, NULL, OPT_HOT_CACHE_SIZE},
+    {"hot-cache-max-file", required_argument, NULL, OPT_HOT_CACHE_MAX_FILE},
+    {"stor-checksum",   required_argument, NULL, OPT_STOR_CHECKSUM},
+    {"checksum-store",  required_argument, NULL, OPT_CHECKSUM_STORE},
+    {"trace-file",      required_argument, NULL, OPT_TRACE_FILE},
+    {"rate-limit",      required_argument, NULL, OPT_RATE_LIMIT},
+    {"rate-file",       required_argument, NULL, OPT_RATE_FILE},
+    {"fair-share",      required_argument, NULL, OPT_FAIR_SHARE},
+    {"user-class",      required_argument, NULL, OPT_USER_CLASS},
+    {"queue",           required_argument, NULL, OPT_QUEUE},
+    {"queue-wait",      required_argument, NULL, OPT_QUEUE_WAIT},
+    {"max-per-ip",      required_argument, NULL, OPT_MAX_PER_IP},
+    {"shed-idle",       required_argument, NULL, OPT_SHED_IDLE},
+    {"conn-rate",       required_argument, NULL, OPT_CONN_RATE},
+    {"conn-rate-action", required_argument, NULL, OPT_CONN_RATE_ACTION},
+    {"extract-threads", required_argument, NULL, OPT_EXTRACT_THREADS},
+    {"dedup",           required_argument, NULL, OPT_DEDUP},
+    {"mem-mount",       required_argument, NULL, OPT_MEM_MOUNT},
+    {"quota",           required_argument, NULL, OPT_QUOTA},
+    {"quota-journal",   required_argument, NULL, OPT_QUOTA_JOURNAL},
+    {"quota-reconcile", required_argument, NULL, OPT_QUOTA_RECONCILE},
+    {"stat-cache",      required_argument, NULL, OPT_STAT_CACHE},
+    {"tls-cert",        required_argument, NULL, OPT_TLS_CERT},
+    {"tls-key",         required_argument, NULL, OPT_TLS_KEY},
+    {"tls-required",    no_argument,       NULL, OPT_TLS_REQUIRED},
+    {"tls-require-reuse", no_argument,     NULL, OPT_TLS_REQUIRE_REUSE},
+    {"help",            no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
 
 int main(int argc, char **argv) {
     int opt;
@@ -73,7 +258,7 @@ int main(int argc, char **argv) {
     log_init();
     
     // Parse command line arguments
-    while ((opt = getopt(argc, argv, "d:u:t:c:Dh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:u:p:t:c:Dh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'd':
                 directory = optarg;
@@ -81,6 +266,13 @@ int main(int argc, char **argv) {
             case 'u':
                 upload_dir = optarg;
                 break;
+            case 'p':
+                server_port = atoi(optarg);
+                if (server_port <= 0 || server_port > 65535) {
+                    fprintf(stderr, "Invalid port value. Using default: %d\n", FTP_PORT);
+                    server_port = FTP_PORT;
+                }
+                break;
             case 't':
                 client_timeout = atoi(optarg);
                 if (client_timeout <= 0) {
@@ -98,6 +290,196 @@ int main(int argc, char **argv) {
             case 'D':
                 daemon_mode = 1;
                 break;
+            case OPT_DROP_CACHE_SIZE:
+                if (!parse_size(optarg, &drop_cache_size)) {
+                    fprintf(stderr, "Invalid drop cache size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_DIRECT_IO_SIZE:
+                if (!parse_size(optarg, &direct_io_size)) {
+                    fprintf(stderr, "Invalid direct I/O size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_DURABILITY:
+                if (!durability_parse(optarg)) {
+                    fprintf(stderr, "Invalid durability mode: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_GROUP_COMMIT_MS:
+                group_commit_ms = atoi(optarg);
+                if (group_commit_ms < 0 || group_commit_ms > 1000) {
+                    fprintf(stderr, "Invalid group commit window. Using default: %d ms\n", DEFAULT_GROUP_COMMIT_MS);
+                    group_commit_ms = DEFAULT_GROUP_COMMIT_MS;
+                }
+                break;
+            case OPT_HOT_CACHE_SIZE:
+                if (!parse_size(optarg, &hot_cache_size)) {
+                    fprintf(stderr, "Invalid hot cache size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_STAT_CACHE:
+                if (!parse_size(optarg, &stat_cache_size)) {
+                    fprintf(stderr, "Invalid stat cache size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_HOT_CACHE_MAX_FILE:
+                if (!parse_size(optarg, &hot_cache_max_file)) {
+                    fprintf(stderr, "Invalid hot cache file size: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_STOR_CHECKSUM: {
+                hash_algo_t algo;
+                if (strcmp(optarg, "none") == 0) {
+                    stor_checksum_algo = -1;
+                } else if (hash_lookup(optarg, &algo)) {
+                    stor_checksum_algo = algo;
+                } else {
+                    fprintf(stderr, "Invalid checksum algorithm: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case OPT_CHECKSUM_STORE:
+                if (!checksum_store_parse(optarg)) {
+                    fprintf(stderr, "Invalid checksum store: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_TRACE_FILE:
+                if (!trace_open(optarg)) {
+                    fprintf(stderr, "Failed to open trace file %s: %s\n", optarg, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_RATE_LIMIT:
+                if (!ratelimit_add(optarg)) {
+                    fprintf(stderr, "Invalid rate limit: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_RATE_FILE:
+                ratelimit_set_file(optarg);
+                break;
+            case OPT_FAIR_SHARE:
+                if (!parse_size(optarg, &sched_link_rate)) {
+                    fprintf(stderr, "Invalid fair share rate: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_USER_CLASS:
+                if (!sched_add_class(optarg)) {
+                    fprintf(stderr, "Invalid user class: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_QUEUE:
+                admission_queue_size = atoi(optarg);
+                if (admission_queue_size < 0) {
+                    fprintf(stderr, "Invalid queue length. Using default: %d\n", DEFAULT_ADMISSION_QUEUE);
+                    admission_queue_size = DEFAULT_ADMISSION_QUEUE;
+                }
+                break;
+            case OPT_QUEUE_WAIT:
+                admission_wait = atoi(optarg);
+                if (admission_wait <= 0) {
+                    fprintf(stderr, "Invalid queue wait. Using default: %d seconds\n", DEFAULT_ADMISSION_WAIT);
+                    admission_wait = DEFAULT_ADMISSION_WAIT;
+                }
+                break;
+            case OPT_MAX_PER_IP:
+                max_per_ip = atoi(optarg);
+                if (max_per_ip < 0) {
+                    fprintf(stderr, "Invalid per-address limit. Using unlimited\n");
+                    max_per_ip = 0;
+                }
+                break;
+            case OPT_SHED_IDLE:
+                shed_idle_time = atoi(optarg);
+                if (shed_idle_time < 0) {
+                    fprintf(stderr, "Invalid shed idle time. Using default: %d seconds\n", DEFAULT_SHED_IDLE_TIME);
+                    shed_idle_time = DEFAULT_SHED_IDLE_TIME;
+                }
+                break;
+            case OPT_CONN_RATE:
+                if (!connrate_parse(optarg)) {
+                    fprintf(stderr, "Invalid connection rate: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_CONN_RATE_ACTION:
+                if (!connrate_parse_action(optarg)) {
+                    fprintf(stderr, "Invalid connection rate action: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_EXTRACT_THREADS:
+                extract_threads = atoi(optarg);
+                if (extract_threads < 0 || extract_threads > 64) {
+                    fprintf(stderr, "Invalid extract thread count. Using default: %d\n", DEFAULT_EXTRACT_THREADS);
+                    extract_threads = DEFAULT_EXTRACT_THREADS;
+                }
+                break;
+            case OPT_DEDUP:
+                if (optarg[0] == '\0' || strlen(optarg) >= sizeof(dedup_store)) {
+                    fprintf(stderr, "Invalid dedup store: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                strcpy(dedup_store, optarg);
+                break;
+            case OPT_QUOTA:
+                if (!quota_add(optarg)) {
+                    fprintf(stderr, "Invalid quota: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_QUOTA_JOURNAL:
+                if (optarg[0] == '\0' || strlen(optarg) >= sizeof(quota_journal)) {
+                    fprintf(stderr, "Invalid quota journal: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                strcpy(quota_journal, optarg);
+                break;
+            case OPT_QUOTA_RECONCILE:
+                quota_reconcile_interval = atoi(optarg);
+                if (quota_reconcile_interval < 0) {
+                    fprintf(stderr, "Invalid quota reconcile interval. Using default: %d\n", DEFAULT_QUOTA_RECONCILE);
+                    quota_reconcile_interval = DEFAULT_QUOTA_RECONCILE;
+                }
+                break;
+            case OPT_TLS_CERT:
+            case OPT_TLS_KEY: {
+                char *file = opt == OPT_TLS_CERT ? tls_cert_file : tls_key_file;
+                if (optarg[0] == '\0' || strlen(optarg) >= PATH_MAX) {
+                    fprintf(stderr, "Invalid TLS file: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                strcpy(file, optarg);
+                break;
+            }
+            case OPT_TLS_REQUIRED:
+                tls_required = 1;
+                break;
+            case OPT_TLS_REQUIRE_REUSE:
+                tls_require_reuse = 1;
+                break;
+            case OPT_MEM_MOUNT:
+                if (!storage_add_memory(optarg)) {
+                    fprintf(stderr, "Invalid memory mount: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_CACHE_POLICY:
+                if (!pagecache_add_rule(optarg)) {
+                    fprintf(stderr, "Invalid cache policy: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'h':
                 print_usage(program_name);
                 exit(EXIT_SUCCESS);
@@ -174,20 +556,72 @@ int main(int argc, char **argv) {
     sa.sa_handler = signal_handler;
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    
+    // A client dropping a data connection mid-sendfile() must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    
+    if (!ratelimit_reload()) {
+        exit(EXIT_FAILURE);
+    }
     
     // Initialize client module
     client_init();
+    filecache_init();
+    if (!statcache_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // In-memory mounts under the root
+    if (!storage_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Content-addressed upload store; it shares the inline checksum, which must be SHA-256
+    if (dedup_store[0] != '\0' && stor_checksum_algo >= 0 && stor_checksum_algo != DEDUP_ALGO) {
+        fprintf(stderr, "--dedup needs --stor-checksum sha256 (or none)\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!dedup_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Quota usage from the journal; the reconciler counts the rest in the background
+    if (!quota_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Start the group commit thread for upload durability
+    if (!durability_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Start the threads that write out uploaded archives
+    if (!tar_extract_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // FTPS certificate
+    if (!tls_init()) {
+        exit(EXIT_FAILURE);
+    }
+    
+    // Start the fair transfer scheduler
+    if (!sched_init()) {
+        exit(EXIT_FAILURE);
+    }
     
     // Create server socket
-    server_socket = init_server_socket(FTP_PORT);
+    server_socket = init_server_socket(server_port);
     if (server_socket < 0) {
         exit(EXIT_FAILURE);
     }
     
-    log_message(FTPLOG_INFO, "Server listening on port %d", FTP_PORT);
+    log_message(FTPLOG_INFO, "Server listening on port %d", server_port);
     
     // Variables for timeout checking
     time_t last_timeout_check = time(NULL);
+    time_t last_admission_tick = 0;
     
     // Main server loop
     while (server_running) {
@@ -205,6 +639,12 @@ int main(int argc, char **argv) {
         
         int select_result = select(server_socket + 1, &readfds, NULL, NULL, &timeout);
         
+        if (ratelimit_reload_pending) {
+            ratelimit_reload_pending = 0;
+            log_message(FTPLOG_INFO, "Reloading rate limits");
+            ratelimit_reload();
+        }
+        
         // Check for inactive clients every 60 seconds
         time_t current_time = time(NULL);
         if (difftime(current_time, last_timeout_check) >= 60) {
@@ -213,6 +653,14 @@ int main(int argc, char **argv) {
             
             // Log current client count
             log_message(FTPLOG_INFO, "Active clients: %d/%d", active_clients, max_clients);
+            filecache_log_stats();
+        }
+        
+        // Once a second, expire queued connections and shed idle sessions near capacity
+        if (current_time != last_admission_tick) {
+            admission_tick();
+            connrate_tick();
+            last_admission_tick = current_time;
         }
         
         if (select_result <= 0) {
@@ -234,6 +682,11 @@ int main(int argc, char **argv) {
             continue;
         }
         
+        // Turn away addresses connecting too fast before allocating anything for them
+        if (!connrate_admit(client_socket, &client_addr.sin_addr)) {
+            continue;
+        }
+        
         // Create client structure
         client_t *client = (client_t*)malloc(sizeof(client_t));
         if (!client) {
@@ -248,33 +701,10 @@ int main(int argc, char **argv) {
         client->transfer_mode = TRANSFER_MODE_NONE;
         client->thread_running = 1;  // Set thread as running
         inet_ntop(AF_INET, &client_addr.sin_addr, client->ip_address, sizeof(client->ip_address));
+        PROBE2(accept, client_socket, client->ip_address);
         
-        // Check if we've reached max clients
-        if (!add_client(client)) {
-            log_message(FTPLOG_ERROR, "Maximum number of clients reached (%d). Rejecting connection from %s", 
-                      max_clients, client->ip_address);
-            send_response(client->control_socket, 421, "Service not available, too many users connected");
-            close(client_socket);
-            free(client);
-            continue;
-        }
-        
-        log_message(FTPLOG_INFO, "New client connected: %s (%d/%d active)", 
-                  client->ip_address, active_clients, max_clients);
-        
-        // Create a thread to handle the client
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-        
-        if (pthread_create(&client->thread_id, &attr, handle_client_thread, client) != 0) {
-            log_message(FTPLOG_ERROR, "Failed to create thread for client: %s", strerror(errno));
-            remove_client(client);
-            close(client_socket);
-            free(client);
-        }
-        
-        pthread_attr_destroy(&attr);
+        // Start the session, or queue it if the server is full
+        admission_submit(client);
     }
     
     // Wait for all threads to finish
@@ -295,3 +725,5 @@ int main(int argc, char **argv) {
     cleanup();
     return 0;
 }
+
+#endif // FTPSERVER_NO_MAIN
@@ -0,0 +1,114 @@
+// src/hashstream.c
+#include "hashstream.h"
+#include "bufpool.h"
+#include "logging.h"
+
+static void *hash_stream_thread(void *arg) {
+    hash_stream_t *stream = (hash_stream_t *)arg;
+
+    pthread_mutex_lock(&stream->mutex);
+    for (;;) {
+        while (stream->count == 0 && !stream->closing) {
+            pthread_cond_wait(&stream->not_empty, &stream->mutex);
+        }
+        if (stream->count == 0) {
+            break;
+        }
+
+        char *block = stream->queue[stream->head];
+        pthread_mutex_unlock(&stream->mutex);
+
+        hash_update(&stream->ctx, block, BUFPOOL_BUFFER_SIZE);
+        bufpool_put(block);
+
+        pthread_mutex_lock(&stream->mutex);
+        stream->head = (stream->head + 1) % HASH_STREAM_QUEUE;
+        stream->count--;
+        pthread_cond_signal(&stream->not_full);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return NULL;
+}
+
+// Hand a full block to the worker, starting it on first use
+static void queue_block(hash_stream_t *stream, char *block) {
+    if (!stream->thread_started) {
+        if (pthread_create(&stream->thread, NULL, hash_stream_thread, stream) == 0) {
+            stream->thread_started = 1;
+        } else {
+            // No worker: hash in the receiving thread instead
+            hash_update(&stream->ctx, block, BUFPOOL_BUFFER_SIZE);
+            bufpool_put(block);
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->count == HASH_STREAM_QUEUE) {
+        pthread_cond_wait(&stream->not_full, &stream->mutex);
+    }
+    stream->queue[(stream->head + stream->count) % HASH_STREAM_QUEUE] = block;
+    stream->count++;
+    pthread_cond_signal(&stream->not_empty);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+void hash_stream_init(hash_stream_t *stream, hash_algo_t algo) {
+    memset(stream, 0, sizeof(*stream));
+    hash_init(&stream->ctx, algo);
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->not_empty, NULL);
+    pthread_cond_init(&stream->not_full, NULL);
+}
+
+int hash_stream_update(hash_stream_t *stream, const void *data, size_t len) {
+    const char *src = (const char *)data;
+
+    while (len > 0) {
+        if (stream->current == NULL) {
+            stream->current = (char *)bufpool_get();
+            if (stream->current == NULL) {
+                return 0;
+            }
+            stream->current_len = 0;
+        }
+
+        size_t chunk = BUFPOOL_BUFFER_SIZE - stream->current_len;
+        if (chunk > len) chunk = len;
+        memcpy(stream->current + stream->current_len, src, chunk);
+        stream->current_len += chunk;
+        src += chunk;
+        len -= chunk;
+
+        if (stream->current_len == BUFPOOL_BUFFER_SIZE) {
+            queue_block(stream, stream->current);
+            stream->current = NULL;
+        }
+    }
+    return 1;
+}
+
+void hash_stream_final(hash_stream_t *stream, char hex[HASH_MAX_HEX]) {
+    if (stream->thread_started) {
+        pthread_mutex_lock(&stream->mutex);
+        stream->closing = 1;
+        pthread_cond_signal(&stream->not_empty);
+        pthread_mutex_unlock(&stream->mutex);
+        pthread_join(stream->thread, NULL);
+        stream->thread_started = 0;
+    }
+
+    // Last partial block, and all of a small upload, is hashed here
+    if (stream->current != NULL) {
+        hash_update(&stream->ctx, stream->current, stream->current_len);
+        bufpool_put(stream->current);
+        stream->current = NULL;
+    }
+
+    hash_final(&stream->ctx, hex);
+
+    pthread_mutex_destroy(&stream->mutex);
+    pthread_cond_destroy(&stream->not_empty);
+    pthread_cond_destroy(&stream->not_full);
+}
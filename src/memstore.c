@@ -0,0 +1,533 @@
+// src/memstore.c
+#include "storage.h"
+#include <stdint.h>
+
+// A file or directory held in memory
+typedef struct mem_node {
+    char *name;
+    int is_dir;
+    mode_t mode;
+    struct timespec mtime;
+    ino_t ino;
+    char *data;                    // File contents
+    size_t size;
+    size_t capacity;
+    struct mem_node *parent;
+    struct mem_node *children;     // Directory entries, newest first
+    struct mem_node *next_sibling;
+    struct mem_node *hash_next;    // Chain in the (parent, name) table
+    int refs;                      // Open handles
+    int unlinked;                  // Removed while open; freed on the last close
+} mem_node_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    mem_node_t *root;
+    mem_node_t *buckets[MEMSTORE_BUCKETS];
+    off_t capacity;                // Byte limit for file contents, 0 = unlimited
+    off_t used;
+    ino_t next_ino;
+} mem_store_t;
+
+// A directory snapshot entry
+typedef struct {
+    char name[NAME_MAX + 1];
+    struct stat st;
+} mem_entry_t;
+
+static unsigned int name_bucket(const mem_node_t *parent, const char *name, size_t len) {
+    unsigned int h = (unsigned int)((uintptr_t)parent >> 4) * 2654435761u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return h & (MEMSTORE_BUCKETS - 1);
+}
+
+static mem_node_t *child_lookup(mem_store_t *store, const mem_node_t *parent, const char *name, size_t len) {
+    for (mem_node_t *node = store->buckets[name_bucket(parent, name, len)]; node != NULL; node = node->hash_next) {
+        if (node->parent == parent && strlen(node->name) == len && memcmp(node->name, name, len) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void attach(mem_store_t *store, mem_node_t *parent, mem_node_t *node) {
+    unsigned int b = name_bucket(parent, node->name, strlen(node->name));
+    node->parent = parent;
+    node->hash_next = store->buckets[b];
+    store->buckets[b] = node;
+    node->next_sibling = parent->children;
+    parent->children = node;
+    clock_gettime(CLOCK_REALTIME, &parent->mtime);
+}
+
+static void detach(mem_store_t *store, mem_node_t *node) {
+    mem_node_t *parent = node->parent;
+    mem_node_t **link = &store->buckets[name_bucket(parent, node->name, strlen(node->name))];
+    while (*link != node) link = &(*link)->hash_next;
+    *link = node->hash_next;
+    link = &parent->children;
+    while (*link != node) link = &(*link)->next_sibling;
+    *link = node->next_sibling;
+    node->parent = NULL;
+    node->hash_next = NULL;
+    node->next_sibling = NULL;
+    clock_gettime(CLOCK_REALTIME, &parent->mtime);
+}
+
+static mem_node_t *node_create(mem_store_t *store, const char *name, size_t len, int is_dir, mode_t mode) {
+    mem_node_t *node = calloc(1, sizeof(mem_node_t));
+    if (node == NULL || (node->name = strndup(name, len)) == NULL) {
+        free(node);
+        errno = ENOMEM;
+        return NULL;
+    }
+    node->is_dir = is_dir;
+    node->mode = (is_dir ? S_IFDIR : S_IFREG) | (mode & 0777);
+    node->ino = ++store->next_ino;
+    clock_gettime(CLOCK_REALTIME, &node->mtime);
+    return node;
+}
+
+static void node_free(mem_store_t *store, mem_node_t *node) {
+    store->used -= (off_t)node->capacity;
+    free(node->data);
+    free(node->name);
+    free(node);
+}
+
+// Free a removed node now, or on its last close if it is still open
+static void node_release(mem_store_t *store, mem_node_t *node) {
+    node->unlinked = 1;
+    if (node->refs == 0) {
+        node_free(store, node);
+    }
+}
+
+// Walk a path below the mount point. "." and ".." are handled lexically and
+// ".." stops at the mount root. With parent set, returns the parent of the
+// last component and leaves that component in name/len.
+static mem_node_t *walk(storage_t *storage, const char *path, int parent,
+                        const char **name, size_t *len) {
+    mem_store_t *store = storage->data;
+    mem_node_t *dir = store->root;
+    const char *p = path + storage->prefix_len;
+    const char *last = NULL;
+    size_t last_len = 0;
+
+    for (;;) {
+        while (*p == '/') p++;
+        size_t n = strcspn(p, "/");
+        if (n == 0) {
+            break;
+        }
+        if (n > NAME_MAX) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+
+        // Hold back the last real component when the caller wants its parent
+        const char *next = p + n;
+        while (*next == '/') next++;
+        int final = *next == '\0';
+        int dot = (n == 1 && p[0] == '.') || (n == 2 && p[0] == '.' && p[1] == '.');
+        if (parent && final && !dot) {
+            last = p;
+            last_len = n;
+            break;
+        }
+
+        if (n == 1 && p[0] == '.') {
+            // Stay
+        } else if (dot) {
+            if (dir->parent != NULL) dir = dir->parent;
+        } else {
+            if (!dir->is_dir) {
+                errno = ENOTDIR;
+                return NULL;
+            }
+            mem_node_t *child = child_lookup(store, dir, p, n);
+            if (child == NULL) {
+                errno = ENOENT;
+                return NULL;
+            }
+            dir = child;
+        }
+        p += n;
+    }
+
+    if (parent) {
+        if (last == NULL) {
+            // The mount root itself has no name in this store
+            errno = EBUSY;
+            return NULL;
+        }
+        if (!dir->is_dir) {
+            errno = ENOTDIR;
+            return NULL;
+        }
+        *name = last;
+        *len = last_len;
+    }
+    return dir;
+}
+
+static void node_stat(const mem_node_t *node, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = node->mode;
+    st->st_ino = node->ino;
+    st->st_nlink = node->is_dir ? 2 : 1;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_size = node->is_dir ? 0 : (off_t)node->size;
+    st->st_blksize = 4096;
+    st->st_blocks = (blkcnt_t)((node->capacity + 511) / 512);
+    st->st_mtim = node->mtime;
+    st->st_atim = node->mtime;
+    st->st_ctim = node->mtime;
+}
+
+static int mem_stat(storage_t *storage, const char *path, struct stat *st) {
+    mem_store_t *store = storage->data;
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *node = walk(storage, path, 0, NULL, NULL);
+    if (node != NULL) {
+        node_stat(node, st);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return node != NULL;
+}
+
+static int mem_open(storage_t *storage, const char *path, int flags, mode_t mode, storage_file_t *file) {
+    mem_store_t *store = storage->data;
+    const char *name;
+    size_t len;
+    int ok = 0;
+
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *dir = walk(storage, path, 1, &name, &len);
+    mem_node_t *node = NULL;
+    if (dir == NULL) {
+        // Opening the mount root for reading is opening a directory
+        if (errno == EBUSY) errno = EISDIR;
+    } else if ((node = child_lookup(store, dir, name, len)) == NULL) {
+        if ((flags & O_CREAT) && (node = node_create(store, name, len, 0, mode)) != NULL) {
+            attach(store, dir, node);
+            ok = 1;
+        } else if (!(flags & O_CREAT)) {
+            errno = ENOENT;
+        }
+    } else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+        errno = EEXIST;
+    } else if (node->is_dir && (flags & O_ACCMODE) != O_RDONLY) {
+        errno = EISDIR;
+    } else {
+        if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+            node->size = 0;
+            clock_gettime(CLOCK_REALTIME, &node->mtime);
+        }
+        ok = 1;
+    }
+
+    if (ok) {
+        node->refs++;
+        file->node = node;
+        file->offset = (flags & O_APPEND) ? (off_t)node->size : 0;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+static ssize_t mem_read(storage_file_t *file, void *buf, size_t len) {
+    mem_store_t *store = file->storage->data;
+    mem_node_t *node = file->node;
+    ssize_t n = 0;
+
+    pthread_mutex_lock(&store->lock);
+    if (node->is_dir) {
+        errno = EISDIR;
+        n = -1;
+    } else if (file->offset < (off_t)node->size) {
+        n = (ssize_t)((size_t)(node->size - file->offset) < len ? node->size - file->offset : len);
+        memcpy(buf, node->data + file->offset, (size_t)n);
+        file->offset += n;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return n;
+}
+
+static ssize_t mem_write(storage_file_t *file, const void *buf, size_t len) {
+    mem_store_t *store = file->storage->data;
+    mem_node_t *node = file->node;
+    size_t end = (size_t)file->offset + len;
+
+    pthread_mutex_lock(&store->lock);
+    if (end > node->capacity) {
+        // Grow geometrically so streaming uploads are not quadratic
+        size_t capacity = node->capacity ? node->capacity : 4096;
+        while (capacity < end) capacity *= 2;
+        off_t growth = (off_t)(capacity - node->capacity);
+        if (store->capacity > 0 && store->used + growth > store->capacity) {
+            capacity = end;
+            growth = (off_t)(capacity - node->capacity);
+        }
+        if (store->capacity > 0 && store->used + growth > store->capacity) {
+            pthread_mutex_unlock(&store->lock);
+            errno = ENOSPC;
+            return -1;
+        }
+        char *data = realloc(node->data, capacity);
+        if (data == NULL) {
+            pthread_mutex_unlock(&store->lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        node->data = data;
+        node->capacity = capacity;
+        store->used += growth;
+    }
+    if ((size_t)file->offset > node->size) {
+        memset(node->data + node->size, 0, (size_t)file->offset - node->size);
+    }
+    memcpy(node->data + file->offset, buf, len);
+    file->offset += (off_t)len;
+    if (end > node->size) {
+        node->size = end;
+    }
+    clock_gettime(CLOCK_REALTIME, &node->mtime);
+    pthread_mutex_unlock(&store->lock);
+    return (ssize_t)len;
+}
+
+static int mem_fstat(storage_file_t *file, struct stat *st) {
+    mem_store_t *store = file->storage->data;
+    pthread_mutex_lock(&store->lock);
+    node_stat(file->node, st);
+    pthread_mutex_unlock(&store->lock);
+    return 1;
+}
+
+static int mem_close(storage_file_t *file) {
+    mem_store_t *store = file->storage->data;
+    mem_node_t *node = file->node;
+
+    pthread_mutex_lock(&store->lock);
+    node->refs--;
+    if (node->refs == 0 && node->unlinked) {
+        node_free(store, node);
+    }
+    pthread_mutex_unlock(&store->lock);
+    file->node = NULL;
+    return 1;
+}
+
+static int mem_opendir(storage_t *storage, const char *path, storage_dir_t *dir) {
+    mem_store_t *store = storage->data;
+    int ok = 0;
+
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *node = walk(storage, path, 0, NULL, NULL);
+    if (node != NULL && !node->is_dir) {
+        errno = ENOTDIR;
+    } else if (node != NULL) {
+        // Snapshot the entries so the lock is not held while listing
+        size_t count = 2;
+        for (mem_node_t *child = node->children; child != NULL; child = child->next_sibling) count++;
+        mem_entry_t *entries = malloc(count * sizeof(mem_entry_t));
+        if (entries == NULL) {
+            errno = ENOMEM;
+        } else {
+            snprintf(entries[0].name, sizeof(entries[0].name), ".");
+            node_stat(node, &entries[0].st);
+            snprintf(entries[1].name, sizeof(entries[1].name), "..");
+            node_stat(node->parent != NULL ? node->parent : node, &entries[1].st);
+            size_t i = 2;
+            for (mem_node_t *child = node->children; child != NULL; child = child->next_sibling, i++) {
+                snprintf(entries[i].name, sizeof(entries[i].name), "%s", child->name);
+                node_stat(child, &entries[i].st);
+            }
+            dir->entries = entries;
+            dir->count = count;
+            dir->next = 0;
+            ok = 1;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+static int mem_readdir(storage_dir_t *dir, char *name, size_t size, struct stat *st) {
+    mem_entry_t *entries = dir->entries;
+    if (dir->next == dir->count) {
+        return 0;
+    }
+    snprintf(name, size, "%s", entries[dir->next].name);
+    if (st != NULL) {
+        *st = entries[dir->next].st;
+    }
+    dir->next++;
+    return 1;
+}
+
+// The snapshot already holds every entry's metadata
+static int mem_entry_stat(storage_dir_t *dir, const char *name, struct stat *st) {
+    mem_entry_t *entries = dir->entries;
+    (void)name;
+    if (dir->next == 0) {
+        errno = ENOENT;
+        return 0;
+    }
+    *st = entries[dir->next - 1].st;
+    return 1;
+}
+
+static void mem_closedir(storage_dir_t *dir) {
+    free(dir->entries);
+    dir->entries = NULL;
+}
+
+static int mem_rename(storage_t *storage, const char *from, const char *to) {
+    mem_store_t *store = storage->data;
+    const char *from_name, *to_name;
+    size_t from_len, to_len;
+    int ok = 0;
+
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *from_dir = walk(storage, from, 1, &from_name, &from_len);
+    mem_node_t *to_dir = from_dir != NULL ? walk(storage, to, 1, &to_name, &to_len) : NULL;
+    mem_node_t *node = from_dir != NULL ? child_lookup(store, from_dir, from_name, from_len) : NULL;
+    if (from_dir == NULL || to_dir == NULL) {
+        // errno set by walk
+    } else if (node == NULL) {
+        errno = ENOENT;
+    } else {
+        // A directory cannot move into its own subtree
+        mem_node_t *ancestor = to_dir;
+        while (ancestor != NULL && ancestor != node) ancestor = ancestor->parent;
+        mem_node_t *existing = child_lookup(store, to_dir, to_name, to_len);
+        char *name = NULL;
+
+        if (ancestor == node) {
+            errno = EINVAL;
+        } else if (existing == node) {
+            ok = 1;
+        } else if (existing != NULL && existing->is_dir != node->is_dir) {
+            errno = existing->is_dir ? EISDIR : ENOTDIR;
+        } else if (existing != NULL && existing->children != NULL) {
+            errno = ENOTEMPTY;
+        } else if ((name = strndup(to_name, to_len)) == NULL) {
+            errno = ENOMEM;
+        } else {
+            if (existing != NULL) {
+                detach(store, existing);
+                node_release(store, existing);
+            }
+            detach(store, node);
+            free(node->name);
+            node->name = name;
+            attach(store, to_dir, node);
+            ok = 1;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+static int mem_remove(storage_t *storage, const char *path) {
+    mem_store_t *store = storage->data;
+    const char *name;
+    size_t len;
+    int ok = 0;
+
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *dir = walk(storage, path, 1, &name, &len);
+    mem_node_t *node = dir != NULL ? child_lookup(store, dir, name, len) : NULL;
+    if (dir == NULL) {
+        // errno set by walk
+    } else if (node == NULL) {
+        errno = ENOENT;
+    } else if (node->children != NULL) {
+        errno = ENOTEMPTY;
+    } else {
+        detach(store, node);
+        node_release(store, node);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+static int mem_mkdir(storage_t *storage, const char *path, mode_t mode) {
+    mem_store_t *store = storage->data;
+    const char *name;
+    size_t len;
+    int ok = 0;
+
+    pthread_mutex_lock(&store->lock);
+    mem_node_t *dir = walk(storage, path, 1, &name, &len);
+    if (dir == NULL) {
+        if (errno == EBUSY) errno = EEXIST;
+    } else if (child_lookup(store, dir, name, len) != NULL) {
+        errno = EEXIST;
+    } else {
+        mem_node_t *node = node_create(store, name, len, 1, mode);
+        if (node != NULL) {
+            attach(store, dir, node);
+            ok = 1;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return ok;
+}
+
+static void free_tree(mem_store_t *store, mem_node_t *node) {
+    while (node->children != NULL) {
+        mem_node_t *child = node->children;
+        node->children = child->next_sibling;
+        free_tree(store, child);
+    }
+    node_free(store, node);
+}
+
+static void mem_destroy(storage_t *storage) {
+    mem_store_t *store = storage->data;
+    free_tree(store, store->root);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+    storage->data = NULL;
+}
+
+int memory_storage_create(storage_t *storage, off_t capacity) {
+    mem_store_t *store = calloc(1, sizeof(mem_store_t));
+    if (store == NULL) {
+        return 0;
+    }
+    store->capacity = capacity;
+    store->root = node_create(store, "", 0, 1, 0755);
+    if (store->root == NULL) {
+        free(store);
+        return 0;
+    }
+    pthread_mutex_init(&store->lock, NULL);
+    storage->data = store;
+    return 1;
+}
+
+const storage_ops_t memory_storage_ops = {
+    .name = "memory",
+    .stat = mem_stat,
+    .open = mem_open,
+    .read = mem_read,
+    .write = mem_write,
+    .fstat = mem_fstat,
+    .close = mem_close,
+    .opendir = mem_opendir,
+    .readdir = mem_readdir,
+    .entry_stat = mem_entry_stat,
+    .closedir = mem_closedir,
+    .rename = mem_rename,
+    .remove = mem_remove,
+    .mkdir = mem_mkdir,
+    .destroy = mem_destroy,
+};
@@ -1,6 +1,8 @@
 // src/network.c
 #include "network.h"
 #include "logging.h"
+#include "probes.h"
+#include "tls.h"
 
 int init_server_socket(int port) {
     int server_socket;
@@ -34,7 +36,9 @@ int init_server_socket(int port) {
     }
     
     // Listen for connections
-    if (listen(server_socket, 5) < 0) {
+    // A short backlog drops SYNs during connection bursts, which costs the
+    // client a full second in retransmission before it even gets queued
+    if (listen(server_socket, SOMAXCONN) < 0) {
         log_message(FTPLOG_ERROR, "Failed to listen on port %d: %s", port, strerror(errno));
         close(server_socket);
         return -1;
@@ -78,6 +82,7 @@ int open_data_connection(client_t *client) {
     
     int port = ntohs(data_addr.sin_port);
     log_message(FTPLOG_DEBUG, "Data socket listening on port %d", port);
+    PROBE2(data__listen, client, port);
     
     // Get the server's IP address as seen by the client
     struct sockaddr_in server_addr;
@@ -97,7 +102,7 @@ int open_data_connection(client_t *client) {
             "227 Entering Passive Mode (%d,%d,%d,%d,%d,%d)\r\n",
             ip[0], ip[1], ip[2], ip[3], port >> 8, port & 0xFF);
     
-    send(client->control_socket, response, strlen(response), 0);
+    tls_send(client->control_socket, response, strlen(response), 0);
     log_message(FTPLOG_DEBUG, "Sent: %s", response);
     
     return data_socket;
@@ -181,6 +186,21 @@ int create_data_connection(client_t *client) {
     
     log_message(FTPLOG_DEBUG, "Successfully connected to client at %s:%d", 
                 client->data_ip, client->data_port);
+    PROBE4(data__connect, client, data_socket, client->data_ip, client->data_port);
     
     return data_socket;
 }
+
+int accept_data_connection(client_t *client) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    int data_conn = accept(client->data_socket, (struct sockaddr*)&client_addr, &client_len);
+    
+    if (data_conn < 0) {
+        log_message(FTPLOG_ERROR, "Failed to accept data connection: %s", strerror(errno));
+        return -1;
+    }
+    
+    PROBE2(data__accept, client, data_conn);
+    return data_conn;
+}
@@ -0,0 +1,168 @@
+// src/pagecache.c
+#include "pagecache.h"
+#include "logging.h"
+#include "utils.h"
+
+#define MAX_CACHE_RULES 64
+#define READAHEAD_MIN_WINDOW (512 * 1024)         // Smallest readahead window
+#define READAHEAD_MAX_WINDOW (32 * 1024 * 1024)   // Largest readahead window
+#define READAHEAD_LEAD_MS 1000                    // Keep this much transfer time read ahead
+#define DROP_CHUNK (8 * 1024 * 1024)              // Drop sent pages in chunks of this size
+#define DROP_SLACK (1024 * 1024)                  // Leave this much behind the read position
+
+off_t drop_cache_size = DEFAULT_DROP_CACHE_SIZE;
+
+typedef struct {
+    char dir[PATH_MAX];       // Directory relative to FTP root, no trailing slash
+    cache_policy_t policy;
+    off_t threshold;          // Size threshold for CACHE_POLICY_AUTO (-1 = global)
+} cache_rule_t;
+
+static cache_rule_t *rules[MAX_CACHE_RULES];
+static int rule_count = 0;
+
+int pagecache_add_rule(const char *spec) {
+    const char *eq = strrchr(spec, '=');
+    if (eq == NULL || eq == spec || rule_count >= MAX_CACHE_RULES) {
+        return 0;
+    }
+
+    cache_rule_t *rule = (cache_rule_t *)calloc(1, sizeof(cache_rule_t));
+    if (!rule) {
+        return 0;
+    }
+
+    // Directory part, always with a leading slash and without a trailing one
+    size_t len = (size_t)(eq - spec);
+    if (spec[0] != '/') {
+        rule->dir[0] = '/';
+        len = len < sizeof(rule->dir) - 2 ? len : sizeof(rule->dir) - 2;
+        memcpy(rule->dir + 1, spec, len);
+    } else {
+        len = len < sizeof(rule->dir) - 1 ? len : sizeof(rule->dir) - 1;
+        memcpy(rule->dir, spec, len);
+    }
+    len = strlen(rule->dir);
+    while (len > 1 && rule->dir[len - 1] == '/') {
+        rule->dir[--len] = '\0';
+    }
+
+    // Policy part
+    const char *policy = eq + 1;
+    rule->threshold = -1;
+    if (strcmp(policy, "keep") == 0) {
+        rule->policy = CACHE_POLICY_KEEP;
+    } else if (strcmp(policy, "drop") == 0) {
+        rule->policy = CACHE_POLICY_DROP;
+    } else if (strncmp(policy, "auto", 4) == 0 && (policy[4] == '\0' || policy[4] == ':')) {
+        rule->policy = CACHE_POLICY_AUTO;
+        if (policy[4] == ':' && !parse_size(policy + 5, &rule->threshold)) {
+            free(rule);
+            return 0;
+        }
+    } else {
+        free(rule);
+        return 0;
+    }
+
+    rules[rule_count++] = rule;
+    return 1;
+}
+
+void pagecache_cleanup(void) {
+    for (int i = 0; i < rule_count; i++) {
+        free(rules[i]);
+        rules[i] = NULL;
+    }
+    rule_count = 0;
+}
+
+// Decide whether pages of this file should be dropped once sent
+static int should_drop(const char *path, off_t file_size) {
+    cache_policy_t policy = CACHE_POLICY_AUTO;
+    off_t threshold = drop_cache_size;
+    size_t best = 0;
+
+    // Longest matching directory rule wins
+    size_t root_len = strlen(root_directory);
+    const char *rel = (strncmp(path, root_directory, root_len) == 0) ? path + root_len : path;
+    for (int i = 0; i < rule_count; i++) {
+        size_t len = strlen(rules[i]->dir);
+        int match = (len == 1) ||
+                    (strncmp(rel, rules[i]->dir, len) == 0 && (rel[len] == '/' || rel[len] == '\0'));
+        if (match && len >= best) {
+            best = len;
+            policy = rules[i]->policy;
+            threshold = rules[i]->threshold >= 0 ? rules[i]->threshold : drop_cache_size;
+        }
+    }
+
+    switch (policy) {
+        case CACHE_POLICY_KEEP:
+            return 0;
+        case CACHE_POLICY_DROP:
+            return 1;
+        default:
+            return threshold > 0 && file_size >= threshold;
+    }
+}
+
+void read_hint_begin(read_hint_t *hint, int fd, const char *path, off_t file_size) {
+    memset(hint, 0, sizeof(*hint));
+    hint->fd = fd;
+    hint->file_size = file_size;
+    hint->drop = should_drop(path, file_size);
+    hint->ra_window = READAHEAD_MIN_WINDOW;
+    clock_gettime(CLOCK_MONOTONIC, &hint->start);
+
+    // Whole-file sequential access; the kernel doubles its own readahead
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (file_size > 0) {
+        size_t window = (size_t)(file_size < (off_t)hint->ra_window ? file_size : (off_t)hint->ra_window);
+        readahead(fd, 0, window);
+        hint->ra_end = (off_t)window;
+    }
+
+    log_message(FTPLOG_DEBUG, "Reading %s (%lld bytes), cache policy: %s",
+                path, (long long)file_size, hint->drop ? "drop" : "keep");
+}
+
+void read_hint_advance(read_hint_t *hint, off_t offset) {
+    // Extend readahead once half of the current window has been consumed
+    if (hint->ra_end < hint->file_size && offset + (off_t)(hint->ra_window / 2) >= hint->ra_end) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - hint->start.tv_sec) + (now.tv_nsec - hint->start.tv_nsec) / 1e9;
+
+        // Size the window to the observed throughput
+        if (elapsed > 0) {
+            double window = (offset / elapsed) * READAHEAD_LEAD_MS / 1000.0;
+            if (window < READAHEAD_MIN_WINDOW) window = READAHEAD_MIN_WINDOW;
+            if (window > READAHEAD_MAX_WINDOW) window = READAHEAD_MAX_WINDOW;
+            hint->ra_window = ((size_t)window + 65535) & ~(size_t)65535;
+        }
+
+        if (hint->ra_end < offset) {
+            hint->ra_end = offset;
+        }
+        off_t len = (off_t)hint->ra_window;
+        if (hint->ra_end + len > hint->file_size) {
+            len = hint->file_size - hint->ra_end;
+        }
+        readahead(hint->fd, hint->ra_end, (size_t)len);
+        hint->ra_end += len;
+    }
+
+    // Drop pages that have already been sent
+    if (hint->drop && offset - DROP_SLACK - hint->drop_start >= DROP_CHUNK) {
+        off_t len = offset - DROP_SLACK - hint->drop_start;
+        posix_fadvise(hint->fd, hint->drop_start, len, POSIX_FADV_DONTNEED);
+        hint->drop_start += len;
+    }
+}
+
+void read_hint_end(read_hint_t *hint) {
+    if (hint->drop) {
+        posix_fadvise(hint->fd, hint->drop_start, 0, POSIX_FADV_DONTNEED);
+    }
+}
@@ -0,0 +1,670 @@
+// src/quota.c
+#include "quota.h"
+#include "fileops.h"
+#include "logging.h"
+#include "storage.h"
+#include "utils.h"
+#include <sys/xattr.h>
+
+char quota_journal[PATH_MAX] = "";
+int quota_reconcile_interval = DEFAULT_QUOTA_RECONCILE;
+
+enum { QUOTA_USER, QUOTA_DIR };
+
+typedef struct {
+    int scope;
+    char name[PATH_MAX];       // User, or directory as configured
+    char path[PATH_MAX];       // Directory on disk, normalized (QUOTA_DIR)
+    size_t path_len;
+    off_t max_bytes;           // 0 = no limit
+    off_t max_files;
+    off_t bytes;               // Current usage
+    off_t files;
+    off_t reserved;            // Held by uploads in progress
+    off_t scan_bytes;          // Changes made while a rescan is running
+    off_t scan_files;
+    int known;                 // Usage came from the journal or a rescan
+} quota_t;
+
+// A directory on the rescan's current path, to stop symlink loops
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} dir_id_t;
+
+static quota_t quotas[QUOTA_MAX];
+static int quota_count = 0;
+static int user_quotas = 0;
+static pthread_mutex_t quota_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reconcile_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reconcile_thread;
+static int reconcile_running = 0;
+static int reconcile_requested = 0;
+static int scanning = 0;
+static char journal_path[PATH_MAX];
+static int journal_fd = -1;
+static int journal_lines = 0;
+
+int quota_add(const char *spec) {
+    char limits[64];
+    char *end;
+    quota_t *q = &quotas[quota_count];
+    const char *name;
+
+    if (quota_count == QUOTA_MAX) {
+        return 0;
+    }
+    memset(q, 0, sizeof(*q));
+    if (strncmp(spec, "user:", 5) == 0) {
+        q->scope = QUOTA_USER;
+        name = spec + 5;
+    } else if (strncmp(spec, "dir:", 4) == 0) {
+        q->scope = QUOTA_DIR;
+        name = spec + 4;
+    } else {
+        return 0;
+    }
+
+    const char *eq = strrchr(name, '=');
+    if (eq == NULL || eq == name || (size_t)(eq - name) >= sizeof(q->name) ||
+        strlen(eq + 1) >= sizeof(limits) || (q->scope == QUOTA_DIR && name[0] != '/') ||
+        (q->scope == QUOTA_USER && (size_t)(eq - name) >= QUOTA_OWNER_MAX)) {
+        return 0;
+    }
+    snprintf(q->name, sizeof(q->name), "%.*s", (int)(eq - name), name);
+
+    // BYTES[/FILES]
+    snprintf(limits, sizeof(limits), "%s", eq + 1);
+    char *slash = strchr(limits, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        errno = 0;
+        long long files = strtoll(slash + 1, &end, 10);
+        if (errno != 0 || end == slash + 1 || *end != '\0' || files < 0) {
+            return 0;
+        }
+        q->max_files = (off_t)files;
+    }
+    if (!parse_size(limits, &q->max_bytes)) {
+        return 0;
+    }
+
+    if (q->scope == QUOTA_USER) {
+        user_quotas++;
+    }
+    quota_count++;
+    return 1;
+}
+
+int quota_enabled(void) {
+    return quota_count > 0;
+}
+
+static quota_t *find_quota(int scope, const char *name) {
+    for (int i = 0; i < quota_count; i++) {
+        if (quotas[i].scope == scope && strcmp(quotas[i].name, name) == 0) {
+            return &quotas[i];
+        }
+    }
+    return NULL;
+}
+
+// Does q cover a file at path uploaded by user? user is NULL where
+// ownership cannot be recorded.
+static int applies(const quota_t *q, const char *user, const char *path) {
+    if (q->scope == QUOTA_USER) {
+        return user != NULL && strcmp(q->name, user) == 0;
+    }
+    return strncmp(path, q->path, q->path_len) == 0 && (path[q->path_len] == '/' || path[q->path_len] == '\0');
+}
+
+// Owners live in an xattr, so only files on the real filesystem have one
+static const char *owner_of(const char *user, const char *path) {
+    return user[0] != '\0' && storage_is_posix(path) ? user : NULL;
+}
+
+static void write_snapshot(void) {
+    char temp[PATH_MAX + 8];
+
+    if (journal_path[0] == '\0') {
+        return;
+    }
+    snprintf(temp, sizeof(temp), "%s.tmp", journal_path);
+    FILE *out = fopen(temp, "w");
+    if (out == NULL) {
+        log_message(FTPLOG_ERROR, "Quota: Cannot write %s: %s", temp, strerror(errno));
+        return;
+    }
+
+    int lines = 0;
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        if (q->known) {
+            fprintf(out, "%lld %lld %c %s\n", (long long)q->bytes, (long long)q->files,
+                    q->scope == QUOTA_USER ? 'u' : 'd', q->name);
+            lines++;
+        }
+    }
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0 || fclose(out) != 0 || rename(temp, journal_path) != 0) {
+        log_message(FTPLOG_ERROR, "Quota: Cannot replace %s: %s", journal_path, strerror(errno));
+        unlink(temp);
+        return;
+    }
+
+    // Further changes go on the end of the new snapshot
+    int fd = open(journal_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd >= 0) {
+        if (journal_fd >= 0) close(journal_fd);
+        journal_fd = fd;
+        journal_lines = lines;
+    }
+}
+
+// Apply a change to q and append it to the journal; called with quota_mutex held
+static void charge(quota_t *q, off_t bytes, off_t files) {
+    if (bytes == 0 && files == 0) {
+        return;
+    }
+    q->bytes = q->bytes + bytes > 0 ? q->bytes + bytes : 0;
+    q->files = q->files + files > 0 ? q->files + files : 0;
+    if (scanning) {
+        q->scan_bytes += bytes;
+        q->scan_files += files;
+    }
+
+    if (journal_fd >= 0) {
+        if (dprintf(journal_fd, "%lld %lld %c %s\n", (long long)bytes, (long long)files,
+                    q->scope == QUOTA_USER ? 'u' : 'd', q->name) < 0) {
+            log_message(FTPLOG_ERROR, "Quota: Cannot append to journal: %s", strerror(errno));
+        }
+        if (++journal_lines >= QUOTA_JOURNAL_COMPACT) {
+            write_snapshot();
+        }
+    }
+}
+
+// Sum the journal into the usage counters; returns 1 on success
+static int load_journal(void) {
+    char line[PATH_MAX + 64];
+    long long bytes, files;
+    char scope;
+    int name_at;
+
+    FILE *fp = fopen(journal_path, "r");
+    if (fp == NULL) {
+        return errno == ENOENT;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lld %lld %c %n", &bytes, &files, &scope, &name_at) != 3) {
+            continue;
+        }
+        quota_t *q = find_quota(scope == 'u' ? QUOTA_USER : QUOTA_DIR, line + name_at);
+        if (q != NULL && (scope == 'u' || scope == 'd')) {
+            q->bytes += (off_t)bytes;
+            q->files += (off_t)files;
+            q->known = 1;
+        }
+        journal_lines++;
+    }
+    fclose(fp);
+    return 1;
+}
+
+// Rescan totals for one file
+static void count_file(const char *path, const struct stat *st, off_t *bytes, off_t *files) {
+    char owner[QUOTA_OWNER_MAX] = "";
+
+    if (user_quotas > 0 && storage_is_posix(path)) {
+        ssize_t len = getxattr(path, QUOTA_OWNER_XATTR, owner, sizeof(owner) - 1);
+        owner[len > 0 ? len : 0] = '\0';
+    }
+    for (int i = 0; i < quota_count; i++) {
+        if (applies(&quotas[i], owner[0] != '\0' ? owner : NULL, path)) {
+            bytes[i] += st->st_size;
+            files[i]++;
+        }
+    }
+}
+
+// Walk a directory through the storage layer, so in-memory mounts are counted too
+static void scan_dir(const char *path, int depth, dir_id_t *stack, off_t *bytes, off_t *files) {
+    storage_dir_t dir;
+    char name[NAME_MAX + 1];
+    char child[PATH_MAX];
+    struct stat st;
+
+    if (!storage_opendir(path, &dir)) {
+        return;
+    }
+    while (__atomic_load_n(&reconcile_running, __ATOMIC_RELAXED) &&
+           storage_readdir(&dir, name, sizeof(name), &st)) {
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            snprintf(child, sizeof(child), "%s/%s", path, name) >= (int)sizeof(child)) {
+            continue;
+        }
+        if (S_ISREG(st.st_mode)) {
+            count_file(child, &st, bytes, files);
+        } else if (S_ISDIR(st.st_mode) && depth + 1 < QUOTA_MAX_DEPTH) {
+            int seen = 0;
+            for (int i = 0; i <= depth; i++) {
+                seen |= stack[i].dev == st.st_dev && stack[i].ino == st.st_ino;
+            }
+            if (!seen) {
+                stack[depth + 1].dev = st.st_dev;
+                stack[depth + 1].ino = st.st_ino;
+                scan_dir(child, depth + 1, stack, bytes, files);
+            }
+        }
+    }
+    storage_closedir(&dir);
+}
+
+// Recount everything; changes made meanwhile are added on top. Called with quota_mutex held.
+static void reconcile(void) {
+    off_t bytes[QUOTA_MAX] = {0};
+    off_t files[QUOTA_MAX] = {0};
+    dir_id_t stack[QUOTA_MAX_DEPTH];
+    struct stat st;
+
+    for (int i = 0; i < quota_count; i++) {
+        quotas[i].scan_bytes = 0;
+        quotas[i].scan_files = 0;
+    }
+    scanning = 1;
+    pthread_mutex_unlock(&quota_mutex);
+
+    time_t start = time(NULL);
+    memset(stack, 0, sizeof(stack));
+    if (stat(root_directory, &st) == 0) {
+        stack[0].dev = st.st_dev;
+        stack[0].ino = st.st_ino;
+    }
+    scan_dir(root_directory, 0, stack, bytes, files);
+
+    pthread_mutex_lock(&quota_mutex);
+    scanning = 0;
+    if (!reconcile_running) {
+        return;
+    }
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        if (q->known && (q->bytes != bytes[i] + q->scan_bytes || q->files != files[i] + q->scan_files)) {
+            log_message(FTPLOG_INFO, "Quota: %s %s corrected from %lld bytes, %lld files to %lld bytes, %lld files",
+                        q->scope == QUOTA_USER ? "user" : "directory", q->name, (long long)q->bytes,
+                        (long long)q->files, (long long)(bytes[i] + q->scan_bytes),
+                        (long long)(files[i] + q->scan_files));
+        }
+        q->bytes = bytes[i] + q->scan_bytes;
+        q->files = files[i] + q->scan_files;
+        q->known = 1;
+    }
+    write_snapshot();
+    log_message(FTPLOG_DEBUG, "Quota: Rescan took %.0f seconds", difftime(time(NULL), start));
+}
+
+static void *reconcile_main(void *arg) {
+    struct timespec next;
+    (void)arg;
+
+    pthread_mutex_lock(&quota_mutex);
+    clock_gettime(CLOCK_REALTIME, &next);
+    next.tv_sec += quota_reconcile_interval;
+    while (reconcile_running) {
+        if (reconcile_requested) {
+            reconcile_requested = 0;
+            reconcile();
+            clock_gettime(CLOCK_REALTIME, &next);
+            next.tv_sec += quota_reconcile_interval;
+        } else if (quota_reconcile_interval > 0) {
+            if (pthread_cond_timedwait(&reconcile_cond, &quota_mutex, &next) == ETIMEDOUT) {
+                reconcile_requested = 1;
+            }
+        } else {
+            pthread_cond_wait(&reconcile_cond, &quota_mutex);
+        }
+    }
+    pthread_mutex_unlock(&quota_mutex);
+    return NULL;
+}
+
+int quota_init(void) {
+    char joined[PATH_MAX * 2];
+    int unknown = 0;
+
+    if (quota_count == 0) {
+        return 1;
+    }
+
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        if (q->scope == QUOTA_DIR) {
+            snprintf(joined, sizeof(joined), "%s%s", root_directory, q->name);
+            storage_normalize(joined, q->path, sizeof(q->path));
+            q->path_len = strlen(q->path);
+        }
+    }
+
+    if (quota_journal[0] != '\0') {
+        int len;
+        if (quota_journal[0] == '/') {
+            len = snprintf(journal_path, sizeof(journal_path), "%s", quota_journal);
+        } else {
+            len = snprintf(journal_path, sizeof(journal_path), "%s/%s", root_directory, quota_journal);
+        }
+        if (len < 0 || (size_t)len >= sizeof(journal_path)) {
+            log_message(FTPLOG_ERROR, "Quota: Journal path too long: %s", quota_journal);
+            journal_path[0] = '\0';
+            return 0;
+        }
+        if (!load_journal()) {
+            log_message(FTPLOG_ERROR, "Quota: Cannot read journal %s: %s", journal_path, strerror(errno));
+            return 0;
+        }
+        journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (journal_fd < 0) {
+            log_message(FTPLOG_ERROR, "Quota: Cannot open journal %s: %s", journal_path, strerror(errno));
+            return 0;
+        }
+
+        // Clients must not rewrite the journal or its snapshot inside the root
+        char resolved[PATH_MAX], temp[PATH_MAX + 8];
+        if (realpath(journal_path, resolved) == NULL) {
+            log_message(FTPLOG_ERROR, "Quota: Cannot resolve journal %s: %s", journal_path, strerror(errno));
+            return 0;
+        }
+        snprintf(temp, sizeof(temp), "%s.tmp", resolved);
+        if (fileops_inside_root(resolved) && (!storage_add_private(resolved) || !storage_add_private(temp))) {
+            log_message(FTPLOG_ERROR, "Quota: Cannot hide journal %s: %s", resolved, strerror(errno));
+            return 0;
+        }
+    }
+
+    // Quotas the journal does not cover are counted once in the background
+    for (int i = 0; i < quota_count; i++) {
+        unknown += !quotas[i].known;
+    }
+    reconcile_requested = unknown > 0;
+    reconcile_running = 1;
+    if (pthread_create(&reconcile_thread, NULL, reconcile_main, NULL) != 0) {
+        log_message(FTPLOG_ERROR, "Quota: Cannot start reconciler thread");
+        reconcile_running = 0;
+        return 0;
+    }
+
+    log_message(FTPLOG_INFO, "Quota: %d quotas, %d to be counted%s%s", quota_count, unknown,
+                journal_path[0] ? ", journal " : "", journal_path);
+    return 1;
+}
+
+void quota_cleanup(void) {
+    if (!reconcile_running) {
+        return;
+    }
+    pthread_mutex_lock(&quota_mutex);
+    __atomic_store_n(&reconcile_running, 0, __ATOMIC_RELAXED);
+    pthread_cond_signal(&reconcile_cond);
+    pthread_mutex_unlock(&quota_mutex);
+    pthread_join(reconcile_thread, NULL);
+
+    pthread_mutex_lock(&quota_mutex);
+    write_snapshot();
+    if (journal_fd >= 0) {
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    pthread_mutex_unlock(&quota_mutex);
+}
+
+void quota_dirty(void) {
+    if (quota_count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&quota_mutex);
+    reconcile_requested = 1;
+    pthread_cond_signal(&reconcile_cond);
+    pthread_mutex_unlock(&quota_mutex);
+}
+
+void quota_stat(const char *path, quota_file_t *file) {
+    struct stat st;
+
+    memset(file, 0, sizeof(*file));
+    if (quota_count == 0 || !storage_stat(path, &st)) {
+        return;
+    }
+    file->exists = 1;
+    file->is_dir = S_ISDIR(st.st_mode);
+    file->size = S_ISREG(st.st_mode) ? st.st_size : 0;
+    if (user_quotas > 0 && S_ISREG(st.st_mode) && storage_is_posix(path)) {
+        ssize_t len = getxattr(path, QUOTA_OWNER_XATTR, file->owner, sizeof(file->owner) - 1);
+        file->owner[len > 0 ? len : 0] = '\0';
+    }
+}
+
+// Bytes and files of the replaced file already counted in q
+static void credit(const quota_t *q, const quota_reservation_t *r, off_t *bytes, off_t *files) {
+    int counted = r->old.exists && !r->old.is_dir &&
+                  (q->scope == QUOTA_DIR || strcmp(q->name, r->old.owner) == 0);
+    *bytes = counted ? r->old.size : 0;
+    *files = counted ? 1 : 0;
+}
+
+int quota_begin(quota_reservation_t *r, const char *user, const char *path, off_t bytes) {
+    quota_t *over = NULL;
+
+    memset(r, 0, sizeof(*r));
+    if (quota_count == 0) {
+        return 1;
+    }
+    storage_normalize(path, r->path, sizeof(r->path));
+    snprintf(r->user, sizeof(r->user), "%s", user);
+    quota_stat(r->path, &r->old);
+    const char *owner = owner_of(r->user, r->path);
+
+    pthread_mutex_lock(&quota_mutex);
+    for (int i = 0; i < quota_count && over == NULL; i++) {
+        quota_t *q = &quotas[i];
+        off_t old_bytes, old_files;
+        if (!applies(q, owner, r->path)) {
+            continue;
+        }
+        credit(q, r, &old_bytes, &old_files);
+        if ((q->max_bytes > 0 && q->bytes + q->reserved + bytes - old_bytes > q->max_bytes) ||
+            (q->max_files > 0 && q->files + 1 - old_files > q->max_files)) {
+            over = q;
+        }
+    }
+    if (over == NULL) {
+        for (int i = 0; i < quota_count; i++) {
+            if (applies(&quotas[i], owner, r->path)) {
+                quotas[i].reserved += bytes;
+            }
+        }
+        r->reserved = bytes;
+        r->active = 1;
+    }
+    pthread_mutex_unlock(&quota_mutex);
+
+    if (over != NULL) {
+        log_message(FTPLOG_INFO, "Quota: %s over %s %s quota writing %s (%lld bytes)", user,
+                    over->scope == QUOTA_USER ? "user" : "directory", over->name, r->path, (long long)bytes);
+        errno = EDQUOT;
+        return 0;
+    }
+    return 1;
+}
+
+int quota_extend(quota_reservation_t *r, off_t total) {
+    if (!r->active || total <= r->reserved) {
+        return 1;
+    }
+    const char *owner = owner_of(r->user, r->path);
+    off_t need = total - r->reserved;
+    off_t grow = (need + QUOTA_RESERVE_STEP - 1) / QUOTA_RESERVE_STEP * QUOTA_RESERVE_STEP;
+    int ok = 1;
+
+    // Take a whole step where it fits, but never less than what has arrived
+    pthread_mutex_lock(&quota_mutex);
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        off_t old_bytes, old_files;
+        if (!applies(q, owner, r->path) || q->max_bytes == 0) {
+            continue;
+        }
+        credit(q, r, &old_bytes, &old_files);
+        off_t room = q->max_bytes + old_bytes - q->bytes - q->reserved;
+        if (room < need) {
+            ok = 0;
+            break;
+        }
+        if (room < grow) {
+            grow = room;
+        }
+    }
+    if (ok) {
+        for (int i = 0; i < quota_count; i++) {
+            if (applies(&quotas[i], owner, r->path)) {
+                quotas[i].reserved += grow;
+            }
+        }
+        r->reserved += grow;
+    }
+    pthread_mutex_unlock(&quota_mutex);
+
+    if (!ok) {
+        errno = EDQUOT;
+    }
+    return ok;
+}
+
+// Drop the reservation from its quotas; called with quota_mutex held
+static void release(quota_reservation_t *r, const char *owner) {
+    for (int i = 0; i < quota_count; i++) {
+        if (applies(&quotas[i], owner, r->path)) {
+            quotas[i].reserved -= r->reserved;
+        }
+    }
+    r->reserved = 0;
+    r->active = 0;
+}
+
+void quota_cancel(quota_reservation_t *r) {
+    if (!r->active) {
+        return;
+    }
+    pthread_mutex_lock(&quota_mutex);
+    release(r, owner_of(r->user, r->path));
+    pthread_mutex_unlock(&quota_mutex);
+}
+
+void quota_end(quota_reservation_t *r) {
+    quota_file_t now;
+
+    if (!r->active) {
+        return;
+    }
+    const char *owner = owner_of(r->user, r->path);
+    quota_stat(r->path, &now);
+    int new_file = now.exists && !now.is_dir;
+    int old_file = r->old.exists && !r->old.is_dir;
+
+    pthread_mutex_lock(&quota_mutex);
+    release(r, owner);
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        off_t bytes = 0, files = 0;
+        if (q->scope == QUOTA_DIR) {
+            if (applies(q, NULL, r->path)) {
+                bytes = (new_file ? now.size : 0) - (old_file ? r->old.size : 0);
+                files = new_file - old_file;
+            }
+        } else {
+            // The upload now belongs to whoever sent it
+            if (new_file && applies(q, owner, r->path)) {
+                bytes += now.size;
+                files++;
+            }
+            if (old_file && strcmp(q->name, r->old.owner) == 0) {
+                bytes -= r->old.size;
+                files--;
+            }
+        }
+        charge(q, bytes, files);
+    }
+    pthread_mutex_unlock(&quota_mutex);
+
+    if (new_file && owner != NULL && setxattr(r->path, QUOTA_OWNER_XATTR, owner, strlen(owner), 0) != 0) {
+        log_message(FTPLOG_DEBUG, "Quota: Cannot record owner of %s: %s", r->path, strerror(errno));
+    }
+}
+
+void quota_end_tree(quota_reservation_t *r, off_t bytes, off_t files) {
+    if (!r->active) {
+        return;
+    }
+    const char *owner = owner_of(r->user, r->path);
+
+    pthread_mutex_lock(&quota_mutex);
+    release(r, owner);
+    for (int i = 0; i < quota_count; i++) {
+        if (applies(&quotas[i], owner, r->path)) {
+            charge(&quotas[i], bytes, files);
+        }
+    }
+    pthread_mutex_unlock(&quota_mutex);
+
+    // Replaced files and directories are only seen by a rescan
+    quota_dirty();
+}
+
+const char *quota_owner(const quota_reservation_t *r) {
+    return r->active ? owner_of(r->user, r->path) : NULL;
+}
+
+void quota_removed(const char *path, const quota_file_t *file) {
+    char normalized[PATH_MAX];
+
+    if (quota_count == 0 || !file->exists || file->is_dir) {
+        return;
+    }
+    storage_normalize(path, normalized, sizeof(normalized));
+
+    pthread_mutex_lock(&quota_mutex);
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        if (q->scope == QUOTA_DIR ? applies(q, NULL, normalized) : strcmp(q->name, file->owner) == 0) {
+            charge(q, -file->size, -1);
+        }
+    }
+    pthread_mutex_unlock(&quota_mutex);
+}
+
+void quota_renamed(const char *from, const char *to, const quota_file_t *source, const quota_file_t *target) {
+    char from_path[PATH_MAX], to_path[PATH_MAX];
+
+    if (quota_count == 0 || !source->exists) {
+        return;
+    }
+
+    // A directory carries an unknown amount with it; count again
+    if (source->is_dir) {
+        quota_dirty();
+        return;
+    }
+
+    quota_removed(to, target);
+    storage_normalize(from, from_path, sizeof(from_path));
+    storage_normalize(to, to_path, sizeof(to_path));
+
+    // The owner moves with the file, so only directory quotas change
+    pthread_mutex_lock(&quota_mutex);
+    for (int i = 0; i < quota_count; i++) {
+        quota_t *q = &quotas[i];
+        if (q->scope == QUOTA_DIR) {
+            int delta = applies(q, NULL, to_path) - applies(q, NULL, from_path);
+            charge(q, delta * source->size, delta);
+        }
+    }
+    pthread_mutex_unlock(&quota_mutex);
+}
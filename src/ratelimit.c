@@ -0,0 +1,357 @@
+// src/ratelimit.c
+#include "ratelimit.h"
+#include "logging.h"
+#include "utils.h"
+
+#define RATE_SCOPES 4
+#define RATE_GLOBAL 0
+#define RATE_IP 1
+#define RATE_USER 2
+#define RATE_SESSION 3
+
+#define RATE_MAX_SPECS 64
+#define RATE_SPEC_MAX 128
+#define RATE_SHARED_BUCKETS 256
+#define RATE_KEY_MAX 72
+#define RATE_MIN_BURST (16 * 1024)    // Default burst floor when none is given
+#define RATE_MIN_CHUNK 1024
+#define RATE_SLEEP_SLICE 0.25         // Longest single sleep, so shutdown is noticed
+
+// IP and user buckets are shared by every session they cover
+struct rate_shared {
+    int scope;
+    char key[RATE_KEY_MAX];
+    int refs;                          // Sessions attached; freed at zero
+    pthread_mutex_t lock;
+    rate_bucket_t bucket[2];
+    struct rate_shared *next;          // Hash chain
+};
+
+typedef struct {
+    double rate;                       // Bytes per second (0 = unlimited)
+    double burst;                      // Bucket depth in bytes
+} rate_limit_t;
+
+static const char *scope_names[RATE_SCOPES] = {"global", "ip", "user", "session"};
+static const char *dir_names[2] = {"down", "up"};
+
+volatile sig_atomic_t ratelimit_reload_pending = 0;
+
+// Limits given on the command line, re-applied under the file's on every reload
+static char base_specs[RATE_MAX_SPECS][RATE_SPEC_MAX];
+static int base_count = 0;
+static char *limit_file = NULL;
+
+static pthread_rwlock_t limits_lock = PTHREAD_RWLOCK_INITIALIZER;
+static rate_limit_t limits[RATE_SCOPES][2];
+static int limits_active = 0;          // Any limit set; read without the lock
+static size_t chunk_limit[2];          // Smallest burst per direction
+
+static pthread_mutex_t global_lock[2] = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+static rate_bucket_t global_bucket[2];
+
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rate_shared_t *shared_table[RATE_SHARED_BUCKETS];
+
+static double monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Apply one spec to a limit table; returns 1 on success
+static int parse_spec(const char *spec, rate_limit_t table[RATE_SCOPES][2]) {
+    char scope[16], dir[8] = "";
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL) {
+        return 0;
+    }
+
+    size_t name_len = (size_t)(eq - spec);
+    const char *colon = memchr(spec, ':', name_len);
+    size_t scope_len = colon ? (size_t)(colon - spec) : name_len;
+    if (scope_len == 0 || scope_len >= sizeof(scope)) {
+        return 0;
+    }
+    memcpy(scope, spec, scope_len);
+    scope[scope_len] = '\0';
+    if (colon) {
+        size_t dir_len = name_len - scope_len - 1;
+        if (dir_len == 0 || dir_len >= sizeof(dir)) {
+            return 0;
+        }
+        memcpy(dir, colon + 1, dir_len);
+        dir[dir_len] = '\0';
+    }
+
+    int s;
+    for (s = 0; s < RATE_SCOPES && strcmp(scope, scope_names[s]) != 0; s++) {
+    }
+    if (s == RATE_SCOPES) {
+        return 0;
+    }
+    int first = 0, last = 1;
+    if (strcmp(dir, "down") == 0) {
+        last = 0;
+    } else if (strcmp(dir, "up") == 0) {
+        first = 1;
+    } else if (dir[0] != '\0' && strcmp(dir, "both") != 0) {
+        return 0;
+    }
+
+    // RATE[/BURST], both with the usual size suffixes
+    char value[RATE_SPEC_MAX];
+    snprintf(value, sizeof(value), "%s", eq + 1);
+    char *slash = strchr(value, '/');
+    off_t rate, burst = 0;
+    if (slash) {
+        *slash = '\0';
+        if (!parse_size(slash + 1, &burst) || burst == 0) {
+            return 0;
+        }
+    }
+    if (!parse_size(value, &rate)) {
+        return 0;
+    }
+    if (burst == 0) {
+        burst = rate / 10 > RATE_MIN_BURST ? rate / 10 : RATE_MIN_BURST;
+    }
+
+    for (int d = first; d <= last; d++) {
+        table[s][d].rate = (double)rate;
+        table[s][d].burst = (double)burst;
+    }
+    return 1;
+}
+
+int ratelimit_add(const char *spec) {
+    rate_limit_t scratch[RATE_SCOPES][2];
+    if (base_count >= RATE_MAX_SPECS || strlen(spec) >= RATE_SPEC_MAX || !parse_spec(spec, scratch)) {
+        return 0;
+    }
+    strcpy(base_specs[base_count++], spec);
+    return 1;
+}
+
+void ratelimit_set_file(const char *path) {
+    free(limit_file);
+    limit_file = strdup(path);
+}
+
+int ratelimit_reload(void) {
+    rate_limit_t table[RATE_SCOPES][2];
+    memset(table, 0, sizeof(table));
+
+    for (int i = 0; i < base_count; i++) {
+        parse_spec(base_specs[i], table);
+    }
+
+    if (limit_file != NULL) {
+        FILE *fp = fopen(limit_file, "r");
+        if (fp == NULL) {
+            log_message(FTPLOG_ERROR, "Failed to open rate limit file %s: %s", limit_file, strerror(errno));
+            return 0;
+        }
+
+        char line[RATE_SPEC_MAX];
+        int line_no = 0, valid = 1;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            line_no++;
+            char *p = line;
+            while (isspace((unsigned char)*p)) p++;
+            char *end = p + strcspn(p, "#\r\n");
+            while (end > p && isspace((unsigned char)end[-1])) end--;
+            *end = '\0';
+            if (*p != '\0' && !parse_spec(p, table)) {
+                log_message(FTPLOG_ERROR, "%s:%d: invalid rate limit: %s", limit_file, line_no, p);
+                valid = 0;
+            }
+        }
+        fclose(fp);
+
+        // Keep the old limits rather than applying half a file
+        if (!valid) {
+            return 0;
+        }
+    }
+
+    int active = 0;
+    size_t chunk[2] = {0, 0};
+    for (int s = 0; s < RATE_SCOPES; s++) {
+        for (int d = 0; d < 2; d++) {
+            if (table[s][d].rate <= 0) {
+                continue;
+            }
+            active = 1;
+            size_t burst = table[s][d].burst > RATE_MIN_CHUNK ? (size_t)table[s][d].burst : RATE_MIN_CHUNK;
+            if (chunk[d] == 0 || burst < chunk[d]) {
+                chunk[d] = burst;
+            }
+
+            char rate_str[64];
+            format_transfer_rate(table[s][d].rate, rate_str, sizeof(rate_str));
+            log_message(FTPLOG_INFO, "Rate limit %s %s: %s, burst %.0f bytes",
+                        scope_names[s], dir_names[d], rate_str, table[s][d].burst);
+        }
+    }
+
+    pthread_rwlock_wrlock(&limits_lock);
+    memcpy(limits, table, sizeof(limits));
+    chunk_limit[RATE_DOWN] = chunk[RATE_DOWN];
+    chunk_limit[RATE_UP] = chunk[RATE_UP];
+    __atomic_store_n(&limits_active, active, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&limits_lock);
+
+    return 1;
+}
+
+void ratelimit_cleanup(void) {
+    pthread_mutex_lock(&shared_mutex);
+    for (int i = 0; i < RATE_SHARED_BUCKETS; i++) {
+        while (shared_table[i] != NULL) {
+            rate_shared_t *entry = shared_table[i];
+            shared_table[i] = entry->next;
+            pthread_mutex_destroy(&entry->lock);
+            free(entry);
+        }
+    }
+    pthread_mutex_unlock(&shared_mutex);
+    free(limit_file);
+    limit_file = NULL;
+}
+
+static unsigned int hash_key(int scope, const char *key) {
+    unsigned int h = 2166136261u ^ (unsigned int)scope;
+    for (; *key; key++) {
+        h = (h ^ (unsigned char)*key) * 16777619u;
+    }
+    return h % RATE_SHARED_BUCKETS;
+}
+
+static rate_shared_t *shared_acquire(int scope, const char *key) {
+    unsigned int slot = hash_key(scope, key);
+
+    pthread_mutex_lock(&shared_mutex);
+    rate_shared_t *entry = shared_table[slot];
+    while (entry != NULL && (entry->scope != scope || strncmp(entry->key, key, RATE_KEY_MAX - 1) != 0)) {
+        entry = entry->next;
+    }
+    if (entry == NULL && (entry = calloc(1, sizeof(rate_shared_t))) != NULL) {
+        entry->scope = scope;
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        pthread_mutex_init(&entry->lock, NULL);
+        entry->next = shared_table[slot];
+        shared_table[slot] = entry;
+    }
+    if (entry != NULL) {
+        entry->refs++;
+    }
+    pthread_mutex_unlock(&shared_mutex);
+
+    return entry;
+}
+
+static void shared_release(rate_shared_t *entry) {
+    if (entry == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&shared_mutex);
+    if (--entry->refs == 0) {
+        rate_shared_t **link = &shared_table[hash_key(entry->scope, entry->key)];
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+        pthread_mutex_destroy(&entry->lock);
+        free(entry);
+    }
+    pthread_mutex_unlock(&shared_mutex);
+}
+
+void ratelimit_session_begin(rate_session_t *rs, const char *ip) {
+    memset(rs, 0, sizeof(*rs));
+    rs->ip = shared_acquire(RATE_IP, ip);
+}
+
+void ratelimit_session_user(rate_session_t *rs, const char *user) {
+    shared_release(rs->user);
+    rs->user = shared_acquire(RATE_USER, user);
+}
+
+void ratelimit_session_end(rate_session_t *rs) {
+    shared_release(rs->ip);
+    shared_release(rs->user);
+    rs->ip = NULL;
+    rs->user = NULL;
+}
+
+size_t ratelimit_chunk(int dir, size_t len) {
+    if (!__atomic_load_n(&limits_active, __ATOMIC_ACQUIRE)) {
+        return len;
+    }
+
+    pthread_rwlock_rdlock(&limits_lock);
+    size_t chunk = chunk_limit[dir];
+    pthread_rwlock_unlock(&limits_lock);
+
+    return chunk != 0 && chunk < len ? chunk : len;
+}
+
+// Refill from the time elapsed, take bytes and return how long the debt takes to clear
+static double charge(rate_bucket_t *bucket, const rate_limit_t *limit, size_t bytes, double now) {
+    if (limit->rate <= 0) {
+        return 0;
+    }
+
+    bucket->tokens += (now - bucket->last) * limit->rate;
+    if (bucket->tokens > limit->burst) {
+        bucket->tokens = limit->burst;
+    }
+    bucket->last = now;
+    bucket->tokens -= (double)bytes;
+
+    return bucket->tokens < 0 ? -bucket->tokens / limit->rate : 0;
+}
+
+static double charge_locked(pthread_mutex_t *lock, rate_bucket_t *bucket, const rate_limit_t *limit,
+                            size_t bytes, double now) {
+    if (limit->rate <= 0) {
+        return 0;
+    }
+    pthread_mutex_lock(lock);
+    double wait = charge(bucket, limit, bytes, now);
+    pthread_mutex_unlock(lock);
+    return wait;
+}
+
+void ratelimit_consume(rate_session_t *rs, int dir, size_t bytes) {
+    if (!__atomic_load_n(&limits_active, __ATOMIC_ACQUIRE) || bytes == 0) {
+        return;
+    }
+
+    double now = monotonic_now();
+    double wait, longest;
+
+    pthread_rwlock_rdlock(&limits_lock);
+    longest = charge_locked(&global_lock[dir], &global_bucket[dir], &limits[RATE_GLOBAL][dir], bytes, now);
+    if (rs->ip != NULL) {
+        wait = charge_locked(&rs->ip->lock, &rs->ip->bucket[dir], &limits[RATE_IP][dir], bytes, now);
+        if (wait > longest) longest = wait;
+    }
+    if (rs->user != NULL) {
+        wait = charge_locked(&rs->user->lock, &rs->user->bucket[dir], &limits[RATE_USER][dir], bytes, now);
+        if (wait > longest) longest = wait;
+    }
+    wait = charge(&rs->session[dir], &limits[RATE_SESSION][dir], bytes, now);
+    if (wait > longest) longest = wait;
+    pthread_rwlock_unlock(&limits_lock);
+
+    // Sleep off the deepest debt in slices so a shutdown is not held up
+    while (longest > 0 && server_running) {
+        double slice = longest < RATE_SLEEP_SLICE ? longest : RATE_SLEEP_SLICE;
+        struct timespec ts = {(time_t)slice, (long)((slice - (time_t)slice) * 1e9)};
+        nanosleep(&ts, NULL);
+        longest -= slice;
+    }
+}
@@ -0,0 +1,275 @@
+// src/scheduler.c
+#include "scheduler.h"
+#include "logging.h"
+
+#define SCHED_QUANTUM (16 * 1024)      // Bytes per round for a weight of 1
+#define SCHED_MAX_CLASSES 32
+#define SCHED_MAX_WEIGHT 1000
+
+typedef struct {
+    char name[32];
+    int weight;
+    char *users;                        // Comma-separated, NULL for the default class
+} sched_class_t;
+
+off_t sched_link_rate = 0;
+
+static sched_class_t classes[SCHED_MAX_CLASSES];
+static int class_count = 0;
+static int default_weight = 1;
+
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static sched_flow_t *cursor = NULL;     // Flow whose turn it is, NULL when the ring is empty
+static int waiting = 0;                 // Flows with a request outstanding
+static int sched_running = 0;
+static pthread_t sched_thread;
+
+static double monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int sched_add_class(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (eq == NULL || eq == spec || (size_t)(eq - spec) >= sizeof(classes[0].name) ||
+        class_count >= SCHED_MAX_CLASSES) {
+        return 0;
+    }
+
+    char *end;
+    long weight = strtol(eq + 1, &end, 10);
+    if (end == eq + 1 || weight < 1 || weight > SCHED_MAX_WEIGHT || (*end != '\0' && *end != ':')) {
+        return 0;
+    }
+
+    sched_class_t *class = &classes[class_count];
+    memcpy(class->name, spec, (size_t)(eq - spec));
+    class->name[eq - spec] = '\0';
+    class->weight = (int)weight;
+    class->users = NULL;
+
+    if (strcmp(class->name, "default") == 0) {
+        default_weight = class->weight;
+        return 1;
+    }
+    if (*end != ':' || end[1] == '\0' || (class->users = strdup(end + 1)) == NULL) {
+        return 0;
+    }
+    class_count++;
+    return 1;
+}
+
+static int class_weight(const char *user) {
+    size_t len = strlen(user);
+
+    for (int i = 0; i < class_count; i++) {
+        const char *p = classes[i].users;
+        while (*p) {
+            size_t n = strcspn(p, ",");
+            if (n == len && strncmp(p, user, len) == 0) {
+                return classes[i].weight;
+            }
+            p += n;
+            if (*p == ',') p++;
+        }
+    }
+    return default_weight;
+}
+
+// Hand the turn to a flow, topping up its deficit for the new round
+static void take_turn(sched_flow_t *flow) {
+    long quantum = (long)SCHED_QUANTUM * flow->weight;
+    cursor = flow;
+    flow->deficit += quantum;
+
+    // A flow that is between chunks does not bank credit across rounds
+    if (flow->request == 0 && flow->deficit > quantum) {
+        flow->deficit = quantum;
+    }
+}
+
+// Deficit round robin over active flows, paced at the link rate
+static void *scheduler_thread(void *arg) {
+    (void)arg;
+    double link_free = 0;
+
+    pthread_mutex_lock(&sched_mutex);
+    while (sched_running) {
+        if (waiting == 0) {
+            pthread_cond_wait(&work_cond, &sched_mutex);
+            continue;
+        }
+
+        // Pace before looking at the cursor, so the flow just served has had
+        // time to ask for its next chunk and can use the rest of its turn
+        double now = monotonic_now();
+        if (link_free > now) {
+            double wait = link_free - now;
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)wait;
+            deadline.tv_nsec += (long)((wait - (time_t)wait) * 1e9);
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&work_cond, &sched_mutex, &deadline);
+            continue;
+        }
+
+        sched_flow_t *flow = cursor;
+        if (flow->request == 0 || flow->deficit < (long)flow->request) {
+            take_turn(flow->next);
+            continue;
+        }
+
+        // Idle time is not saved up, so a quiet link does not allow a burst
+        if (link_free < now) {
+            link_free = now;
+        }
+        link_free += flow->request / (double)sched_link_rate;
+
+        flow->deficit -= (long)flow->request;
+        flow->request = 0;
+        flow->granted = 1;
+        waiting--;
+        pthread_cond_signal(&flow->cond);
+    }
+    pthread_mutex_unlock(&sched_mutex);
+
+    return NULL;
+}
+
+int sched_init(void) {
+    if (sched_link_rate <= 0) {
+        return 1;
+    }
+
+    sched_running = 1;
+    if (pthread_create(&sched_thread, NULL, scheduler_thread, NULL) != 0) {
+        log_message(FTPLOG_ERROR, "Failed to start transfer scheduler: %s", strerror(errno));
+        sched_running = 0;
+        return 0;
+    }
+
+    char rate_str[64];
+    format_transfer_rate((double)sched_link_rate, rate_str, sizeof(rate_str));
+    log_message(FTPLOG_INFO, "Fair transfer scheduling at %s, %d user classes", rate_str, class_count + 1);
+    return 1;
+}
+
+void sched_cleanup(void) {
+    pthread_mutex_lock(&sched_mutex);
+    if (sched_running) {
+        sched_running = 0;
+        pthread_cond_signal(&work_cond);
+
+        // Let blocked transfers run out unscheduled
+        sched_flow_t *flow = cursor;
+        if (flow != NULL) {
+            do {
+                pthread_cond_signal(&flow->cond);
+                flow = flow->next;
+            } while (flow != cursor);
+        }
+        pthread_mutex_unlock(&sched_mutex);
+        pthread_join(sched_thread, NULL);
+    } else {
+        pthread_mutex_unlock(&sched_mutex);
+    }
+
+    for (int i = 0; i < class_count; i++) {
+        free(classes[i].users);
+    }
+    class_count = 0;
+}
+
+void sched_flow_init(sched_flow_t *flow) {
+    memset(flow, 0, sizeof(*flow));
+    flow->weight = default_weight;
+    pthread_cond_init(&flow->cond, NULL);
+}
+
+void sched_flow_user(sched_flow_t *flow, const char *user) {
+    int weight = class_weight(user);
+    pthread_mutex_lock(&sched_mutex);
+    flow->weight = weight;
+    pthread_mutex_unlock(&sched_mutex);
+}
+
+void sched_flow_destroy(sched_flow_t *flow) {
+    sched_end(flow);
+    pthread_cond_destroy(&flow->cond);
+}
+
+void sched_begin(sched_flow_t *flow) {
+    if (sched_link_rate <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sched_mutex);
+    if (sched_running && !flow->active) {
+        flow->active = 1;
+        flow->deficit = 0;
+        flow->request = 0;
+        if (cursor == NULL) {
+            flow->next = flow->prev = flow;
+            take_turn(flow);
+        } else {
+            // Join at the tail, just before the flow whose turn it is
+            flow->next = cursor;
+            flow->prev = cursor->prev;
+            cursor->prev->next = flow;
+            cursor->prev = flow;
+        }
+    }
+    pthread_mutex_unlock(&sched_mutex);
+}
+
+void sched_end(sched_flow_t *flow) {
+    if (sched_link_rate <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sched_mutex);
+    if (flow->active) {
+        if (flow->request != 0) {
+            flow->request = 0;
+            waiting--;
+        }
+        if (flow->next == flow) {
+            cursor = NULL;
+        } else {
+            flow->prev->next = flow->next;
+            flow->next->prev = flow->prev;
+            if (cursor == flow) {
+                take_turn(flow->next);
+            }
+        }
+        flow->next = flow->prev = NULL;
+        flow->active = 0;
+    }
+    pthread_mutex_unlock(&sched_mutex);
+}
+
+size_t sched_chunk(size_t len) {
+    return sched_link_rate > 0 && len > SCHED_QUANTUM ? SCHED_QUANTUM : len;
+}
+
+void sched_wait(sched_flow_t *flow, size_t bytes) {
+    if (sched_link_rate <= 0 || bytes == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sched_mutex);
+    if (sched_running && flow->active) {
+        flow->request = bytes;
+        flow->granted = 0;
+        waiting++;
+        pthread_cond_signal(&work_cond);
+        while (!flow->granted && sched_running) {
+            pthread_cond_wait(&flow->cond, &sched_mutex);
+        }
+    }
+    pthread_mutex_unlock(&sched_mutex);
+}
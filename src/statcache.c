@@ -0,0 +1,362 @@
+// src/statcache.c
+#include "statcache.h"
+#include "logging.h"
+#include "storage.h"
+#include <poll.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | \
+                      IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+off_t stat_cache_size = DEFAULT_STAT_CACHE_SIZE;
+
+struct stat_dir;
+
+// Metadata of one file
+typedef struct stat_entry {
+    struct stat_dir *dir;
+    struct stat_entry *hash_next;
+    struct stat_entry *dir_next;
+    struct stat st;
+    char name[];
+} stat_entry_t;
+
+// A watched directory and the files cached from it
+typedef struct stat_dir {
+    char *path;
+    int wd;
+    unsigned long gen;             // Changes whenever an event touches the directory
+    stat_entry_t *entries;
+    size_t bytes;                  // Memory charged to this directory
+    struct stat_dir *path_next;
+    struct stat_dir *wd_next;
+    struct stat_dir *lru_prev;     // Most recently used at the head
+    struct stat_dir *lru_next;
+} stat_dir_t;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stat_entry_t *entry_buckets[STATCACHE_BUCKETS];
+static stat_dir_t *path_buckets[STATCACHE_DIR_BUCKETS];
+static stat_dir_t *wd_buckets[STATCACHE_DIR_BUCKETS];
+static stat_dir_t *lru_head = NULL;
+static stat_dir_t *lru_tail = NULL;
+static int dir_count = 0;
+static off_t used = 0;
+static unsigned long next_gen = 0;
+static int inotify_fd = -1;
+static int wake_pipe[2] = {-1, -1};
+static pthread_t watch_thread;
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static unsigned int hash_string(const char *s, size_t len, unsigned int h) {
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static unsigned int entry_bucket(const stat_dir_t *dir, const char *name) {
+    return hash_string(name, strlen(name), (unsigned int)((uintptr_t)dir >> 4) * 2654435761u) &
+           (STATCACHE_BUCKETS - 1);
+}
+
+static stat_dir_t *dir_by_path(const char *path, size_t len) {
+    for (stat_dir_t *dir = path_buckets[hash_string(path, len, 2166136261u) & (STATCACHE_DIR_BUCKETS - 1)];
+         dir != NULL; dir = dir->path_next) {
+        if (strncmp(dir->path, path, len) == 0 && dir->path[len] == '\0') {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+static stat_dir_t *dir_by_wd(int wd) {
+    for (stat_dir_t *dir = wd_buckets[(unsigned int)wd & (STATCACHE_DIR_BUCKETS - 1)]; dir != NULL;
+         dir = dir->wd_next) {
+        if (dir->wd == wd) {
+            return dir;
+        }
+    }
+    return NULL;
+}
+
+static stat_entry_t *entry_lookup(const stat_dir_t *dir, const char *name) {
+    for (stat_entry_t *entry = entry_buckets[entry_bucket(dir, name)]; entry != NULL; entry = entry->hash_next) {
+        if (entry->dir == dir && strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void entry_free(stat_entry_t *entry) {
+    stat_entry_t **link = &entry_buckets[entry_bucket(entry->dir, entry->name)];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    size_t size = sizeof(stat_entry_t) + strlen(entry->name) + 1;
+    entry->dir->bytes -= size;
+    used -= (off_t)size;
+    free(entry);
+}
+
+// Forget what changed in a directory: one name, or everything
+static void dir_invalidate(stat_dir_t *dir, const char *name) {
+    stat_entry_t **link = &dir->entries;
+    while (*link != NULL) {
+        stat_entry_t *entry = *link;
+        if (name == NULL || strcmp(entry->name, name) == 0) {
+            *link = entry->dir_next;
+            entry_free(entry);
+        } else {
+            link = &entry->dir_next;
+        }
+    }
+    dir->gen = ++next_gen;
+}
+
+static void lru_unlink(stat_dir_t *dir) {
+    if (dir->lru_prev) dir->lru_prev->lru_next = dir->lru_next; else lru_head = dir->lru_next;
+    if (dir->lru_next) dir->lru_next->lru_prev = dir->lru_prev; else lru_tail = dir->lru_prev;
+    dir->lru_prev = dir->lru_next = NULL;
+}
+
+static void lru_push(stat_dir_t *dir) {
+    dir->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = dir; else lru_tail = dir;
+    lru_head = dir;
+}
+
+// Stop watching a directory; the watch is already gone when the kernel dropped it
+static void dir_remove(stat_dir_t *dir, int watched) {
+    dir_invalidate(dir, NULL);
+    if (watched) {
+        inotify_rm_watch(inotify_fd, dir->wd);
+    }
+
+    stat_dir_t **link = &path_buckets[hash_string(dir->path, strlen(dir->path), 2166136261u) &
+                                      (STATCACHE_DIR_BUCKETS - 1)];
+    while (*link != dir) link = &(*link)->path_next;
+    *link = dir->path_next;
+    link = &wd_buckets[(unsigned int)dir->wd & (STATCACHE_DIR_BUCKETS - 1)];
+    while (*link != dir) link = &(*link)->wd_next;
+    *link = dir->wd_next;
+    lru_unlink(dir);
+
+    used -= (off_t)dir->bytes;
+    dir_count--;
+    free(dir->path);
+    free(dir);
+}
+
+// Make room by dropping the least recently used directories other than keep
+static void evict(const stat_dir_t *keep) {
+    while ((used > stat_cache_size || dir_count > STATCACHE_MAX_DIRS) && lru_tail != NULL && lru_tail != keep) {
+        dir_remove(lru_tail, 1);
+    }
+}
+
+// Start watching a directory. The watch goes in before anything in it is
+// stat'd, so no change can slip between the two.
+static stat_dir_t *dir_add(const char *path, size_t len) {
+    stat_dir_t *dir = calloc(1, sizeof(stat_dir_t));
+    if (dir == NULL || (dir->path = strndup(path, len)) == NULL) {
+        free(dir);
+        return NULL;
+    }
+
+    dir->wd = inotify_add_watch(inotify_fd, dir->path, WATCH_EVENTS);
+    if (dir->wd < 0 || dir_by_wd(dir->wd) != NULL) {
+        // Unwatchable, or another path for a directory already watched
+        if (dir->wd < 0) {
+            log_message(FTPLOG_DEBUG, "Stat cache: Cannot watch %s: %s", dir->path, strerror(errno));
+        }
+        free(dir->path);
+        free(dir);
+        return NULL;
+    }
+
+    unsigned int b = hash_string(path, len, 2166136261u) & (STATCACHE_DIR_BUCKETS - 1);
+    dir->path_next = path_buckets[b];
+    path_buckets[b] = dir;
+    b = (unsigned int)dir->wd & (STATCACHE_DIR_BUCKETS - 1);
+    dir->wd_next = wd_buckets[b];
+    wd_buckets[b] = dir;
+    lru_push(dir);
+
+    dir->gen = ++next_gen;
+    dir->bytes = sizeof(stat_dir_t) + len + 1;
+    used += (off_t)dir->bytes;
+    dir_count++;
+    evict(dir);
+    return dir;
+}
+
+static void entry_add(stat_dir_t *dir, const char *name, const struct stat *st) {
+    size_t size = sizeof(stat_entry_t) + strlen(name) + 1;
+    stat_entry_t *entry = malloc(size);
+    if (entry == NULL) {
+        return;
+    }
+    entry->dir = dir;
+    entry->st = *st;
+    strcpy(entry->name, name);
+
+    unsigned int b = entry_bucket(dir, name);
+    entry->hash_next = entry_buckets[b];
+    entry_buckets[b] = entry;
+    entry->dir_next = dir->entries;
+    dir->entries = entry;
+    dir->bytes += size;
+    used += (off_t)size;
+    evict(dir);
+}
+
+int statcache_stat(const char *path, struct stat *st) {
+    char normalized[PATH_MAX];
+
+    if (inotify_fd < 0 || !storage_is_posix(path)) {
+        return storage_stat(path, st);
+    }
+
+    // Only plain paths are cached; anything with "." or ".." takes the slow way
+    storage_normalize(path, normalized, sizeof(normalized));
+    const char *slash = strrchr(normalized, '/');
+    if (strcmp(normalized, path) != 0 || slash == normalized) {
+        return stat(path, st) == 0;
+    }
+    size_t dir_len = (size_t)(slash - normalized);
+    const char *name = slash + 1;
+
+    pthread_mutex_lock(&cache_mutex);
+    stat_dir_t *dir = dir_by_path(normalized, dir_len);
+    if (dir != NULL) {
+        stat_entry_t *entry = entry_lookup(dir, name);
+        lru_unlink(dir);
+        lru_push(dir);
+        if (entry != NULL) {
+            *st = entry->st;
+            hits++;
+            pthread_mutex_unlock(&cache_mutex);
+            return 1;
+        }
+    } else {
+        dir = dir_add(normalized, dir_len);
+    }
+    unsigned long gen = dir != NULL ? dir->gen : 0;
+    misses++;
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (lstat(path, st) != 0) {
+        return 0;
+    }
+    // Changes behind a symlink or inside a subdirectory are not seen by this watch
+    if (S_ISLNK(st->st_mode)) {
+        return stat(path, st) == 0;
+    }
+    if (dir == NULL || S_ISDIR(st->st_mode)) {
+        return 1;
+    }
+
+    // Keep the result only if no event arrived while it was being fetched
+    pthread_mutex_lock(&cache_mutex);
+    dir = dir_by_path(normalized, dir_len);
+    if (dir != NULL && dir->gen == gen && entry_lookup(dir, name) == NULL) {
+        entry_add(dir, name, st);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return 1;
+}
+
+static void *watch_main(void *arg) {
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+    (void)arg;
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&cache_mutex);
+        for (char *p = buffer; p < buffer + len; ) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; nothing cached can be trusted
+                for (stat_dir_t *dir = lru_head; dir != NULL; dir = dir->lru_next) {
+                    dir_invalidate(dir, NULL);
+                }
+                log_message(FTPLOG_DEBUG, "Stat cache: Event queue overflowed, cache dropped");
+                continue;
+            }
+            stat_dir_t *dir = dir_by_wd(event->wd);
+            if (dir == NULL) {
+                continue;
+            }
+            if (event->mask & (IN_IGNORED | IN_UNMOUNT)) {
+                dir_remove(dir, 0);
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                dir_remove(dir, 1);
+            } else {
+                dir_invalidate(dir, event->len > 0 ? event->name : NULL);
+            }
+        }
+        pthread_mutex_unlock(&cache_mutex);
+    }
+    return NULL;
+}
+
+int statcache_init(void) {
+    if (stat_cache_size <= 0) {
+        return 1;
+    }
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        log_message(FTPLOG_INFO, "Stat cache: inotify not available (%s), disabled", strerror(errno));
+        return 1;
+    }
+    if (pipe2(wake_pipe, O_CLOEXEC) != 0 || pthread_create(&watch_thread, NULL, watch_main, NULL) != 0) {
+        log_message(FTPLOG_ERROR, "Stat cache: Cannot start watcher thread");
+        close(inotify_fd);
+        inotify_fd = -1;
+        return 0;
+    }
+
+    log_message(FTPLOG_INFO, "Stat cache: %lldK for file metadata", (long long)(stat_cache_size >> 10));
+    return 1;
+}
+
+void statcache_cleanup(void) {
+    if (inotify_fd < 0) {
+        return;
+    }
+    if (write(wake_pipe[1], "", 1) != 1) {
+        log_message(FTPLOG_ERROR, "Stat cache: Cannot stop watcher thread: %s", strerror(errno));
+    }
+    pthread_join(watch_thread, NULL);
+
+    pthread_mutex_lock(&cache_mutex);
+    while (lru_head != NULL) {
+        dir_remove(lru_head, 1);
+    }
+    log_message(FTPLOG_DEBUG, "Stat cache: %lu hits, %lu misses", hits, misses);
+    close(inotify_fd);
+    inotify_fd = -1;
+    pthread_mutex_unlock(&cache_mutex);
+
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+}
@@ -0,0 +1,481 @@
+// src/storage.c
+#include "storage.h"
+#include "bufpool.h"
+#include "fileops.h"
+#include "logging.h"
+#include "utils.h"
+
+// Mounts, longest prefix first; everything else is on the real filesystem
+static storage_t mounts[STORAGE_MAX_MOUNTS];
+static off_t mount_capacity[STORAGE_MAX_MOUNTS];
+static int mount_count = 0;
+static int private_count = 0;
+static storage_t posix_root = {&posix_storage_ops, "", 0, NULL};
+
+static int private_entry(const char *dir, const char *name);
+
+// POSIX backend: the calls the command handlers always made
+
+static int posix_stat(storage_t *storage, const char *path, struct stat *st) {
+    (void)storage;
+    return stat(path, st) == 0;
+}
+
+static int posix_open(storage_t *storage, const char *path, int flags, mode_t mode, storage_file_t *file) {
+    (void)storage;
+    file->fd = open(path, flags | O_CLOEXEC, mode);
+    return file->fd >= 0;
+}
+
+static ssize_t posix_read(storage_file_t *file, void *buf, size_t len) {
+    return read(file->fd, buf, len);
+}
+
+static ssize_t posix_write(storage_file_t *file, const void *buf, size_t len) {
+    return write(file->fd, buf, len);
+}
+
+static int posix_fstat(storage_file_t *file, struct stat *st) {
+    return fstat(file->fd, st) == 0;
+}
+
+static int posix_close(storage_file_t *file) {
+    int ok = close(file->fd) == 0;
+    file->fd = -1;
+    return ok;
+}
+
+static int posix_opendir(storage_t *storage, const char *path, storage_dir_t *dir) {
+    (void)storage;
+    snprintf(dir->path, sizeof(dir->path), "%s", path);
+    dir->dir = opendir(path);
+    return dir->dir != NULL;
+}
+
+static int posix_readdir(storage_dir_t *dir, char *name, size_t size, struct stat *st) {
+    struct dirent *entry;
+
+    // Entries that vanish or cannot be examined are left out, as are private mounts
+    while ((entry = readdir(dir->dir)) != NULL) {
+        if (private_count > 0 && private_entry(dir->path, entry->d_name)) {
+            continue;
+        }
+        if (st == NULL || fstatat(dirfd(dir->dir), entry->d_name, st, 0) == 0) {
+            snprintf(name, size, "%s", entry->d_name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int posix_entry_stat(storage_dir_t *dir, const char *name, struct stat *st) {
+    return fstatat(dirfd(dir->dir), name, st, 0) == 0;
+}
+
+static void posix_closedir(storage_dir_t *dir) {
+    closedir(dir->dir);
+    dir->dir = NULL;
+}
+
+static int posix_rename(storage_t *storage, const char *from, const char *to) {
+    (void)storage;
+    return fileops_rename(from, to);
+}
+
+static int posix_remove(storage_t *storage, const char *path) {
+    char name[NAME_MAX + 1];
+    (void)storage;
+
+    int dir = fileops_open_parent(path, name, sizeof(name));
+    if (dir < 0) {
+        return 0;
+    }
+    int ok = unlinkat(dir, name, 0) == 0;
+    if (!ok && errno == EISDIR) {
+        ok = unlinkat(dir, name, AT_REMOVEDIR) == 0;
+    }
+    int saved = errno;
+    close(dir);
+    errno = saved;
+    return ok;
+}
+
+static int posix_mkdir(storage_t *storage, const char *path, mode_t mode) {
+    char name[NAME_MAX + 1];
+    (void)storage;
+
+    int dir = fileops_open_parent(path, name, sizeof(name));
+    if (dir < 0) {
+        return 0;
+    }
+    int ok = mkdirat(dir, name, mode) == 0;
+    int saved = errno;
+    close(dir);
+    errno = saved;
+    return ok;
+}
+
+const storage_ops_t posix_storage_ops = {
+    .name = "posix",
+    .stat = posix_stat,
+    .open = posix_open,
+    .read = posix_read,
+    .write = posix_write,
+    .fstat = posix_fstat,
+    .close = posix_close,
+    .opendir = posix_opendir,
+    .readdir = posix_readdir,
+    .entry_stat = posix_entry_stat,
+    .closedir = posix_closedir,
+    .rename = posix_rename,
+    .remove = posix_remove,
+    .mkdir = posix_mkdir,
+    .destroy = NULL,
+};
+
+// Private backend: an area inside the root that clients may not touch
+
+static int private_stat(storage_t *storage, const char *path, struct stat *st) {
+    (void)storage; (void)path; (void)st;
+    errno = EACCES;
+    return 0;
+}
+
+static int private_open(storage_t *storage, const char *path, int flags, mode_t mode, storage_file_t *file) {
+    (void)storage; (void)path; (void)flags; (void)mode; (void)file;
+    errno = EACCES;
+    return 0;
+}
+
+static int private_opendir(storage_t *storage, const char *path, storage_dir_t *dir) {
+    (void)storage; (void)path; (void)dir;
+    errno = EACCES;
+    return 0;
+}
+
+static int private_rename(storage_t *storage, const char *from, const char *to) {
+    (void)storage; (void)from; (void)to;
+    errno = EACCES;
+    return 0;
+}
+
+static int private_path_op(storage_t *storage, const char *path) {
+    (void)storage; (void)path;
+    errno = EACCES;
+    return 0;
+}
+
+static int private_mkdir(storage_t *storage, const char *path, mode_t mode) {
+    (void)mode;
+    return private_path_op(storage, path);
+}
+
+// Nothing is ever opened, so there are no file or listing operations
+static const storage_ops_t private_storage_ops = {
+    .name = "private",
+    .stat = private_stat,
+    .open = private_open,
+    .opendir = private_opendir,
+    .rename = private_rename,
+    .remove = private_path_op,
+    .mkdir = private_mkdir,
+    .destroy = NULL,
+};
+
+// Whether dir/name is a private mount point, to be left out of listings
+static int private_entry(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return n > 0 && (size_t)n < sizeof(path) && storage_for(path)->ops == &private_storage_ops;
+}
+
+// Longest prefix first, so nested mounts win
+static void sort_mounts(void) {
+    for (int i = 1; i < mount_count; i++) {
+        for (int j = i; j > 0 && mounts[j].prefix_len > mounts[j - 1].prefix_len; j--) {
+            storage_t tmp = mounts[j];
+            mounts[j] = mounts[j - 1];
+            mounts[j - 1] = tmp;
+        }
+    }
+}
+
+int storage_add_memory(const char *spec) {
+    char path[PATH_MAX];
+    off_t capacity = 0;
+
+    if (mount_count == STORAGE_MAX_MOUNTS || spec[0] != '/') {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s", spec);
+    char *colon = strrchr(path, ':');
+    if (colon != NULL) {
+        if (!parse_size(colon + 1, &capacity)) {
+            return 0;
+        }
+        *colon = '\0';
+    }
+
+    // The prefix holds the path relative to the root until storage_init()
+    storage_t *mount = &mounts[mount_count];
+    memset(mount, 0, sizeof(*mount));
+    mount->ops = &memory_storage_ops;
+    snprintf(mount->prefix, sizeof(mount->prefix), "%s", path);
+    mount_capacity[mount_count] = capacity;
+    mount_count++;
+    return 1;
+}
+
+void storage_normalize(const char *path, char *out, size_t size) {
+    size_t len = 0;
+    const char *p = path;
+
+    out[0] = '\0';
+    while (*p != '\0') {
+        while (*p == '/') p++;
+        size_t n = strcspn(p, "/");
+        if (n == 0) {
+            break;
+        }
+        if (n == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+            out[len] = '\0';
+        } else if (!(n == 1 && p[0] == '.') && len + n + 2 <= size) {
+            out[len++] = '/';
+            memcpy(out + len, p, n);
+            len += n;
+            out[len] = '\0';
+        }
+        p += n;
+    }
+    if (len == 0) {
+        snprintf(out, size, "/");
+    }
+}
+
+int storage_init(void) {
+    char relative[PATH_MAX];
+    char joined[PATH_MAX * 2];
+
+    for (int i = 0; i < mount_count; i++) {
+        storage_t *mount = &mounts[i];
+        storage_normalize(mount->prefix, relative, sizeof(relative));
+        snprintf(joined, sizeof(joined), "%s%s", root_directory, relative);
+        storage_normalize(joined, mount->prefix, sizeof(mount->prefix));
+        mount->prefix_len = strlen(mount->prefix);
+
+        // A directory on disk makes the mount point show up in its parent's listing
+        if (mount->prefix_len > strlen(root_directory) && mkdir(mount->prefix, 0755) != 0 && errno != EEXIST) {
+            log_message(FTPLOG_ERROR, "Cannot create mount point %s: %s", mount->prefix, strerror(errno));
+            return 0;
+        }
+        if (!memory_storage_create(mount, mount_capacity[i])) {
+            log_message(FTPLOG_ERROR, "Cannot create in-memory store for %s", mount->prefix);
+            return 0;
+        }
+        log_message(FTPLOG_INFO, "Storage: %s is in memory (limit %lld bytes)", mount->prefix,
+                    (long long)mount_capacity[i]);
+    }
+
+    sort_mounts();
+    return 1;
+}
+
+int storage_add_private(const char *path) {
+    if (mount_count == STORAGE_MAX_MOUNTS || path[0] != '/') {
+        errno = ENOSPC;
+        return 0;
+    }
+
+    storage_t *mount = &mounts[mount_count];
+    memset(mount, 0, sizeof(*mount));
+    mount->ops = &private_storage_ops;
+    storage_normalize(path, mount->prefix, sizeof(mount->prefix));
+    mount->prefix_len = strlen(mount->prefix);
+    mount->data = mount;  // No state, but marks the mount as set up
+    log_message(FTPLOG_INFO, "Storage: %s is private", mount->prefix);
+    mount_count++;
+    private_count++;
+    sort_mounts();
+    return 1;
+}
+
+void storage_cleanup(void) {
+    for (int i = 0; i < mount_count; i++) {
+        if (mounts[i].ops->destroy != NULL && mounts[i].data != NULL) {
+            mounts[i].ops->destroy(&mounts[i]);
+        }
+    }
+    mount_count = 0;
+    private_count = 0;
+}
+
+// Backend for a path, judged on its lexical form so "disk/../mem" is in the
+// mount; *path is switched to that form for backends other than POSIX
+static storage_t *resolve(const char **path, char lexical[PATH_MAX]) {
+    storage_normalize(*path, lexical, PATH_MAX);
+    for (int i = 0; i < mount_count; i++) {
+        storage_t *mount = &mounts[i];
+        if (mount->data != NULL && strncmp(lexical, mount->prefix, mount->prefix_len) == 0 &&
+            (lexical[mount->prefix_len] == '\0' || lexical[mount->prefix_len] == '/')) {
+            *path = lexical;
+            return mount;
+        }
+    }
+    return &posix_root;
+}
+
+storage_t *storage_for(const char *path) {
+    char lexical[PATH_MAX];
+    return resolve(&path, lexical);
+}
+
+int storage_is_posix(const char *path) {
+    return storage_for(path)->ops == &posix_storage_ops;
+}
+
+int storage_realpath(const char *path, char resolved[PATH_MAX]) {
+    char lexical[PATH_MAX];
+    if (resolve(&path, lexical) == &posix_root) {
+        return realpath(path, resolved) != NULL;
+    }
+    snprintf(resolved, PATH_MAX, "%s", path);
+    return 1;
+}
+
+int storage_exists(const char *path) {
+    struct stat st;
+    if (storage_is_posix(path)) {
+        return fileops_exists(path);
+    }
+    return storage_stat(path, &st);
+}
+
+int storage_stat(const char *path, struct stat *st) {
+    char lexical[PATH_MAX];
+    storage_t *storage = resolve(&path, lexical);
+    return storage->ops->stat(storage, path, st);
+}
+
+int storage_open(const char *path, int flags, mode_t mode, storage_file_t *file) {
+    char lexical[PATH_MAX];
+    storage_t *storage = resolve(&path, lexical);
+    memset(file, 0, sizeof(*file));
+    file->storage = storage;
+    file->fd = -1;
+    return storage->ops->open(storage, path, flags, mode, file);
+}
+
+ssize_t storage_read(storage_file_t *file, void *buf, size_t len) {
+    return file->storage->ops->read(file, buf, len);
+}
+
+ssize_t storage_write(storage_file_t *file, const void *buf, size_t len) {
+    return file->storage->ops->write(file, buf, len);
+}
+
+int storage_fstat(storage_file_t *file, struct stat *st) {
+    return file->storage->ops->fstat(file, st);
+}
+
+int storage_close(storage_file_t *file) {
+    return file->storage->ops->close(file);
+}
+
+int storage_opendir(const char *path, storage_dir_t *dir) {
+    char lexical[PATH_MAX];
+    storage_t *storage = resolve(&path, lexical);
+    memset(dir, 0, sizeof(*dir));
+    dir->storage = storage;
+    return storage->ops->opendir(storage, path, dir);
+}
+
+int storage_readdir(storage_dir_t *dir, char *name, size_t size, struct stat *st) {
+    return dir->storage->ops->readdir(dir, name, size, st);
+}
+
+int storage_entry_stat(storage_dir_t *dir, const char *name, struct stat *st) {
+    return dir->storage->ops->entry_stat(dir, name, st);
+}
+
+void storage_closedir(storage_dir_t *dir) {
+    dir->storage->ops->closedir(dir);
+}
+
+int storage_remove(const char *path) {
+    char lexical[PATH_MAX];
+    storage_t *storage = resolve(&path, lexical);
+    return storage->ops->remove(storage, path);
+}
+
+int storage_mkdir(const char *path, mode_t mode) {
+    char lexical[PATH_MAX];
+    storage_t *storage = resolve(&path, lexical);
+    return storage->ops->mkdir(storage, path, mode);
+}
+
+int storage_rename(const char *from, const char *to) {
+    char from_lexical[PATH_MAX], to_lexical[PATH_MAX];
+    storage_t *storage = resolve(&from, from_lexical);
+    if (resolve(&to, to_lexical) != storage) {
+        errno = EXDEV;
+        return 0;
+    }
+    return storage->ops->rename(storage, from, to);
+}
+
+int storage_copy(const char *from, const char *to, void (*progress)(void *arg), void *arg) {
+    storage_file_t src, dst;
+    struct stat st;
+    int ok = 0;
+
+    if (!storage_open(from, O_RDONLY, 0, &src)) {
+        return 0;
+    }
+    if (!storage_fstat(&src, &st) || !S_ISREG(st.st_mode)) {
+        if (S_ISDIR(st.st_mode)) errno = EISDIR;
+        storage_close(&src);
+        return 0;
+    }
+    if (!storage_open(to, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777, &dst)) {
+        int saved = errno;
+        storage_close(&src);
+        errno = saved;
+        return 0;
+    }
+
+    char *buffer = bufpool_get();
+    ok = buffer != NULL;
+    ssize_t n;
+    while (ok && (n = storage_read(&src, buffer, BUFPOOL_BUFFER_SIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = 0;
+            break;
+        }
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = storage_write(&dst, buffer + done, (size_t)(n - done));
+            if (w < 0) {
+                ok = 0;
+                break;
+            }
+            done += w;
+        }
+        if (ok && progress) {
+            progress(arg);
+        }
+    }
+
+    int saved = errno;
+    if (buffer) bufpool_put(buffer);
+    storage_close(&src);
+    if (!storage_close(&dst)) {
+        ok = 0;
+    }
+    if (!ok) {
+        storage_remove(to);
+        errno = saved;
+    }
+    return ok;
+}
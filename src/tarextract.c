@@ -0,0 +1,825 @@
+// src/tarextract.c
+#include "tarextract.h"
+#include "bufpool.h"
+#include "durability.h"
+#include "fileops.h"
+#include "storage.h"
+#include "logging.h"
+#include "tls.h"
+#include <stddef.h>
+#include <sys/xattr.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define HAVE_OPENAT2 1
+#endif
+#endif
+
+int extract_threads = DEFAULT_EXTRACT_THREADS;
+
+// What the body of the current entry is for
+typedef enum {
+    ENTRY_SKIP,        // Discarded
+    ENTRY_QUEUED,      // Small file collected in memory for a worker
+    ENTRY_DIRECT,      // Large file written as it arrives
+    ENTRY_PAX,         // pax extended header for the next entry
+    ENTRY_LONGNAME     // GNU long name for the next entry
+} entry_kind_t;
+
+struct extract_ctx;
+
+// A small file read completely into memory, waiting for a worker
+typedef struct extract_job {
+    struct extract_ctx *ctx;
+    char path[PATH_MAX];
+    mode_t mode;
+    time_t mtime;
+    char *data;
+    size_t size;
+    size_t reserved;               // Counted against the upload's buffer limit
+    struct extract_job *next;
+} extract_job_t;
+
+typedef struct extract_ctx {
+    int root_fd;
+    const char *dir;               // Absolute path of root_fd
+    tar_extract_stats_t *stats;
+    quota_reservation_t *quota;    // NULL if no quotas apply
+    const char *owner;             // Recorded on each file for user quotas, or NULL
+
+    unsigned char header[TAR_BLOCK];
+    size_t header_used;
+    int ended;                     // End-of-archive block seen
+    entry_kind_t kind;
+    off_t remaining;               // Body bytes still to come
+    off_t padding;                 // Then this many up to the next block
+    char path[PATH_MAX];           // Cleaned name of the current entry
+    mode_t mode;
+    time_t mtime;
+    extract_job_t *job;            // ENTRY_QUEUED
+    int fd;                        // ENTRY_DIRECT
+    char *meta;                    // ENTRY_PAX, ENTRY_LONGNAME
+    size_t meta_used;
+
+    // Set by a pax header or GNU long name, used by the entry after it
+    char next_path[PATH_MAX];
+    off_t next_size;               // -1 if not set
+
+    char last_dir[PATH_MAX];       // Most recent directory known to exist
+    size_t last_dir_len;
+
+    // Protected by extract_mutex
+    size_t queued_bytes;
+    int queued_jobs;
+} extract_ctx_t;
+
+static pthread_mutex_t extract_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static extract_job_t *queue_head = NULL;
+static extract_job_t *queue_tail = NULL;
+static pthread_t *workers = NULL;
+static int worker_count = 0;
+static int workers_running = 0;
+
+int tar_extract_target(const char *path, char *dir, size_t size) {
+    char candidate[PATH_MAX];
+    struct stat st;
+    size_t len = strlen(path);
+
+    if (len <= 4 || strcmp(path + len - 4, ".tar") != 0) {
+        return 0;
+    }
+    snprintf(candidate, sizeof(candidate), "%.*s", (int)(len - 4), path);
+    return realpath(candidate, dir) != NULL && strlen(dir) < size &&
+           stat(dir, &st) == 0 && S_ISDIR(st.st_mode) && fileops_inside_root(dir) &&
+           storage_is_posix(dir);
+}
+
+// Open rel below root_fd without following symlinks or leaving the tree
+static int open_beneath(int root_fd, const char *rel, int flags, mode_t mode) {
+#ifdef HAVE_OPENAT2
+    static volatile int have_openat2 = 1;
+    if (have_openat2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = (unsigned long long)(flags | O_CLOEXEC);
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+        int fd = (int)syscall(SYS_openat2, root_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) {
+            return fd;
+        }
+        have_openat2 = 0;
+    }
+#endif
+
+    // Older kernels: one component at a time, refusing symlinks at each step
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", rel);
+    int dir = root_fd;
+    char *component = buf;
+    char *slash;
+    while ((slash = strchr(component, '/')) != NULL) {
+        *slash = '\0';
+        int next = openat(dir, component, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dir != root_fd) close(dir);
+        if (next < 0) {
+            return -1;
+        }
+        dir = next;
+        component = slash + 1;
+    }
+    int fd = openat(dir, component, flags | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (dir != root_fd) {
+        int saved = errno;
+        close(dir);
+        errno = saved;
+    }
+    return fd;
+}
+
+// Normalise an archive name to a relative path without "." or ".." parts.
+// Returns its length, 0 for the top directory itself, -1 if it would escape.
+static int clean_path(const char *in, char *out, size_t size) {
+    size_t len = 0;
+    while (*in != '\0') {
+        while (*in == '/') in++;
+        size_t n = strcspn(in, "/");
+        if (n == 0) {
+            break;
+        }
+        if (n == 2 && in[0] == '.' && in[1] == '.') {
+            return -1;
+        }
+        if (!(n == 1 && in[0] == '.')) {
+            if (len + n + 2 > size) {
+                return -1;
+            }
+            if (len > 0) {
+                out[len++] = '/';
+            }
+            memcpy(out + len, in, n);
+            len += n;
+        }
+        in += n;
+    }
+    out[len] = '\0';
+    return (int)len;
+}
+
+// Members may only land on disk: a memory or private mount below the target
+// directory is not written through to the disk beneath it
+static int member_allowed(extract_ctx_t *ctx, const char *rel) {
+    char path[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/%s", ctx->dir, rel);
+    return n > 0 && (size_t)n < sizeof(path) && storage_is_posix(path);
+}
+
+// Create each missing directory along the first len bytes of rel
+static int make_dirs(extract_ctx_t *ctx, const char *rel, size_t len) {
+    if (len == 0 || (len == ctx->last_dir_len && memcmp(rel, ctx->last_dir, len) == 0)) {
+        return 1;
+    }
+
+    char partial[PATH_MAX];
+    memcpy(partial, rel, len);
+    partial[len] = '\0';
+    for (size_t i = 1; i <= len; i++) {
+        if (i < len && partial[i] != '/') {
+            continue;
+        }
+        partial[i] = '\0';
+
+        // Members arrive grouped by directory, so most prefixes were made just before
+        if (i <= ctx->last_dir_len && memcmp(partial, ctx->last_dir, i) == 0 &&
+            (i == ctx->last_dir_len || ctx->last_dir[i] == '/')) {
+            if (i < len) partial[i] = '/';
+            continue;
+        }
+
+        char *slash = strrchr(partial, '/');
+        const char *name = partial;
+        int parent = ctx->root_fd;
+        if (slash != NULL) {
+            *slash = '\0';
+            parent = open_beneath(ctx->root_fd, partial, O_PATH | O_DIRECTORY, 0);
+            *slash = '/';
+            name = slash + 1;
+            if (parent < 0) {
+                return 0;
+            }
+        }
+
+        int ok = 1;
+        if (mkdirat(parent, name, 0755) != 0) {
+            struct stat st;
+            ok = errno == EEXIST && fstatat(parent, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+            if (ok && !S_ISDIR(st.st_mode)) {
+                errno = ENOTDIR;
+                ok = 0;
+            }
+        }
+        if (parent != ctx->root_fd) {
+            int saved = errno;
+            close(parent);
+            errno = saved;
+        }
+        if (!ok) {
+            return 0;
+        }
+        if (i < len) partial[i] = '/';
+    }
+
+    memcpy(ctx->last_dir, rel, len);
+    ctx->last_dir[len] = '\0';
+    ctx->last_dir_len = len;
+    return 1;
+}
+
+// Create the file for an entry. An existing file is replaced rather than
+// truncated, since it may share its inode with deduplicated copies.
+static int create_file(int root_fd, const char *rel) {
+    int fd = open_beneath(root_fd, rel, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0 || errno != EEXIST) {
+        return fd;
+    }
+
+    char dir[PATH_MAX];
+    const char *slash = strrchr(rel, '/');
+    int parent = root_fd;
+    if (slash != NULL) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - rel), rel);
+        if ((parent = open_beneath(root_fd, dir, O_PATH | O_DIRECTORY, 0)) < 0) {
+            return -1;
+        }
+    }
+    int removed = unlinkat(parent, slash ? slash + 1 : rel, 0) == 0;
+    int saved = errno;
+    if (parent != root_fd) close(parent);
+    if (!removed) {
+        errno = saved;
+        return -1;
+    }
+    return open_beneath(root_fd, rel, O_WRONLY | O_CREAT | O_EXCL, 0600);
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Apply permissions, modification time and owner, make durable and close
+static int finish_file(int fd, mode_t mode, time_t mtime, const char *owner) {
+    struct timespec times[2] = {{0, UTIME_OMIT}, {mtime, 0}};
+    int ok = fchmod(fd, mode & 0777) == 0;
+    futimens(fd, times);
+    if (owner != NULL) {
+        fsetxattr(fd, QUOTA_OWNER_XATTR, owner, strlen(owner), 0);
+    }
+    ok = durability_commit(fd) && ok;
+    if (close(fd) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+static int write_job(extract_job_t *job) {
+    int fd = create_file(job->ctx->root_fd, job->path);
+    if (fd < 0) {
+        return 0;
+    }
+    if (!write_all(fd, job->data, job->size)) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return 0;
+    }
+    return finish_file(fd, job->mode, job->mtime, job->ctx->owner);
+}
+
+// Account for a finished job; called with extract_mutex held
+static void job_done(extract_job_t *job, int ok) {
+    extract_ctx_t *ctx = job->ctx;
+    if (ok) {
+        ctx->stats->files++;
+    } else {
+        ctx->stats->errors++;
+    }
+    ctx->queued_bytes -= job->reserved;
+    ctx->queued_jobs--;
+    pthread_cond_broadcast(&done_cond);
+}
+
+static void free_job(extract_job_t *job) {
+    free(job->data);
+    free(job);
+}
+
+static void *extract_worker(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&extract_mutex);
+    for (;;) {
+        while (queue_head == NULL && workers_running) {
+            pthread_cond_wait(&work_cond, &extract_mutex);
+        }
+        extract_job_t *job = queue_head;
+        if (job == NULL) {
+            break;
+        }
+        queue_head = job->next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&extract_mutex);
+
+        int ok = write_job(job);
+        if (!ok) {
+            log_message(FTPLOG_ERROR, "Extract: Failed to write %s - %s", job->path, strerror(errno));
+        }
+
+        pthread_mutex_lock(&extract_mutex);
+        job_done(job, ok);
+        pthread_mutex_unlock(&extract_mutex);
+        free_job(job);
+        pthread_mutex_lock(&extract_mutex);
+    }
+    pthread_mutex_unlock(&extract_mutex);
+
+    return NULL;
+}
+
+// Hand a complete small file to the workers, or write it here if there are none
+static void submit_job(extract_job_t *job) {
+    pthread_mutex_lock(&extract_mutex);
+    if (workers_running) {
+        job->next = NULL;
+        if (queue_tail != NULL) {
+            queue_tail->next = job;
+        } else {
+            queue_head = job;
+        }
+        queue_tail = job;
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&extract_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&extract_mutex);
+
+    int ok = write_job(job);
+    if (!ok) {
+        log_message(FTPLOG_ERROR, "Extract: Failed to write %s - %s", job->path, strerror(errno));
+    }
+    pthread_mutex_lock(&extract_mutex);
+    job_done(job, ok);
+    pthread_mutex_unlock(&extract_mutex);
+    free_job(job);
+}
+
+static void count(long *counter) {
+    pthread_mutex_lock(&extract_mutex);
+    (*counter)++;
+    pthread_mutex_unlock(&extract_mutex);
+}
+
+// Parse an octal header field, or GNU base-256 for large values
+static int parse_number(const char *field, size_t len, long long *value) {
+    const unsigned char *p = (const unsigned char *)field;
+    long long v = 0;
+
+    if (p[0] & 0x80) {
+        v = p[0] & 0x3f;
+        for (size_t i = 1; i < len; i++) {
+            if (v > (LLONG_MAX >> 8)) return 0;
+            v = (v << 8) | p[i];
+        }
+        *value = v;
+        return 1;
+    }
+
+    size_t i = 0;
+    while (i < len && p[i] == ' ') i++;
+    if (i == len || p[i] < '0' || p[i] > '7') {
+        return 0;
+    }
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+        if (v > (LLONG_MAX >> 3)) return 0;
+        v = (v << 3) | (p[i] - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+static int header_checksum_ok(const tar_header_t *h) {
+    long long stored;
+    if (!parse_number(h->chksum, sizeof(h->chksum), &stored)) {
+        return 0;
+    }
+    long long sum = 0;
+    const unsigned char *bytes = (const unsigned char *)h;
+    for (size_t i = 0; i < sizeof(*h); i++) {
+        int in_chksum = i >= offsetof(tar_header_t, chksum) &&
+                        i < offsetof(tar_header_t, chksum) + sizeof(h->chksum);
+        sum += in_chksum ? ' ' : bytes[i];
+    }
+    return sum == stored;
+}
+
+static void start_file(extract_ctx_t *ctx, const char *name) {
+    int len = clean_path(name, ctx->path, sizeof(ctx->path));
+    if (len <= 0 || !member_allowed(ctx, ctx->path)) {
+        log_message(FTPLOG_ERROR, "Extract: Skipping unsafe name %s", name);
+        count(&ctx->stats->skipped);
+        return;
+    }
+
+    // Nothing more is written once a quota has no room for the next file
+    if (ctx->stats->over_quota) {
+        return;
+    }
+    if (ctx->quota != NULL && !quota_extend(ctx->quota, ctx->stats->written + ctx->remaining)) {
+        log_message(FTPLOG_INFO, "Extract: Quota exceeded at %s", ctx->path);
+        ctx->stats->over_quota = 1;
+        return;
+    }
+    ctx->stats->written += ctx->remaining;
+
+    const char *slash = strrchr(ctx->path, '/');
+    if (!make_dirs(ctx, ctx->path, slash ? (size_t)(slash - ctx->path) : 0)) {
+        log_message(FTPLOG_ERROR, "Extract: Cannot create directory for %s - %s", ctx->path, strerror(errno));
+        count(&ctx->stats->errors);
+        return;
+    }
+
+    if (ctx->remaining <= EXTRACT_INLINE_MAX) {
+        // Wait for earlier files of this upload to be written if too much is buffered
+        size_t size = (size_t)ctx->remaining;
+        pthread_mutex_lock(&extract_mutex);
+        while (ctx->queued_jobs > 0 && ctx->queued_bytes + size > EXTRACT_QUEUE_BYTES) {
+            pthread_cond_wait(&done_cond, &extract_mutex);
+        }
+        ctx->queued_bytes += size;
+        ctx->queued_jobs++;
+        pthread_mutex_unlock(&extract_mutex);
+
+        extract_job_t *job = calloc(1, sizeof(extract_job_t));
+        char *data = job != NULL ? malloc(size > 0 ? size : 1) : NULL;
+        if (data == NULL) {
+            free(job);
+            pthread_mutex_lock(&extract_mutex);
+            ctx->queued_bytes -= size;
+            ctx->queued_jobs--;
+            ctx->stats->errors++;
+            pthread_mutex_unlock(&extract_mutex);
+            return;
+        }
+        job->ctx = ctx;
+        memcpy(job->path, ctx->path, (size_t)len + 1);
+        job->mode = ctx->mode;
+        job->mtime = ctx->mtime;
+        job->data = data;
+        job->reserved = size;
+        ctx->job = job;
+        ctx->kind = ENTRY_QUEUED;
+        return;
+    }
+
+    ctx->fd = create_file(ctx->root_fd, ctx->path);
+    if (ctx->fd < 0) {
+        log_message(FTPLOG_ERROR, "Extract: Failed to create %s - %s", ctx->path, strerror(errno));
+        count(&ctx->stats->errors);
+        return;
+    }
+    fallocate(ctx->fd, FALLOC_FL_KEEP_SIZE, 0, ctx->remaining);
+    ctx->kind = ENTRY_DIRECT;
+}
+
+static void entry_data(extract_ctx_t *ctx, const char *data, size_t len) {
+    switch (ctx->kind) {
+        case ENTRY_QUEUED:
+            memcpy(ctx->job->data + ctx->job->size, data, len);
+            ctx->job->size += len;
+            break;
+        case ENTRY_DIRECT:
+            if (!write_all(ctx->fd, data, len)) {
+                log_message(FTPLOG_ERROR, "Extract: Failed to write %s - %s", ctx->path, strerror(errno));
+                close(ctx->fd);
+                ctx->fd = -1;
+                ctx->kind = ENTRY_SKIP;
+                count(&ctx->stats->errors);
+            }
+            break;
+        case ENTRY_PAX:
+        case ENTRY_LONGNAME:
+            memcpy(ctx->meta + ctx->meta_used, data, len);
+            ctx->meta_used += len;
+            break;
+        default:
+            break;
+    }
+}
+
+// Take path and size from pax records ("length key=value\n")
+static void parse_pax(extract_ctx_t *ctx) {
+    size_t pos = 0;
+    while (pos < ctx->meta_used) {
+        char *end;
+        unsigned long record = strtoul(ctx->meta + pos, &end, 10);
+        if (end == ctx->meta + pos || *end != ' ' || record == 0 || pos + record > ctx->meta_used ||
+            ctx->meta[pos + record - 1] != '\n') {
+            break;
+        }
+        char *key = end + 1;
+        char *eq = memchr(key, '=', ctx->meta + pos + record - key);
+        if (eq != NULL) {
+            size_t value_len = (size_t)(ctx->meta + pos + record - 1 - (eq + 1));
+            if ((size_t)(eq - key) == 4 && memcmp(key, "path", 4) == 0 && value_len < sizeof(ctx->next_path)) {
+                memcpy(ctx->next_path, eq + 1, value_len);
+                ctx->next_path[value_len] = '\0';
+            } else if ((size_t)(eq - key) == 4 && memcmp(key, "size", 4) == 0) {
+                ctx->next_size = strtoll(eq + 1, NULL, 10);
+            }
+        }
+        pos += record;
+    }
+}
+
+static void end_entry(extract_ctx_t *ctx) {
+    switch (ctx->kind) {
+        case ENTRY_QUEUED:
+            submit_job(ctx->job);
+            ctx->job = NULL;
+            break;
+        case ENTRY_DIRECT:
+            if (finish_file(ctx->fd, ctx->mode, ctx->mtime, ctx->owner)) {
+                count(&ctx->stats->files);
+            } else {
+                log_message(FTPLOG_ERROR, "Extract: Failed to write %s - %s", ctx->path, strerror(errno));
+                count(&ctx->stats->errors);
+            }
+            ctx->fd = -1;
+            break;
+        case ENTRY_PAX:
+            parse_pax(ctx);
+            break;
+        case ENTRY_LONGNAME:
+            ctx->meta[ctx->meta_used] = '\0';
+            snprintf(ctx->next_path, sizeof(ctx->next_path), "%s", ctx->meta);
+            break;
+        default:
+            break;
+    }
+    free(ctx->meta);
+    ctx->meta = NULL;
+    ctx->kind = ENTRY_SKIP;
+}
+
+// A header block has arrived; returns 0 if the archive is malformed
+static int begin_entry(extract_ctx_t *ctx) {
+    static const char zero_block[TAR_BLOCK];
+    const tar_header_t *h = (const tar_header_t *)ctx->header;
+    long long size, mode, mtime;
+    char name[PATH_MAX];
+
+    if (memcmp(ctx->header, zero_block, TAR_BLOCK) == 0) {
+        ctx->ended = 1;
+        return 1;
+    }
+    if (!header_checksum_ok(h) || !parse_number(h->size, sizeof(h->size), &size)) {
+        return 0;
+    }
+    if (!parse_number(h->mode, sizeof(h->mode), &mode)) mode = 0644;
+    if (!parse_number(h->mtime, sizeof(h->mtime), &mtime)) mtime = time(NULL);
+
+    int meta = h->typeflag == 'x' || h->typeflag == 'L';
+    if (!meta) {
+        if (ctx->next_size >= 0) {
+            size = ctx->next_size;
+        }
+        if (ctx->next_path[0] != '\0') {
+            snprintf(name, sizeof(name), "%s", ctx->next_path);
+        } else if (h->prefix[0] != '\0' && memcmp(h->magic, "ustar", 5) == 0) {
+            snprintf(name, sizeof(name), "%.*s/%.*s", (int)strnlen(h->prefix, sizeof(h->prefix)), h->prefix,
+                     (int)strnlen(h->name, sizeof(h->name)), h->name);
+        } else {
+            snprintf(name, sizeof(name), "%.*s", (int)strnlen(h->name, sizeof(h->name)), h->name);
+        }
+        ctx->next_path[0] = '\0';
+        ctx->next_size = -1;
+    }
+
+    ctx->remaining = size;
+    ctx->padding = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+    ctx->mode = (mode_t)mode;
+    ctx->mtime = (time_t)mtime;
+    ctx->kind = ENTRY_SKIP;
+
+    switch (h->typeflag) {
+        case 'x':
+        case 'L':
+            if (size <= EXTRACT_META_MAX && (ctx->meta = malloc((size_t)size + 1)) != NULL) {
+                ctx->meta_used = 0;
+                ctx->kind = h->typeflag == 'x' ? ENTRY_PAX : ENTRY_LONGNAME;
+            }
+            break;
+        case '0':
+        case '\0':
+        case '7':
+            start_file(ctx, name);
+            break;
+        case '5': {
+            int len = clean_path(name, ctx->path, sizeof(ctx->path));
+            if (len < 0 || (len > 0 && !member_allowed(ctx, ctx->path))) {
+                log_message(FTPLOG_ERROR, "Extract: Skipping unsafe name %s", name);
+                count(&ctx->stats->skipped);
+            } else if (len > 0) {
+                if (make_dirs(ctx, ctx->path, (size_t)len)) {
+                    count(&ctx->stats->directories);
+                } else {
+                    log_message(FTPLOG_ERROR, "Extract: Cannot create directory %s - %s", ctx->path, strerror(errno));
+                    count(&ctx->stats->errors);
+                }
+            }
+            break;
+        }
+        case 'g':
+            // Global pax header: nothing in it we use
+            break;
+        default:
+            // Hard and symbolic links, devices, FIFOs
+            log_message(FTPLOG_DEBUG, "Extract: Skipping %s, type %c", name, h->typeflag);
+            count(&ctx->stats->skipped);
+            break;
+    }
+
+    if (ctx->remaining == 0) {
+        end_entry(ctx);
+    }
+    return 1;
+}
+
+// Run received bytes through the archive parser; returns 0 if malformed
+static int extract_feed(extract_ctx_t *ctx, const char *data, size_t len) {
+    while (len > 0 && !ctx->ended) {
+        size_t n;
+        if (ctx->remaining > 0) {
+            n = (off_t)len < ctx->remaining ? len : (size_t)ctx->remaining;
+            entry_data(ctx, data, n);
+            ctx->remaining -= n;
+            if (ctx->remaining == 0) {
+                end_entry(ctx);
+            }
+        } else if (ctx->padding > 0) {
+            n = (off_t)len < ctx->padding ? len : (size_t)ctx->padding;
+            ctx->padding -= n;
+        } else {
+            n = TAR_BLOCK - ctx->header_used;
+            n = len < n ? len : n;
+            memcpy(ctx->header + ctx->header_used, data, n);
+            ctx->header_used += n;
+            if (ctx->header_used == TAR_BLOCK) {
+                ctx->header_used = 0;
+                if (!begin_entry(ctx)) {
+                    return 0;
+                }
+            }
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+int tar_extract(int data_fd, const char *dir, quota_reservation_t *quota, tar_extract_stats_t *stats,
+                tar_progress_t progress, void *arg) {
+    memset(stats, 0, sizeof(*stats));
+
+    extract_ctx_t *ctx = calloc(1, sizeof(extract_ctx_t));
+    char *buffer = bufpool_get();
+    if (ctx == NULL || buffer == NULL) {
+        free(ctx);
+        if (buffer) bufpool_put(buffer);
+        stats->errors++;
+        return 0;
+    }
+    ctx->stats = stats;
+    ctx->quota = quota;
+    ctx->owner = quota != NULL ? quota_owner(quota) : NULL;
+    ctx->dir = dir;
+    ctx->fd = -1;
+    ctx->next_size = -1;
+    ctx->root_fd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (ctx->root_fd < 0) {
+        log_message(FTPLOG_ERROR, "Extract: Cannot open %s - %s", dir, strerror(errno));
+        stats->errors++;
+    }
+
+    ssize_t n = 0;
+    while (ctx->root_fd >= 0) {
+        n = tls_recv(data_fd, buffer, BUFPOOL_BUFFER_SIZE, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        stats->bytes += n;
+        progress(arg, (size_t)n);
+        if (!extract_feed(ctx, buffer, (size_t)n)) {
+            log_message(FTPLOG_ERROR, "Extract: Malformed archive header after %lld bytes", (long long)stats->bytes);
+            n = -1;
+            break;
+        }
+        if (stats->over_quota) {
+            n = -1;
+            break;
+        }
+    }
+
+    // A missing end-of-archive marker is fine if the data stopped between members
+    stats->complete = ctx->ended ||
+                      (n == 0 && ctx->header_used == 0 && ctx->remaining == 0 && ctx->padding == 0);
+
+    // Drop whatever member was cut off
+    if (ctx->kind == ENTRY_QUEUED) {
+        pthread_mutex_lock(&extract_mutex);
+        ctx->queued_bytes -= ctx->job->reserved;
+        ctx->queued_jobs--;
+        pthread_mutex_unlock(&extract_mutex);
+        free_job(ctx->job);
+    } else if (ctx->kind == ENTRY_DIRECT) {
+        close(ctx->fd);
+    }
+    free(ctx->meta);
+
+    // Files handed to the workers still refer to ctx
+    pthread_mutex_lock(&extract_mutex);
+    while (ctx->queued_jobs > 0) {
+        pthread_cond_wait(&done_cond, &extract_mutex);
+    }
+    pthread_mutex_unlock(&extract_mutex);
+
+    if (ctx->root_fd >= 0) {
+        close(ctx->root_fd);
+    }
+    bufpool_put(buffer);
+    free(ctx);
+
+    // Each file was synced as it was finished; the new names and
+    // directories are made durable once for the whole archive
+    if (stats->complete && stats->errors == 0 && !durability_commit_tree(dir)) {
+        log_message(FTPLOG_ERROR, "Extract: Cannot sync %s - %s", dir, strerror(errno));
+        stats->errors++;
+    }
+    return stats->complete && stats->errors == 0 && !stats->over_quota;
+}
+
+int tar_extract_init(void) {
+    if (extract_threads <= 0) {
+        return 1;
+    }
+
+    workers = calloc((size_t)extract_threads, sizeof(pthread_t));
+    if (workers == NULL) {
+        return 0;
+    }
+    workers_running = 1;
+    for (int i = 0; i < extract_threads; i++) {
+        if (pthread_create(&workers[worker_count], NULL, extract_worker, NULL) != 0) {
+            log_message(FTPLOG_ERROR, "Failed to start extract thread: %s", strerror(errno));
+            break;
+        }
+        worker_count++;
+    }
+    if (worker_count == 0) {
+        workers_running = 0;
+        free(workers);
+        workers = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void tar_extract_cleanup(void) {
+    pthread_mutex_lock(&extract_mutex);
+    workers_running = 0;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&extract_mutex);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+}
@@ -0,0 +1,530 @@
+// src/tarstream.c
+#include "tarstream.h"
+#include "bufpool.h"
+#include "fileops.h"
+#include "logging.h"
+#include "storage.h"
+#include "tls.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define TAR_RECORD (20 * TAR_BLOCK)            // Archives are padded to whole records
+#define TAR_PREFETCH_BYTES (1024 * 1024)       // Readahead issued for each upcoming file
+#define TAR_SENDFILE_CHUNK (1024 * 1024)       // Bytes per sendfile() between progress reports
+#define TAR_USTAR_MAX_SIZE 077777777777LL      // Larger sizes go in a pax header
+#define TAR_USTAR_MAX_ID 07777777
+#define TAR_PAX_MAX (2 * PATH_MAX + 256)
+
+// One archive member, opened ahead of time
+typedef struct {
+    char path[PATH_MAX];           // Name in the archive, directories end in '/'
+    char link[PATH_MAX];           // Symlink target
+    struct stat st;
+    int fd;                        // Open regular file, -1 otherwise
+} tar_entry_t;
+
+typedef struct {
+    DIR *dir;
+    size_t len;                    // Length of this directory's archive path
+} walk_level_t;
+
+// Depth-first walk that holds one open directory per level and nothing else
+typedef struct {
+    walk_level_t stack[TAR_MAX_DEPTH];
+    int depth;
+    char path[PATH_MAX];           // Archive path of the deepest open directory
+    const char *dir;               // Directory on disk the archive is made of
+    size_t root_len;               // Length of its own archive path
+    tar_stats_t *stats;
+} tar_walker_t;
+
+typedef struct {
+    int fd;
+    tar_format_t format;
+    char *buf;                     // Bytes waiting to be sent (compressed for gzip)
+    size_t len;
+    char *io;                      // File contents on their way into buf
+    off_t archive_bytes;           // Uncompressed size so far, for the record padding
+    int failed;
+    tar_stats_t *stats;
+    tar_progress_t progress;
+    void *arg;
+#ifdef HAVE_ZLIB
+    z_stream zs;
+#endif
+} tar_out_t;
+
+static const char zero_block[TAR_BLOCK];
+
+int tar_virtual_path(const char *path, char *dir, size_t size, tar_format_t *format) {
+    static const struct { const char *suffix; tar_format_t format; } suffixes[] = {
+        {".tar", TAR_PLAIN},
+#ifdef HAVE_ZLIB
+        {".tar.gz", TAR_GZIP},
+        {".tgz", TAR_GZIP},
+#endif
+    };
+    size_t len = strlen(path);
+    char candidate[PATH_MAX];
+    struct stat st;
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        size_t suffix_len = strlen(suffixes[i].suffix);
+        if (len <= suffix_len || strcmp(path + len - suffix_len, suffixes[i].suffix) != 0) {
+            continue;
+        }
+
+        // A real file of that name always wins
+        if (stat(path, &st) == 0) {
+            return 0;
+        }
+
+        snprintf(candidate, sizeof(candidate), "%.*s", (int)(len - suffix_len), path);
+        if (realpath(candidate, dir) == NULL || strlen(dir) >= size ||
+            stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || !fileops_inside_root(dir) ||
+            !storage_is_posix(dir)) {
+            return 0;
+        }
+
+        *format = suffixes[i].format;
+        return 1;
+    }
+    return 0;
+}
+
+static void send_all(tar_out_t *out, const char *data, size_t len) {
+    while (len > 0 && !out->failed) {
+        ssize_t n = tls_send(out->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            out->failed = 1;
+            break;
+        }
+        data += n;
+        len -= (size_t)n;
+        out->stats->bytes += n;
+        out->progress(out->arg, (size_t)n);
+    }
+}
+
+static void out_flush(tar_out_t *out) {
+    send_all(out, out->buf, out->len);
+    out->len = 0;
+}
+
+static void out_write(tar_out_t *out, const void *data, size_t len) {
+    out->archive_bytes += len;
+
+#ifdef HAVE_ZLIB
+    if (out->format == TAR_GZIP) {
+        out->zs.next_in = (Bytef *)data;
+        out->zs.avail_in = (uInt)len;
+        while (out->zs.avail_in > 0 && !out->failed) {
+            out->zs.next_out = (Bytef *)out->buf + out->len;
+            out->zs.avail_out = (uInt)(BUFPOOL_BUFFER_SIZE - out->len);
+            deflate(&out->zs, Z_NO_FLUSH);
+            out->len = BUFPOOL_BUFFER_SIZE - out->zs.avail_out;
+            if (out->len == BUFPOOL_BUFFER_SIZE) {
+                out_flush(out);
+            }
+        }
+        return;
+    }
+#endif
+
+    const char *p = data;
+    while (len > 0 && !out->failed) {
+        size_t room = BUFPOOL_BUFFER_SIZE - out->len;
+        size_t n = len < room ? len : room;
+        memcpy(out->buf + out->len, p, n);
+        out->len += n;
+        p += n;
+        len -= n;
+        if (out->len == BUFPOOL_BUFFER_SIZE) {
+            out_flush(out);
+        }
+    }
+}
+
+static void out_zeros(tar_out_t *out, off_t count) {
+    while (count > 0 && !out->failed) {
+        size_t n = count < TAR_BLOCK ? (size_t)count : TAR_BLOCK;
+        out_write(out, zero_block, n);
+        count -= n;
+    }
+}
+
+// Finish the compressed stream and send everything still buffered
+static void out_finish(tar_out_t *out) {
+#ifdef HAVE_ZLIB
+    if (out->format == TAR_GZIP) {
+        int status = Z_OK;
+        out->zs.avail_in = 0;
+        while (status != Z_STREAM_END && !out->failed) {
+            out->zs.next_out = (Bytef *)out->buf + out->len;
+            out->zs.avail_out = (uInt)(BUFPOOL_BUFFER_SIZE - out->len);
+            status = deflate(&out->zs, Z_FINISH);
+            out->len = BUFPOOL_BUFFER_SIZE - out->zs.avail_out;
+            if (status == Z_STREAM_END || out->len == BUFPOOL_BUFFER_SIZE) {
+                out_flush(out);
+            }
+            if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+                out->failed = 1;
+            }
+        }
+        return;
+    }
+#endif
+    out_flush(out);
+}
+
+static void octal(char *field, size_t width, unsigned long long value) {
+    snprintf(field, width, "%0*llo", (int)width - 1, value);
+}
+
+// Append a pax "length key=value\n" record; the length counts itself
+static void pax_record(char *pax, size_t *used, const char *key, const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3;  // space, '=', newline
+    size_t total = body + 1;
+    while (total != body + (size_t)snprintf(NULL, 0, "%zu", total)) {
+        total = body + (size_t)snprintf(NULL, 0, "%zu", total);
+    }
+    if (*used + total < TAR_PAX_MAX) {
+        *used += (size_t)snprintf(pax + *used, TAR_PAX_MAX - *used, "%zu %s=%s\n", total, key, value);
+    }
+}
+
+// Store path as ustar name, or prefix + name split at a slash; returns 0 if it does not fit
+static int ustar_name(tar_header_t *h, const char *path) {
+    size_t len = strlen(path);
+    if (len <= sizeof(h->name)) {
+        memcpy(h->name, path, len);
+        return 1;
+    }
+    for (size_t i = 0; i < len - 1 && i <= sizeof(h->prefix); i++) {
+        if (path[i] == '/' && len - i - 1 <= sizeof(h->name)) {
+            memcpy(h->prefix, path, i);
+            memcpy(h->name, path + i + 1, len - i - 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void header_block(tar_out_t *out, tar_header_t *h, char typeflag, const struct stat *st, off_t size) {
+    octal(h->mode, sizeof(h->mode), st->st_mode & 07777);
+    octal(h->uid, sizeof(h->uid), st->st_uid <= TAR_USTAR_MAX_ID ? st->st_uid : 0);
+    octal(h->gid, sizeof(h->gid), st->st_gid <= TAR_USTAR_MAX_ID ? st->st_gid : 0);
+    octal(h->size, sizeof(h->size), size <= TAR_USTAR_MAX_SIZE ? (unsigned long long)size : 0);
+    octal(h->mtime, sizeof(h->mtime), st->st_mtime > 0 ? (unsigned long long)st->st_mtime : 0);
+    h->typeflag = typeflag;
+    memcpy(h->magic, "ustar", 6);
+    memcpy(h->version, "00", 2);
+
+    // The checksum is computed with its own field full of spaces
+    memset(h->chksum, ' ', sizeof(h->chksum));
+    unsigned int sum = 0;
+    const unsigned char *bytes = (const unsigned char *)h;
+    for (size_t i = 0; i < sizeof(*h); i++) {
+        sum += bytes[i];
+    }
+    snprintf(h->chksum, sizeof(h->chksum), "%06o", sum);
+    h->chksum[7] = ' ';
+
+    out_write(out, h, sizeof(*h));
+}
+
+// Headers for one member: a pax extended header first if anything overflows ustar
+static void write_header(tar_out_t *out, const tar_entry_t *e) {
+    tar_header_t h;
+    char pax[TAR_PAX_MAX];
+    size_t pax_len = 0;
+    char number[32];
+    memset(&h, 0, sizeof(h));
+
+    char typeflag = S_ISDIR(e->st.st_mode) ? '5' : S_ISLNK(e->st.st_mode) ? '2' : '0';
+    off_t size = typeflag == '0' ? e->st.st_size : 0;
+
+    if (!ustar_name(&h, e->path)) {
+        pax_record(pax, &pax_len, "path", e->path);
+        memcpy(h.name, e->path, sizeof(h.name));
+    }
+    if (typeflag == '2') {
+        size_t link_len = strlen(e->link);
+        if (link_len > sizeof(h.linkname)) {
+            pax_record(pax, &pax_len, "linkpath", e->link);
+            link_len = sizeof(h.linkname);
+        }
+        memcpy(h.linkname, e->link, link_len);
+    }
+    if (size > TAR_USTAR_MAX_SIZE) {
+        snprintf(number, sizeof(number), "%lld", (long long)size);
+        pax_record(pax, &pax_len, "size", number);
+    }
+    if (e->st.st_uid > TAR_USTAR_MAX_ID) {
+        snprintf(number, sizeof(number), "%u", (unsigned int)e->st.st_uid);
+        pax_record(pax, &pax_len, "uid", number);
+    }
+    if (e->st.st_gid > TAR_USTAR_MAX_ID) {
+        snprintf(number, sizeof(number), "%u", (unsigned int)e->st.st_gid);
+        pax_record(pax, &pax_len, "gid", number);
+    }
+
+    if (pax_len > 0) {
+        tar_header_t x;
+        struct stat xst = e->st;
+        memset(&x, 0, sizeof(x));
+        snprintf(x.name, sizeof(x.name), "PaxHeader/%.80s", e->path);
+        xst.st_mode = 0644;
+        xst.st_uid = 0;
+        xst.st_gid = 0;
+        header_block(out, &x, 'x', &xst, (off_t)pax_len);
+        out_write(out, pax, pax_len);
+        out_zeros(out, (TAR_BLOCK - pax_len % TAR_BLOCK) % TAR_BLOCK);
+    }
+
+    header_block(out, &h, typeflag, &e->st, size);
+}
+
+// File body padded to whole blocks; a file that shrinks meanwhile is padded with zeros
+static void write_body(tar_out_t *out, const tar_entry_t *e) {
+    off_t size = e->st.st_size;
+    off_t offset = 0;
+
+    // Userspace TLS has to see the bytes, so only plain and kernel TLS sockets take sendfile()
+    if (out->format == TAR_PLAIN && size >= TAR_SENDFILE_MIN && tls_can_sendfile(out->fd)) {
+        out_flush(out);
+        while (offset < size && !out->failed) {
+            size_t chunk = size - offset > TAR_SENDFILE_CHUNK ? TAR_SENDFILE_CHUNK : (size_t)(size - offset);
+            off_t before = offset;
+            ssize_t n = tls_sendfile(out->fd, e->fd, &offset, chunk);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (n < 0 && (errno == EPIPE || errno == ECONNRESET || errno == ENOTCONN)) {
+                out->failed = 1;
+                return;
+            }
+            if (n <= 0) {
+                offset = before;
+                break;
+            }
+            out->archive_bytes += n;
+            out->stats->bytes += n;
+            out->progress(out->arg, (size_t)n);
+        }
+    } else {
+        while (offset < size && !out->failed) {
+            size_t chunk = size - offset > BUFPOOL_BUFFER_SIZE ? BUFPOOL_BUFFER_SIZE : (size_t)(size - offset);
+            ssize_t n = pread(e->fd, out->io, chunk, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            out_write(out, out->io, (size_t)n);
+            offset += n;
+        }
+    }
+
+    if (offset < size) {
+        log_message(FTPLOG_ERROR, "Archive: %s ended early, padded with zeros", e->path);
+        out_zeros(out, size - offset);
+    }
+    out_zeros(out, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+// Only members on disk are archived: what lies beneath a memory or private
+// mount is not what clients see there
+static int walk_allowed(tar_walker_t *w, const char *path) {
+    char disk[PATH_MAX];
+    int n = snprintf(disk, sizeof(disk), "%s/%s", w->dir, path + w->root_len);
+    return n > 0 && (size_t)n < sizeof(disk) && storage_is_posix(disk);
+}
+
+// Next member in depth-first order, opened and with readahead started; 0 at the end
+static int walk_next(tar_walker_t *w, tar_entry_t *e) {
+    while (w->depth > 0) {
+        walk_level_t *top = &w->stack[w->depth - 1];
+        struct dirent *d = readdir(top->dir);
+        if (d == NULL) {
+            closedir(top->dir);
+            w->depth--;
+            continue;
+        }
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t name_len = strlen(d->d_name);
+        int dir_fd = dirfd(top->dir);
+        if (top->len + name_len + 2 > sizeof(e->path) ||
+            fstatat(dir_fd, d->d_name, &e->st, AT_SYMLINK_NOFOLLOW) != 0) {
+            w->stats->skipped++;
+            continue;
+        }
+        memcpy(e->path, w->path, top->len);
+        memcpy(e->path + top->len, d->d_name, name_len + 1);
+        e->fd = -1;
+        e->link[0] = '\0';
+        if (!walk_allowed(w, e->path)) {
+            w->stats->skipped++;
+            continue;
+        }
+
+        if (S_ISREG(e->st.st_mode)) {
+            e->fd = openat(dir_fd, d->d_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (e->fd < 0) {
+                w->stats->skipped++;
+                continue;
+            }
+            // Asynchronous readahead: upcoming files load in parallel while this one is sent
+            off_t ahead = e->st.st_size < TAR_PREFETCH_BYTES ? e->st.st_size : TAR_PREFETCH_BYTES;
+            posix_fadvise(e->fd, 0, ahead, POSIX_FADV_WILLNEED);
+            w->stats->files++;
+            return 1;
+        }
+
+        if (S_ISLNK(e->st.st_mode)) {
+            ssize_t n = readlinkat(dir_fd, d->d_name, e->link, sizeof(e->link) - 1);
+            if (n < 0) {
+                w->stats->skipped++;
+                continue;
+            }
+            e->link[n] = '\0';
+            return 1;
+        }
+
+        if (S_ISDIR(e->st.st_mode)) {
+            strcat(e->path, "/");
+            w->stats->directories++;
+            if (w->depth == TAR_MAX_DEPTH) {
+                w->stats->skipped++;
+                return 1;
+            }
+            int fd = openat(dir_fd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            DIR *sub = fd >= 0 ? fdopendir(fd) : NULL;
+            if (sub == NULL) {
+                if (fd >= 0) close(fd);
+                w->stats->skipped++;
+                return 1;
+            }
+            w->stack[w->depth].dir = sub;
+            w->stack[w->depth].len = strlen(e->path);
+            w->depth++;
+            memcpy(w->path, e->path, strlen(e->path) + 1);
+            return 1;
+        }
+
+        // Devices, sockets and FIFOs have no place in a download
+        w->stats->skipped++;
+    }
+    return 0;
+}
+
+int tar_stream(int data_fd, const char *dir, tar_format_t format, tar_stats_t *stats,
+               tar_progress_t progress, void *arg) {
+    tar_out_t out;
+    tar_walker_t walker;
+    tar_entry_t *ring = NULL;
+    int head = 0, count = 0, done = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&out, 0, sizeof(out));
+    memset(&walker, 0, sizeof(walker));
+    out.fd = data_fd;
+    out.format = format;
+    out.stats = stats;
+    out.progress = progress;
+    out.arg = arg;
+    walker.stats = stats;
+
+    out.buf = bufpool_get();
+    out.io = bufpool_get();
+    ring = malloc(TAR_PREFETCH * sizeof(tar_entry_t));
+    if (out.buf == NULL || out.io == NULL || ring == NULL) {
+        out.failed = 1;
+        goto cleanup;
+    }
+#ifdef HAVE_ZLIB
+    // Fast compression: the archive is generated at network speed
+    if (format == TAR_GZIP && deflateInit2(&out.zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                                           Z_DEFAULT_STRATEGY) != Z_OK) {
+        out.failed = 1;
+        goto cleanup;
+    }
+#endif
+
+    // The top-level member is the directory itself, under its own name
+    tar_entry_t *root = &ring[0];
+    const char *base = strrchr(dir, '/');
+    base = (base && base[1]) ? base + 1 : "root";
+    snprintf(root->path, sizeof(root->path), "%s/", base);
+    root->fd = -1;
+    DIR *top = opendir(dir);
+    if (top == NULL || stat(dir, &root->st) != 0) {
+        if (top) closedir(top);
+        out.failed = 1;
+        goto finish;
+    }
+    walker.stack[0].dir = top;
+    walker.stack[0].len = strlen(root->path);
+    walker.depth = 1;
+    walker.dir = dir;
+    walker.root_len = walker.stack[0].len;
+    memcpy(walker.path, root->path, walker.stack[0].len + 1);
+    stats->directories++;
+    write_header(&out, root);
+
+    // Keep a window of members open ahead of the one being written
+    while (!out.failed) {
+        while (!done && count < TAR_PREFETCH) {
+            if (walk_next(&walker, &ring[(head + count) % TAR_PREFETCH])) {
+                count++;
+            } else {
+                done = 1;
+            }
+        }
+        if (count == 0) {
+            break;
+        }
+
+        tar_entry_t *e = &ring[head];
+        write_header(&out, e);
+        if (e->fd >= 0) {
+            write_body(&out, e);
+            close(e->fd);
+        }
+        head = (head + 1) % TAR_PREFETCH;
+        count--;
+    }
+
+    // End of archive: two zero blocks, then pad to a whole record
+    if (!out.failed) {
+        out_zeros(&out, 2 * TAR_BLOCK);
+        out_zeros(&out, (TAR_RECORD - out.archive_bytes % TAR_RECORD) % TAR_RECORD);
+        out_finish(&out);
+    }
+
+finish:
+    for (; count > 0; count--) {
+        if (ring[head].fd >= 0) close(ring[head].fd);
+        head = (head + 1) % TAR_PREFETCH;
+    }
+    while (walker.depth > 0) {
+        closedir(walker.stack[--walker.depth].dir);
+    }
+#ifdef HAVE_ZLIB
+    if (format == TAR_GZIP) {
+        deflateEnd(&out.zs);
+    }
+#endif
+
+cleanup:
+    if (out.buf) bufpool_put(out.buf);
+    if (out.io) bufpool_put(out.io);
+    free(ring);
+    return !out.failed;
+}
@@ -0,0 +1,423 @@
+// src/tls.c
+#include "tls.h"
+#include "logging.h"
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+char tls_cert_file[PATH_MAX] = "";
+char tls_key_file[PATH_MAX] = "";
+int tls_required = 0;
+int tls_require_reuse = 0;
+
+#ifdef HAVE_OPENSSL
+
+#define TLS_MAX_SLOTS (1024 * 1024)  // Highest descriptor that can carry TLS
+
+// TLS state of one socket. The table holds a reference, and so does every
+// call in progress, so a close from the session thread cannot free it under
+// the idle reaper writing its 421.
+typedef struct {
+    SSL *ssl;
+    pthread_mutex_t lock;          // One SSL call at a time
+    int refs;
+    int ktls_send;                 // The kernel encrypts what is written
+    uintptr_t origin;              // Serial of this handshake, recorded on the sessions it creates
+} tls_conn_t;
+
+static SSL_CTX *ctx = NULL;
+static int origin_index = -1;      // Session ex_data: serial of the handshake that first negotiated it
+static uintptr_t next_origin = 1;
+static tls_conn_t **conns = NULL;  // Indexed by descriptor
+static int conn_slots = 0;
+static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void log_ssl_error(const char *what) {
+    unsigned long err = ERR_get_error();
+    char message[256];
+    ERR_error_string_n(err, message, sizeof(message));
+    log_message(FTPLOG_ERROR, "TLS: %s: %s", what, err != 0 ? message : strerror(errno));
+    ERR_clear_error();
+}
+
+// A session entering the cache remembers the connection that negotiated it.
+// Tickets issued on a resumed connection are copies of the resumed session
+// and keep its origin, so a whole chain of resumptions shares one origin.
+static int remember_origin(SSL *ssl, SSL_SESSION *session) {
+    tls_conn_t *conn = SSL_get_app_data(ssl);
+    if (conn != NULL && SSL_SESSION_get_ex_data(session, origin_index) == NULL) {
+        SSL_SESSION_set_ex_data(session, origin_index, (void *)conn->origin);
+    }
+    return 0;  // The cache keeps its own reference
+}
+
+int tls_init(void) {
+    if (tls_cert_file[0] == '\0') {
+        if (tls_required) {
+            log_message(FTPLOG_ERROR, "TLS: --tls-required needs --tls-cert");
+            return 0;
+        }
+        return 1;
+    }
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        log_ssl_error("Cannot create context");
+        return 0;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // Clients that close without close_notify are not treated as attacks;
+    // FTP marks the end of an upload by closing the connection
+    long options = 0;
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    options |= SSL_OP_IGNORE_UNEXPECTED_EOF;
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+    options |= SSL_OP_ENABLE_KTLS;
+#endif
+
+    // Data connections resume the control connection's session instead of
+    // paying for a full handshake each. Sessions stay in the server cache
+    // rather than in tickets, so each keeps the origin recorded on it.
+    options |= SSL_OP_NO_TICKET;
+    SSL_CTX_set_options(ctx, options);
+    static const unsigned char session_context[] = "ftpserver";
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, TLS_SESSION_CACHE);
+    SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+    SSL_CTX_set_session_id_context(ctx, session_context, sizeof(session_context) - 1);
+    origin_index = SSL_SESSION_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    SSL_CTX_sess_set_new_cb(ctx, remember_origin);
+
+    const char *key = tls_key_file[0] != '\0' ? tls_key_file : tls_cert_file;
+    if (SSL_CTX_use_certificate_chain_file(ctx, tls_cert_file) != 1) {
+        log_ssl_error(tls_cert_file);
+        tls_cleanup();
+        return 0;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+        log_ssl_error(key);
+        tls_cleanup();
+        return 0;
+    }
+
+    struct rlimit limit;
+    conn_slots = TLS_MAX_SLOTS;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < TLS_MAX_SLOTS) {
+        conn_slots = (int)limit.rlim_cur;
+    }
+    conns = calloc((size_t)conn_slots, sizeof(tls_conn_t *));
+    if (conns == NULL) {
+        log_message(FTPLOG_ERROR, "TLS: Cannot allocate connection table");
+        tls_cleanup();
+        return 0;
+    }
+
+    log_message(FTPLOG_INFO, "TLS: AUTH TLS enabled with %s%s", tls_cert_file,
+                tls_required ? ", required" : "");
+    return 1;
+}
+
+void tls_cleanup(void) {
+    if (ctx != NULL) {
+        SSL_CTX_free(ctx);
+        ctx = NULL;
+    }
+    free(conns);
+    conns = NULL;
+    conn_slots = 0;
+}
+
+int tls_available(void) {
+    return ctx != NULL;
+}
+
+static tls_conn_t *conn_get(int fd) {
+    if (fd < 0 || fd >= conn_slots || __atomic_load_n(&conns[fd], __ATOMIC_ACQUIRE) == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&conns_mutex);
+    tls_conn_t *conn = conns[fd];
+    if (conn != NULL) {
+        conn->refs++;
+    }
+    pthread_mutex_unlock(&conns_mutex);
+    return conn;
+}
+
+static void conn_put(tls_conn_t *conn) {
+    pthread_mutex_lock(&conns_mutex);
+    int last = --conn->refs == 0;
+    pthread_mutex_unlock(&conns_mutex);
+    if (last) {
+        SSL_free(conn->ssl);
+        pthread_mutex_destroy(&conn->lock);
+        free(conn);
+    }
+}
+
+// Turn an SSL_read/SSL_write result into the send()/recv() convention
+static ssize_t io_result(tls_conn_t *conn, int ret, const char *what) {
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(conn->ssl, ret)) {
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_SYSCALL:
+            if (errno == 0) {
+                errno = ECONNRESET;
+            }
+            ERR_clear_error();
+            return -1;
+        default:
+            log_ssl_error(what);
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+int tls_accept(int fd) {
+    if (ctx == NULL) {
+        errno = EOPNOTSUPP;
+        return 0;
+    }
+    if (fd < 0 || fd >= conn_slots) {
+        errno = EMFILE;
+        return 0;
+    }
+
+    tls_conn_t *conn = calloc(1, sizeof(tls_conn_t));
+    if (conn == NULL || (conn->ssl = SSL_new(ctx)) == NULL || SSL_set_fd(conn->ssl, fd) != 1) {
+        if (conn != NULL) {
+            SSL_free(conn->ssl);
+        }
+        free(conn);
+        errno = ENOMEM;
+        return 0;
+    }
+    pthread_mutex_init(&conn->lock, NULL);
+    conn->refs = 1;
+    conn->origin = __atomic_fetch_add(&next_origin, 1, __ATOMIC_RELAXED);
+    SSL_set_app_data(conn->ssl, conn);
+
+    // A client that stops mid-handshake must not hold the session forever
+    struct timeval saved_rcv, saved_snd;
+    struct timeval timeout = {TLS_HANDSHAKE_TIMEOUT, 0};
+    socklen_t len = sizeof(saved_rcv);
+    getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &saved_rcv, &len);
+    len = sizeof(saved_snd);
+    getsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &saved_snd, &len);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    int ret = SSL_accept(conn->ssl);
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &saved_rcv, sizeof(saved_rcv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &saved_snd, sizeof(saved_snd));
+
+    if (ret != 1) {
+        io_result(conn, ret, "Handshake failed");
+        int err = errno;
+        conn_put(conn);
+        errno = err;
+        return 0;
+    }
+
+#ifdef BIO_get_ktls_send
+    conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+#endif
+    log_message(FTPLOG_DEBUG, "TLS: Handshake on %d, %s %s%s, %s", fd,
+                SSL_get_version(conn->ssl), SSL_get_cipher_name(conn->ssl),
+                SSL_session_reused(conn->ssl) ? ", resumed" : "",
+                conn->ktls_send ? "kernel TLS" : "userspace TLS");
+
+    __atomic_store_n(&conns[fd], conn, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int tls_active(int fd) {
+    tls_conn_t *conn = conn_get(fd);
+    if (conn == NULL) {
+        return 0;
+    }
+    conn_put(conn);
+    return 1;
+}
+
+// Origin of the session a connection ended up with, 0 if unknown
+static uintptr_t session_origin(tls_conn_t *conn) {
+    SSL_SESSION *session = SSL_get_session(conn->ssl);
+    return session != NULL ? (uintptr_t)SSL_SESSION_get_ex_data(session, origin_index) : 0;
+}
+
+int tls_resumed_from(int fd, int control_fd) {
+    tls_conn_t *conn = conn_get(fd);
+    tls_conn_t *control = conn_get(control_fd);
+    int same = conn != NULL && control != NULL && SSL_session_reused(conn->ssl);
+    if (same) {
+        uintptr_t origin = session_origin(conn);
+        same = origin != 0 && origin == session_origin(control);
+    }
+    if (control != NULL) conn_put(control);
+    if (conn != NULL) conn_put(conn);
+    return same;
+}
+
+int tls_can_sendfile(int fd) {
+    tls_conn_t *conn = conn_get(fd);
+    if (conn == NULL) {
+        return 1;
+    }
+    int ktls = conn->ktls_send;
+    conn_put(conn);
+    return ktls;
+}
+
+ssize_t tls_send(int fd, const void *buf, size_t len, int flags) {
+    tls_conn_t *conn = conn_get(fd);
+    if (conn == NULL) {
+        return send(fd, buf, len, flags);
+    }
+    if (len > INT_MAX) {
+        len = INT_MAX;
+    }
+    pthread_mutex_lock(&conn->lock);
+    ERR_clear_error();
+    ssize_t n = io_result(conn, SSL_write(conn->ssl, buf, (int)len), "Write failed");
+    pthread_mutex_unlock(&conn->lock);
+    conn_put(conn);
+    return n;
+}
+
+ssize_t tls_recv(int fd, void *buf, size_t len, int flags) {
+    tls_conn_t *conn = conn_get(fd);
+    if (conn == NULL) {
+        return recv(fd, buf, len, flags);
+    }
+    if (len > INT_MAX) {
+        len = INT_MAX;
+    }
+    pthread_mutex_lock(&conn->lock);
+    ERR_clear_error();
+    ssize_t n = io_result(conn, SSL_read(conn->ssl, buf, (int)len), "Read failed");
+    pthread_mutex_unlock(&conn->lock);
+    conn_put(conn);
+    return n;
+}
+
+ssize_t tls_sendfile(int fd, int in_fd, off_t *offset, size_t count) {
+    tls_conn_t *conn = conn_get(fd);
+    if (conn == NULL) {
+        return sendfile(fd, in_fd, offset, count);
+    }
+
+    ssize_t n = -1;
+#ifdef BIO_get_ktls_send
+    if (conn->ktls_send) {
+        pthread_mutex_lock(&conn->lock);
+        ERR_clear_error();
+        n = SSL_sendfile(conn->ssl, in_fd, *offset, count, 0);
+        if (n > 0) {
+            *offset += n;
+        } else {
+            n = io_result(conn, (int)n, "Sendfile failed");
+        }
+        pthread_mutex_unlock(&conn->lock);
+    } else
+#endif
+    {
+        errno = EOPNOTSUPP;
+    }
+    conn_put(conn);
+    return n;
+}
+
+void tls_close(int fd) {
+    tls_conn_t *conn = NULL;
+    if (fd >= 0 && fd < conn_slots) {
+        pthread_mutex_lock(&conns_mutex);
+        conn = conns[fd];
+        conns[fd] = NULL;
+        pthread_mutex_unlock(&conns_mutex);
+    }
+
+    if (conn != NULL) {
+        // One close_notify; the peer's is not waited for
+        pthread_mutex_lock(&conn->lock);
+        ERR_clear_error();
+        SSL_shutdown(conn->ssl);
+        ERR_clear_error();
+        pthread_mutex_unlock(&conn->lock);
+        conn_put(conn);
+    }
+    close(fd);
+}
+
+#else // !HAVE_OPENSSL
+
+// Built without OpenSSL: no FTPS, everything passes through in the clear
+
+int tls_init(void) {
+    if (tls_cert_file[0] != '\0' || tls_required) {
+        log_message(FTPLOG_ERROR, "TLS: Built without OpenSSL, FTPS is not available");
+        return 0;
+    }
+    return 1;
+}
+
+void tls_cleanup(void) {
+}
+
+int tls_available(void) {
+    return 0;
+}
+
+int tls_accept(int fd) {
+    (void)fd;
+    errno = EOPNOTSUPP;
+    return 0;
+}
+
+int tls_active(int fd) {
+    (void)fd;
+    return 0;
+}
+
+int tls_resumed_from(int fd, int control_fd) {
+    (void)fd;
+    (void)control_fd;
+    return 0;
+}
+
+int tls_can_sendfile(int fd) {
+    (void)fd;
+    return 1;
+}
+
+ssize_t tls_send(int fd, const void *buf, size_t len, int flags) {
+    return send(fd, buf, len, flags);
+}
+
+ssize_t tls_recv(int fd, void *buf, size_t len, int flags) {
+    return recv(fd, buf, len, flags);
+}
+
+ssize_t tls_sendfile(int fd, int in_fd, off_t *offset, size_t count) {
+    return sendfile(fd, in_fd, offset, count);
+}
+
+void tls_close(int fd) {
+    close(fd);
+}
+
+#endif // HAVE_OPENSSL
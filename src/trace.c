@@ -0,0 +1,210 @@
+// src/trace.c
+#include "trace.h"
+#include "checksum.h"
+#include "logging.h"
+
+#define TRACE_BUFFER (64 * 1024)
+#define TRACE_NAME_HEX 10    // Hex digits kept from each anonymized component
+#define TRACE_MAX_EXT 5      // Longest extension kept on anonymized names
+
+int trace_enabled = 0;
+
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int next_session = 1;
+static unsigned char trace_key[32];  // Per-run key, so names cannot be guessed from hashes
+
+int trace_open(const char *path) {
+    trace_file = fopen(path, "a");
+    if (trace_file == NULL) {
+        return 0;
+    }
+    setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER);
+
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, trace_key, sizeof(trace_key)) != (ssize_t)sizeof(trace_key)) {
+        // Weaker, but the trace is still useful
+        unsigned long long seed = (unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32);
+        memcpy(trace_key, &seed, sizeof(seed));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    // Flushed now so a daemonizing fork does not write it twice
+    fprintf(trace_file, "%s\n", TRACE_VERSION);
+    fflush(trace_file);
+    trace_enabled = 1;
+    return 1;
+}
+
+void trace_close(void) {
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    trace_enabled = 0;
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static long long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000LL + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+// Replace one path component with a keyed hash, keeping a short extension
+static size_t anonymize_component(const char *name, size_t len, char *out, size_t size) {
+    if ((len == 1 && name[0] == '.') || (len == 2 && name[0] == '.' && name[1] == '.') || len == 0) {
+        if (len >= size) return 0;
+        memcpy(out, name, len);
+        return len;
+    }
+
+    hash_ctx_t ctx;
+    char hex[HASH_MAX_HEX];
+    hash_init(&ctx, HASH_SHA256);
+    hash_update(&ctx, trace_key, sizeof(trace_key));
+    hash_update(&ctx, name, len);
+    hash_final(&ctx, hex);
+
+    // Extensions shape client behaviour (ASCII transfers, compressed files)
+    size_t ext = 0;
+    const char *dot = NULL;
+    for (size_t i = len - 1; i > 0; i--) {
+        if (name[i] == '.') {
+            dot = name + i;
+            break;
+        }
+    }
+    if (dot != NULL) {
+        ext = (size_t)(name + len - dot);
+        for (size_t i = 1; i < ext; i++) {
+            if (!isalnum((unsigned char)dot[i])) {
+                ext = 0;
+                break;
+            }
+        }
+        if (ext < 2 || ext > TRACE_MAX_EXT + 1) {
+            ext = 0;
+        }
+    }
+
+    if (TRACE_NAME_HEX + ext >= size) return 0;
+    memcpy(out, hex, TRACE_NAME_HEX);
+    memcpy(out + TRACE_NAME_HEX, dot, ext);
+    return TRACE_NAME_HEX + ext;
+}
+
+static void anonymize_path(const char *path, char *out, size_t size) {
+    size_t used = 0;
+    const char *p = path;
+
+    while (used + 1 < size) {
+        const char *slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        used += anonymize_component(p, len, out + used, size - used);
+        if (slash == NULL || used + 2 >= size) {
+            break;
+        }
+        out[used++] = '/';
+        p = slash + 1;
+    }
+    out[used] = '\0';
+}
+
+// Trace form of a command argument
+static void trace_argument(const char *command, const char *arg, char *out, size_t size) {
+    static const char *dropped[] = {"USER", "PASS", "ACCT", "PORT", "EPRT", NULL};
+    static const char *plain[] = {"TYPE", "MODE", "STRU", "OPTS", "ALLO", "REST", "FEAT", "PASV",
+                                  "EPSV", "SYST", "PWD", "QUIT", "NOOP", NULL};
+
+    out[0] = '\0';
+    if (arg[0] == '\0') {
+        return;
+    }
+    for (int i = 0; dropped[i]; i++) {
+        if (strcmp(command, dropped[i]) == 0) return;
+    }
+    for (int i = 0; plain[i]; i++) {
+        if (strcmp(command, plain[i]) == 0) {
+            snprintf(out, size, "%s", arg);
+            return;
+        }
+    }
+
+    // Everything else takes a path, possibly after options (LIST -la) or a subcommand (SITE)
+    size_t used = 0;
+    const char *p = arg;
+    if (strcmp(command, "SITE") == 0) {
+        while (*p && *p != ' ') p++;
+        used = (size_t)(p - arg) < size - 1 ? (size_t)(p - arg) : size - 1;
+        memcpy(out, arg, used);
+        while (*p == ' ') p++;
+        if (*p && used + 1 < size) out[used++] = ' ';
+    }
+    while (*p == '-') {
+        const char *end = strchr(p, ' ');
+        size_t len = end ? (size_t)(end - p + 1) : strlen(p);
+        if (used + len >= size) break;
+        memcpy(out + used, p, len);
+        used += len;
+        p += len;
+        while (*p == ' ') p++;
+    }
+    out[used] = '\0';
+    if (*p) {
+        anonymize_path(p, out + used, size - used);
+    }
+}
+
+void trace_session_begin(client_t *client) {
+    if (!trace_enabled) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &client->trace_start);
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    pthread_mutex_lock(&trace_mutex);
+    client->trace_session = next_session++;
+    if (trace_file) {
+        fprintf(trace_file, "S\t%u\t%lld\n", client->trace_session,
+                wall.tv_sec * 1000LL + wall.tv_nsec / 1000000);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_session_end(client_t *client) {
+    if (!trace_enabled) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) {
+        fprintf(trace_file, "E\t%u\t%lld\n", client->trace_session, elapsed_ms(&client->trace_start, &now));
+        fflush(trace_file);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_command(client_t *client, const char *command, const char *arg, const struct timespec *start) {
+    if (!trace_enabled) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long duration_us = (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+
+    char argument[MAX_BUFFER];
+    trace_argument(command, arg, argument, sizeof(argument));
+
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file) {
+        fprintf(trace_file, "C\t%u\t%lld\t%lld\t%lld\t%s%s%s\n", client->trace_session,
+                elapsed_ms(&client->trace_start, start), duration_us, (long long)client->transfer_bytes,
+                command, argument[0] ? "\t" : "", argument);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
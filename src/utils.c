@@ -6,3 +6,42 @@ char* get_absolute_path(const char *path) {
     realpath(path, abs_path);
     return abs_path;
 }
+
+int parse_size(const char *str, off_t *size) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(str, &end, 10);
+    if (errno != 0 || end == str || value < 0) {
+        return 0;
+    }
+
+    // Optional binary suffix: K, M, G or T
+    int shifts;
+    switch (toupper((unsigned char)*end)) {
+        case 'T': shifts = 4; break;
+        case 'G': shifts = 3; break;
+        case 'M': shifts = 2; break;
+        case 'K': shifts = 1; break;
+        case '\0': shifts = 0; break;
+        default: return 0;
+    }
+    if (shifts > 0) {
+        end++;
+    }
+    for (; shifts > 0; shifts--) {
+        if (value > LLONG_MAX / 1024) {
+            errno = ERANGE;
+            return 0;
+        }
+        value *= 1024;
+    }
+    if (*end == 'B' || *end == 'b') {
+        end++;
+    }
+    if (*end != '\0') {
+        return 0;
+    }
+
+    *size = (off_t)value;
+    return 1;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Run the throughput/latency suite against a local server on loopback.
+# Usage: tools/bench.sh [ftpbench options...]
+#   BENCH_PORT  control port (default: 2121)
+#   BENCH_OUT   JSON results file (default: bench_results.json)
+
+BIN_DIR=${BIN_DIR:-bin}
+PORT=${BENCH_PORT:-2121}
+OUT=${BENCH_OUT:-bench_results.json}
+ROOT=$(mktemp -d "${TMPDIR:-/tmp}/ftpbench.XXXXXX") || exit 1
+SERVER_PID=
+
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null
+        wait "$SERVER_PID" 2>/dev/null
+    fi
+    rm -rf "$ROOT"
+}
+trap cleanup EXIT INT TERM
+
+mkdir "$ROOT/root" && "$BIN_DIR/ftpbench" --seed "$ROOT/root" "$@" || exit 1
+
+"$BIN_DIR/ftpserver" -p "$PORT" -d "$ROOT/root" -c 10000 >"$ROOT/server.log" 2>&1 &
+SERVER_PID=$!
+
+# Wait for the listening socket
+i=0
+while ! "$BIN_DIR/ftpbench" -p "$PORT" -s 1 -d 0.05 --mix cwd=1 >/dev/null 2>&1; do
+    i=$((i + 1))
+    if [ $i -ge 50 ] || ! kill -0 "$SERVER_PID" 2>/dev/null; then
+        echo "Server did not start, log:" >&2
+        cat "$ROOT/server.log" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$BIN_DIR/ftpbench" -p "$PORT" --server-pid "$SERVER_PID" -o "$OUT" "$@" || exit 1
+echo "Results written to $OUT"
@@ -0,0 +1,499 @@
+// tools/ftpbench.c
+// Load generator: N concurrent sessions running a RETR/STOR/LIST/CWD mix
+#include "ftpclient.h"
+#include "wan.h"
+#include <pthread.h>
+#include <getopt.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include <limits.h>
+
+#define MAX_SESSIONS 4096
+#define UPLOAD_SLOTS 8     // Uploads per session cycle through this many names
+#define CWD_DIRS 8         // Directories created by --seed for CWD
+
+typedef enum {
+    OP_CONNECT,    // Connect, greeting and login
+    OP_RETR,
+    OP_STOR,
+    OP_LIST,
+    OP_CWD,
+    OP_COUNT
+} op_t;
+
+static const char *op_names[OP_COUNT] = {"CONNECT", "RETR", "STOR", "LIST", "CWD"};
+
+typedef struct {
+    double *values;
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    samples_t latency[OP_COUNT];
+    long long bytes;
+    long long ops;
+    long long connections;
+    long long errors;
+} session_t;
+
+// Benchmark configuration
+static const char *host = "127.0.0.1";
+static int port = 2121;
+static int sessions = 16;
+static double duration = 10.0;
+static int use_port = 0;
+static int reconnect = 0;          // Reconnect after this many operations (0 = never)
+static int file_count = 64;
+static long long file_size = 64 * 1024;
+static int mix[OP_COUNT] = {0, 50, 10, 30, 10};
+static const char *user = "anonymous";
+static const char *pass = "bench@";
+
+static volatile int running = 1;
+static double deadline;
+
+static void record(samples_t *s, double value) {
+    if (s->count == s->capacity) {
+        size_t capacity = s->capacity ? s->capacity * 2 : 1024;
+        double *values = realloc(s->values, capacity * sizeof(double));
+        if (values == NULL) {
+            return;
+        }
+        s->values = values;
+        s->capacity = capacity;
+    }
+    s->values[s->count++] = value;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const samples_t *s, double p) {
+    if (s->count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (s->count - 1) + 0.5);
+    return s->values[index];
+}
+
+static op_t pick_op(unsigned int *seed) {
+    int total = 0;
+    for (int i = 0; i < OP_COUNT; i++) total += mix[i];
+    int r = rand_r(seed) % total;
+    for (int i = 1; i < OP_COUNT; i++) {
+        if (r < mix[i]) return (op_t)i;
+        r -= mix[i];
+    }
+    return OP_RETR;
+}
+
+static int session_connect(session_t *s, ftp_conn_t *conn) {
+    double start = ftp_now();
+    if (!ftp_connect(conn, host, port) || !ftp_login(conn, user, pass)) {
+        ftp_close(conn, 0);
+        s->errors++;
+        return 0;
+    }
+    conn->use_port = use_port;
+    record(&s->latency[OP_CONNECT], ftp_now() - start);
+    s->connections++;
+    return 1;
+}
+
+static void *session_main(void *arg) {
+    session_t *s = (session_t *)arg;
+    unsigned int seed = (unsigned int)(s->id * 2654435761u) ^ (unsigned int)getpid();
+    ftp_conn_t conn;
+    int connected = 0;
+    int ops_on_conn = 0;
+    int upload = 0;
+    char path[256];
+
+    while (running && ftp_now() < deadline) {
+        if (!connected) {
+            connected = session_connect(s, &conn);
+            ops_on_conn = 0;
+            if (!connected) {
+                usleep(10000);
+                continue;
+            }
+        }
+
+        op_t op = pick_op(&seed);
+        double start = ftp_now();
+        long long n = 0;
+        int ok;
+
+        switch (op) {
+            case OP_RETR:
+                snprintf(path, sizeof(path), "/data/file%d", rand_r(&seed) % file_count);
+                n = ftp_download(&conn, "RETR", path);
+                ok = n >= 0;
+                break;
+            case OP_STOR:
+                snprintf(path, sizeof(path), "/upload/s%d_%d", s->id, upload++ % UPLOAD_SLOTS);
+                n = ftp_upload(&conn, path, file_size);
+                ok = n >= 0;
+                break;
+            case OP_LIST:
+                n = ftp_download(&conn, "LIST", "/data");
+                ok = n >= 0;
+                break;
+            default:
+                snprintf(path, sizeof(path), "/dir%d", rand_r(&seed) % CWD_DIRS);
+                ok = ftp_command(&conn, "CWD %s", path) == 250;
+                n = 0;
+                break;
+        }
+
+        if (ok) {
+            record(&s->latency[op], ftp_now() - start);
+            s->bytes += n;
+            s->ops++;
+        } else {
+            // Resynchronising after a failed transfer is not worth it; start over
+            s->errors++;
+            ftp_close(&conn, 0);
+            connected = 0;
+            continue;
+        }
+
+        if (reconnect > 0 && ++ops_on_conn >= reconnect) {
+            ftp_close(&conn, 1);
+            connected = 0;
+        }
+    }
+
+    if (connected) {
+        ftp_close(&conn, 1);
+    }
+    return NULL;
+}
+
+// CPU ticks and memory of the server process, from /proc
+typedef struct {
+    double cpu;          // utime + stime in seconds
+    long rss_kb;
+    long hwm_kb;
+} proc_stats_t;
+
+static int read_proc_stats(int pid, proc_stats_t *stats) {
+    char path[64], buffer[4096];
+    memset(stats, 0, sizeof(*stats));
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    size_t len = fread(buffer, 1, sizeof(buffer) - 1, f);
+    fclose(f);
+    buffer[len] = '\0';
+
+    // Fields after the command name, which may itself contain spaces
+    char *p = strrchr(buffer, ')');
+    unsigned long utime, stime;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                            &utime, &stime) != 2) {
+        return 0;
+    }
+    stats->cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    f = fopen(path, "r");
+    if (f != NULL) {
+        while (fgets(buffer, sizeof(buffer), f)) {
+            sscanf(buffer, "VmRSS: %ld", &stats->rss_kb);
+            sscanf(buffer, "VmHWM: %ld", &stats->hwm_kb);
+        }
+        fclose(f);
+    }
+    return 1;
+}
+
+// Create the file tree the benchmark expects below an FTP root
+static int seed_root(const char *root) {
+    char path[PATH_MAX];
+    char *buffer = malloc(65536);
+    if (buffer == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < 65536; i++) {
+        buffer[i] = (char)(i * 13 + 1);
+    }
+
+    const char *dirs[] = {"data", "upload"};
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, dirs[i]);
+        mkdir(path, 0755);
+    }
+    for (int i = 0; i < CWD_DIRS; i++) {
+        snprintf(path, sizeof(path), "%s/dir%d", root, i);
+        mkdir(path, 0755);
+    }
+
+    for (int i = 0; i < file_count; i++) {
+        snprintf(path, sizeof(path), "%s/data/file%d", root, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path);
+            free(buffer);
+            return 0;
+        }
+        long long left = file_size;
+        while (left > 0) {
+            size_t chunk = left < 65536 ? (size_t)left : 65536;
+            if (write(fd, buffer, chunk) != (ssize_t)chunk) {
+                perror(path);
+                close(fd);
+                free(buffer);
+                return 0;
+            }
+            left -= chunk;
+        }
+        close(fd);
+    }
+
+    free(buffer);
+    return 1;
+}
+
+static int parse_mix(const char *spec) {
+    int parsed[OP_COUNT] = {0};
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", spec);
+
+    for (char *save = NULL, *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        if (eq == NULL) {
+            return 0;
+        }
+        *eq = '\0';
+        int i;
+        for (i = 1; i < OP_COUNT; i++) {
+            if (strcasecmp(item, op_names[i]) == 0) break;
+        }
+        if (i == OP_COUNT || atoi(eq + 1) < 0) {
+            return 0;
+        }
+        parsed[i] = atoi(eq + 1);
+    }
+
+    int total = 0;
+    for (int i = 1; i < OP_COUNT; i++) total += parsed[i];
+    if (total <= 0) {
+        return 0;
+    }
+    memcpy(mix, parsed, sizeof(mix));
+    return 1;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  -H host           Server address (default: 127.0.0.1)\n");
+    fprintf(stderr, "  -p port           Server port (default: 2121)\n");
+    fprintf(stderr, "  -s sessions       Concurrent sessions (default: 16)\n");
+    fprintf(stderr, "  -d seconds        Test duration (default: 10)\n");
+    fprintf(stderr, "  -o file           Write results as JSON\n");
+    fprintf(stderr, "  --mix SPEC        Operation weights (default: retr=50,stor=10,list=30,cwd=10)\n");
+    fprintf(stderr, "  --active          Use PORT instead of PASV\n");
+    fprintf(stderr, "  --reconnect N     Reconnect every N operations (default: 0, never)\n");
+    fprintf(stderr, "  --files N         Files in /data (default: 64)\n");
+    fprintf(stderr, "  --file-size N     Size of seeded files and uploads (default: 65536)\n");
+    fprintf(stderr, "  --server-pid PID  Report CPU and RSS of the server process\n");
+    fprintf(stderr, "  --seed DIR        Create the test tree below DIR and exit\n");
+    wan_usage();
+}
+
+enum {
+    OPT_MIX = 256,
+    OPT_ACTIVE,
+    OPT_RECONNECT,
+    OPT_FILES,
+    OPT_FILE_SIZE,
+    OPT_SERVER_PID,
+    OPT_SEED,
+    OPT_WAN
+};
+
+static const struct option long_options[] = {
+    {"mix",        required_argument, NULL, OPT_MIX},
+    {"active",     no_argument,       NULL, OPT_ACTIVE},
+    {"reconnect",  required_argument, NULL, OPT_RECONNECT},
+    {"files",      required_argument, NULL, OPT_FILES},
+    {"file-size",  required_argument, NULL, OPT_FILE_SIZE},
+    {"server-pid", required_argument, NULL, OPT_SERVER_PID},
+    {"rtt",        required_argument, NULL, OPT_WAN},
+    {"jitter",     required_argument, NULL, OPT_WAN},
+    {"bandwidth",  required_argument, NULL, OPT_WAN},
+    {"loss",       required_argument, NULL, OPT_WAN},
+    {"seed",       required_argument, NULL, OPT_SEED},
+    {"help",       no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+static void stop(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    const char *seed = NULL;
+    int server_pid = 0;
+    int opt, option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "H:p:s:d:o:h", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 's': sessions = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'o': output = optarg; break;
+            case OPT_MIX:
+                if (!parse_mix(optarg)) {
+                    fprintf(stderr, "Invalid --mix: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_ACTIVE: use_port = 1; break;
+            case OPT_RECONNECT: reconnect = atoi(optarg); break;
+            case OPT_FILES: file_count = atoi(optarg); break;
+            case OPT_FILE_SIZE: file_size = atoll(optarg); break;
+            case OPT_SERVER_PID: server_pid = atoi(optarg); break;
+            case OPT_SEED: seed = optarg; break;
+            case OPT_WAN:
+                if (!wan_option(long_options[option_index].name, optarg)) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (sessions <= 0 || sessions > MAX_SESSIONS || duration <= 0 || file_count <= 0 || file_size < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (seed != NULL) {
+        return seed_root(seed) ? 0 : 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    wan_enable();
+    signal(SIGINT, stop);
+
+    session_t *all = calloc((size_t)sessions, sizeof(session_t));
+    if (all == NULL) {
+        return 1;
+    }
+
+    proc_stats_t before, after;
+    int have_proc = server_pid > 0 && read_proc_stats(server_pid, &before);
+
+    double start = ftp_now();
+    deadline = start + duration;
+    for (int i = 0; i < sessions; i++) {
+        all[i].id = i;
+        if (pthread_create(&all[i].thread, NULL, session_main, &all[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for (int i = 0; i < sessions; i++) {
+        pthread_join(all[i].thread, NULL);
+    }
+    double elapsed = ftp_now() - start;
+
+    have_proc = have_proc && read_proc_stats(server_pid, &after);
+
+    // Merge per-session results
+    session_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < sessions; i++) {
+        total.bytes += all[i].bytes;
+        total.ops += all[i].ops;
+        total.connections += all[i].connections;
+        total.errors += all[i].errors;
+        for (int op = 0; op < OP_COUNT; op++) {
+            for (size_t k = 0; k < all[i].latency[op].count; k++) {
+                record(&total.latency[op], all[i].latency[op].values[k]);
+            }
+            free(all[i].latency[op].values);
+        }
+    }
+    free(all);
+
+    FILE *json = NULL;
+    if (output != NULL && (json = fopen(output, "w")) == NULL) {
+        perror(output);
+    }
+
+    printf("%d sessions, %.1fs, %s\n", sessions, elapsed, use_port ? "PORT" : "PASV");
+    printf("%lld ops (%.0f/s), %lld connections (%.1f/s), %.2f MB/s, %lld errors\n",
+           total.ops, total.ops / elapsed, total.connections, total.connections / elapsed,
+           total.bytes / elapsed / 1e6, total.errors);
+    printf("%-8s %10s %10s %10s %10s\n", "op", "count", "p50 ms", "p99 ms", "p99.9 ms");
+
+    if (json) {
+        fprintf(json, "{\n  \"sessions\": %d,\n  \"duration\": %.3f,\n  \"mode\": \"%s\",\n",
+                sessions, elapsed, use_port ? "PORT" : "PASV");
+        fprintf(json, "  \"file_size\": %lld,\n  \"reconnect\": %d,\n", file_size, reconnect);
+        fprintf(json, "  \"ops\": %lld,\n  \"ops_per_sec\": %.1f,\n", total.ops, total.ops / elapsed);
+        fprintf(json, "  \"connections\": %lld,\n  \"connections_per_sec\": %.1f,\n",
+                total.connections, total.connections / elapsed);
+        fprintf(json, "  \"bytes\": %lld,\n  \"mb_per_sec\": %.2f,\n  \"errors\": %lld,\n",
+                total.bytes, total.bytes / elapsed / 1e6, total.errors);
+        fprintf(json, "  \"latency_ms\": {");
+    }
+
+    int first = 1;
+    for (int op = 0; op < OP_COUNT; op++) {
+        samples_t *s = &total.latency[op];
+        if (s->count == 0) {
+            continue;
+        }
+        qsort(s->values, s->count, sizeof(double), compare_double);
+        double p50 = percentile(s, 0.50) * 1e3;
+        double p99 = percentile(s, 0.99) * 1e3;
+        double p999 = percentile(s, 0.999) * 1e3;
+        printf("%-8s %10zu %10.3f %10.3f %10.3f\n", op_names[op], s->count, p50, p99, p999);
+        if (json) {
+            fprintf(json, "%s\n    \"%s\": {\"count\": %zu, \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f}",
+                    first ? "" : ",", op_names[op], s->count, p50, p99, p999);
+        }
+        first = 0;
+        free(s->values);
+    }
+
+    if (have_proc) {
+        double cpu = after.cpu - before.cpu;
+        printf("server: %.2fs CPU (%.0f%%), RSS %ld KB, peak RSS %ld KB\n",
+               cpu, 100.0 * cpu / elapsed, after.rss_kb, after.hwm_kb);
+    }
+
+    if (json) {
+        fprintf(json, "\n  }");
+        if (have_proc) {
+            double cpu = after.cpu - before.cpu;
+            fprintf(json, ",\n  \"server\": {\"cpu_seconds\": %.2f, \"cpu_percent\": %.1f, "
+                          "\"rss_kb\": %ld, \"peak_rss_kb\": %ld}",
+                    cpu, 100.0 * cpu / elapsed, after.rss_kb, after.hwm_kb);
+        }
+        fprintf(json, "\n}\n");
+        fclose(json);
+    }
+
+    return total.errors > 0 && total.ops == 0 ? 1 : 0;
+}
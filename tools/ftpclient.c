@@ -0,0 +1,341 @@
+// tools/ftpclient.c
+#include "ftpclient.h"
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#define DATA_BUFFER 65536
+
+int (*ftp_socket_hook)(int fd) = NULL;
+
+// Upload payload, shared read-only by all connections
+static char upload_pattern[DATA_BUFFER];
+static pthread_once_t upload_pattern_once = PTHREAD_ONCE_INIT;
+
+static void fill_upload_pattern(void) {
+    for (size_t i = 0; i < sizeof(upload_pattern); i++) {
+        upload_pattern[i] = (char)(i * 31 + 7);
+    }
+}
+
+double ftp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Read one CRLF-terminated line from the control connection
+static int read_line(ftp_conn_t *conn, char *line, size_t size) {
+    for (;;) {
+        char *nl = memchr(conn->rbuf, '\n', conn->rlen);
+        if (nl != NULL) {
+            size_t len = (size_t)(nl - conn->rbuf) + 1;
+            size_t copy = len < size ? len : size - 1;
+            memcpy(line, conn->rbuf, copy);
+            line[copy] = '\0';
+            while (copy > 0 && (line[copy - 1] == '\n' || line[copy - 1] == '\r')) {
+                line[--copy] = '\0';
+            }
+            memmove(conn->rbuf, conn->rbuf + len, conn->rlen - len);
+            conn->rlen -= len;
+            return 1;
+        }
+
+        if (conn->rlen == sizeof(conn->rbuf)) {
+            conn->rlen = 0;  // Overlong line, drop it
+        }
+        ssize_t n = recv(conn->sock, conn->rbuf + conn->rlen, sizeof(conn->rbuf) - conn->rlen, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return 0;
+        }
+        conn->rlen += (size_t)n;
+    }
+}
+
+int ftp_read_reply(ftp_conn_t *conn) {
+    char line[FTP_REPLY_MAX];
+
+    if (!read_line(conn, line, sizeof(line))) {
+        conn->code = -1;
+        return -1;
+    }
+
+    // Multi-line replies run until "<code> " on a line of its own
+    if (strlen(line) >= 4 && line[3] == '-') {
+        char end[5];
+        memcpy(end, line, 3);
+        end[3] = ' ';
+        end[4] = '\0';
+        do {
+            if (!read_line(conn, line, sizeof(line))) {
+                conn->code = -1;
+                return -1;
+            }
+        } while (strncmp(line, end, 4) != 0);
+    }
+
+    snprintf(conn->reply, sizeof(conn->reply), "%s", line);
+    conn->code = atoi(line);
+    return conn->code;
+}
+
+int ftp_command(ftp_conn_t *conn, const char *format, ...) {
+    char command[FTP_REPLY_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(command, sizeof(command) - 2, format, args);
+    va_end(args);
+    if (len < 0 || len >= (int)sizeof(command) - 2) {
+        return -1;
+    }
+    memcpy(command + len, "\r\n", 3);
+
+    if (!send_all(conn->sock, command, (size_t)len + 2)) {
+        return -1;
+    }
+    return ftp_read_reply(conn);
+}
+
+int ftp_connect(ftp_conn_t *conn, const char *host, int port) {
+    memset(conn, 0, sizeof(*conn));
+    conn->sock = -1;
+    conn->data_fd = -1;
+
+    conn->server.sin_family = AF_INET;
+    conn->server.sin_port = htons((unsigned short)port);
+    if (inet_pton(AF_INET, host, &conn->server.sin_addr) != 1) {
+        struct hostent *he = gethostbyname(host);
+        if (he == NULL || he->h_addrtype != AF_INET) {
+            return 0;
+        }
+        memcpy(&conn->server.sin_addr, he->h_addr_list[0], sizeof(conn->server.sin_addr));
+    }
+
+    conn->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->sock < 0) {
+        return 0;
+    }
+    socklen_t len = sizeof(conn->local);
+    if (connect(conn->sock, (struct sockaddr *)&conn->server, sizeof(conn->server)) < 0 ||
+        getsockname(conn->sock, (struct sockaddr *)&conn->local, &len) < 0) {
+        close(conn->sock);
+        conn->sock = -1;
+        return 0;
+    }
+    if (ftp_socket_hook != NULL && (conn->sock = ftp_socket_hook(conn->sock)) < 0) {
+        return 0;
+    }
+
+    // A full server may hold us with 120 "service ready in N minutes" first
+    int code;
+    while ((code = ftp_read_reply(conn)) == 120) {
+    }
+    return code == 220;
+}
+
+int ftp_login(ftp_conn_t *conn, const char *user, const char *pass) {
+    int code = ftp_command(conn, "USER %s", user);
+    if (code == 331) {
+        code = ftp_command(conn, "PASS %s", pass);
+    }
+    return code == 230;
+}
+
+int ftp_data_prepare(ftp_conn_t *conn) {
+    if (conn->data_fd >= 0) {
+        close(conn->data_fd);
+        conn->data_fd = -1;
+    }
+
+    if (!conn->use_port) {
+        if (ftp_command(conn, "PASV") != 227) {
+            return 0;
+        }
+        const char *p = strchr(conn->reply, '(');
+        unsigned int h1, h2, h3, h4, p1, p2;
+        if (p == NULL || sscanf(p + 1, "%u,%u,%u,%u,%u,%u", &h1, &h2, &h3, &h4, &p1, &p2) != 6) {
+            return 0;
+        }
+
+        struct sockaddr_in addr = conn->server;
+        addr.sin_port = htons((unsigned short)((p1 << 8) | p2));
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return 0;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return 0;
+        }
+        if (ftp_socket_hook != NULL && (fd = ftp_socket_hook(fd)) < 0) {
+            return 0;
+        }
+        conn->data_fd = fd;
+        return 1;
+    }
+
+    // Active mode: listen on the control connection's local address
+    struct sockaddr_in addr = conn->local;
+    socklen_t len;
+    addr.sin_port = 0;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    unsigned char *ip = (unsigned char *)&addr.sin_addr.s_addr;
+    int port = ntohs(addr.sin_port);
+    if (ftp_command(conn, "PORT %d,%d,%d,%d,%d,%d", ip[0], ip[1], ip[2], ip[3], port >> 8, port & 0xff) != 200) {
+        close(fd);
+        return 0;
+    }
+    conn->data_fd = fd;
+    return 1;
+}
+
+int ftp_data_accept(ftp_conn_t *conn) {
+    int fd = conn->data_fd;
+    conn->data_fd = -1;
+
+    if (fd < 0 || !conn->use_port) {
+        return fd;
+    }
+
+    int data = accept(fd, NULL, NULL);
+    close(fd);
+    if (data >= 0 && ftp_socket_hook != NULL) {
+        data = ftp_socket_hook(data);
+    }
+    return data;
+}
+
+long long ftp_download(ftp_conn_t *conn, const char *command, const char *arg) {
+    if (conn->data_buf == NULL && (conn->data_buf = malloc(DATA_BUFFER)) == NULL) {
+        return -1;
+    }
+    if (!ftp_data_prepare(conn)) {
+        return -1;
+    }
+
+    char line[FTP_REPLY_MAX];
+    if (arg != NULL && arg[0] != '\0') {
+        snprintf(line, sizeof(line), "%s %s\r\n", command, arg);
+    } else {
+        snprintf(line, sizeof(line), "%s\r\n", command);
+    }
+    if (!send_all(conn->sock, line, strlen(line))) {
+        return -1;
+    }
+
+    // PASV servers reply 150 before accepting, PORT servers after connecting
+    int data = -1;
+    if (conn->use_port) {
+        data = ftp_data_accept(conn);
+    }
+    int code = ftp_read_reply(conn);
+    if (code != 150 && code != 125) {
+        if (data >= 0) close(data);
+        return -1;
+    }
+    if (data < 0) {
+        data = ftp_data_accept(conn);
+    }
+    if (data < 0) {
+        return -1;
+    }
+
+    long long total = 0;
+    ssize_t n;
+    while ((n = recv(data, conn->data_buf, DATA_BUFFER, 0)) > 0) {
+        total += n;
+    }
+    close(data);
+
+    if (n < 0 || ftp_read_reply(conn) != 226) {
+        return -1;
+    }
+    return total;
+}
+
+long long ftp_upload(ftp_conn_t *conn, const char *path, long long size) {
+    pthread_once(&upload_pattern_once, fill_upload_pattern);
+
+    if (!ftp_data_prepare(conn)) {
+        return -1;
+    }
+
+    char line[FTP_REPLY_MAX];
+    snprintf(line, sizeof(line), "STOR %s\r\n", path);
+    if (!send_all(conn->sock, line, strlen(line))) {
+        return -1;
+    }
+
+    int data = -1;
+    if (conn->use_port) {
+        data = ftp_data_accept(conn);
+    }
+    int code = ftp_read_reply(conn);
+    if (code != 150 && code != 125) {
+        if (data >= 0) close(data);
+        return -1;
+    }
+    if (data < 0) {
+        data = ftp_data_accept(conn);
+    }
+    if (data < 0) {
+        return -1;
+    }
+
+    long long sent = 0;
+    while (sent < size) {
+        size_t chunk = size - sent < DATA_BUFFER ? (size_t)(size - sent) : DATA_BUFFER;
+        if (!send_all(data, upload_pattern, chunk)) {
+            close(data);
+            return -1;
+        }
+        sent += chunk;
+    }
+    close(data);
+
+    if (ftp_read_reply(conn) != 226) {
+        return -1;
+    }
+    return sent;
+}
+
+void ftp_close(ftp_conn_t *conn, int polite) {
+    if (conn->sock >= 0 && polite) {
+        ftp_command(conn, "QUIT");
+    }
+    if (conn->data_fd >= 0) {
+        close(conn->data_fd);
+        conn->data_fd = -1;
+    }
+    if (conn->sock >= 0) {
+        close(conn->sock);
+        conn->sock = -1;
+    }
+    free(conn->data_buf);
+    conn->data_buf = NULL;
+}
@@ -0,0 +1,69 @@
+// tools/ftpclient.h
+#ifndef FTPCLIENT_H
+#define FTPCLIENT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define FTP_REPLY_MAX 4096
+
+// Minimal FTP client connection used by the benchmark tools
+typedef struct {
+    int sock;
+    int use_port;                  // Active (PORT) instead of passive (PASV) data connections
+    int data_fd;                   // Connected (PASV) or listening (PORT) data socket
+    int code;                      // Code of the last reply
+    char reply[FTP_REPLY_MAX];     // Text of the last reply line
+    char rbuf[FTP_REPLY_MAX];      // Control channel read buffer
+    size_t rlen;
+    struct sockaddr_in server;
+    struct sockaddr_in local;      // Our address on the control connection, for PORT
+    char *data_buf;                // Receive buffer for downloads
+} ftp_conn_t;
+
+// Called with every connected or accepted socket; returns the fd to use
+// instead (see wan.h), or -1 after closing fd on failure
+extern int (*ftp_socket_hook)(int fd);
+
+// Connect and read the greeting; returns 1 on success
+int ftp_connect(ftp_conn_t *conn, const char *host, int port);
+
+// USER/PASS; returns 1 on success
+int ftp_login(ftp_conn_t *conn, const char *user, const char *pass);
+
+// Send a command and wait for its final reply; returns the reply code or -1
+int ftp_command(ftp_conn_t *conn, const char *format, ...);
+
+// Read the next (possibly multi-line) reply; returns the code or -1
+int ftp_read_reply(ftp_conn_t *conn);
+
+// Prepare a data connection with PASV or PORT; returns 1 on success
+int ftp_data_prepare(ftp_conn_t *conn);
+
+// Get the data socket after the transfer command was sent; returns fd or -1
+int ftp_data_accept(ftp_conn_t *conn);
+
+// Run a download-style command (RETR/LIST/NLST), discarding the data; returns bytes or -1
+long long ftp_download(ftp_conn_t *conn, const char *command, const char *arg);
+
+// Upload size generated bytes with STOR; returns bytes or -1
+long long ftp_upload(ftp_conn_t *conn, const char *path, long long size);
+
+// Close the connection (QUIT if polite)
+void ftp_close(ftp_conn_t *conn, int polite);
+
+// Monotonic time in seconds
+double ftp_now(void);
+
+#endif // FTPCLIENT_H
@@ -0,0 +1,554 @@
+// tools/ftpreplay.c
+// Replays control sessions recorded with ftpserver --trace-file
+#include "ftpclient.h"
+#include "wan.h"
+#include <pthread.h>
+#include <getopt.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define LIST_LINE_GUESS 64     // Average LIST line length when recreating directory contents
+#define MAX_COMMAND_NAMES 64
+
+typedef struct {
+    long long offset_ms;       // From session start
+    long long duration_us;     // As recorded by the server
+    long long bytes;
+    char command[16];
+    char *arg;
+} trace_command_t;
+
+typedef struct {
+    long long start_ms;        // Wall clock of the session start
+    long long end_ms;          // Offset of the session end (-1 if not recorded)
+    trace_command_t *commands;
+    size_t count;
+    size_t capacity;
+} trace_session_t;
+
+typedef struct {
+    double *values;
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+// Replay configuration
+static const char *host = "127.0.0.1";
+static int port = 2121;
+static double speed = 1.0;           // 0 = as fast as possible
+static const char *user = "anonymous";
+static const char *pass = "replay@";
+
+static trace_session_t *sessions = NULL;
+static size_t session_count = 0;
+static long long first_start_ms = -1;
+
+// Results, shared by all session threads
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static char command_names[MAX_COMMAND_NAMES][16];
+static samples_t command_latency[MAX_COMMAND_NAMES];
+static int command_name_count = 0;
+static samples_t lag;                // How late commands were issued, seconds
+static long long total_bytes = 0;
+static long long total_commands = 0;
+static long long total_errors = 0;
+static int running_sessions = 0;
+static double replay_start;
+
+static void record(samples_t *s, double value) {
+    if (s->count == s->capacity) {
+        size_t capacity = s->capacity ? s->capacity * 2 : 256;
+        double *values = realloc(s->values, capacity * sizeof(double));
+        if (values == NULL) {
+            return;
+        }
+        s->values = values;
+        s->capacity = capacity;
+    }
+    s->values[s->count++] = value;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(samples_t *s, double p) {
+    return s->count ? s->values[(size_t)(p * (s->count - 1) + 0.5)] : 0;
+}
+
+static int compare_start(const void *a, const void *b) {
+    const trace_session_t *x = a, *y = b;
+    return (x->start_ms > y->start_ms) - (x->start_ms < y->start_ms);
+}
+
+// Read a trace; sessions from several server runs in one file stay apart
+static int load_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    size_t *index = NULL;     // Session id -> position in sessions, for the current run
+    size_t index_size = 0;
+    size_t capacity = 0;
+    char line[8192];
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "# ftpserver trace", 17) == 0) {
+            memset(index, 0xff, index_size * sizeof(size_t));
+            continue;
+        }
+
+        char *fields[7] = {0};
+        int n = 0;
+        char *p = line;
+        while (n < 7) {
+            fields[n++] = p;
+            char *tab = strchr(p, '\t');
+            if (tab == NULL || n == 7) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        if (n < 3) continue;
+
+        size_t id = strtoul(fields[1], NULL, 10);
+        if (id >= index_size) {
+            size_t size = index_size ? index_size : 1024;
+            while (size <= id) size *= 2;
+            size_t *grown = realloc(index, size * sizeof(size_t));
+            if (grown == NULL) break;
+            memset(grown + index_size, 0xff, (size - index_size) * sizeof(size_t));
+            index = grown;
+            index_size = size;
+        }
+
+        if (fields[0][0] == 'S') {
+            if (session_count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                trace_session_t *grown = realloc(sessions, capacity * sizeof(trace_session_t));
+                if (grown == NULL) break;
+                sessions = grown;
+            }
+            trace_session_t *s = &sessions[session_count];
+            memset(s, 0, sizeof(*s));
+            s->start_ms = atoll(fields[2]);
+            s->end_ms = -1;
+            index[id] = session_count++;
+            continue;
+        }
+
+        if (index[id] == (size_t)-1) continue;
+        trace_session_t *s = &sessions[index[id]];
+
+        if (fields[0][0] == 'E') {
+            s->end_ms = atoll(fields[2]);
+        } else if (fields[0][0] == 'C' && n >= 6) {
+            if (s->count == s->capacity) {
+                size_t cap = s->capacity ? s->capacity * 2 : 16;
+                trace_command_t *grown = realloc(s->commands, cap * sizeof(trace_command_t));
+                if (grown == NULL) break;
+                s->commands = grown;
+                s->capacity = cap;
+            }
+            trace_command_t *c = &s->commands[s->count++];
+            c->offset_ms = atoll(fields[2]);
+            c->duration_us = atoll(fields[3]);
+            c->bytes = atoll(fields[4]);
+            snprintf(c->command, sizeof(c->command), "%s", fields[5]);
+            c->arg = strdup(n == 7 ? fields[6] : "");
+        }
+    }
+
+    free(index);
+    fclose(f);
+
+    qsort(sessions, session_count, sizeof(trace_session_t), compare_start);
+    if (session_count > 0) {
+        first_start_ms = sessions[0].start_ms;
+    }
+    return 1;
+}
+
+// Skip "-la" style options in front of a LIST/NLST path
+static const char *path_argument(const char *arg) {
+    while (*arg == '-') {
+        while (*arg && *arg != ' ') arg++;
+        while (*arg == ' ') arg++;
+    }
+    return arg;
+}
+
+// Resolve path against the session's directory, both relative to the FTP root
+static void resolve(const char *cwd, const char *path, char *out, size_t size) {
+    char joined[PATH_MAX * 2];
+    if (path[0] == '/') {
+        snprintf(joined, sizeof(joined), "%s", path);
+    } else {
+        snprintf(joined, sizeof(joined), "%s/%s", cwd, path);
+    }
+
+    // Normalise . and .. without touching the filesystem
+    size_t used = 0;
+    out[0] = '\0';
+    for (char *save = NULL, *part = strtok_r(joined, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) continue;
+        if (strcmp(part, "..") == 0) {
+            char *slash = strrchr(out, '/');
+            used = slash ? (size_t)(slash - out) : 0;
+            out[used] = '\0';
+            continue;
+        }
+        int n = snprintf(out + used, size - used, "/%s", part);
+        if (n < 0 || (size_t)n >= size - used) break;
+        used += (size_t)n;
+    }
+    if (used == 0) {
+        snprintf(out, size, "/");
+    }
+}
+
+static void make_dirs(const char *root, const char *path) {
+    char full[PATH_MAX * 2];
+    snprintf(full, sizeof(full), "%s%s", root, path);
+    for (char *p = full + strlen(root) + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(full, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(full, 0755);
+}
+
+static void make_file(const char *root, const char *path, long long size) {
+    char full[PATH_MAX * 2];
+    static char block[65536];
+    if (block[0] == 0) {
+        for (size_t i = 0; i < sizeof(block); i++) block[i] = (char)(i * 7 + 1);
+    }
+
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s", path);
+    char *slash = strrchr(parent, '/');
+    if (slash != NULL && slash != parent) {
+        *slash = '\0';
+        make_dirs(root, parent);
+    }
+
+    snprintf(full, sizeof(full), "%s%s", root, path);
+    struct stat st;
+    if (stat(full, &st) == 0 && (S_ISDIR(st.st_mode) || st.st_size >= size)) {
+        return;
+    }
+    int fd = open(full, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(full);
+        return;
+    }
+    for (long long left = size; left > 0;) {
+        size_t chunk = left < (long long)sizeof(block) ? (size_t)left : sizeof(block);
+        if (write(fd, block, chunk) != (ssize_t)chunk) break;
+        left -= chunk;
+    }
+    close(fd);
+}
+
+// Recreate a tree of the shape the trace touched: directories entered or
+// listed, downloaded files at their transfer size, and enough filler entries
+// to make listings about as long as recorded
+static int seed_tree(const char *root) {
+    mkdir(root, 0755);
+
+    for (size_t i = 0; i < session_count; i++) {
+        trace_session_t *s = &sessions[i];
+        char cwd[PATH_MAX] = "/";
+        char path[PATH_MAX];
+
+        for (size_t k = 0; k < s->count; k++) {
+            trace_command_t *c = &s->commands[k];
+            const char *arg = c->arg;
+
+            if (strcmp(c->command, "CWD") == 0 || strcmp(c->command, "XCWD") == 0) {
+                if (arg[0] == '\0') continue;
+                resolve(cwd, arg, path, sizeof(path));
+                make_dirs(root, path);
+                snprintf(cwd, sizeof(cwd), "%s", path);
+            } else if (strcmp(c->command, "CDUP") == 0) {
+                resolve(cwd, "..", path, sizeof(path));
+                snprintf(cwd, sizeof(cwd), "%s", path);
+            } else if (strcmp(c->command, "LIST") == 0 || strcmp(c->command, "NLST") == 0 ||
+                       strcmp(c->command, "MLSD") == 0) {
+                resolve(cwd, path_argument(arg), path, sizeof(path));
+                make_dirs(root, path);
+                long long entries = c->bytes / LIST_LINE_GUESS;
+                for (long long e = 0; e < entries; e++) {
+                    char filler[PATH_MAX + 32];
+                    snprintf(filler, sizeof(filler), "%s/filler%lld", strcmp(path, "/") ? path : "", e);
+                    make_file(root, filler, 0);
+                }
+            } else if (strcmp(c->command, "RETR") == 0) {
+                resolve(cwd, arg, path, sizeof(path));
+                make_file(root, path, c->bytes);
+            } else if (strcmp(c->command, "STOR") == 0 || strcmp(c->command, "APPE") == 0) {
+                resolve(cwd, arg, path, sizeof(path));
+                char *slash = strrchr(path, '/');
+                if (slash != NULL && slash != path) {
+                    *slash = '\0';
+                    make_dirs(root, path);
+                }
+            } else if (strcmp(c->command, "SIZE") == 0 || strcmp(c->command, "MDTM") == 0 ||
+                       strcmp(c->command, "HASH") == 0 || strcmp(c->command, "XCRC") == 0 ||
+                       strcmp(c->command, "XMD5") == 0 || strcmp(c->command, "XSHA256") == 0) {
+                resolve(cwd, arg, path, sizeof(path));
+                make_file(root, path, 0);
+            }
+        }
+    }
+    return 1;
+}
+
+static void wait_until(double when) {
+    double delay = when - ftp_now();
+    if (delay > 0) {
+        struct timespec ts = {(time_t)delay, (long)((delay - (time_t)delay) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void record_command(const char *command, double latency, long long bytes, int ok) {
+    pthread_mutex_lock(&results_mutex);
+    if (!ok) {
+        total_errors++;
+    } else {
+        int i;
+        for (i = 0; i < command_name_count; i++) {
+            if (strcmp(command_names[i], command) == 0) break;
+        }
+        if (i == command_name_count && command_name_count < MAX_COMMAND_NAMES) {
+            snprintf(command_names[command_name_count++], sizeof(command_names[0]), "%s", command);
+        }
+        if (i < MAX_COMMAND_NAMES) {
+            record(&command_latency[i], latency);
+        }
+        total_commands++;
+        total_bytes += bytes;
+    }
+    pthread_mutex_unlock(&results_mutex);
+}
+
+static int replay_connect(ftp_conn_t *conn, int use_port) {
+    double start = ftp_now();
+    int ok = ftp_connect(conn, host, port) && ftp_login(conn, user, pass);
+    record_command("CONNECT", ftp_now() - start, 0, ok);
+    if (!ok) {
+        ftp_close(conn, 0);
+    }
+    conn->use_port = use_port;
+    return ok;
+}
+
+static void *session_thread(void *arg) {
+    trace_session_t *s = (trace_session_t *)arg;
+    double base = replay_start + (speed > 0 ? (s->start_ms - first_start_ms) / 1000.0 / speed : 0);
+    ftp_conn_t conn;
+    int use_port = 0;
+    int connected = replay_connect(&conn, use_port);
+
+    for (size_t k = 0; k < s->count && connected; k++) {
+        trace_command_t *c = &s->commands[k];
+        const char *command = c->command;
+
+        if (speed > 0) {
+            double when = base + c->offset_ms / 1000.0 / speed;
+            wait_until(when);
+            double late = ftp_now() - when;
+            pthread_mutex_lock(&results_mutex);
+            record(&lag, late > 0 ? late : 0);
+            pthread_mutex_unlock(&results_mutex);
+        }
+
+        // Login and data connection setup are done by the client library
+        if (strcmp(command, "USER") == 0 || strcmp(command, "PASS") == 0) continue;
+        if (strcmp(command, "PASV") == 0 || strcmp(command, "EPSV") == 0) {
+            conn.use_port = use_port = 0;
+            continue;
+        }
+        if (strcmp(command, "PORT") == 0 || strcmp(command, "EPRT") == 0) {
+            conn.use_port = use_port = 1;
+            continue;
+        }
+        if (strcmp(command, "QUIT") == 0) break;
+
+        double start = ftp_now();
+        long long bytes = 0;
+        int ok;
+        if (strcmp(command, "RETR") == 0 || strcmp(command, "LIST") == 0 ||
+            strcmp(command, "NLST") == 0 || strcmp(command, "MLSD") == 0) {
+            bytes = ftp_download(&conn, command, c->arg);
+            ok = bytes >= 0;
+        } else if (strcmp(command, "STOR") == 0 || strcmp(command, "APPE") == 0) {
+            bytes = ftp_upload(&conn, c->arg, c->bytes);
+            ok = bytes >= 0;
+        } else {
+            int code = c->arg[0] ? ftp_command(&conn, "%s %s", command, c->arg) : ftp_command(&conn, "%s", command);
+            ok = code > 0;
+        }
+        record_command(command, ftp_now() - start, ok ? bytes : 0, ok);
+
+        // A failed transfer leaves the control channel in an unknown state
+        if (!ok) {
+            ftp_close(&conn, 0);
+            connected = replay_connect(&conn, use_port);
+        }
+    }
+
+    if (connected) {
+        ftp_close(&conn, 1);
+    }
+
+    pthread_mutex_lock(&results_mutex);
+    running_sessions--;
+    pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&results_mutex);
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] TRACE\n", program);
+    fprintf(stderr, "  -H host          Server address (default: 127.0.0.1)\n");
+    fprintf(stderr, "  -p port          Server port (default: 2121)\n");
+    fprintf(stderr, "  -x speed         Time scale, 2 = twice as fast, 0 = no pauses (default: 1)\n");
+    fprintf(stderr, "  -o file          Write results as JSON\n");
+    fprintf(stderr, "  --seed DIR       Create a tree of the shape the trace uses below DIR and exit\n");
+    wan_usage();
+}
+
+enum {
+    OPT_SEED = 256,
+    OPT_WAN
+};
+
+static const struct option long_options[] = {
+    {"rtt",        required_argument, NULL, OPT_WAN},
+    {"jitter",     required_argument, NULL, OPT_WAN},
+    {"bandwidth",  required_argument, NULL, OPT_WAN},
+    {"loss",       required_argument, NULL, OPT_WAN},
+    {"seed", required_argument, NULL, OPT_SEED},
+    {"help", no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    const char *seed = NULL;
+    int opt, option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "H:p:x:o:h", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'H': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'x': speed = atof(optarg); break;
+            case 'o': output = optarg; break;
+            case OPT_SEED: seed = optarg; break;
+            case OPT_WAN:
+                if (!wan_option(long_options[option_index].name, optarg)) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1 || speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!load_trace(argv[optind])) {
+        return 1;
+    }
+    if (seed != NULL) {
+        return seed_tree(seed) ? 0 : 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    wan_enable();
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+
+    // Sessions are started on schedule so only the overlapping ones have threads
+    replay_start = ftp_now();
+    for (size_t i = 0; i < session_count; i++) {
+        if (speed > 0) {
+            wait_until(replay_start + (sessions[i].start_ms - first_start_ms) / 1000.0 / speed);
+        }
+        pthread_mutex_lock(&results_mutex);
+        running_sessions++;
+        pthread_mutex_unlock(&results_mutex);
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, session_thread, &sessions[i]) != 0) {
+            perror("pthread_create");
+            pthread_mutex_lock(&results_mutex);
+            running_sessions--;
+            total_errors++;
+            pthread_mutex_unlock(&results_mutex);
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_lock(&results_mutex);
+    while (running_sessions > 0) {
+        pthread_cond_wait(&done_cond, &results_mutex);
+    }
+    pthread_mutex_unlock(&results_mutex);
+    double elapsed = ftp_now() - replay_start;
+
+    FILE *json = NULL;
+    if (output != NULL && (json = fopen(output, "w")) == NULL) {
+        perror(output);
+    }
+
+    printf("%zu sessions, %lld commands in %.1fs (speed %gx), %.2f MB/s, %lld errors\n",
+           session_count, total_commands, elapsed, speed, total_bytes / elapsed / 1e6, total_errors);
+    qsort(lag.values, lag.count, sizeof(double), compare_double);
+    if (lag.count) {
+        printf("schedule lag: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               percentile(&lag, 0.5) * 1e3, percentile(&lag, 0.99) * 1e3, lag.values[lag.count - 1] * 1e3);
+    }
+    printf("%-8s %10s %10s %10s %10s\n", "command", "count", "p50 ms", "p99 ms", "p99.9 ms");
+
+    if (json) {
+        fprintf(json, "{\n  \"sessions\": %zu,\n  \"commands\": %lld,\n  \"duration\": %.3f,\n"
+                      "  \"speed\": %g,\n  \"bytes\": %lld,\n  \"errors\": %lld,\n"
+                      "  \"lag_ms\": {\"p50\": %.3f, \"p99\": %.3f},\n  \"latency_ms\": {",
+                session_count, total_commands, elapsed, speed, total_bytes, total_errors,
+                percentile(&lag, 0.5) * 1e3, percentile(&lag, 0.99) * 1e3);
+    }
+    for (int i = 0; i < command_name_count; i++) {
+        samples_t *s = &command_latency[i];
+        qsort(s->values, s->count, sizeof(double), compare_double);
+        double p50 = percentile(s, 0.5) * 1e3, p99 = percentile(s, 0.99) * 1e3, p999 = percentile(s, 0.999) * 1e3;
+        printf("%-8s %10zu %10.3f %10.3f %10.3f\n", command_names[i], s->count, p50, p99, p999);
+        if (json) {
+            fprintf(json, "%s\n    \"%s\": {\"count\": %zu, \"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f}",
+                    i ? "," : "", command_names[i], s->count, p50, p99, p999);
+        }
+    }
+    if (json) {
+        fprintf(json, "\n  }\n}\n");
+        fclose(json);
+    }
+
+    return total_errors > 0 && total_commands == 0 ? 1 : 0;
+}
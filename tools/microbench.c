@@ -0,0 +1,358 @@
+// tools/microbench.c
+// In-process microbenchmarks for hot server routines, linked against the
+// server objects built without main() (see LIB_OBJS in the Makefile)
+#include "config.h"
+#include "client.h"
+#include "commands.h"
+#include "logging.h"
+#include "ascii.h"
+#include <getopt.h>
+#include <sys/socket.h>
+
+#define MAX_LOG_THREADS 64
+
+typedef struct {
+    const char *name;
+    long long iterations;
+    double seconds;
+    int threads;
+} result_t;
+
+static long long iterations = 200000;
+static int max_threads = 8;
+static result_t results[64];
+static int result_count = 0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long long n, double seconds, int threads) {
+    printf("%-28s %8d %12lld %12.1f %14.0f\n", name, threads, n, seconds * 1e9 / n, n / seconds);
+    if (result_count < (int)(sizeof(results) / sizeof(results[0]))) {
+        results[result_count++] = (result_t){name, n, seconds, threads};
+    }
+}
+
+// Reads and discards everything written to the other end of a socketpair
+static void *drain_thread(void *arg) {
+    int fd = *(int *)arg;
+    char buffer[65536];
+    while (recv(fd, buffer, sizeof(buffer), 0) > 0) {
+    }
+    return NULL;
+}
+
+typedef struct {
+    int fds[2];
+    pthread_t thread;
+} sink_t;
+
+static int sink_open(sink_t *sink) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sink->fds) < 0) {
+        perror("socketpair");
+        return 0;
+    }
+    return pthread_create(&sink->thread, NULL, drain_thread, &sink->fds[1]) == 0;
+}
+
+static void sink_close(sink_t *sink) {
+    close(sink->fds[0]);
+    pthread_join(sink->thread, NULL);
+    close(sink->fds[1]);
+}
+
+static client_t *bench_client(int control_socket) {
+    client_t *client = (client_t *)calloc(1, sizeof(client_t));
+    client->control_socket = control_socket;
+    client->data_socket = -1;
+    client->thread_running = 1;
+    strcpy(client->ip_address, "127.0.0.1");
+    strcpy(client->current_dir, root_directory);
+    return client;
+}
+
+static void bench_list_format(void) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    st.st_nlink = 1;
+    st.st_size = 123456789;
+    st.st_mtime = time(NULL);
+
+    char line[MAX_BUFFER];
+    size_t total = 0;
+    double start = now();
+    for (long long i = 0; i < iterations; i++) {
+        total += format_list_line(line, sizeof(line), "some-reasonably-long-file-name.tar.gz", &st, 1);
+    }
+    report("list_format", iterations, now() - start, 1);
+
+    start = now();
+    for (long long i = 0; i < iterations; i++) {
+        total += format_list_line(line, sizeof(line), "some-reasonably-long-file-name.tar.gz", &st, 0);
+    }
+    report("nlst_format", iterations, now() - start, 1);
+
+    if (total == 0) {
+        printf("unexpected empty output\n");
+    }
+}
+
+// TYPE A translation of one 8K transfer buffer of 60-byte text lines
+static void bench_ascii(void) {
+    char text[8192], wire[2 * sizeof(text)], back[sizeof(wire) + 1];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = i % 60 == 59 ? '\n' : 'a' + (char)(i % 26);
+    }
+
+    ascii_state_t state;
+    ascii_begin(&state);
+    size_t wire_len = 0;
+    double start = now();
+    for (long long i = 0; i < iterations; i++) {
+        wire_len = ascii_encode(&state, text, sizeof(text), wire);
+    }
+    report("ascii_encode_8k", iterations, now() - start, 1);
+
+    size_t total = 0;
+    ascii_begin(&state);
+    start = now();
+    for (long long i = 0; i < iterations; i++) {
+        total += ascii_decode(&state, wire, wire_len, back);
+    }
+    report("ascii_decode_8k", iterations, now() - start, 1);
+
+    if (total != (size_t)iterations * sizeof(text) || memcmp(back, text, sizeof(text)) != 0) {
+        printf("ascii round trip mismatch (%s)\n", ascii_implementation());
+    }
+}
+
+static void bench_send_response(void) {
+    sink_t sink;
+    if (!sink_open(&sink)) {
+        return;
+    }
+
+    double start = now();
+    for (long long i = 0; i < iterations; i++) {
+        send_response(sink.fds[0], 200, "Type set to I");
+    }
+    report("send_response", iterations, now() - start, 1);
+    sink_close(&sink);
+}
+
+static void *log_thread(void *arg) {
+    long long n = *(long long *)arg;
+    for (long long i = 0; i < n; i++) {
+        log_message(FTPLOG_DEBUG, "Received from %s: %s", "192.168.1.10", "RETR /pub/file.bin");
+    }
+    return NULL;
+}
+
+static void bench_log_message(void) {
+    static const char *names[] = {"log_message/1", "log_message/2", "log_message/4", "log_message/8",
+                                  "log_message/16", "log_message/32", "log_message/64"};
+    pthread_t threads[MAX_LOG_THREADS];
+
+    for (int t = 1, k = 0; t <= max_threads && t <= MAX_LOG_THREADS; t *= 2, k++) {
+        long long per_thread = iterations / t;
+        double start = now();
+        for (int i = 0; i < t; i++) {
+            pthread_create(&threads[i], NULL, log_thread, &per_thread);
+        }
+        for (int i = 0; i < t; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        report(names[k], per_thread * t, now() - start, t);
+    }
+}
+
+static void bench_dispatch(void) {
+    static const char *commands[][2] = {
+        {"SYST", ""}, {"PWD", ""}, {"TYPE", "I"}, {"OPTS", "UTF8 ON"}, {"XXXX", ""}
+    };
+    const int count = sizeof(commands) / sizeof(commands[0]);
+
+    sink_t sink;
+    if (!sink_open(&sink)) {
+        return;
+    }
+    client_t *client = bench_client(sink.fds[0]);
+
+    double start = now();
+    for (long long i = 0; i < iterations; i++) {
+        process_command(client, commands[i % count][0], commands[i % count][1]);
+    }
+    report("process_command", iterations, now() - start, 1);
+
+    free(client);
+    sink_close(&sink);
+}
+
+static void bench_cwd(void) {
+    sink_t sink;
+    if (!sink_open(&sink)) {
+        return;
+    }
+    client_t *client = bench_client(sink.fds[0]);
+
+    double start = now();
+    for (long long i = 0; i < iterations; i++) {
+        process_command(client, "CWD", (i & 1) ? ".." : "/a/b/c");
+    }
+    report("cwd", iterations, now() - start, 1);
+
+    start = now();
+    for (long long i = 0; i < iterations; i++) {
+        process_command(client, "CWD", (i & 1) ? "/" : "a/b");
+    }
+    report("cwd_relative", iterations, now() - start, 1);
+
+    free(client);
+    sink_close(&sink);
+}
+
+// Full control loop: one command at a time through handle_client_thread
+static void bench_session(void) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return;
+    }
+
+    client_t *client = bench_client(fds[0]);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, handle_client_thread, client) != 0) {
+        return;
+    }
+
+    char reply[MAX_BUFFER];
+    if (recv(fds[1], reply, sizeof(reply), 0) <= 0) {  // Greeting
+        return;
+    }
+
+    long long n = iterations / 4;
+    double start = now();
+    for (long long i = 0; i < n; i++) {
+        const char *command = (i & 1) ? "PWD\r\n" : "TYPE I\r\n";
+        if (send(fds[1], command, strlen(command), 0) < 0 || recv(fds[1], reply, sizeof(reply), 0) <= 0) {
+            break;
+        }
+    }
+    report("session_roundtrip", n, now() - start, 1);
+
+    // The thread frees the client once the peer goes away
+    close(fds[1]);
+    pthread_join(thread, NULL);
+}
+
+static int make_tree(void) {
+    char path[PATH_MAX + 8];
+    char template[] = "/tmp/microbench.XXXXXX";
+    if (mkdtemp(template) == NULL || realpath(template, root_directory) == NULL) {
+        perror("mkdtemp");
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/a", root_directory);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/a/b", root_directory);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/a/b/c", root_directory);
+    mkdir(path, 0755);
+    strcpy(upload_directory, root_directory);
+    return 1;
+}
+
+static void remove_tree(void) {
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/a/b/c", root_directory);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/a/b", root_directory);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/a", root_directory);
+    rmdir(path);
+    rmdir(root_directory);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} benchmarks[] = {
+    {"list", bench_list_format},
+    {"ascii", bench_ascii},
+    {"response", bench_send_response},
+    {"log", bench_log_message},
+    {"dispatch", bench_dispatch},
+    {"cwd", bench_cwd},
+    {"session", bench_session},
+};
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n iterations] [-t max_threads] [-o results.json] [benchmark...]\n", program);
+    fprintf(stderr, "Benchmarks:");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        fprintf(stderr, " %s", benchmarks[i].name);
+    }
+    fprintf(stderr, "\nLog output goes to /dev/null, as with a daemon log file.\n");
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:o:h")) != -1) {
+        switch (opt) {
+            case 'n': iterations = atoll(optarg); break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (iterations <= 0 || max_threads <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    log_file = fopen("/dev/null", "w");
+    client_init();
+    if (!make_tree()) {
+        return 1;
+    }
+
+    printf("%-28s %8s %12s %12s %14s\n", "benchmark", "threads", "iterations", "ns/op", "ops/s");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        int selected = optind >= argc;
+        for (int k = optind; k < argc; k++) {
+            if (strcmp(argv[k], benchmarks[i].name) == 0) selected = 1;
+        }
+        if (selected) {
+            benchmarks[i].run();
+        }
+    }
+
+    if (output != NULL) {
+        FILE *json = fopen(output, "w");
+        if (json == NULL) {
+            perror(output);
+        } else {
+            fprintf(json, "{\n");
+            for (int i = 0; i < result_count; i++) {
+                fprintf(json, "  \"%s\": {\"threads\": %d, \"iterations\": %lld, \"ns_per_op\": %.1f}%s\n",
+                        results[i].name, results[i].threads, results[i].iterations,
+                        results[i].seconds * 1e9 / results[i].iterations, i + 1 < result_count ? "," : "");
+            }
+            fprintf(json, "}\n");
+            fclose(json);
+        }
+    }
+
+    remove_tree();
+    client_cleanup();
+    return 0;
+}
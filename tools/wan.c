@@ -0,0 +1,275 @@
+// tools/wan.c
+#include "ftpclient.h"
+#include "wan.h"
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#define WAN_CHUNK 16384              // Largest read relayed as one unit
+#define WAN_SEGMENT 1448             // Loss is drawn per TCP-sized segment
+#define WAN_MIN_RTO 0.2              // Linux minimum retransmission timeout, seconds
+#define WAN_QUEUE_MIN (256 * 1024)   // Bytes in flight per direction beyond the bandwidth-delay product
+
+wan_config_t wan_config = {0, 0, 0, 0};
+
+typedef struct chunk {
+    double due;                      // When the far end may read it
+    size_t len;
+    size_t off;
+    struct chunk *next;
+    char data[];
+} chunk_t;
+
+// Both directions of one relayed connection
+typedef struct {
+    int real;                        // Socket to the server
+    int relay;                       // Our end of the socketpair handed to the client
+    int refs;
+    pthread_mutex_t lock;
+} link_t;
+
+typedef struct {
+    link_t *link;
+    int src;
+    int dst;
+    unsigned int seed;
+} direction_t;
+
+static int parse_number(const char *value, double *out) {
+    char *end;
+    double n = strtod(value, &end);
+    switch (*end) {
+        case 'k': case 'K': n *= 1024; end++; break;
+        case 'm': case 'M': n *= 1024 * 1024; end++; break;
+        case 'g': case 'G': n *= 1024.0 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (end == value || *end != '\0' || n < 0) {
+        return 0;
+    }
+    *out = n;
+    return 1;
+}
+
+int wan_option(const char *name, const char *value) {
+    if (strcmp(name, "rtt") == 0) {
+        return parse_number(value, &wan_config.rtt_ms);
+    } else if (strcmp(name, "jitter") == 0) {
+        return parse_number(value, &wan_config.jitter_ms);
+    } else if (strcmp(name, "bandwidth") == 0) {
+        return parse_number(value, &wan_config.bandwidth);
+    } else if (strcmp(name, "loss") == 0) {
+        if (!parse_number(value, &wan_config.loss) || wan_config.loss > 100) {
+            return 0;
+        }
+        wan_config.loss /= 100;
+        return 1;
+    }
+    return 0;
+}
+
+void wan_usage(void) {
+    fprintf(stderr, "  --rtt MS          Emulated round-trip time\n");
+    fprintf(stderr, "  --jitter MS       Extra random one-way delay, up to MS\n");
+    fprintf(stderr, "  --bandwidth RATE  Bytes/s per connection and direction (K/M/G suffixes)\n");
+    fprintf(stderr, "  --loss PCT        Segment loss rate, each loss stalls for a retransmission timeout\n");
+}
+
+static void link_release(link_t *link) {
+    pthread_mutex_lock(&link->lock);
+    int last = --link->refs == 0;
+    pthread_mutex_unlock(&link->lock);
+    if (last) {
+        close(link->real);
+        close(link->relay);
+        pthread_mutex_destroy(&link->lock);
+        free(link);
+    }
+}
+
+static double random_unit(unsigned int *seed) {
+    return rand_r(seed) / ((double)RAND_MAX + 1);
+}
+
+// Delivery time of a chunk read now, keeping the stream in order
+static double schedule(direction_t *dir, size_t len, double now, double *link_free, double *last_due) {
+    double one_way = wan_config.rtt_ms / 2000.0 + wan_config.jitter_ms * random_unit(&dir->seed) / 1000.0;
+
+    // Serialisation at the sender's line rate
+    double start = now > *link_free ? now : *link_free;
+    *link_free = start + (wan_config.bandwidth > 0 ? len / wan_config.bandwidth : 0);
+    double due = *link_free + one_way;
+
+    // A lost segment holds everything behind it until it is retransmitted
+    if (wan_config.loss > 0) {
+        double rto = wan_config.rtt_ms / 1000.0 > WAN_MIN_RTO ? wan_config.rtt_ms / 1000.0 : WAN_MIN_RTO;
+        for (size_t sent = 0; sent < len; sent += WAN_SEGMENT) {
+            if (random_unit(&dir->seed) < wan_config.loss) {
+                due += rto;
+                break;
+            }
+        }
+    }
+
+    if (due < *last_due) {
+        due = *last_due;
+    }
+    *last_due = due;
+    return due;
+}
+
+static void *direction_thread(void *arg) {
+    direction_t *dir = (direction_t *)arg;
+    chunk_t *head = NULL, *tail = NULL;
+    size_t queued = 0;
+    double link_free = 0, last_due = 0;
+    int eof = 0, failed = 0;
+
+    // Enough to keep the emulated pipe full, but no more, so senders feel backpressure
+    double delay = (wan_config.rtt_ms / 2 + wan_config.jitter_ms) / 1000.0;
+    size_t limit = WAN_QUEUE_MIN + (wan_config.bandwidth > 0 ? (size_t)(wan_config.bandwidth * delay) : 0);
+
+    for (;;) {
+        double now = ftp_now();
+
+        while (head != NULL && head->due <= now) {
+            ssize_t n = send(dir->dst, head->data + head->off, head->len - head->off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                failed = 1;
+                break;
+            }
+            head->off += (size_t)n;
+            if (head->off == head->len) {
+                chunk_t *done = head;
+                head = head->next;
+                if (head == NULL) tail = NULL;
+                queued -= done->len;
+                free(done);
+            }
+        }
+        if (failed || (eof && head == NULL)) {
+            break;
+        }
+
+        struct pollfd pfd = {dir->src, POLLIN, 0};
+        int watch = !eof && queued < limit;
+        struct timespec timeout, *wait = NULL;
+        if (head != NULL) {
+            double left = head->due - ftp_now();
+            if (left < 0) left = 0;
+            timeout.tv_sec = (time_t)left;
+            timeout.tv_nsec = (long)((left - (double)timeout.tv_sec) * 1e9);
+            wait = &timeout;
+        }
+
+        int ready = ppoll(watch ? &pfd : NULL, watch ? 1 : 0, wait, NULL);
+        if (ready < 0 && errno != EINTR) {
+            failed = 1;
+            break;
+        }
+        if (ready <= 0 || !(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        chunk_t *chunk = malloc(sizeof(chunk_t) + WAN_CHUNK);
+        if (chunk == NULL) {
+            failed = 1;
+            break;
+        }
+        ssize_t n = recv(dir->src, chunk->data, WAN_CHUNK, 0);
+        if (n <= 0) {
+            free(chunk);
+            if (n < 0 && errno == EINTR) continue;
+            eof = 1;
+            continue;
+        }
+        chunk->len = (size_t)n;
+        chunk->off = 0;
+        chunk->next = NULL;
+        chunk->due = schedule(dir, chunk->len, ftp_now(), &link_free, &last_due);
+        if (tail) tail->next = chunk; else head = chunk;
+        tail = chunk;
+        queued += chunk->len;
+    }
+
+    while (head != NULL) {
+        chunk_t *next = head->next;
+        free(head);
+        head = next;
+    }
+
+    if (failed) {
+        // Wake the other direction too
+        shutdown(dir->link->real, SHUT_RDWR);
+        shutdown(dir->link->relay, SHUT_RDWR);
+    } else {
+        shutdown(dir->dst, SHUT_WR);
+    }
+    link_release(dir->link);
+    free(dir);
+    return NULL;
+}
+
+// Put a connected socket behind the emulated link; returns the fd the client should use
+static int wan_wrap(int fd) {
+    // The three-way handshake costs a round trip before either side can send
+    if (wan_config.rtt_ms > 0) {
+        double rtt = wan_config.rtt_ms / 1000.0;
+        struct timespec ts = {(time_t)rtt, (long)((rtt - (time_t)rtt) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    link_t *link = calloc(1, sizeof(link_t));
+    direction_t *down = calloc(1, sizeof(direction_t));
+    direction_t *up = calloc(1, sizeof(direction_t));
+    if (link == NULL || down == NULL || up == NULL) {
+        free(link); free(down); free(up);
+        close(pair[0]); close(pair[1]); close(fd);
+        return -1;
+    }
+    link->real = fd;
+    link->relay = pair[1];
+    link->refs = 2;
+    pthread_mutex_init(&link->lock, NULL);
+
+    unsigned int seed = (unsigned int)fd * 2654435761u ^ (unsigned int)(ftp_now() * 1e6);
+    *down = (direction_t){link, fd, pair[1], seed};
+    *up = (direction_t){link, pair[1], fd, seed * 31 + 7};
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 128 * 1024);
+    pthread_t thread;
+    int started = 0;
+    if (pthread_create(&thread, &attr, direction_thread, down) == 0) started++;
+    if (started && pthread_create(&thread, &attr, direction_thread, up) == 0) started++;
+    pthread_attr_destroy(&attr);
+
+    if (started < 2) {
+        if (started == 0) {
+            free(down);
+            link->refs--;
+        }
+        free(up);
+        shutdown(fd, SHUT_RDWR);
+        shutdown(pair[1], SHUT_RDWR);
+        close(pair[0]);
+        link_release(link);
+        return -1;
+    }
+    return pair[0];
+}
+
+void wan_enable(void) {
+    if (wan_config.rtt_ms > 0 || wan_config.jitter_ms > 0 || wan_config.bandwidth > 0 || wan_config.loss > 0) {
+        ftp_socket_hook = wan_wrap;
+    }
+}
@@ -0,0 +1,26 @@
+// tools/wan.h
+#ifndef WAN_H
+#define WAN_H
+
+// Emulated wide-area link for the benchmark tools. Every connection the
+// client library makes or accepts is relayed through a socketpair by two
+// threads that delay, rate-limit and "lose" data in each direction.
+typedef struct {
+    double rtt_ms;            // Round-trip time, split evenly between directions
+    double jitter_ms;         // Uniform extra one-way delay, never reorders data
+    double bandwidth;         // Bytes per second per direction and connection (0 = unlimited)
+    double loss;              // Segment loss probability, paid as a retransmission timeout
+} wan_config_t;
+
+extern wan_config_t wan_config;
+
+// Parse a long option (rtt, jitter, bandwidth, loss); returns 1 on success
+int wan_option(const char *name, const char *value);
+
+// Install the relay in the client library if any impairment is configured
+void wan_enable(void);
+
+// Usage text for the options
+void wan_usage(void);
+
+#endif // WAN_H